@@ -1,16 +1,8 @@
-#include "wave.h"
+#include "wave_ring.h"
 #include "portaudio.h"
 #include <stdlib.h>
 #include <stdio.h>
 
-typedef struct
-{
-    char*       waveData;
-    WAVE_INFO   waveInfo;
-    int         position;
-    int         bytesPerSample;
-} StreamState;
-
 
 int Callback(
         const void                      *input,
@@ -20,22 +12,10 @@ int Callback(
         PaStreamCallbackFlags           statusFlags,
         void                            *userData)
 {
-    StreamState *state = (StreamState *) userData;
-
-    int mustRead = state->waveInfo.nChannels * state->bytesPerSample * frameCount;
-
-    if ((state->position + mustRead) > state->waveInfo.dataSize) {
-
-        // read end of wave buffer and go to the begining
-        int readEnd = state->waveInfo.dataSize - state->position;
-        memcpy(output, &state->waveData[state->position], readEnd);
-        state->position = 0;
-        mustRead = mustRead - readEnd;
-    }
+    WAVE_RING *ring = (WAVE_RING *) userData;
 
-    memcpy(output, &state->waveData[state->position], mustRead);
-
-    state->position += mustRead;
+    // the prefetch thread keeps the ring filled, never blocks
+    waveRingPull(ring, output, frameCount);
 
     return paContinue;
 }
@@ -44,28 +24,29 @@ int Callback(
 
 int main(int argc, char* argv[])
 {
-    StreamState*    state = (StreamState *)malloc(sizeof(StreamState));
+    WAVE_INFO       waveInfo;
+    WAVE_RING*      ring;
 
-    state->waveData = waveOpen(argv[1], &state->waveInfo);
-    if (!state->waveData) {
+    ring = waveRingOpen(argv[1], &waveInfo, 0, WAVE_RING_LOOP);
+    if (!ring) {
         printf("error opening file\n");
         return 1;
     }
-    state->position = 0;
-    state->bytesPerSample = state->waveInfo.wBitsPerSample / 8;
 
     Pa_Initialize();
 
     PaStreamParameters outputParameters;
     outputParameters.device = Pa_GetDefaultOutputDevice();
-    outputParameters.channelCount = state->waveInfo.nChannels;
+    outputParameters.channelCount = waveInfo.nChannels;
     outputParameters.suggestedLatency = 0.2;
     outputParameters.hostApiSpecificStreamInfo = 0;
-    if (state->waveInfo.wBitsPerSample == 8)
-        outputParameters.sampleFormat = paInt8;
-    else if (state->waveInfo.wBitsPerSample == 16)
+    if (waveInfo.wBitsPerSample == 8)
+        outputParameters.sampleFormat = paUInt8;
+    else if (waveInfo.wBitsPerSample == 16)
         outputParameters.sampleFormat = paInt16;
-    else if (state->waveInfo.wBitsPerSample == 32)
+    else if (waveInfo.wBitsPerSample == 24)
+        outputParameters.sampleFormat = paInt24;
+    else if (waveInfo.wBitsPerSample == 32)
         outputParameters.sampleFormat = paInt32;
 
 
@@ -75,16 +56,17 @@ int main(int argc, char* argv[])
     error = Pa_OpenStream(&stream,
             0,                              // no input
             &outputParameters,
-            state->waveInfo.nSamplesPerSec,  // sample rate 
+            waveInfo.nSamplesPerSec,        // sample rate
             paFramesPerBufferUnspecified,
             paNoFlag,  // no special modes (clip off, dither off)
-            Callback,  
-            state ); 
+            Callback,
+            ring );
 
     /* if we can't open it, then bail out */
     if (error)
     {
         printf("error opening output, error code = %i\n", error);
+        waveRingClose(ring);
         Pa_Terminate();
         return 1;
     }
@@ -93,8 +75,13 @@ int main(int argc, char* argv[])
     Pa_StartStream(stream);
     Pa_Sleep(300000);
     Pa_StopStream(stream);
+
+    WAVE_RING_STATS stats;
+    waveRingStats(ring, &stats);
+    printf("%llu underruns, lowest fill %zu of %zu frames\n",
+           (unsigned long long) stats.underruns, stats.minFill, stats.capacity);
+
     Pa_Terminate();
+    waveRingClose(ring);
     return 0;
 }
-
-
@@ -29,18 +29,42 @@
 #ifndef WAVE_H
 #define WAVE_H
 
+// 64-bit file offsets on 32-bit systems, when wave.h comes first
+#if !defined(_WIN32) && !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <inttypes.h>
 
+#include "wave_sys.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 /**
  * @brief Information on a wave file
  */
 typedef struct {
 
     // format
+    uint16_t wFormatTag;    // WAVE_FORMAT_*, the SubFormat one if extensible
     uint16_t nChannels;
     uint32_t nSamplesPerSec;
     uint32_t nAvgBytesPerSec;
@@ -51,10 +75,179 @@ typedef struct {
     uint16_t wValidBitsPerSample;
     uint32_t dwChannelMask;
 
-    int      dataSize;
+    uint64_t dataSize;
 
 } WAVE_INFO;
 
+/**
+ * @brief Why a call failed, see waveLastError
+ */
+typedef enum wave_error_t {
+
+    WAVE_OK = 0,
+    WAVE_ERROR_OPEN,            // the file can not be opened or created
+    WAVE_ERROR_READ,            // a read failed
+    WAVE_ERROR_WRITE,           // a write failed
+    WAVE_ERROR_FORMAT,          // not a RIFF/RF64 WAVE file, or chunks missing
+    WAVE_ERROR_UNSUPPORTED,     // a valid file, but a sample format not handled
+    WAVE_ERROR_MEMORY           // an allocation or a mapping failed
+
+} WAVE_ERROR;
+
+/**
+ * @brief Called on every failure, see waveSetErrorCallback
+ */
+typedef void (*WAVE_ERROR_CALLBACK)(WAVE_ERROR error, const char* fileName,
+                                    void* user);
+
+/**
+ * @brief Loader counters, see waveEnableStats
+ *
+ * Times are in nanoseconds, summed over every call and thread.
+ */
+typedef struct wave_stats_t {
+
+    uint64_t files;         // files opened
+    uint64_t errors;        // failed calls
+    uint64_t syscalls;      // open, read, seek, stat, map... calls
+    uint64_t reads;         // read calls, included in syscalls
+    uint64_t bytesRead;
+
+    uint64_t openTime;      // opening the files
+    uint64_t parseTime;     // reading and parsing the headers
+    uint64_t readTime;      // reading the data
+    uint64_t convertTime;   // converting the samples
+
+} WAVE_STATS;
+
+/**
+ * @brief Memory functions for the buffers handed to the caller, see
+ * waveSetAllocator
+ */
+typedef struct wave_allocator_t {
+
+    void* (*alloc)(size_t size, void* user);
+    void  (*free)(void* ptr, void* user);
+    void*   user;
+
+} WAVE_ALLOCATOR;
+
+/*
+ * Maximum number of chunks recorded in a WAVE_CHUNK_INDEX
+ */
+#define WAVE_MAX_CHUNKS                32
+
+/**
+ * @brief Location of a chunk in a wave file
+ */
+typedef struct wave_chunk_t {
+
+    char     ckID[4];   // Chunk ID: "fmt ", "data", "LIST", ...
+    uint64_t cksize;    // Chunk size, without the pad byte, from ds64 if RF64
+    uint64_t offset;    // Offset of the chunk body in the file
+
+} WAVE_CHUNK;
+
+/**
+ * @brief The chunks of a wave file, in file order
+ */
+typedef struct wave_chunk_index_t {
+
+    WAVE_CHUNK chunks[WAVE_MAX_CHUNKS];
+    int        count;
+    int        bigEndian;   // RIFX: header fields and samples are big-endian
+
+} WAVE_CHUNK_INDEX;
+
+/*
+ * Tags of a LIST/INFO chunk kept by waveProbe, and bytes kept of each text
+ */
+#define WAVE_PROBE_TAGS                16
+#define WAVE_PROBE_TEXT                128
+
+/**
+ * @brief A text of the LIST/INFO chunk: "INAM" title, "IART" artist...
+ */
+typedef struct wave_tag_t {
+
+    char     id[4];
+    char     text[WAVE_PROBE_TEXT];   // nul terminated, cut if longer
+
+} WAVE_TAG;
+
+/**
+ * @brief What waveProbe finds in the headers of a file
+ */
+typedef struct wave_probe_t {
+
+    WAVE_INFO        info;
+    WAVE_ERROR       status;        // WAVE_ERROR_UNSUPPORTED: info is valid
+                                    // but the samples can not be loaded
+    uint64_t         fileSize;
+    uint64_t         dataOffset;
+    uint64_t         frames;        // from the fact chunk if not PCM/float
+    uint64_t         factLength;    // dwSampleLength, 0 without fact chunk
+
+    WAVE_TAG         tags[WAVE_PROBE_TAGS];
+    int              tagCount;
+
+    WAVE_CHUNK_INDEX index;
+
+} WAVE_PROBE;
+
+/*
+ * Access pattern hints for waveMap and waveMapAdvise
+ */
+#define WAVE_MAP_NORMAL                0x0
+#define WAVE_MAP_SEQUENTIAL            0x1
+#define WAVE_MAP_RANDOM                0x2
+#define WAVE_MAP_WILLNEED              0x4
+
+/**
+ * @brief A wave file mapped read-only in memory
+ */
+typedef struct wave_map_t {
+
+    void*    base;      // start of the mapping
+    size_t   length;    // length of the mapping (the file size)
+
+    void*    data;      // start of the data chunk, inside the mapping
+    size_t   dataSize;  // bytes of the data chunk present in the file
+
+    WAVE_CHUNK_INDEX index;
+
+#ifdef _WIN32
+    HANDLE   mapping;
+#endif
+
+} WAVE_MAP;
+
+/*
+ * Default size of the reads issued by a WAVE_STREAM
+ */
+#define WAVE_STREAM_READ_SIZE          (64 * 1024)
+
+/**
+ * @brief A wave file opened for reading frames in sequence
+ */
+typedef struct wave_stream_t {
+
+    int            fd;
+    WAVE_INFO      info;
+    WAVE_CHUNK_INDEX index;
+
+    uint64_t       dataOffset;  // file offset of the first frame
+    uint64_t       remaining;   // data bytes not yet handed to the caller
+
+    unsigned char* buffer;      // bytes read from the file, not yet consumed
+    size_t         bufferSize;
+    size_t         bufferPos;
+    size_t         bufferEnd;
+
+    int            swap;        // bytes per sample to reverse, 0 in host order
+
+} WAVE_STREAM;
+
 /*
  * From: http://www-mmsp.ece.mcgill.ca/documents/audioformats/wave/wave.html
  *
@@ -134,16 +327,22 @@ typedef struct fmt_chunk_t { // max size 40
  * The standard format codes for waveform data
  */
 const uint16_t WAVE_FORMAT_PCM        = 0x0001; // PCM
+const uint16_t WAVE_FORMAT_ADPCM      = 0x0002; // Microsoft ADPCM
 const uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003; // IEEE float
 const uint16_t WAVE_FORMAT_ALAW       = 0x0006; // 8-bit ITU-T G.711 A-law
 const uint16_t WAVE_FORMAT_MULAW      = 0x0007; // 8-bit ITU-T G.711 µ-law
+const uint16_t WAVE_FORMAT_IMA_ADPCM  = 0x0011; // IMA/DVI ADPCM
 const uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE; // Determined by SubFormat
 
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
 
-static void
+/**
+ * @brief Print a fmt chunk on stdout, for debugging
+ * @param fmt_chunk The chunk
+ */
+void
 waveDebugFmt(FMT_CHUNK fmt_chunk)
 {
     printf("\n\n");
@@ -169,6 +368,190 @@ waveDebugFmt(FMT_CHUNK fmt_chunk)
     printf("\n\n");
 }
 
+#if defined(_MSC_VER)
+#define WAVE_THREAD_LOCAL __declspec(thread)
+#else
+#define WAVE_THREAD_LOCAL __thread
+#endif
+
+static WAVE_THREAD_LOCAL WAVE_ERROR waveLastErrorCode = WAVE_OK;
+static WAVE_ERROR_CALLBACK          waveErrorCallback = NULL;
+static void*                        waveErrorUser     = NULL;
+
+static volatile int                 waveStatsEnabled  = 0;
+static WAVE_STATS                   waveStatsCounters;
+
+/*
+ * Record a failure. The loaders stay silent, the application decides what
+ * to tell.
+ */
+static void
+waveError(WAVE_ERROR error, const char* fileName)
+{
+    waveLastErrorCode = error;
+
+    if (waveStatsEnabled)
+        waveAtomicAdd64(&waveStatsCounters.errors, 1);
+
+    if (waveErrorCallback)
+        waveErrorCallback(error, fileName, waveErrorUser);
+}
+
+static void
+waveCount(uint64_t* counter, uint64_t value)
+{
+    if (waveStatsEnabled)
+        waveAtomicAdd64(counter, value);
+}
+
+static uint64_t
+waveStageStart(void)
+{
+    return waveStatsEnabled ? waveClock() : 0;
+}
+
+static void
+waveStageEnd(uint64_t* counter, uint64_t start)
+{
+    if (waveStatsEnabled && start)
+        waveAtomicAdd64(counter, waveClock() - start);
+}
+
+/**
+ * @brief Get the last failure of the calling thread
+ * @return The error code of the last failed call, WAVE_OK if none failed
+ */
+WAVE_ERROR
+waveLastError(void)
+{
+    return waveLastErrorCode;
+}
+
+/**
+ * @brief Describe an error code
+ * @param error A WAVE_ERROR
+ * @return A static string
+ */
+const char*
+waveErrorString(WAVE_ERROR error)
+{
+    switch (error) {
+    case WAVE_OK:                return "no error";
+    case WAVE_ERROR_OPEN:        return "can not open the file";
+    case WAVE_ERROR_READ:        return "read failed";
+    case WAVE_ERROR_WRITE:       return "write failed";
+    case WAVE_ERROR_FORMAT:      return "not a wave file";
+    case WAVE_ERROR_UNSUPPORTED: return "unsupported sample format";
+    case WAVE_ERROR_MEMORY:      return "out of memory";
+    }
+
+    return "unknown error";
+}
+
+/**
+ * @brief Be called on every failure
+ *
+ * The callback runs on the thread of the failed call.
+ *
+ * @param callback The function, NULL to remove it
+ * @param user Given back to the callback
+ */
+void
+waveSetErrorCallback(WAVE_ERROR_CALLBACK callback, void* user)
+{
+    waveErrorCallback = callback;
+    waveErrorUser     = user;
+}
+
+/**
+ * @brief Turn the loader counters on or off
+ *
+ * Off by default, the loaders then skip the clock reads and the counters.
+ *
+ * @param enable 1 to count, 0 to stop
+ */
+void
+waveEnableStats(int enable)
+{
+    waveStatsEnabled = enable;
+}
+
+/**
+ * @brief Read the loader counters
+ * @param stats Pointer to a WAVE_STATS variable
+ */
+void
+waveGetStats(WAVE_STATS* stats)
+{
+    stats->files       = waveAtomicLoad64(&waveStatsCounters.files);
+    stats->errors      = waveAtomicLoad64(&waveStatsCounters.errors);
+    stats->syscalls    = waveAtomicLoad64(&waveStatsCounters.syscalls);
+    stats->reads       = waveAtomicLoad64(&waveStatsCounters.reads);
+    stats->bytesRead   = waveAtomicLoad64(&waveStatsCounters.bytesRead);
+    stats->openTime    = waveAtomicLoad64(&waveStatsCounters.openTime);
+    stats->parseTime   = waveAtomicLoad64(&waveStatsCounters.parseTime);
+    stats->readTime    = waveAtomicLoad64(&waveStatsCounters.readTime);
+    stats->convertTime = waveAtomicLoad64(&waveStatsCounters.convertTime);
+}
+
+/**
+ * @brief Set the loader counters back to zero
+ */
+void
+waveResetStats(void)
+{
+    memset(&waveStatsCounters, 0, sizeof(WAVE_STATS));
+}
+
+static WAVE_ALLOCATOR waveAllocator = {NULL, NULL, NULL};
+
+/**
+ * @brief Allocate the buffers handed to the caller with other functions
+ *
+ * waveLoad, waveLoadRange and waveLoadFloat use it, their buffers must then
+ * be released with waveFree. Set it before loading.
+ *
+ * @param allocator The functions, copied, or NULL for malloc and free
+ */
+void
+waveSetAllocator(const WAVE_ALLOCATOR* allocator)
+{
+    if (allocator)
+        waveAllocator = *allocator;
+    else
+        memset(&waveAllocator, 0, sizeof(WAVE_ALLOCATOR));
+}
+
+/**
+ * @brief Allocate memory with the allocator of waveSetAllocator
+ * @param size Bytes wanted
+ * @return The memory, uninitialized, or NULL
+ */
+void*
+waveAlloc(size_t size)
+{
+    if (waveAllocator.alloc)
+        return waveAllocator.alloc(size ? size : 1, waveAllocator.user);
+
+    return malloc(size ? size : 1);
+}
+
+/**
+ * @brief Release a buffer returned by a loader
+ * @param ptr The buffer, or NULL
+ */
+void
+waveFree(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    if (waveAllocator.free)
+        waveAllocator.free(ptr, waveAllocator.user);
+    else
+        free(ptr);
+}
+
 /*
  * PCM Format
  *
@@ -263,167 +646,1841 @@ waveDebugFmt(FMT_CHUNK fmt_chunk)
  */
 
 
-/**
- * @brief Load a wave file in memory
- * @param fileName The wave file name
- * @param info Pointer to a WAVE_INFO variable
- * @return Pointer to the wave data
+/*
+ * Header fields are little-endian. Read them byte by byte so that neither the
+ * host byte order nor the alignment of the source buffer matters.
  */
-void*
-waveLoad(char* fileName, WAVE_INFO* info)
+static uint16_t
+waveGet16(const unsigned char* p)
 {
-    // try to open the file
-    FILE *wave_file = fopen(fileName, "rb");
-
-    if (!wave_file) {
-        printf("Open file failed\n");
-        return NULL;
-    }
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
 
-    // try to read the master header
-    MASTER_WAVE_CHUNK wave_chunk;
+static uint32_t
+waveGet32(const unsigned char* p)
+{
+    return (uint32_t) p[0]         | ((uint32_t) p[1] << 8) |
+           ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
 
-    if (fread(&wave_chunk.ckID, sizeof(char), 4, wave_file) < 1)
-        return NULL;
-    if (fread(&wave_chunk.cksize, sizeof(uint32_t), 1, wave_file) < 1)
-        return NULL;
-    if (fread(&wave_chunk.WAVEID, sizeof(char), 4, wave_file) < 1)
-        return NULL;
+static uint64_t
+waveGet64(const unsigned char* p)
+{
+    return (uint64_t) waveGet32(p) | ((uint64_t) waveGet32(p + 4) << 32);
+}
 
-    // check indianness consistancy
+static int
+waveHostIsLittleEndian(void)
+{
     volatile uint32_t i = 0x01234567;
-    int isLittleIndian = (*((uint8_t*)(&i))) == 0x67;
-
-    if (isLittleIndian) {
-        if (
-            memcmp(wave_chunk.ckID, "XFIR", 4) == 0 ||
-            memcmp(wave_chunk.ckID, "FFIR", 4) == 0)
-        {
-            printf("Indianness of the file does not match the system one");
-            return NULL;
-        }
-    } else {
-        if (
-            memcmp(wave_chunk.ckID, "RIFX", 4) == 0 ||
-            memcmp(wave_chunk.ckID, "RIFF", 4) == 0)
-        {
-            printf("Indianness of the file does not match the system one");
-            return NULL;
-        }
-    }
+    return (*((uint8_t*)(&i))) == 0x67;
+}
+
+/*
+ * RIFX files store the same fields big-endian
+ */
+static uint16_t
+waveGetOrder16(const unsigned char* p, int bigEndian)
+{
+    return bigEndian ? (uint16_t) ((p[0] << 8) | p[1]) : waveGet16(p);
+}
 
-    // read the format chunk and get content lenght
-    RIFF_HEAD fmt_chunk_head;
+static uint32_t
+waveGetOrder32(const unsigned char* p, int bigEndian)
+{
+    if (!bigEndian)
+        return waveGet32(p);
 
-    if (fread(&fmt_chunk_head.ckID, sizeof(char), 4, wave_file) < 1)
-        return NULL;
-    if (fread(&fmt_chunk_head.cksize, sizeof(uint32_t), 1, wave_file) < 1)
-        return NULL;
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+           ((uint32_t) p[2] << 8)  | (uint32_t) p[3];
+}
 
-    if (memcmp(fmt_chunk_head.ckID, "fmt ", 4) != 0) {
+/*
+ * Byte swap kernels, in place or not, for samples of 2, 3, 4 or 8 bytes. A
+ * pshufb mask reverses the bytes of each sample of a 16 bytes lane; packed
+ * 24-bit samples go 5 to a lane, the lanes 15 bytes apart.
+ */
+static void
+waveSwapC(unsigned char* dst, const unsigned char* src, size_t size,
+          int sampleSize)
+{
+    size_t i;
+    int    k;
 
-        printf("Not an format header fmt\n");
-        return NULL;
+    for (i = 0; i + (size_t) sampleSize <= size; i += (size_t) sampleSize) {
+        unsigned char t[8];
+        memcpy(t, src + i, (size_t) sampleSize);
+        for (k = 0; k < sampleSize; k++)
+            dst[i + k] = t[sampleSize - 1 - k];
     }
+}
 
-    int fmtSize = fmt_chunk_head.cksize;
-    // max size of FMT_CHUNK
-    if (fmtSize > 40) return NULL;
+#ifdef WAVE_X86
 
-    printf("begin to read\n");
-    // read format options
-    FMT_CHUNK fmt_chunk = {0,0,0,0,0,0,0,0,0,{0,""}};
+static const char waveSwapMasks[9][16] = {
+    {0}, {0},
+    {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+    {2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15},
+    {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+    {0}, {0}, {0},
+    {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8}
+};
 
-    if (fread(&fmt_chunk.wFormatTag, sizeof(uint16_t), 1, wave_file) < 1)
-        return NULL;
-    if (fread(&fmt_chunk.nChannels, sizeof(uint16_t), 1, wave_file) < 1)
-        return NULL;
-    if (fread(&fmt_chunk.nSamplesPerSec, sizeof(uint32_t), 1, wave_file) < 1)
-        return NULL;
-    if (fread(&fmt_chunk.nAvgBytesPerSec, sizeof(uint32_t), 1, wave_file) < 1)
-        return NULL;
-    if (fread(&fmt_chunk.nBlockAlign, sizeof(uint16_t), 1, wave_file) < 1)
-        return NULL;
-    if (fread(&fmt_chunk.wBitsPerSample, sizeof(uint16_t), 1, wave_file) < 1)
-        return NULL;
+WAVE_TARGET("ssse3") static void
+waveSwapSSSE3(unsigned char* dst, const unsigned char* src, size_t size,
+              int sampleSize)
+{
+    const __m128i mask = _mm_loadu_si128((const __m128i*) waveSwapMasks[sampleSize]);
+    size_t        step = sampleSize == 3 ? 15 : 16;
+    size_t        i    = 0;
 
-    if (fmtSize > 16) {
-        if (fread(&fmt_chunk.cbSize, sizeof(uint16_t), 1, wave_file) < 1)
-            return NULL;
-        if (fmt_chunk.cbSize == 22) {
-            if (fread(&fmt_chunk.wValidBitsPerSample, sizeof(uint16_t), 1, wave_file) < 1)
-                return NULL;
-            if (fread(&fmt_chunk.dwChannelMask, sizeof(uint32_t), 1, wave_file) < 1)
-                return NULL;
-            if (fread(&fmt_chunk.SubFormat.formatCode, sizeof(uint16_t), 1, wave_file) < 1)
-                return NULL;
-            if (fread(&fmt_chunk.SubFormat.fixedString, sizeof(char), 14, wave_file) < 1)
-                return NULL;
-        }
+    // the 16th byte of a 24-bit lane is stored unchanged, then redone
+    for (; i + 16 <= size; i += step) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_shuffle_epi8(x, mask));
     }
 
-    // only accept PCM
-    if (fmt_chunk.wFormatTag != WAVE_FORMAT_PCM) {
-        if (fmt_chunk.cbSize != 0) {
-            if (fmt_chunk.SubFormat.formatCode != WAVE_FORMAT_PCM) {
-                printf ("It is not PCM data\n");
-                return NULL;
-            }
-        } else {
-                printf ("It is not PCM data\n");
-                return NULL;
+    waveSwapC(dst + i, src + i, size - i, sampleSize);
+}
+
+WAVE_TARGET("avx2") static void
+waveSwapAVX2(unsigned char* dst, const unsigned char* src, size_t size,
+             int sampleSize)
+{
+    const __m256i mask = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i*) waveSwapMasks[sampleSize]));
+    size_t        i    = 0;
+
+    if (sampleSize == 3) {
+        for (; i + 31 <= size; i += 30) {
+            __m256i x = _mm256_castsi128_si256(
+                    _mm_loadu_si128((const __m128i*) (src + i)));
+            x = _mm256_inserti128_si256(x,
+                    _mm_loadu_si128((const __m128i*) (src + i + 15)), 1);
+            x = _mm256_shuffle_epi8(x, mask);
+            _mm_storeu_si128((__m128i*) (dst + i), _mm256_castsi256_si128(x));
+            _mm_storeu_si128((__m128i*) (dst + i + 15),
+                             _mm256_extracti128_si256(x, 1));
+        }
+    } else {
+        for (; i + 32 <= size; i += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i*) (src + i));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_shuffle_epi8(x, mask));
         }
     }
 
-    // TODO read dwChannelMask to know wich channel go with wich speaker.
-    uint16_t expectedConfigForSurround =
-        SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER |
-        SPEAKER_BACK_CENTER;
+    waveSwapSSSE3(dst + i, src + i, size - i, sampleSize);
+}
 
-    uint16_t expectedConfigForStereo = SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
-    waveDebugFmt(fmt_chunk);
+#ifdef WAVE_HAVE_AVX512
+WAVE_TARGET("avx512f,avx512bw") static void
+waveSwapAVX512(unsigned char* dst, const unsigned char* src, size_t size,
+               int sampleSize)
+{
+    const __m512i mask = _mm512_broadcast_i32x4(
+            _mm_loadu_si128((const __m128i*) waveSwapMasks[sampleSize]));
+    size_t        i    = 0;
 
-    // read data cunk
-    RIFF_HEAD data_chunk = {"", 0};
+    if (sampleSize == 3) {
+        for (; i + 61 <= size; i += 60) {
+            const unsigned char* p = src + i;
 
-    if (fread(&data_chunk, sizeof(RIFF_HEAD), 1, wave_file) < 1) {
-        printf ("Can not read the data chunk\n");
-        return NULL;
-    }
+            __m512i x = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i*) p));
+            x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*) (p + 15)), 1);
+            x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*) (p + 30)), 2);
+            x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*) (p + 45)), 3);
+            x = _mm512_shuffle_epi8(x, mask);
 
-    if (memcmp(data_chunk.ckID, "data", 4) != 0) {
-        printf ("It is not a data chunk: %.4s\n", data_chunk.ckID);
-        return NULL;
+            _mm_storeu_si128((__m128i*) (dst + i),      _mm512_castsi512_si128(x));
+            _mm_storeu_si128((__m128i*) (dst + i + 15), _mm512_extracti32x4_epi32(x, 1));
+            _mm_storeu_si128((__m128i*) (dst + i + 30), _mm512_extracti32x4_epi32(x, 2));
+            _mm_storeu_si128((__m128i*) (dst + i + 45), _mm512_extracti32x4_epi32(x, 3));
+        }
+    } else {
+        for (; i + 64 <= size; i += 64) {
+            __m512i x = _mm512_loadu_si512((const void*) (src + i));
+            _mm512_storeu_si512((void*) (dst + i), _mm512_shuffle_epi8(x, mask));
+        }
     }
 
-    // I should be able to fill channel buffers with this:
-    int dataSize   = data_chunk.cksize;
-    int sampleLen  = fmt_chunk.wBitsPerSample / 8;
-    int channelNum = fmt_chunk.nChannels;
+    waveSwapSSSE3(dst + i, src + i, size - i, sampleSize);
+}
+#endif // WAVE_HAVE_AVX512
+#endif // WAVE_X86
+
+/**
+ * @brief Reverse the byte order of samples
+ *
+ * The loaders use it on files of the other byte order (RIFX on a little
+ * endian host), so that the samples are always handed back in host order.
+ *
+ * @param data The samples, swapped in place
+ * @param size Size in bytes, a multiple of sampleSize
+ * @param sampleSize Bytes per sample: 2, 3, 4 or 8, anything else is left
+ * untouched
+ */
+void
+waveSwapBytes(void* data, size_t size, int sampleSize)
+{
+    unsigned char* p = (unsigned char*) data;
+
+    if (sampleSize != 2 && sampleSize != 3 && sampleSize != 4 &&
+        sampleSize != 8)
+        return;
 
-    // in memory buffer
-    char* wave_data = calloc(dataSize, sizeof(char));
-    int   haveRead  = fread(wave_data, 1, (size_t) dataSize, wave_file);
+    int level = waveSimdLevel();
 
-    if (haveRead < dataSize)
-        printf("warning unexpected end of file %d %s\n", haveRead, wave_data);
+#ifdef WAVE_X86
+#ifdef WAVE_HAVE_AVX512
+    if (level >= WAVE_SIMD_AVX512)
+        waveSwapAVX512(p, p, size, sampleSize);
+    else
+#endif
+    if (level >= WAVE_SIMD_AVX2)
+        waveSwapAVX2(p, p, size, sampleSize);
+    else if (level >= WAVE_SIMD_SSSE3)
+        waveSwapSSSE3(p, p, size, sampleSize);
     else
-        printf("Read file success\n");
+#endif // WAVE_X86
+        waveSwapC(p, p, size, sampleSize);
+
+    (void) level;
+}
+
+/*
+ * Fill a FMT_CHUNK from the body of a "fmt " chunk. Return 0 on success.
+ * Extension bytes past the 40 of FMT_CHUNK, such as the ADPCM coefficients,
+ * are left to the codec.
+ */
+static int
+waveParseFmt(const unsigned char* body, uint32_t size, FMT_CHUNK* fmt,
+             int bigEndian)
+{
+    if (size < 16) return -1;
+
+    // max size of FMT_CHUNK
+    if (size > 40) size = 40;
 
-    fclose(wave_file);
+    memset(fmt, 0, sizeof(FMT_CHUNK));
 
-    info->nChannels            = fmt_chunk.nChannels;
-    info->nSamplesPerSec       = fmt_chunk.nSamplesPerSec;
-    info->nAvgBytesPerSec      = fmt_chunk.nAvgBytesPerSec;
-    info->nBlockAlign          = fmt_chunk.nBlockAlign;
-    info->wBitsPerSample       = fmt_chunk.wBitsPerSample;
-    info->wValidBitsPerSample  = fmt_chunk.wValidBitsPerSample;
-    info->dwChannelMask        = fmt_chunk.dwChannelMask;
-    info->dataSize             = haveRead;
+    fmt->wFormatTag      = waveGetOrder16(body, bigEndian);
+    fmt->nChannels       = waveGetOrder16(body + 2, bigEndian);
+    fmt->nSamplesPerSec  = waveGetOrder32(body + 4, bigEndian);
+    fmt->nAvgBytesPerSec = waveGetOrder32(body + 8, bigEndian);
+    fmt->nBlockAlign     = waveGetOrder16(body + 12, bigEndian);
+    fmt->wBitsPerSample  = waveGetOrder16(body + 14, bigEndian);
 
-    return wave_data;
+    if (size >= 18)
+        fmt->cbSize = waveGetOrder16(body + 16, bigEndian);
+
+    if (fmt->cbSize == 22 && size >= 40) {
+        fmt->wValidBitsPerSample   = waveGetOrder16(body + 18, bigEndian);
+        fmt->dwChannelMask         = waveGetOrder32(body + 20, bigEndian);
+        memcpy(fmt->SubFormat.fixedString, body + 26, 14);
+
+        if (bigEndian) {
+            // the first three fields of the GUID are big-endian too, keep
+            // the little-endian layout of a RIFF file
+            uint32_t data1 = waveGetOrder32(body + 24, 1);
+            uint16_t data2 = waveGetOrder16(body + 28, 1);
+            uint16_t data3 = waveGetOrder16(body + 30, 1);
+
+            fmt->SubFormat.formatCode = (uint16_t) data1;
+            fmt->SubFormat.fixedString[0] = (char) (data1 >> 16);
+            fmt->SubFormat.fixedString[1] = (char) (data1 >> 24);
+            fmt->SubFormat.fixedString[2] = (char) data2;
+            fmt->SubFormat.fixedString[3] = (char) (data2 >> 8);
+            fmt->SubFormat.fixedString[4] = (char) data3;
+            fmt->SubFormat.fixedString[5] = (char) (data3 >> 8);
+        } else {
+            fmt->SubFormat.formatCode = waveGet16(body + 24);
+        }
+    }
+
+    return 0;
 }
 
+/*
+ * The format code, looked up in the SubFormat GUID if extensible
+ */
+static uint16_t
+waveFormatCode(const FMT_CHUNK* fmt)
+{
+    if (fmt->wFormatTag == WAVE_FORMAT_EXTENSIBLE && fmt->cbSize != 0)
+        return fmt->SubFormat.formatCode;
+
+    return fmt->wFormatTag;
+}
+
+/*
+ * Return 0 if the format is one the loaders can hand back.
+ */
+static int
+waveCheckFmt(const FMT_CHUNK* fmt)
+{
+    if (fmt->nChannels == 0 || fmt->nBlockAlign == 0)
+        return -1;
+
+    // the WAVE_FORMAT_* codes are not constant expressions in C
+    uint16_t code = waveFormatCode(fmt);
+
+    if (code == WAVE_FORMAT_PCM || code == WAVE_FORMAT_IEEE_FLOAT ||
+        code == WAVE_FORMAT_ALAW || code == WAVE_FORMAT_MULAW)
+        return 0;
+
+    return -1;
+}
+
+/*
+ * Bytes per sample to reverse for the host: 0 when the samples are in host
+ * order or single bytes, -1 for a container that can not be swapped
+ */
+static int
+waveSwapSize(const WAVE_CHUNK_INDEX* index, const FMT_CHUNK* fmt)
+{
+    if (index->bigEndian == !waveHostIsLittleEndian())
+        return 0;
+
+    int container = fmt->nBlockAlign / fmt->nChannels;
+
+    if (container == 1)
+        return 0;
+
+    if (fmt->nBlockAlign % fmt->nChannels != 0 ||
+        (container != 2 && container != 3 && container != 4 && container != 8))
+        return -1;
+
+    return container;
+}
+
+/*
+ * The padding is cleared too, filled infos compare with memcmp
+ */
+static void
+waveFillInfo(const FMT_CHUNK* fmt, WAVE_INFO* info)
+{
+    memset(info, 0, sizeof(WAVE_INFO));
+
+    info->wFormatTag           = waveFormatCode(fmt);
+    info->nChannels            = fmt->nChannels;
+    info->nSamplesPerSec       = fmt->nSamplesPerSec;
+    info->nAvgBytesPerSec      = fmt->nAvgBytesPerSec;
+    info->nBlockAlign          = fmt->nBlockAlign;
+    info->wBitsPerSample       = fmt->wBitsPerSample;
+    info->wValidBitsPerSample  = fmt->wValidBitsPerSample;
+    info->dwChannelMask        = fmt->dwChannelMask;
+}
+
+/*
+ * Plain file descriptor I/O, used where stdio buffering only adds a copy.
+ */
+static int
+waveOpenFd(const char* fileName)
+{
+#ifdef _WIN32
+    int fd = _open(fileName, _O_RDONLY | _O_BINARY);
+#else
+    int fd = open(fileName, O_RDONLY);
+#endif
+
+    waveCount(&waveStatsCounters.syscalls, 1);
+    if (fd >= 0)
+        waveCount(&waveStatsCounters.files, 1);
+
+    return fd;
+}
+
+static void
+waveCloseFd(int fd)
+{
+    waveCount(&waveStatsCounters.syscalls, 1);
+
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+static int64_t
+waveFdSize(int fd)
+{
+    waveCount(&waveStatsCounters.syscalls, 1);
+
+#ifdef _WIN32
+    struct _stati64 st;
+    if (_fstati64(fd, &st) != 0)
+        return -1;
+#else
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return -1;
+#endif
+    return (int64_t) st.st_size;
+}
+
+/*
+ * Size and modification time of a file, in seconds: the key of what is
+ * computed or cached from its content. Inline, only the caches call it.
+ */
+static inline int
+waveFileKey(const char* fileName, uint64_t* size, int64_t* time)
+{
+    waveCount(&waveStatsCounters.syscalls, 1);
+
+#ifdef _WIN32
+    struct _stati64 st;
+    if (_stati64(fileName, &st) != 0)
+        return -1;
+#else
+    struct stat st;
+    if (stat(fileName, &st) != 0)
+        return -1;
+#endif
+
+    *size = (uint64_t) st.st_size;
+    *time = (int64_t) st.st_mtime;
+
+    return 0;
+}
+
+/*
+ * Read until size bytes are in, or end of file. Return the bytes read or -1.
+ */
+static int64_t
+waveReadFd(int fd, void* buffer, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+
+        size_t want = size - done;
+        if (want > (1 << 30)) want = 1 << 30;
+
+        waveCount(&waveStatsCounters.syscalls, 1);
+        waveCount(&waveStatsCounters.reads, 1);
+
+#ifdef _WIN32
+        int got = _read(fd, (char*) buffer + done, (unsigned int) want);
+#else
+        ssize_t got = read(fd, (char*) buffer + done, want);
+        if (got < 0 && errno == EINTR)
+            continue;
+#endif
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            break;
+
+        done += (size_t) got;
+    }
+
+    waveCount(&waveStatsCounters.bytesRead, done);
+
+    return (int64_t) done;
+}
+
+/*
+ * Read size bytes at offset. Return 0 if they were all read.
+ */
+static int
+waveReadFdAt(int fd, void* buffer, size_t size, uint64_t offset)
+{
+#ifdef _WIN32
+    waveCount(&waveStatsCounters.syscalls, 1);
+    if (_lseeki64(fd, (__int64) offset, SEEK_SET) < 0)
+        return -1;
+
+    return waveReadFd(fd, buffer, size) == (int64_t) size ? 0 : -1;
+#else
+    size_t done = 0;
+
+    while (done < size) {
+
+        waveCount(&waveStatsCounters.syscalls, 1);
+        waveCount(&waveStatsCounters.reads, 1);
+
+        ssize_t got = pread(fd, (char*) buffer + done, size - done,
+                            (off_t) (offset + done));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+
+        done += (size_t) got;
+    }
+
+    waveCount(&waveStatsCounters.bytesRead, done);
+
+    return 0;
+#endif
+}
+
+static int
+waveSeekFd(int fd, uint64_t offset)
+{
+    waveCount(&waveStatsCounters.syscalls, 1);
+
+#ifdef _WIN32
+    return _lseeki64(fd, (__int64) offset, SEEK_SET) < 0 ? -1 : 0;
+#else
+    return lseek(fd, (off_t) offset, SEEK_SET) < 0 ? -1 : 0;
+#endif
+}
+
+/*
+ * Size of the first read done by the loaders, it usually holds all the
+ * chunks preceding the data.
+ */
+#define WAVE_HEAD_SIZE                 4096
+
+/*
+ * Where the headers are read from: bytes of the file already in memory (the
+ * whole file when mapped), then the file descriptor for the rest.
+ */
+typedef struct wave_source_t {
+
+    int                  fd;        // -1 if everything is in memory
+    const unsigned char* head;
+    size_t               headSize;
+    uint64_t             fileSize;
+
+} WAVE_SOURCE;
+
+static int
+waveSourceRead(const WAVE_SOURCE* source, void* buffer, size_t size,
+               uint64_t offset)
+{
+    if (offset + size > source->fileSize)
+        return -1;
+
+    if (offset + size <= source->headSize) {
+        memcpy(buffer, source->head + offset, size);
+        return 0;
+    }
+
+    if (source->fd < 0)
+        return -1;
+
+    return waveReadFdAt(source->fd, buffer, size, offset);
+}
+
+/**
+ * @brief Find a chunk in an index
+ * @param index An index filled by waveIndexFile, or the one of a WAVE_MAP or
+ * a WAVE_STREAM
+ * @param ckID The four characters chunk ID, e.g. "LIST"
+ * @return The first chunk with this ID or NULL
+ */
+const WAVE_CHUNK*
+waveFindChunk(const WAVE_CHUNK_INDEX* index, const char* ckID)
+{
+    int i;
+    for (i = 0; i < index->count; i++)
+        if (memcmp(index->chunks[i].ckID, ckID, 4) == 0)
+            return &index->chunks[i];
+
+    return NULL;
+}
+
+/*
+ * Entries of the ds64 table looked at, for chunks other than data
+ */
+#define WAVE_DS64_TABLE                16
+
+/*
+ * Record the chunks of the RIFF/WAVE container in one pass. Only the chunk
+ * headers are read, the bodies are skipped over.
+ *
+ * RF64 and BW64 files (EBU Tech 3306, ITU-R BS.2088) start with a ds64
+ * chunk holding the 64-bit sizes of the chunks whose 32-bit size is
+ * 0xFFFFFFFF. RIFX files are RIFF files with every field big-endian.
+ */
+static int
+waveIndexSource(const WAVE_SOURCE* source, WAVE_CHUNK_INDEX* index)
+{
+    unsigned char head[12];
+
+    index->count     = 0;
+    index->bigEndian = 0;
+
+    if (waveSourceRead(source, head, 12, 0) != 0)
+        return -1;
+
+    if (memcmp(head + 8, "WAVE", 4) != 0)
+        return -1;
+
+    int rf64 = memcmp(head, "RF64", 4) == 0 || memcmp(head, "BW64", 4) == 0;
+    int be   = memcmp(head, "RIFX", 4) == 0;
+
+    if (!rf64 && !be && memcmp(head, "RIFF", 4) != 0)
+        return -1;
+
+    index->bigEndian = be;
+
+    uint64_t      riffSize = waveGetOrder32(head + 4, be);
+    unsigned char ds64[28 + 12 * WAVE_DS64_TABLE];
+    uint32_t      tableLength = 0;
+
+    if (rf64) {
+
+        if (waveSourceRead(source, head, 8, 12) != 0 ||
+            memcmp(head, "ds64", 4) != 0 || waveGet32(head + 4) < 28)
+            return -1;
+
+        uint32_t ds64Size = waveGet32(head + 4);
+        if (ds64Size > sizeof(ds64))
+            ds64Size = sizeof(ds64);
+
+        if (waveSourceRead(source, ds64, ds64Size, 20) != 0)
+            return -1;
+
+        riffSize    = waveGet64(ds64);
+        tableLength = ds64Size >= 28 ? waveGet32(ds64 + 24) : 0;
+        if (tableLength > (ds64Size - 28) / 12)
+            tableLength = (ds64Size - 28) / 12;
+    }
+
+    // some writers leave the RIFF size unset, trust the file size then
+    uint64_t end = 8 + riffSize;
+    if (end < 12 || end > source->fileSize)
+        end = source->fileSize;
+
+    uint64_t pos = 12;
+
+    while (pos + 8 <= end && index->count < WAVE_MAX_CHUNKS) {
+
+        if (waveSourceRead(source, head, 8, pos) != 0)
+            break;
+
+        WAVE_CHUNK* chunk = &index->chunks[index->count++];
+
+        memcpy(chunk->ckID, head, 4);
+        chunk->cksize = waveGetOrder32(head + 4, be);
+        chunk->offset = pos + 8;
+
+        if (rf64 && chunk->cksize == 0xFFFFFFFF) {
+
+            if (memcmp(chunk->ckID, "data", 4) == 0) {
+                chunk->cksize = waveGet64(ds64 + 8);
+            } else {
+                uint32_t i;
+                for (i = 0; i < tableLength; i++) {
+                    if (memcmp(ds64 + 28 + 12 * i, chunk->ckID, 4) == 0) {
+                        chunk->cksize = waveGet64(ds64 + 28 + 12 * i + 4);
+                        break;
+                    }
+                }
+            }
+        }
+
+        // chunks are word aligned
+        pos = chunk->offset + chunk->cksize + (chunk->cksize & 1);
+    }
+
+    return 0;
+}
+
+/*
+ * Index the chunks, parse the "fmt " chunk and locate the data chunk. The
+ * data size is clamped to what the file really holds. Returns WAVE_OK or
+ * the reason of the failure.
+ */
+static WAVE_ERROR
+waveParseSource(
+        const WAVE_SOURCE* source,
+        WAVE_CHUNK_INDEX*  index,
+        FMT_CHUNK*         fmt,
+        uint64_t*          dataOffset,
+        uint64_t*          dataSize)
+{
+    if (waveIndexSource(source, index) != 0)
+        return WAVE_ERROR_FORMAT;
+
+    const WAVE_CHUNK* fmtChunk  = waveFindChunk(index, "fmt ");
+    const WAVE_CHUNK* dataChunk = waveFindChunk(index, "data");
+
+    if (!fmtChunk || !dataChunk)
+        return WAVE_ERROR_FORMAT;
+
+    // max size of FMT_CHUNK, a longer extension is not read
+    unsigned char body[40];
+    uint32_t      fmtSize = fmtChunk->cksize > sizeof(body) ?
+                            (uint32_t) sizeof(body) : (uint32_t) fmtChunk->cksize;
+
+    if (waveSourceRead(source, body, fmtSize, fmtChunk->offset) != 0 ||
+        waveParseFmt(body, fmtSize, fmt, index->bigEndian) != 0)
+        return WAVE_ERROR_FORMAT;
+
+    *dataOffset = dataChunk->offset;
+    *dataSize   = dataChunk->cksize;
+
+    // truncated file, keep what is there
+    if (*dataOffset > source->fileSize)
+        *dataOffset = source->fileSize;
+    if (*dataSize > source->fileSize - *dataOffset)
+        *dataSize = source->fileSize - *dataOffset;
+
+    // the chunks are still located for waveProbe, the samples are handed
+    // back in host order
+    if (waveCheckFmt(fmt) != 0 || waveSwapSize(index, fmt) < 0)
+        return WAVE_ERROR_UNSUPPORTED;
+
+    return WAVE_OK;
+}
+
+/*
+ * Open a file and parse its headers from a first read of up to headMax bytes
+ * into head. Returns the descriptor, or -1 once the error is reported.
+ */
+static int
+waveOpenHead(
+        const char*       fileName,
+        unsigned char*    head,
+        size_t            headMax,
+        WAVE_SOURCE*      source,
+        WAVE_CHUNK_INDEX* index,
+        FMT_CHUNK*        fmt,
+        uint64_t*         dataOffset,
+        uint64_t*         dataSize)
+{
+    uint64_t start = waveStageStart();
+    int      fd    = waveOpenFd(fileName);
+
+    waveStageEnd(&waveStatsCounters.openTime, start);
+
+    if (fd < 0) {
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return -1;
+    }
+
+    // read the headers, usually in one go
+    start = waveStageStart();
+
+    int64_t    headSize = waveReadFd(fd, head, headMax);
+    int64_t    fileSize = waveFdSize(fd);
+    WAVE_ERROR error    = WAVE_ERROR_READ;
+
+    source->fd       = fd;
+    source->head     = head;
+    source->headSize = headSize > 0 ? (size_t) headSize : 0;
+    source->fileSize = fileSize > 0 ? (uint64_t) fileSize : 0;
+
+    if (headSize >= 0 && fileSize >= 0)
+        error = waveParseSource(source, index, fmt, dataOffset, dataSize);
+
+    waveStageEnd(&waveStatsCounters.parseTime, start);
+
+    if (error != WAVE_OK) {
+        waveError(error, fileName);
+        waveCloseFd(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Samples of the other byte order are read and swapped by slices of about
+ * this size, while they are still in cache
+ */
+#define WAVE_SWAP_SLICE                (256 * 1024)
+
+/*
+ * Read size bytes at offset, taking what the first read already brought,
+ * reversing the bytes of each sample when swap is not 0. Returns 0 if they
+ * were all read.
+ */
+static int
+waveReadSpan(const WAVE_SOURCE* source, void* buffer, size_t size,
+             uint64_t offset, int swap)
+{
+    unsigned char* out      = (unsigned char*) buffer;
+    size_t         haveRead = 0;
+    size_t         swapped  = 0;
+    int            status   = 0;
+    uint64_t       start    = waveStageStart();
+
+    if (offset < source->headSize) {
+        haveRead = source->headSize - (size_t) offset;
+        if (haveRead > size)
+            haveRead = size;
+        memcpy(out, source->head + offset, haveRead);
+    }
+
+    while (status == 0 && haveRead < size) {
+
+        size_t n = size - haveRead;
+        if (swap && n > WAVE_SWAP_SLICE)
+            n = WAVE_SWAP_SLICE - WAVE_SWAP_SLICE % (size_t) swap;
+
+        status    = waveReadFdAt(source->fd, out + haveRead, n,
+                                 offset + haveRead);
+        haveRead += n;
+
+        if (swap && status == 0 && haveRead < size) {
+            size_t end = haveRead - haveRead % (size_t) swap;
+            waveSwapBytes(out + swapped, end - swapped, swap);
+            swapped = end;
+        }
+    }
+
+    if (swap && status == 0)
+        waveSwapBytes(out + swapped, size - swapped, swap);
+
+    waveStageEnd(&waveStatsCounters.readTime, start);
+
+    return status;
+}
+
+/**
+ * @brief Load a wave file in memory
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable
+ * @return Pointer to the wave data, to release with waveFree (or free when
+ * no allocator is set)
+ */
+void*
+waveLoad(char* fileName, WAVE_INFO* info)
+{
+    unsigned char    head[WAVE_HEAD_SIZE];
+    WAVE_SOURCE      source;
+    WAVE_CHUNK_INDEX index;
+    FMT_CHUNK        fmt_chunk;
+    uint64_t         dataOffset, dataSize;
+
+    int fd = waveOpenHead(fileName, head, sizeof(head), &source, &index,
+                          &fmt_chunk, &dataOffset, &dataSize);
+    if (fd < 0)
+        return NULL;
+
+    // in memory buffer, which must be addressable, no need to clear it
+    char* wave_data = dataSize > (size_t) -1 ? NULL :
+                      (char*) waveAlloc((size_t) dataSize);
+    if (!wave_data) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveCloseFd(fd);
+        return NULL;
+    }
+
+    int failed = waveReadSpan(&source, wave_data, (size_t) dataSize,
+                              dataOffset, waveSwapSize(&index, &fmt_chunk)) != 0;
+
+    waveCloseFd(fd);
+
+    if (failed) {
+        waveError(WAVE_ERROR_READ, fileName);
+        waveFree(wave_data);
+        return NULL;
+    }
+
+    waveFillInfo(&fmt_chunk, info);
+    info->dataSize             = dataSize;
+
+    return wave_data;
+}
+
+/*
+ * Clamp a frame range to the data chunk, return its size in bytes
+ */
+static size_t
+waveClampRange(const FMT_CHUNK* fmt, uint64_t dataSize, uint64_t* firstFrame,
+               size_t* frames)
+{
+    uint64_t total = dataSize / fmt->nBlockAlign;
+
+    if (*firstFrame > total)
+        *firstFrame = total;
+    if (*frames > total - *firstFrame)
+        *frames = (size_t) (total - *firstFrame);
+
+    return *frames * fmt->nBlockAlign;
+}
+
+/**
+ * @brief Load a range of frames of a wave file in memory
+ *
+ * Only the headers and the range are read, with a single positioned read
+ * for the range unless it came with the headers.
+ *
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable, describing the whole file
+ * @param firstFrame Index of the first frame wanted
+ * @param frames Pointer to the number of frames wanted, set to the number
+ * read, less at the end of the file
+ * @return Pointer to the frames, to release with waveFree, or NULL
+ */
+void*
+waveLoadRange(char* fileName, WAVE_INFO* info, uint64_t firstFrame,
+              size_t* frames)
+{
+    unsigned char    head[WAVE_HEAD_SIZE];
+    WAVE_SOURCE      source;
+    WAVE_CHUNK_INDEX index;
+    FMT_CHUNK        fmt;
+    uint64_t         dataOffset, dataSize;
+
+    int fd = waveOpenHead(fileName, head, sizeof(head), &source, &index,
+                          &fmt, &dataOffset, &dataSize);
+    if (fd < 0)
+        return NULL;
+
+    size_t size   = waveClampRange(&fmt, dataSize, &firstFrame, frames);
+    char*  buffer = (char*) waveAlloc(size);
+
+    if (!buffer) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveCloseFd(fd);
+        return NULL;
+    }
+
+    int failed = waveReadSpan(&source, buffer, size,
+                              dataOffset + firstFrame * fmt.nBlockAlign,
+                              waveSwapSize(&index, &fmt)) != 0;
+
+    waveCloseFd(fd);
+
+    if (failed) {
+        waveError(WAVE_ERROR_READ, fileName);
+        waveFree(buffer);
+        return NULL;
+    }
+
+    waveFillInfo(&fmt, info);
+    info->dataSize = dataSize;
+
+    return buffer;
+}
+
+/**
+ * @brief Load a wave file in a buffer of the caller
+ *
+ * When the buffer is too small, info is still filled, so the call can be
+ * repeated with a buffer of info->dataSize bytes.
+ *
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable
+ * @param buffer Destination of the data chunk
+ * @param size Size of the buffer
+ * @return 0 on success, -1 on failure (WAVE_ERROR_MEMORY if the buffer is
+ * too small)
+ */
+int
+waveLoadInto(char* fileName, WAVE_INFO* info, void* buffer, size_t size)
+{
+    unsigned char    head[WAVE_HEAD_SIZE];
+    WAVE_SOURCE      source;
+    WAVE_CHUNK_INDEX index;
+    FMT_CHUNK        fmt;
+    uint64_t         dataOffset, dataSize;
+
+    int fd = waveOpenHead(fileName, head, sizeof(head), &source, &index,
+                          &fmt, &dataOffset, &dataSize);
+    if (fd < 0)
+        return -1;
+
+    waveFillInfo(&fmt, info);
+    info->dataSize = dataSize;
+
+    WAVE_ERROR error = WAVE_OK;
+
+    if (dataSize > size)
+        error = WAVE_ERROR_MEMORY;
+    else if (waveReadSpan(&source, buffer, (size_t) dataSize, dataOffset,
+                          waveSwapSize(&index, &fmt)) != 0)
+        error = WAVE_ERROR_READ;
+
+    waveCloseFd(fd);
+
+    if (error != WAVE_OK) {
+        waveError(error, fileName);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Loads files one after the other in the same buffer
+ *
+ * The buffer only grows, once it fits the largest file loads do no heap
+ * allocation at all.
+ */
+typedef struct wave_loader_t {
+
+    void*          buffer;
+    size_t         bufferSize;
+    WAVE_ALLOCATOR allocator;   // alloc NULL for malloc and free
+
+} WAVE_LOADER;
+
+/**
+ * @brief Prepare a loader
+ * @param loader Pointer to a WAVE_LOADER variable
+ * @param allocator Functions for its buffer, copied, or NULL for malloc
+ * and free
+ */
+void
+waveLoaderInit(WAVE_LOADER* loader, const WAVE_ALLOCATOR* allocator)
+{
+    memset(loader, 0, sizeof(WAVE_LOADER));
+
+    if (allocator)
+        loader->allocator = *allocator;
+}
+
+/**
+ * @brief Release the buffer of a loader
+ * @param loader A loader from waveLoaderInit
+ */
+void
+waveLoaderFree(WAVE_LOADER* loader)
+{
+    if (loader->buffer) {
+        if (loader->allocator.free)
+            loader->allocator.free(loader->buffer, loader->allocator.user);
+        else
+            free(loader->buffer);
+    }
+
+    loader->buffer     = NULL;
+    loader->bufferSize = 0;
+}
+
+/**
+ * @brief Load a wave file in the buffer of a loader
+ * @param loader A loader from waveLoaderInit
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable
+ * @return Pointer to the wave data, valid until the next call, or NULL
+ */
+const void*
+waveLoaderLoad(WAVE_LOADER* loader, char* fileName, WAVE_INFO* info)
+{
+    unsigned char    head[WAVE_HEAD_SIZE];
+    WAVE_SOURCE      source;
+    WAVE_CHUNK_INDEX index;
+    FMT_CHUNK        fmt;
+    uint64_t         dataOffset, dataSize;
+
+    int fd = waveOpenHead(fileName, head, sizeof(head), &source, &index,
+                          &fmt, &dataOffset, &dataSize);
+    if (fd < 0)
+        return NULL;
+
+    if (dataSize > loader->bufferSize || !loader->buffer) {
+
+        // grow by half at least, the old content is not kept
+        size_t size = loader->bufferSize + loader->bufferSize / 2;
+        if (size < dataSize)
+            size = (size_t) dataSize;
+        if (size == 0)
+            size = 1;
+
+        waveLoaderFree(loader);
+
+        loader->buffer = dataSize > (size_t) -1 ? NULL :
+            loader->allocator.alloc ?
+                loader->allocator.alloc(size, loader->allocator.user) :
+                malloc(size);
+
+        if (!loader->buffer) {
+            waveError(WAVE_ERROR_MEMORY, fileName);
+            waveCloseFd(fd);
+            return NULL;
+        }
+
+        loader->bufferSize = size;
+    }
+
+    int failed = waveReadSpan(&source, loader->buffer, (size_t) dataSize,
+                              dataOffset, waveSwapSize(&index, &fmt)) != 0;
+
+    waveCloseFd(fd);
+
+    if (failed) {
+        waveError(WAVE_ERROR_READ, fileName);
+        return NULL;
+    }
+
+    waveFillInfo(&fmt, info);
+    info->dataSize = dataSize;
+
+    return loader->buffer;
+}
+
+/**
+ * @brief Index the chunks of a wave file
+ *
+ * Only the chunk headers are read. Use waveFindChunk to look a chunk up.
+ *
+ * @param fileName The wave file name
+ * @param index Pointer to a WAVE_CHUNK_INDEX variable
+ * @return 0 on success, -1 if the file is not a RIFF/WAVE file
+ */
+int
+waveIndexFile(char* fileName, WAVE_CHUNK_INDEX* index)
+{
+    int fd = waveOpenFd(fileName);
+    if (fd < 0) {
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return -1;
+    }
+
+    WAVE_SOURCE source;
+    int64_t     fileSize = waveFdSize(fd);
+
+    source.fd       = fd;
+    source.head     = NULL;
+    source.headSize = 0;
+    source.fileSize = fileSize > 0 ? (uint64_t) fileSize : 0;
+
+    int status = waveIndexSource(&source, index);
+
+    waveCloseFd(fd);
+
+    if (status != 0)
+        waveError(WAVE_ERROR_FORMAT, fileName);
+
+    return status;
+}
+
+/*
+ * Keep the texts of a LIST/INFO chunk body
+ */
+static void
+waveParseInfo(const unsigned char* body, size_t size, WAVE_PROBE* probe)
+{
+    size_t pos = 4;
+
+    if (size < 4 || memcmp(body, "INFO", 4) != 0)
+        return;
+
+    while (pos + 8 <= size && probe->tagCount < WAVE_PROBE_TAGS) {
+
+        uint32_t  length = waveGetOrder32(body + pos + 4,
+                                          probe->index.bigEndian);
+        size_t    avail  = size - pos - 8;
+        WAVE_TAG* tag    = &probe->tags[probe->tagCount++];
+
+        if (length > avail)
+            length = (uint32_t) avail;
+
+        size_t keep = length < WAVE_PROBE_TEXT ? length : WAVE_PROBE_TEXT - 1;
+
+        memcpy(tag->id, body + pos, 4);
+        memcpy(tag->text, body + pos + 8, keep);
+        tag->text[keep] = '\0';
+
+        pos += 8 + (size_t) length + (length & 1);
+    }
+}
+
+/**
+ * @brief Read the headers of a wave file, not its samples
+ *
+ * The first WAVE_HEAD_SIZE bytes are read at once, they usually hold every
+ * chunk preceding the data. Chunks after the data (a trailing LIST) cost one
+ * more read each.
+ *
+ * @param fileName The wave file name
+ * @param probe Pointer to a WAVE_PROBE variable
+ * @return 0 when the headers could be read, also for a sample format not
+ * handled (probe->status is then WAVE_ERROR_UNSUPPORTED), -1 on error
+ */
+int
+waveProbe(const char* fileName, WAVE_PROBE* probe)
+{
+    unsigned char head[WAVE_HEAD_SIZE];
+    WAVE_SOURCE   source;
+    FMT_CHUNK     fmt;
+    uint64_t      dataSize = 0;
+
+    memset(probe, 0, sizeof(WAVE_PROBE));
+    memset(&fmt, 0, sizeof(fmt));
+
+    uint64_t start = waveStageStart();
+    int      fd    = waveOpenFd(fileName);
+
+    waveStageEnd(&waveStatsCounters.openTime, start);
+
+    if (fd < 0) {
+        probe->status = WAVE_ERROR_OPEN;
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return -1;
+    }
+
+    start = waveStageStart();
+
+    int64_t headSize = waveReadFd(fd, head, sizeof(head));
+    int64_t fileSize = waveFdSize(fd);
+
+    source.fd       = fd;
+    source.head     = head;
+    source.headSize = headSize > 0 ? (size_t) headSize : 0;
+    source.fileSize = fileSize > 0 ? (uint64_t) fileSize : 0;
+
+    probe->status = headSize < 0 || fileSize < 0 ? WAVE_ERROR_READ :
+        waveParseSource(&source, &probe->index, &fmt, &probe->dataOffset,
+                        &dataSize);
+
+    if (probe->status == WAVE_OK || probe->status == WAVE_ERROR_UNSUPPORTED) {
+
+        const WAVE_CHUNK* fact = waveFindChunk(&probe->index, "fact");
+        unsigned char     body[WAVE_HEAD_SIZE];
+        int               i;
+
+        waveFillInfo(&fmt, &probe->info);
+        probe->info.dataSize = dataSize;
+        probe->fileSize      = source.fileSize;
+
+        if (fact && fact->cksize >= 4 &&
+            waveSourceRead(&source, body, 4, fact->offset) == 0)
+            probe->factLength = waveGetOrder32(body, probe->index.bigEndian);
+
+        // the fact chunk counts frames of compressed formats
+        uint16_t code = probe->info.wFormatTag;
+        probe->frames = probe->info.nBlockAlign == 0 ? 0 :
+                        dataSize / probe->info.nBlockAlign;
+        if (fact && code != WAVE_FORMAT_PCM && code != WAVE_FORMAT_IEEE_FLOAT)
+            probe->frames = probe->factLength;
+
+        for (i = 0; i < probe->index.count; i++) {
+
+            const WAVE_CHUNK* chunk = &probe->index.chunks[i];
+            size_t            size  = chunk->cksize < sizeof(body) ?
+                                      (size_t) chunk->cksize : sizeof(body);
+
+            if (memcmp(chunk->ckID, "LIST", 4) == 0 &&
+                waveSourceRead(&source, body, size, chunk->offset) == 0)
+                waveParseInfo(body, size, probe);
+        }
+    }
+
+    waveStageEnd(&waveStatsCounters.parseTime, start);
+    waveCloseFd(fd);
+
+    if (probe->status != WAVE_OK)
+        waveError(probe->status, fileName);
+
+    return probe->status == WAVE_OK ||
+           probe->status == WAVE_ERROR_UNSUPPORTED ? 0 : -1;
+}
+
+/**
+ * @brief Find a text of the LIST/INFO chunk
+ * @param probe A WAVE_PROBE filled by waveProbe
+ * @param id The four characters tag ID, e.g. "INAM"
+ * @return The text or NULL
+ */
+const char*
+waveProbeTag(const WAVE_PROBE* probe, const char* id)
+{
+    int i;
+    for (i = 0; i < probe->tagCount; i++)
+        if (memcmp(probe->tags[i].id, id, 4) == 0)
+            return probe->tags[i].text;
+
+    return NULL;
+}
+
+/**
+ * @brief Give the system a hint on how the data of a mapped file will be read
+ * @param map A WAVE_MAP filled by waveMap
+ * @param advice WAVE_MAP_NORMAL, WAVE_MAP_SEQUENTIAL or WAVE_MAP_RANDOM,
+ * optionally or'ed with WAVE_MAP_WILLNEED
+ */
+void
+waveMapAdvise(WAVE_MAP* map, int advice)
+{
+    if (!map->data || map->dataSize == 0)
+        return;
+
+#ifdef _WIN32
+    (void) advice;
+#else
+    // madvise wants a page aligned address
+    size_t page  = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = ((char*) map->data - (char*) map->base) / page * page;
+    size_t len   = ((char*) map->data - (char*) map->base) + map->dataSize - start;
+    void*  addr  = (char*) map->base + start;
+
+    waveCount(&waveStatsCounters.syscalls, advice & WAVE_MAP_WILLNEED ? 2 : 1);
+
+    if (advice & WAVE_MAP_SEQUENTIAL)
+        madvise(addr, len, MADV_SEQUENTIAL);
+    else if (advice & WAVE_MAP_RANDOM)
+        madvise(addr, len, MADV_RANDOM);
+    else
+        madvise(addr, len, MADV_NORMAL);
+
+    if (advice & WAVE_MAP_WILLNEED)
+        madvise(addr, len, MADV_WILLNEED);
+#endif
+}
+
+/*
+ * Reverse the bytes of the mapped samples in place. The pages are private,
+ * made writable for the swap, the file is left untouched.
+ */
+static int
+waveMapSwap(WAVE_MAP* map, int swap)
+{
+    if (map->dataSize == 0)
+        return 0;
+
+#ifdef _WIN32
+    DWORD old;
+    if (!VirtualProtect(map->data, map->dataSize, PAGE_WRITECOPY, &old))
+        return -1;
+
+    waveSwapBytes(map->data, map->dataSize, swap);
+    VirtualProtect(map->data, map->dataSize, PAGE_READONLY, &old);
+#else
+    size_t page  = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = ((char*) map->data - (char*) map->base) / page * page;
+    size_t len   = ((char*) map->data - (char*) map->base) + map->dataSize - start;
+    void*  addr  = (char*) map->base + start;
+
+    waveCount(&waveStatsCounters.syscalls, 2);
+
+    if (mprotect(addr, len, PROT_READ | PROT_WRITE) != 0)
+        return -1;
+
+    waveSwapBytes(map->data, map->dataSize, swap);
+    mprotect(addr, len, PROT_READ);
+#endif
+
+    return 0;
+}
+
+/**
+ * @brief Release a mapping created by waveMap
+ * @param map The WAVE_MAP given to waveMap
+ */
+void
+waveUnmap(WAVE_MAP* map)
+{
+    if (!map->base)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(map->base);
+    CloseHandle(map->mapping);
+#else
+    munmap(map->base, map->length);
+#endif
+
+    waveCount(&waveStatsCounters.syscalls, 1);
+
+    memset(map, 0, sizeof(WAVE_MAP));
+}
+
+/**
+ * @brief Map a wave file in memory without copying it
+ *
+ * The headers are validated in place and the returned pointer points
+ * straight into the read-only mapping. It stays valid until waveUnmap.
+ * The samples of a RIFX file are byte swapped in private copies of the
+ * pages, which reads them all.
+ *
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable
+ * @param map Pointer to a WAVE_MAP variable, to give to waveUnmap
+ * @param advice Access pattern hint, see waveMapAdvise
+ * @return Pointer to the wave data or NULL
+ */
+void*
+waveMap(char* fileName, WAVE_INFO* info, WAVE_MAP* map, int advice)
+{
+    memset(map, 0, sizeof(WAVE_MAP));
+
+    uint64_t start = waveStageStart();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    waveCount(&waveStatsCounters.syscalls, 1);
+    if (file == INVALID_HANDLE_VALUE) {
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return NULL;
+    }
+
+    waveCount(&waveStatsCounters.files, 1);
+    waveCount(&waveStatsCounters.syscalls, 4);
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 ||
+        (uint64_t) fileSize.QuadPart > (size_t) -1)
+    {
+        waveError(WAVE_ERROR_FORMAT, fileName);
+        CloseHandle(file);
+        return NULL;
+    }
+
+    // copy on write, for the samples swapped in place
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        return NULL;
+    }
+
+    void* base = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (!base) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        CloseHandle(mapping);
+        return NULL;
+    }
+
+    map->mapping = mapping;
+    map->length  = (size_t) fileSize.QuadPart;
+#else
+    int fd = waveOpenFd(fileName);
+    if (fd < 0) {
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return NULL;
+    }
+
+    int64_t fileSize = waveFdSize(fd);
+    if (fileSize <= 0 || (uint64_t) fileSize > (size_t) -1) {
+        waveError(fileSize < 0 ? WAVE_ERROR_READ : WAVE_ERROR_FORMAT, fileName);
+        waveCloseFd(fd);
+        return NULL;
+    }
+
+    // the mapping keeps its own reference on the file
+    void* base = mmap(NULL, (size_t) fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    waveCount(&waveStatsCounters.syscalls, 1);
+    waveCloseFd(fd);
+    if (base == MAP_FAILED) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        return NULL;
+    }
+
+    map->length = (size_t) fileSize;
+#endif
+
+    map->base = base;
+
+    waveStageEnd(&waveStatsCounters.openTime, start);
+    start = waveStageStart();
+
+    // the whole file is the source, no read involved
+    WAVE_SOURCE source;
+    FMT_CHUNK   fmt;
+    uint64_t    dataOffset, dataSize;
+
+    source.fd       = -1;
+    source.head     = (unsigned char*) base;
+    source.headSize = map->length;
+    source.fileSize = map->length;
+
+    WAVE_ERROR error = waveParseSource(&source, &map->index, &fmt,
+                                       &dataOffset, &dataSize);
+
+    waveStageEnd(&waveStatsCounters.parseTime, start);
+
+    if (error != WAVE_OK) {
+        waveError(error, fileName);
+        waveUnmap(map);
+        return NULL;
+    }
+
+    map->data     = (char*) base + dataOffset;
+    map->dataSize = (size_t) dataSize;
+
+    int swap = waveSwapSize(&map->index, &fmt);
+
+    if (swap && waveMapSwap(map, swap) != 0) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveUnmap(map);
+        return NULL;
+    }
+
+    waveFillInfo(&fmt, info);
+    info->dataSize = dataSize;
+
+    if (advice != WAVE_MAP_NORMAL)
+        waveMapAdvise(map, advice);
+
+    return map->data;
+}
+
+/**
+ * @brief Map a range of frames of a wave file in memory
+ *
+ * Only the pages holding the range are mapped, the headers are read with a
+ * single read. Release the mapping with waveUnmap.
+ *
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable, describing the whole file
+ * @param map Pointer to a WAVE_MAP variable, its data and dataSize cover
+ * the range
+ * @param firstFrame Index of the first frame wanted
+ * @param frames Pointer to the number of frames wanted, set to the number
+ * mapped, less at the end of the file
+ * @param advice Access pattern hint, see waveMapAdvise
+ * @return Pointer to the first frame or NULL
+ */
+void*
+waveMapRange(char* fileName, WAVE_INFO* info, WAVE_MAP* map,
+             uint64_t firstFrame, size_t* frames, int advice)
+{
+    unsigned char head[WAVE_HEAD_SIZE];
+    WAVE_SOURCE   source;
+    FMT_CHUNK     fmt;
+    uint64_t      dataOffset, dataSize;
+
+    memset(map, 0, sizeof(WAVE_MAP));
+
+    int fd = waveOpenHead(fileName, head, sizeof(head), &source, &map->index,
+                          &fmt, &dataOffset, &dataSize);
+    if (fd < 0)
+        return NULL;
+
+    size_t   size   = waveClampRange(&fmt, dataSize, &firstFrame, frames);
+    uint64_t offset = dataOffset + firstFrame * fmt.nBlockAlign;
+
+    // the mapping starts on a page, or allocation granularity, boundary
+#ifdef _WIN32
+    SYSTEM_INFO system;
+    GetSystemInfo(&system);
+    uint64_t granularity = system.dwAllocationGranularity;
+#else
+    uint64_t granularity = (uint64_t) sysconf(_SC_PAGESIZE);
+#endif
+    uint64_t mapOffset = offset / granularity * granularity;
+    size_t   length    = (size_t) (offset - mapOffset) + (size ? size : 1);
+
+    if (mapOffset + length > source.fileSize)
+        length = (size_t) (source.fileSize - mapOffset);
+
+    uint64_t start = waveStageStart();
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA((HANDLE) _get_osfhandle(fd), NULL,
+                                        PAGE_WRITECOPY, 0, 0, NULL);
+    void*  base    = mapping ?
+        MapViewOfFile(mapping, FILE_MAP_COPY, (DWORD) (mapOffset >> 32),
+                      (DWORD) mapOffset, length) : NULL;
+    waveCount(&waveStatsCounters.syscalls, 2);
+
+    if (!base && mapping)
+        CloseHandle(mapping);
+    map->mapping = mapping;
+#else
+    void* base = length == 0 ? MAP_FAILED :
+        mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, (off_t) mapOffset);
+    waveCount(&waveStatsCounters.syscalls, 1);
+
+    if (base == MAP_FAILED)
+        base = NULL;
+#endif
+
+    waveCloseFd(fd);
+    waveStageEnd(&waveStatsCounters.openTime, start);
+
+    if (!base) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        memset(map, 0, sizeof(WAVE_MAP));
+        return NULL;
+    }
+
+    map->base     = base;
+    map->length   = length;
+    map->data     = (char*) base + (offset - mapOffset);
+    map->dataSize = size;
+
+    int swap = waveSwapSize(&map->index, &fmt);
+
+    if (swap && waveMapSwap(map, swap) != 0) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveUnmap(map);
+        return NULL;
+    }
+
+    waveFillInfo(&fmt, info);
+    info->dataSize = dataSize;
+
+    if (advice != WAVE_MAP_NORMAL)
+        waveMapAdvise(map, advice);
+
+    return map->data;
+}
+
+/**
+ * @brief Read the body of a chunk of a streamed file
+ *
+ * The stream position is left untouched.
+ *
+ * @param stream A stream from waveOpen
+ * @param chunk A chunk of the stream index, see waveFindChunk
+ * @param buffer Destination buffer
+ * @param size Size of the destination buffer
+ * @return The number of bytes read, or -1
+ */
+int64_t
+waveReadChunk(WAVE_STREAM* stream, const WAVE_CHUNK* chunk,
+              void* buffer, size_t size)
+{
+    if (size > chunk->cksize)
+        size = (size_t) chunk->cksize;
+
+    if (waveReadFdAt(stream->fd, buffer, size, chunk->offset) != 0)
+        return -1;
+
+    return (int64_t) size;
+}
+
+/**
+ * @brief Close a stream opened by waveOpen
+ * @param stream The stream
+ */
+void
+waveClose(WAVE_STREAM* stream)
+{
+    if (!stream)
+        return;
+
+    waveCloseFd(stream->fd);
+    free(stream);
+}
+
+/**
+ * @brief Open a wave file for streaming
+ *
+ * Only the headers are parsed, the frames are then pulled with waveReadFrames
+ * using reads of readSize bytes, so the memory used does not depend on the
+ * file size.
+ *
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable
+ * @param readSize Size of the reads issued on the file, 0 for
+ * WAVE_STREAM_READ_SIZE
+ * @return The stream, to close with waveClose, or NULL
+ */
+WAVE_STREAM*
+waveOpen(char* fileName, WAVE_INFO* info, size_t readSize)
+{
+    // the first read must hold the headers
+    if (readSize == 0)
+        readSize = WAVE_STREAM_READ_SIZE;
+    if (readSize < 4096)
+        readSize = 4096;
+
+    uint64_t start = waveStageStart();
+    int      fd    = waveOpenFd(fileName);
+
+    waveStageEnd(&waveStatsCounters.openTime, start);
+
+    if (fd < 0) {
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return NULL;
+    }
+
+    WAVE_STREAM* stream = (WAVE_STREAM*) malloc(sizeof(WAVE_STREAM) + readSize);
+    if (!stream) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveCloseFd(fd);
+        return NULL;
+    }
+
+    start = waveStageStart();
+
+    stream->fd         = fd;
+    stream->buffer     = (unsigned char*) (stream + 1);
+    stream->bufferSize = readSize;
+
+    // one read for the headers and the first frames
+    int64_t got = waveReadFd(fd, stream->buffer, readSize);
+
+    int64_t     fileSize = waveFdSize(fd);
+
+    WAVE_SOURCE source;
+    FMT_CHUNK   fmt;
+    uint64_t    dataOffset, dataSize;
+
+    source.fd       = fd;
+    source.head     = stream->buffer;
+    source.headSize = got > 0 ? (size_t) got : 0;
+    source.fileSize = fileSize > 0 ? (uint64_t) fileSize : 0;
+
+    WAVE_ERROR error = WAVE_ERROR_READ;
+
+    if (got >= 0 && fileSize >= 0)
+        error = waveParseSource(&source, &stream->index, &fmt,
+                                &dataOffset, &dataSize);
+
+    waveStageEnd(&waveStatsCounters.parseTime, start);
+
+    if (error != WAVE_OK) {
+        waveError(error, fileName);
+        waveClose(stream);
+        return NULL;
+    }
+
+    waveFillInfo(&fmt, &stream->info);
+    stream->info.dataSize = dataSize;
+
+    stream->dataOffset = dataOffset;
+    stream->remaining  = dataSize;
+    stream->swap       = waveSwapSize(&stream->index, &fmt);
+
+    if (dataOffset < source.headSize) {
+
+        // the first frames came with the headers
+        stream->bufferPos = (size_t) dataOffset;
+        stream->bufferEnd = source.headSize;
+
+    } else {
+
+        stream->bufferPos = 0;
+        stream->bufferEnd = 0;
+
+        if (waveSeekFd(fd, dataOffset) != 0) {
+            waveError(WAVE_ERROR_READ, fileName);
+            waveClose(stream);
+            return NULL;
+        }
+    }
+
+    *info = stream->info;
+
+    return stream;
+}
+
+/**
+ * @brief Read the next frames of a stream
+ *
+ * Only whole frames (nBlockAlign bytes) are copied.
+ *
+ * @param stream A stream from waveOpen
+ * @param buffer Destination, at least frames * nBlockAlign bytes
+ * @param frames Number of frames wanted
+ * @return The number of frames read, 0 at the end of the data
+ */
+size_t
+waveReadFrames(WAVE_STREAM* stream, void* buffer, size_t frames)
+{
+    size_t   blockAlign = stream->info.nBlockAlign;
+    uint64_t available  = stream->remaining / blockAlign;
+
+    if (frames > available)
+        frames = (size_t) available;
+
+    size_t         want  = frames * blockAlign;
+    size_t         done  = 0;
+    unsigned char* out   = (unsigned char*) buffer;
+    uint64_t       start = waveStageStart();
+
+    while (done < want) {
+
+        size_t buffered = stream->bufferEnd - stream->bufferPos;
+
+        if (buffered > 0) {
+
+            size_t n = want - done;
+            if (n > buffered) n = buffered;
+
+            memcpy(out + done, stream->buffer + stream->bufferPos, n);
+            stream->bufferPos += n;
+            done += n;
+            continue;
+        }
+
+        // large requests go straight to the caller buffer
+        if (want - done >= stream->bufferSize) {
+
+            int64_t got = waveReadFd(stream->fd, out + done, want - done);
+            if (got <= 0)
+                break;
+
+            done += (size_t) got;
+            continue;
+        }
+
+        size_t n = stream->bufferSize;
+        if (n > stream->remaining - done)
+            n = (size_t) (stream->remaining - done);
+
+        int64_t got = waveReadFd(stream->fd, stream->buffer, n);
+        if (got <= 0)
+            break;
+
+        stream->bufferPos = 0;
+        stream->bufferEnd = (size_t) got;
+    }
+
+    // foreign byte order, swapped while the frames are in cache
+    if (stream->swap)
+        waveSwapBytes(out, done - done % blockAlign, stream->swap);
+
+    waveStageEnd(&waveStatsCounters.readTime, start);
+
+    // file shorter than announced, drop the partial frame
+    if (done < want) {
+        stream->remaining = 0;
+        return done / blockAlign;
+    }
+
+    stream->remaining -= done;
+    return frames;
+}
+
+/**
+ * @brief Move a stream to a frame
+ *
+ * Forward moves within the frames already buffered cost nothing, others
+ * drop the buffer and the next read starts at the frame.
+ *
+ * @param stream A stream from waveOpen
+ * @param frame Index of the frame, clamped to the end of the data
+ * @return 0 on success, -1 on failure
+ */
+int
+waveSeekFrame(WAVE_STREAM* stream, uint64_t frame)
+{
+    uint64_t blockAlign = stream->info.nBlockAlign;
+    uint64_t total      = stream->info.dataSize / blockAlign;
+
+    if (frame > total)
+        frame = total;
+
+    uint64_t target   = frame * blockAlign;
+    uint64_t consumed = stream->info.dataSize - stream->remaining;
+    size_t   buffered = stream->bufferEnd - stream->bufferPos;
+
+    if (target >= consumed && target - consumed <= buffered) {
+        stream->bufferPos += (size_t) (target - consumed);
+        stream->remaining -= target - consumed;
+        return 0;
+    }
+
+    if (waveSeekFd(stream->fd, stream->dataOffset + target) != 0) {
+        waveError(WAVE_ERROR_READ, NULL);
+        return -1;
+    }
+
+    stream->remaining = stream->info.dataSize - target;
+    stream->bufferPos = 0;
+    stream->bufferEnd = 0;
+
+    return 0;
+}
+
+/**
+ * @brief Go back to the first frame of a stream
+ * @param stream A stream from waveOpen
+ * @return 0 on success, -1 on failure
+ */
+int
+waveRewind(WAVE_STREAM* stream)
+{
+    return waveSeekFrame(stream, 0);
+}
+
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
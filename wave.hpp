@@ -0,0 +1,522 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave.hpp
+ *
+ * C++17 layer over wave.h: a loaded or mapped file owned by a wave::File,
+ * read through typed views whose sample type and channel count are template
+ * parameters. wave::dispatch turns the format of the file into those
+ * parameters once, so the loops running over a view know the encoding and,
+ * for usual layouts, the number of channels at compile time.
+ */
+
+#ifndef WAVE_HPP
+#define WAVE_HPP
+
+#if __cplusplus < 201703L && !(defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#error "wave.hpp needs C++17"
+#endif
+
+#include "wave.h"
+#include "wave_float.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+namespace wave {
+
+/**
+ * @brief Channel count only known at run time
+ */
+inline constexpr std::size_t dynamic = static_cast<std::size_t>(-1);
+
+/**
+ * @brief A 24-bit packed PCM sample
+ */
+struct Int24 {
+
+    std::uint8_t bytes[3];
+
+    constexpr std::int32_t value() const
+    {
+        return static_cast<std::int32_t>(
+            static_cast<std::uint32_t>(bytes[0]) << 8 |
+            static_cast<std::uint32_t>(bytes[1]) << 16 |
+            static_cast<std::uint32_t>(bytes[2]) << 24) >> 8;
+    }
+};
+
+/**
+ * @brief A G.711 A-law sample
+ */
+struct ALaw { std::uint8_t code; };
+
+/**
+ * @brief A G.711 µ-law sample
+ */
+struct MuLaw { std::uint8_t code; };
+
+static_assert(sizeof(Int24) == 3 && sizeof(ALaw) == 1 && sizeof(MuLaw) == 1,
+              "samples must be packed");
+
+/**
+ * @brief Encoding of a sample type: its WAVE_SAMPLE_* code and its
+ * conversion to normalized float, the same as waveToFloat
+ */
+template <class T> struct Sample;
+
+template <> struct Sample<std::uint8_t> {
+    static constexpr int format = WAVE_SAMPLE_U8;
+    static float toFloat(std::uint8_t v)
+    { return static_cast<float>(static_cast<int>(v) - 128) * (1.0f / 128); }
+};
+
+template <> struct Sample<std::int16_t> {
+    static constexpr int format = WAVE_SAMPLE_S16;
+    static float toFloat(std::int16_t v)
+    { return static_cast<float>(v) * (1.0f / 32768); }
+};
+
+template <> struct Sample<Int24> {
+    static constexpr int format = WAVE_SAMPLE_S24;
+    static float toFloat(Int24 v)
+    { return static_cast<float>(v.value()) * (1.0f / 8388608); }
+};
+
+template <> struct Sample<std::int32_t> {
+    static constexpr int format = WAVE_SAMPLE_S32;
+    static float toFloat(std::int32_t v)
+    { return static_cast<float>(v) * (1.0f / 2147483648.0f); }
+};
+
+template <> struct Sample<float> {
+    static constexpr int format = WAVE_SAMPLE_F32;
+    static float toFloat(float v) { return v; }
+};
+
+template <> struct Sample<double> {
+    static constexpr int format = WAVE_SAMPLE_F64;
+    static float toFloat(double v) { return static_cast<float>(v); }
+};
+
+// the G.711 tables are filled by File before handing out a view
+template <> struct Sample<ALaw> {
+    static constexpr int format = WAVE_SAMPLE_ALAW;
+    static float toFloat(ALaw v) { return waveAlawTable[v.code]; }
+};
+
+template <> struct Sample<MuLaw> {
+    static constexpr int format = WAVE_SAMPLE_MULAW;
+    static float toFloat(MuLaw v) { return waveMulawTable[v.code]; }
+};
+
+/**
+ * @brief A run of contiguous elements, fixed length when Extent is not
+ * dynamic, like the C++20 std::span
+ */
+template <class T, std::size_t Extent = dynamic>
+class Span {
+public:
+
+    constexpr Span() = default;
+    constexpr Span(T* data, std::size_t size) : data_(data), size_(size) {}
+
+    constexpr T*          data() const { return data_; }
+    constexpr T*          begin() const { return data_; }
+    constexpr T*          end() const { return data_ + size(); }
+    constexpr bool        empty() const { return size() == 0; }
+    constexpr T&          operator[](std::size_t i) const { return data_[i]; }
+
+    constexpr std::size_t size() const
+    {
+        if constexpr (Extent != dynamic)
+            return Extent;
+        else
+            return size_;
+    }
+
+private:
+
+    T*          data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+/**
+ * @brief The samples of one channel, every stride elements
+ */
+template <class T>
+class ChannelView {
+public:
+
+    class iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const T*;
+        using reference         = const T&;
+
+        iterator() = default;
+        iterator(const T* p, std::size_t stride)
+            : p_(p), stride_(static_cast<difference_type>(stride)) {}
+
+        reference  operator*() const { return *p_; }
+        pointer    operator->() const { return p_; }
+        reference  operator[](difference_type n) const { return p_[n * stride_]; }
+
+        iterator&  operator++() { p_ += stride_; return *this; }
+        iterator&  operator--() { p_ -= stride_; return *this; }
+        iterator   operator++(int) { iterator i = *this; p_ += stride_; return i; }
+        iterator   operator--(int) { iterator i = *this; p_ -= stride_; return i; }
+        iterator&  operator+=(difference_type n) { p_ += n * stride_; return *this; }
+        iterator&  operator-=(difference_type n) { p_ -= n * stride_; return *this; }
+
+        friend iterator operator+(iterator i, difference_type n) { return i += n; }
+        friend iterator operator+(difference_type n, iterator i) { return i += n; }
+        friend iterator operator-(iterator i, difference_type n) { return i -= n; }
+
+        friend difference_type operator-(const iterator& a, const iterator& b)
+        { return (a.p_ - b.p_) / a.stride_; }
+
+        bool       operator==(const iterator& o) const { return p_ == o.p_; }
+        bool       operator!=(const iterator& o) const { return p_ != o.p_; }
+        bool       operator<(const iterator& o) const { return p_ < o.p_; }
+        bool       operator>(const iterator& o) const { return p_ > o.p_; }
+        bool       operator<=(const iterator& o) const { return p_ <= o.p_; }
+        bool       operator>=(const iterator& o) const { return p_ >= o.p_; }
+
+    private:
+        const T*        p_      = nullptr;
+        difference_type stride_ = 1;
+    };
+
+    ChannelView(const T* data, std::size_t frames, std::size_t stride)
+        : data_(data), frames_(frames), stride_(stride) {}
+
+    std::size_t size() const { return frames_; }
+    const T&    operator[](std::size_t frame) const { return data_[frame * stride_]; }
+    iterator    begin() const { return iterator(data_, stride_); }
+    iterator    end() const { return iterator(data_ + frames_ * stride_, stride_); }
+
+private:
+
+    const T*    data_;
+    std::size_t frames_;
+    std::size_t stride_;
+};
+
+/**
+ * @brief Interleaved frames of Channels samples of type T
+ */
+template <class T, std::size_t Channels = dynamic>
+class FrameView {
+public:
+
+    using sample_type = T;
+    using frame_type  = Span<const T, Channels>;
+
+    static constexpr std::size_t extent = Channels;
+
+    constexpr FrameView() = default;
+    constexpr FrameView(const T* data, std::size_t frames, std::size_t channels)
+        : data_(data), frames_(frames), channels_(channels) {}
+
+    constexpr const T*    data() const { return data_; }
+    constexpr std::size_t frames() const { return frames_; }
+    constexpr std::size_t samples() const { return frames_ * channels(); }
+    constexpr bool        empty() const { return frames_ == 0; }
+
+    constexpr std::size_t channels() const
+    {
+        if constexpr (Channels != dynamic)
+            return Channels;
+        else
+            return channels_;
+    }
+
+    /**
+     * @brief The samples of a frame
+     */
+    constexpr frame_type operator[](std::size_t frame) const
+    {
+        return frame_type(data_ + frame * channels(), channels());
+    }
+
+    constexpr const T& at(std::size_t frame, std::size_t channel) const
+    {
+        return data_[frame * channels() + channel];
+    }
+
+    /**
+     * @brief The samples of a channel
+     */
+    ChannelView<T> channel(std::size_t c) const
+    {
+        return ChannelView<T>(data_ + c, frames_, channels());
+    }
+
+    /**
+     * @brief Frames first to first + count, clamped to the view
+     */
+    constexpr FrameView sub(std::size_t first, std::size_t count) const
+    {
+        if (first > frames_) first = frames_;
+        if (count > frames_ - first) count = frames_ - first;
+        return FrameView(data_ + first * channels(), count, channels());
+    }
+
+private:
+
+    const T*    data_     = nullptr;
+    std::size_t frames_   = 0;
+    std::size_t channels_ = 0;
+};
+
+/**
+ * @brief Convert a view to normalized float, interleaved
+ * @param view The frames
+ * @param out Room for view.samples() floats
+ */
+template <class View>
+void toFloat(const View& view, float* out)
+{
+    using T = typename View::sample_type;
+
+    const T*    in = view.data();
+    std::size_t n  = view.samples();
+
+    for (std::size_t i = 0; i < n; i++)
+        out[i] = Sample<T>::toFloat(in[i]);
+}
+
+/**
+ * @brief A wave file in memory, loaded or mapped, released with the object
+ *
+ * Failures do not throw: the object is then false and error() says why.
+ */
+class File {
+public:
+
+    File() = default;
+
+    /**
+     * @brief Read the data chunk to memory, see waveLoad
+     */
+    static File load(const char* fileName)
+    {
+        File file;
+        file.data_ = waveLoad(const_cast<char*>(fileName), &file.info_);
+        file.size_ = static_cast<std::size_t>(file.info_.dataSize);
+        file.done(false);
+        return file;
+    }
+
+    /**
+     * @brief Map the file, see waveMap
+     *
+     * The data chunk only starts on an even offset: when that does not suit
+     * its samples (floats after a fact chunk for example), it is read to an
+     * aligned copy instead.
+     */
+    static File map(const char* fileName, int advice = WAVE_MAP_SEQUENTIAL)
+    {
+        File file;
+        file.data_ = waveMap(const_cast<char*>(fileName), &file.info_,
+                             &file.map_, advice);
+        file.size_ = file.map_.dataSize;
+        file.done(true);
+
+        if (file.data_ && !file.aligned())
+            file.copyMapping(fileName);
+        return file;
+    }
+
+    File(File&& other) noexcept { *this = std::move(other); }
+
+    File& operator=(File&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            info_   = other.info_;
+            map_    = other.map_;
+            data_   = other.data_;
+            size_   = other.size_;
+            mapped_ = other.mapped_;
+            error_  = other.error_;
+            other.data_ = nullptr;
+        }
+        return *this;
+    }
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    ~File() { release(); }
+
+    explicit operator bool() const { return data_ != nullptr; }
+
+    WAVE_ERROR       error() const { return error_; }
+    const WAVE_INFO& info() const { return info_; }
+    const void*      data() const { return data_; }
+    std::size_t      bytes() const { return size_; }
+    std::size_t      channels() const { return info_.nChannels; }
+    std::size_t      frames() const
+    { return data_ && info_.nBlockAlign ? size_ / info_.nBlockAlign : 0; }
+
+    /**
+     * @brief The WAVE_SAMPLE_* encoding, -1 if none
+     */
+    int sampleFormat() const { return data_ ? waveSampleFormat(&info_) : -1; }
+
+    /**
+     * @brief The frames as samples of type T
+     * @return An empty view if the file is not made of T samples, has
+     * another number of channels than a fixed Channels or its data is not
+     * aligned for T (from an allocator of waveSetAllocator)
+     */
+    template <class T, std::size_t Channels = dynamic>
+    FrameView<T, Channels> view() const
+    {
+        if (sampleFormat() != Sample<T>::format ||
+            (Channels != dynamic && Channels != channels()) ||
+            reinterpret_cast<std::uintptr_t>(data_) % alignof(T) != 0)
+            return FrameView<T, Channels>();
+
+        return FrameView<T, Channels>(static_cast<const T*>(data_), frames(),
+                                      channels());
+    }
+
+private:
+
+    void done(bool mapped)
+    {
+        mapped_ = mapped;
+        error_  = data_ ? WAVE_OK : waveLastError();
+
+        if (data_)
+            waveInitLawTables();
+    }
+
+    // whether the view of the file encoding can read data_
+    bool aligned() const
+    {
+        std::size_t alignment = 1;
+
+        switch (sampleFormat()) {
+        case WAVE_SAMPLE_S16: alignment = alignof(std::int16_t); break;
+        case WAVE_SAMPLE_S32: alignment = alignof(std::int32_t); break;
+        case WAVE_SAMPLE_F32: alignment = alignof(float);        break;
+        case WAVE_SAMPLE_F64: alignment = alignof(double);       break;
+        default:                                                 break;
+        }
+
+        return reinterpret_cast<std::uintptr_t>(data_) % alignment == 0;
+    }
+
+    void copyMapping(const char* fileName)
+    {
+        void* copy = waveAlloc(size_);
+
+        if (copy)
+            std::memcpy(copy, data_, size_);
+        else
+            waveError(WAVE_ERROR_MEMORY, fileName);
+
+        waveUnmap(&map_);
+        data_ = copy;
+        done(false);
+    }
+
+    void release()
+    {
+        if (!data_)
+            return;
+        if (mapped_)
+            waveUnmap(&map_);
+        else
+            waveFree(data_);
+        data_ = nullptr;
+    }
+
+    WAVE_INFO   info_   = {};
+    WAVE_MAP    map_    = {};
+    void*       data_   = nullptr;
+    std::size_t size_   = 0;
+    bool        mapped_ = false;
+    WAVE_ERROR  error_  = WAVE_OK;
+};
+
+namespace detail {
+
+template <class T, class F>
+decltype(auto) dispatchChannels(const File& file, F&& f)
+{
+    // layouts common enough to get loops unrolled for them
+    switch (file.channels()) {
+    case 1:  return f(file.view<T, 1>());
+    case 2:  return f(file.view<T, 2>());
+    case 6:  return f(file.view<T, 6>());
+    case 8:  return f(file.view<T, 8>());
+    default: return f(file.view<T>());
+    }
+}
+
+} // namespace detail
+
+/**
+ * @brief Call f with the frames of a file, as the FrameView matching its
+ * encoding and channels
+ *
+ * f is instantiated for every encoding, usually as a generic lambda, and
+ * must return the same type for all. The format is only looked at here.
+ *
+ * @param file A loaded or mapped file
+ * @param f Called with a FrameView<T, Channels>, an empty
+ * FrameView<std::uint8_t> when the file has no readable samples
+ * @return What f returns
+ */
+template <class F>
+decltype(auto) dispatch(const File& file, F&& f)
+{
+    switch (file.sampleFormat()) {
+    case WAVE_SAMPLE_U8:    return detail::dispatchChannels<std::uint8_t>(file, f);
+    case WAVE_SAMPLE_S16:   return detail::dispatchChannels<std::int16_t>(file, f);
+    case WAVE_SAMPLE_S24:   return detail::dispatchChannels<Int24>(file, f);
+    case WAVE_SAMPLE_S32:   return detail::dispatchChannels<std::int32_t>(file, f);
+    case WAVE_SAMPLE_F32:   return detail::dispatchChannels<float>(file, f);
+    case WAVE_SAMPLE_F64:   return detail::dispatchChannels<double>(file, f);
+    case WAVE_SAMPLE_ALAW:  return detail::dispatchChannels<ALaw>(file, f);
+    case WAVE_SAMPLE_MULAW: return detail::dispatchChannels<MuLaw>(file, f);
+    default:                return f(FrameView<std::uint8_t>());
+    }
+}
+
+} // namespace wave
+
+#endif
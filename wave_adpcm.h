@@ -0,0 +1,1214 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file wave_adpcm.h
+ *
+ * IMA/DVI and Microsoft ADPCM, 4 bits per sample. The data chunk is a
+ * sequence of nBlockAlign byte blocks, each starting with the predictor
+ * state of every channel, so a block decodes without the ones before it.
+ * Whole files are decoded and encoded with the blocks spread over threads,
+ * streams decode one block at a time and seek to any frame.
+ *
+ * The decoded frames are interleaved 16-bit PCM, the frame count comes from
+ * the fact chunk.
+ */
+
+#ifndef WAVE_ADPCM_H
+#define WAVE_ADPCM_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_write.h"
+#include "wave_thread.h"
+
+/*
+ * Most predictor pairs a Microsoft ADPCM fmt chunk may hold, the block
+ * header picks one with a byte
+ */
+#define WAVE_ADPCM_MAX_COEF            256
+
+/*
+ * Fewest blocks given to a thread, shorter sounds are not worth waking one
+ */
+#define WAVE_ADPCM_JOB_BLOCKS          64
+
+/*
+ * Most threads of a decode or an encode
+ */
+#define WAVE_ADPCM_MAX_THREADS         64
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * @brief Parameters of an ADPCM data chunk, see waveAdpcmInit
+ */
+typedef struct wave_adpcm_t {
+
+    uint16_t formatTag;         // WAVE_FORMAT_IMA_ADPCM or WAVE_FORMAT_ADPCM
+    uint16_t nChannels;
+    uint32_t nSamplesPerSec;
+    uint16_t nBlockAlign;       // bytes per block
+    uint16_t samplesPerBlock;   // frames per block
+
+    // Microsoft ADPCM predictors, 8.8 fixed point
+    uint16_t numCoef;
+    int16_t  coef[WAVE_ADPCM_MAX_COEF][2];
+
+} WAVE_ADPCM;
+
+/**
+ * @brief An ADPCM file opened for reading frames in sequence
+ */
+typedef struct wave_adpcm_stream_t {
+
+    int            fd;
+    WAVE_ADPCM     adpcm;
+
+    uint64_t       dataOffset;
+    uint64_t       dataSize;
+    uint64_t       frames;      // frames in the file
+    uint64_t       position;    // next frame handed to the caller
+
+    unsigned char* raw;         // blocks read ahead
+    size_t         rawBlocks;   // room in raw
+    uint64_t       rawFirst;    // index of the first block in raw
+    size_t         rawCount;
+
+    int16_t*       pcm;         // the block being handed out in pieces
+    uint64_t       pcmBlock;    // its index, UINT64_MAX if none
+
+} WAVE_ADPCM_STREAM;
+
+static const int16_t waveImaSteps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41,
+    45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190,
+    209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499,
+    2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845,
+    8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385,
+    24623, 27086, 29794, 32767
+};
+
+static const int8_t waveImaIndex[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int16_t waveMsAdapt[16] = {
+    230, 230, 230, 230, 307, 409, 512, 614,
+    768, 614, 512, 409, 307, 230, 230, 230
+};
+
+// the 7 predictors every Microsoft ADPCM file starts with
+static const int16_t waveMsCoef[7][2] = {
+    {256, 0}, {512, -256}, {0, 0}, {192, 64}, {240, 0}, {460, -208},
+    {392, -232}
+};
+
+static int16_t
+waveAdpcmClamp(int v)
+{
+    return (int16_t) (v < -32768 ? -32768 : v > 32767 ? 32767 : v);
+}
+
+/*
+ * Frames held by a block of size bytes, the last one of a file may be
+ * short
+ */
+static size_t
+waveAdpcmBlockFrames(const WAVE_ADPCM* adpcm, size_t size)
+{
+    size_t ch = adpcm->nChannels;
+    size_t frames;
+
+    if (adpcm->formatTag == WAVE_FORMAT_IMA_ADPCM) {
+        if (size < 4 * ch)
+            return 0;
+        frames = (size - 4 * ch) / (4 * ch) * 8 + 1;
+    } else {
+        if (size < 7 * ch)
+            return 0;
+        frames = (size - 7 * ch) * 2 / ch + 2;
+    }
+
+    return frames < adpcm->samplesPerBlock ? frames : adpcm->samplesPerBlock;
+}
+
+/*
+ * Frames in a data chunk of dataSize bytes
+ */
+static uint64_t
+waveAdpcmFrames(const WAVE_ADPCM* adpcm, uint64_t dataSize)
+{
+    uint64_t blocks = dataSize / adpcm->nBlockAlign;
+    size_t   rest   = (size_t) (dataSize % adpcm->nBlockAlign);
+
+    return blocks * adpcm->samplesPerBlock + waveAdpcmBlockFrames(adpcm, rest);
+}
+
+/**
+ * @brief Fill a WAVE_ADPCM for encoding
+ * @param adpcm Pointer to the WAVE_ADPCM to fill
+ * @param formatTag WAVE_FORMAT_IMA_ADPCM or WAVE_FORMAT_ADPCM
+ * @param nChannels Number of channels
+ * @param nSamplesPerSec Sample rate
+ * @param nBlockAlign Bytes per block, 0 for 256 per channel and per 11025 Hz
+ * @return 0 on success, -1 if the block size does not suit the format
+ */
+int
+waveAdpcmInit(
+        WAVE_ADPCM* adpcm,
+        uint16_t    formatTag,
+        uint16_t    nChannels,
+        uint32_t    nSamplesPerSec,
+        uint16_t    nBlockAlign)
+{
+    int      ima = formatTag == WAVE_FORMAT_IMA_ADPCM;
+    uint32_t ch  = nChannels;
+
+    memset(adpcm, 0, sizeof(WAVE_ADPCM));
+
+    if (nChannels == 0 || nChannels > 256 ||
+        (!ima && formatTag != WAVE_FORMAT_ADPCM))
+        return -1;
+
+    if (nBlockAlign == 0) {
+        uint32_t scale = nSamplesPerSec / 11025 ? nSamplesPerSec / 11025 : 1;
+        uint32_t size  = 256 * ch * scale;
+        while (size > 0xFFFF && scale > 1)
+            size = 256 * ch * --scale;
+        if (size > 0xFFFF)
+            return -1;
+        nBlockAlign = (uint16_t) size;
+    }
+
+    // IMA groups 8 samples of a channel in 4 bytes, MS interleaves nibbles
+    if (ima && (nBlockAlign <= 4 * ch || nBlockAlign % (4 * ch) != 0))
+        return -1;
+    if (!ima && (nBlockAlign <= 7 * ch || (2 * nBlockAlign) % ch != 0))
+        return -1;
+
+    adpcm->formatTag       = formatTag;
+    adpcm->nChannels       = nChannels;
+    adpcm->nSamplesPerSec  = nSamplesPerSec;
+    adpcm->nBlockAlign     = nBlockAlign;
+    adpcm->samplesPerBlock = 0xFFFF;
+
+    // wSamplesPerBlock is 16-bit too
+    size_t frames = waveAdpcmBlockFrames(adpcm, nBlockAlign);
+    if (frames > 0xFFFF)
+        return -1;
+    adpcm->samplesPerBlock = (uint16_t) frames;
+
+    if (!ima) {
+        adpcm->numCoef = 7;
+        memcpy(adpcm->coef, waveMsCoef, sizeof(waveMsCoef));
+    }
+
+    return 0;
+}
+
+/*
+ * Fill a WAVE_ADPCM from a whole "fmt " chunk body
+ */
+static WAVE_ERROR
+waveAdpcmParseFmt(const unsigned char* body, size_t size, WAVE_ADPCM* adpcm)
+{
+    memset(adpcm, 0, sizeof(WAVE_ADPCM));
+
+    if (size < 20 || waveGet16(body + 16) < 2)
+        return WAVE_ERROR_FORMAT;
+
+    uint16_t code = waveGet16(body);
+
+    adpcm->formatTag      = code;
+    adpcm->nChannels      = waveGet16(body + 2);
+    adpcm->nSamplesPerSec = waveGet32(body + 4);
+    adpcm->nBlockAlign    = waveGet16(body + 12);
+
+    // 3-bit IMA, extensible and other variants are not handled
+    if ((code != WAVE_FORMAT_IMA_ADPCM && code != WAVE_FORMAT_ADPCM) ||
+        waveGet16(body + 14) != 4)
+        return WAVE_ERROR_UNSUPPORTED;
+
+    if (adpcm->nChannels == 0)
+        return WAVE_ERROR_FORMAT;
+
+    // trust the block size over wSamplesPerBlock
+    adpcm->samplesPerBlock = 0xFFFF;
+    size_t frames = waveAdpcmBlockFrames(adpcm, adpcm->nBlockAlign);
+    size_t wanted = waveGet16(body + 18);
+
+    if (frames == 0 || adpcm->nChannels > 256)
+        return WAVE_ERROR_FORMAT;
+
+    if (wanted > 0 && wanted < frames)
+        frames = wanted;
+    adpcm->samplesPerBlock = (uint16_t) (frames > 0xFFFF ? 0xFFFF : frames);
+
+    if (code == WAVE_FORMAT_ADPCM) {
+
+        size_t i, count = size >= 22 ? waveGet16(body + 20) : 0;
+
+        if (count == 0 || count > WAVE_ADPCM_MAX_COEF || size < 22 + 4 * count)
+            return WAVE_ERROR_FORMAT;
+
+        adpcm->numCoef = (uint16_t) count;
+        for (i = 0; i < count; i++) {
+            adpcm->coef[i][0] = (int16_t) waveGet16(body + 22 + 4 * i);
+            adpcm->coef[i][1] = (int16_t) waveGet16(body + 24 + 4 * i);
+        }
+    }
+
+    return WAVE_OK;
+}
+
+/*
+ * The bits of the nibble select the parts of the step with masks rather
+ * than branches, which noise-like signals would mispredict half the time
+ */
+static int16_t
+waveImaNibble(int* predictor, int* index, int nibble)
+{
+    int step = waveImaSteps[*index];
+    int sign = -(nibble >> 3);
+    int diff = (step >> 3) + (step & -((nibble >> 2) & 1)) +
+               ((step >> 1) & -((nibble >> 1) & 1)) +
+               ((step >> 2) & -(nibble & 1));
+
+    *predictor = waveAdpcmClamp(*predictor + ((diff ^ sign) - sign));
+
+    *index += waveImaIndex[nibble];
+    *index  = *index < 0 ? 0 : *index > 88 ? 88 : *index;
+
+    return (int16_t) *predictor;
+}
+
+static int16_t
+waveMsNibble(int* sample1, int* sample2, int* delta, const int16_t* coef,
+             int nibble)
+{
+    int64_t p = (int64_t) *sample1 * coef[0] + (int64_t) *sample2 * coef[1];
+    int     v = waveAdpcmClamp((int) (p >> 8) +
+                               ((nibble ^ 8) - 8) * *delta);
+
+    *sample2 = *sample1;
+    *sample1 = v;
+
+    // a corrupt block must not overflow the step
+    *delta = (waveMsAdapt[nibble] * *delta) >> 8;
+    if (*delta < 16)
+        *delta = 16;
+    if (*delta > 0x7FFFFFFF / 768)
+        *delta = 0x7FFFFFFF / 768;
+
+    return (int16_t) v;
+}
+
+/*
+ * An IMA block is the predictor and step index of each channel, then for
+ * each group of 8 frames 4 bytes per channel, low nibble first
+ */
+static size_t
+waveImaDecode(const WAVE_ADPCM* adpcm, const unsigned char* in,
+              size_t frames, int16_t* out)
+{
+    int    predictor[256], index[256];
+    size_t ch = adpcm->nChannels;
+    size_t c, f, k;
+
+    for (c = 0; c < ch; c++) {
+        predictor[c] = (int16_t) waveGet16(in + 4 * c);
+        index[c]     = in[4 * c + 2] > 88 ? 88 : in[4 * c + 2];
+        out[c]       = (int16_t) predictor[c];
+    }
+    in += 4 * ch;
+
+    for (f = 1; f < frames; f += 8, in += 4 * ch) {
+
+        size_t n = frames - f < 8 ? frames - f : 8;
+
+        // the channels in the inner loop, their predictions overlap
+        int16_t* o = out + f * ch;
+
+        for (k = 0; k < n; k++) {
+
+            const unsigned char* p     = in + (k >> 1);
+            int                  shift = (int) (k & 1) * 4;
+
+            for (c = 0; c < ch; c++, o++)
+                *o = waveImaNibble(&predictor[c], &index[c],
+                                   (p[4 * c] >> shift) & 15);
+        }
+    }
+
+    return frames;
+}
+
+/*
+ * A Microsoft ADPCM block is the predictor byte, the step and the last two
+ * samples of each channel, then the nibbles of the frames interleaved, high
+ * nibble first
+ */
+static size_t
+waveMsDecode(const WAVE_ADPCM* adpcm, const unsigned char* in,
+             size_t frames, int16_t* out)
+{
+    int            sample1[256], sample2[256], delta[256];
+    const int16_t* coef[256];
+    size_t         ch = adpcm->nChannels;
+    size_t         c, i;
+
+    for (c = 0; c < ch; c++) {
+
+        if (in[c] >= adpcm->numCoef)
+            return 0;
+
+        coef[c]    = adpcm->coef[in[c]];
+        delta[c]   = (int16_t) waveGet16(in + ch + 2 * c);
+        sample1[c] = (int16_t) waveGet16(in + 3 * ch + 2 * c);
+        sample2[c] = (int16_t) waveGet16(in + 5 * ch + 2 * c);
+
+        out[c] = (int16_t) sample2[c];
+        if (frames > 1)
+            out[ch + c] = (int16_t) sample1[c];
+    }
+    in += 7 * ch;
+
+    size_t samples = frames > 2 ? (frames - 2) * ch : 0;
+
+    for (i = 0, c = 0; i < samples; i++) {
+
+        int nibble = (in[i >> 1] >> (i & 1 ? 0 : 4)) & 15;
+
+        out[2 * ch + i] = waveMsNibble(&sample1[c], &sample2[c], &delta[c],
+                                       coef[c], nibble);
+        if (++c == ch)
+            c = 0;
+    }
+
+    return frames;
+}
+
+/**
+ * @brief Decode one block
+ * @param adpcm The parameters of the data chunk
+ * @param block The block, nBlockAlign bytes but for the last of a file
+ * @param size Size of the block
+ * @param frames Destination, room for count interleaved 16-bit frames
+ * @param count Most frames wanted, the fact chunk may end the last block
+ * early
+ * @return Number of frames decoded, 0 for a corrupt block
+ */
+size_t
+waveAdpcmDecodeBlock(const WAVE_ADPCM* adpcm, const void* block, size_t size,
+                     int16_t* frames, size_t count)
+{
+    size_t n = waveAdpcmBlockFrames(adpcm, size);
+
+    // the state arrays hold 256 channels
+    if (adpcm->nChannels > 256)
+        return 0;
+
+    if (n > count)
+        n = count;
+    if (n == 0)
+        return 0;
+
+    if (adpcm->formatTag == WAVE_FORMAT_IMA_ADPCM)
+        return waveImaDecode(adpcm, (const unsigned char*) block, n, frames);
+
+    return waveMsDecode(adpcm, (const unsigned char*) block, n, frames);
+}
+
+/*
+ * Sample k of channel c, the last frame repeated to fill a block
+ */
+static int
+waveAdpcmSample(const int16_t* frames, size_t count, size_t ch, size_t k,
+                size_t c)
+{
+    return frames[(k < count ? k : count - 1) * ch + c];
+}
+
+static void
+waveImaEncode(const WAVE_ADPCM* adpcm, const int16_t* frames, size_t count,
+              unsigned char* out)
+{
+    size_t ch     = adpcm->nChannels;
+    size_t blocks = adpcm->samplesPerBlock;
+    size_t c, k;
+
+    for (c = 0; c < ch; c++) {
+
+        int predictor = frames[c];
+        int index     = 0;
+        int diff      = 0;
+
+        // start from the step of the first moves, blocks stay independent
+        for (k = 1; k < 9 && k < count; k++)
+            diff += abs(waveAdpcmSample(frames, count, ch, k, c) -
+                        waveAdpcmSample(frames, count, ch, k - 1, c));
+        diff /= 8;
+        while (index < 88 && waveImaSteps[index] < diff)
+            index++;
+
+        wavePut16(out + 4 * c, (uint16_t) predictor);
+        out[4 * c + 2] = (unsigned char) index;
+        out[4 * c + 3] = 0;
+
+        for (k = 1; k < blocks; k++) {
+
+            int delta  = waveAdpcmSample(frames, count, ch, k, c) - predictor;
+            int step   = waveImaSteps[index];
+            int nibble = 0;
+
+            if (delta < 0) {
+                nibble = 8;
+                delta  = -delta;
+            }
+            if (delta >= step) { nibble |= 4; delta -= step; }
+            step >>= 1;
+            if (delta >= step) { nibble |= 2; delta -= step; }
+            step >>= 1;
+            if (delta >= step)   nibble |= 1;
+
+            waveImaNibble(&predictor, &index, nibble);
+
+            size_t j = k - 1;
+            out[4 * ch + j / 8 * 4 * ch + 4 * c + j % 8 / 2] |=
+                (unsigned char) (nibble << ((j & 1) * 4));
+        }
+    }
+}
+
+/*
+ * Encode channel c of a Microsoft ADPCM block with a predictor, writing the
+ * nibbles when out is not NULL. Returns the squared error.
+ */
+static uint64_t
+waveMsEncodeChannel(const WAVE_ADPCM* adpcm, const int16_t* frames,
+                    size_t count, size_t c, const int16_t* coef, int delta,
+                    unsigned char* out)
+{
+    size_t   ch      = adpcm->nChannels;
+    size_t   blocks  = adpcm->samplesPerBlock;
+    int      sample1 = waveAdpcmSample(frames, count, ch, 1, c);
+    int      sample2 = waveAdpcmSample(frames, count, ch, 0, c);
+    uint64_t error   = 0;
+    size_t   k;
+
+    for (k = 2; k < blocks; k++) {
+
+        int     x = waveAdpcmSample(frames, count, ch, k, c);
+        int64_t p = (int64_t) sample1 * coef[0] + (int64_t) sample2 * coef[1];
+        int     e = x - (int) (p >> 8);
+
+        // nearest step count
+        int n = e >= 0 ? (e + delta / 2) / delta : -((delta / 2 - e) / delta);
+        if (n < -8) n = -8;
+        if (n > 7)  n = 7;
+
+        int v = waveMsNibble(&sample1, &sample2, &delta, coef, n & 15);
+        error += (uint64_t) ((int64_t) (x - v) * (x - v));
+
+        if (out) {
+            size_t i = (k - 2) * ch + c;
+            out[7 * ch + i / 2] |= (unsigned char) ((n & 15) << (i & 1 ? 0 : 4));
+        }
+    }
+
+    return error;
+}
+
+static void
+waveMsEncode(const WAVE_ADPCM* adpcm, const int16_t* frames, size_t count,
+             unsigned char* out)
+{
+    size_t ch = adpcm->nChannels;
+    size_t c, i, k;
+
+    for (c = 0; c < ch; c++) {
+
+        // the first step from the first moves of the channel
+        int sum = 0;
+
+        for (k = 2; k < 6; k++)
+            sum += abs(waveAdpcmSample(frames, count, ch, k, c) -
+                       waveAdpcmSample(frames, count, ch, k - 1, c));
+
+        int delta = sum / 16 < 16 ? 16 : sum / 16;
+
+        // keep the predictor with the least error over the block
+        uint64_t best  = UINT64_MAX;
+        size_t   which = 0;
+
+        for (i = 0; i < adpcm->numCoef; i++) {
+            uint64_t error = waveMsEncodeChannel(adpcm, frames, count, c,
+                                                 adpcm->coef[i], delta, NULL);
+            if (error < best) {
+                best  = error;
+                which = i;
+            }
+        }
+
+        out[c] = (unsigned char) which;
+        wavePut16(out + ch + 2 * c, (uint16_t) delta);
+        wavePut16(out + 3 * ch + 2 * c,
+                  (uint16_t) waveAdpcmSample(frames, count, ch, 1, c));
+        wavePut16(out + 5 * ch + 2 * c,
+                  (uint16_t) waveAdpcmSample(frames, count, ch, 0, c));
+
+        waveMsEncodeChannel(adpcm, frames, count, c, adpcm->coef[which], delta,
+                            out);
+    }
+}
+
+/**
+ * @brief Encode one block
+ *
+ * A block holds samplesPerBlock frames, a shorter count is padded with the
+ * last frame. Each block starts from its own first frames, so the blocks
+ * of a file encode in any order.
+ *
+ * @param adpcm The parameters from waveAdpcmInit
+ * @param frames Interleaved 16-bit frames
+ * @param count Number of frames, 1 to samplesPerBlock
+ * @param block Destination, nBlockAlign bytes
+ * @return nBlockAlign, 0 if count is out of range
+ */
+size_t
+waveAdpcmEncodeBlock(const WAVE_ADPCM* adpcm, const int16_t* frames,
+                     size_t count, void* block)
+{
+    if (count == 0 || count > adpcm->samplesPerBlock || adpcm->nChannels > 256)
+        return 0;
+
+    memset(block, 0, adpcm->nBlockAlign);
+
+    if (adpcm->formatTag == WAVE_FORMAT_IMA_ADPCM)
+        waveImaEncode(adpcm, frames, count, (unsigned char*) block);
+    else
+        waveMsEncode(adpcm, frames, count, (unsigned char*) block);
+
+    return adpcm->nBlockAlign;
+}
+
+/*
+ * A range of blocks for one thread
+ */
+typedef struct wave_adpcm_job_t {
+
+    const WAVE_ADPCM* adpcm;
+    unsigned char*    blocks;
+    uint64_t          size;     // bytes of blocks
+    int16_t*          frames;
+    uint64_t          count;    // frames
+    uint64_t          first;
+    uint64_t          last;
+    int               encode;
+    int               failed;
+
+} WAVE_ADPCM_JOB;
+
+static void
+waveAdpcmWork(void* arg)
+{
+    WAVE_ADPCM_JOB*   job   = (WAVE_ADPCM_JOB*) arg;
+    const WAVE_ADPCM* adpcm = job->adpcm;
+    size_t            ch    = adpcm->nChannels;
+    size_t            spb   = adpcm->samplesPerBlock;
+    uint64_t          b;
+
+    for (b = job->first; b < job->last; b++) {
+
+        uint64_t       offset = b * adpcm->nBlockAlign;
+        uint64_t       base   = b * spb;
+        unsigned char* block  = job->blocks + offset;
+        int16_t*       frames = job->frames + base * ch;
+        size_t         n      = job->count - base < spb ?
+                                (size_t) (job->count - base) : spb;
+
+        if (job->encode) {
+            waveAdpcmEncodeBlock(adpcm, frames, n, block);
+            continue;
+        }
+
+        size_t size = job->size - offset < adpcm->nBlockAlign ?
+                      (size_t) (job->size - offset) : adpcm->nBlockAlign;
+
+        if (waveAdpcmDecodeBlock(adpcm, block, size, frames, n) != n)
+            job->failed = 1;
+    }
+}
+
+/*
+ * Run the blocks holding count frames over up to threads threads, 0 for one
+ * per processor. The calling thread takes the first range.
+ */
+static int
+waveAdpcmRun(const WAVE_ADPCM* adpcm, unsigned char* blocks, uint64_t size,
+             int16_t* frames, uint64_t count, int encode, int threads)
+{
+    WAVE_ADPCM_JOB jobs[WAVE_ADPCM_MAX_THREADS];
+    WAVE_THREAD    ids[WAVE_ADPCM_MAX_THREADS];
+    int            started[WAVE_ADPCM_MAX_THREADS];
+    uint64_t       blockCount = (count + adpcm->samplesPerBlock - 1) /
+                                adpcm->samplesPerBlock;
+    uint64_t       most = (blockCount + WAVE_ADPCM_JOB_BLOCKS - 1) /
+                          WAVE_ADPCM_JOB_BLOCKS;
+    int            t, failed = 0;
+
+    if (threads <= 0)
+        threads = waveCpuCount();
+    if (threads > WAVE_ADPCM_MAX_THREADS)
+        threads = WAVE_ADPCM_MAX_THREADS;
+    if ((uint64_t) threads > most)
+        threads = most > 0 ? (int) most : 1;
+
+    for (t = 0; t < threads; t++) {
+        jobs[t].adpcm  = adpcm;
+        jobs[t].blocks = blocks;
+        jobs[t].size   = size;
+        jobs[t].frames = frames;
+        jobs[t].count  = count;
+        jobs[t].first  = blockCount * t / threads;
+        jobs[t].last   = blockCount * (t + 1) / threads;
+        jobs[t].encode = encode;
+        jobs[t].failed = 0;
+    }
+
+    for (t = 1; t < threads; t++)
+        started[t] = waveThreadCreate(&ids[t], waveAdpcmWork, &jobs[t]) == 0;
+
+    waveAdpcmWork(&jobs[0]);
+
+    // a range without a thread is done here
+    for (t = 1; t < threads; t++) {
+        if (started[t])
+            waveThreadJoin(ids[t]);
+        else
+            waveAdpcmWork(&jobs[t]);
+    }
+
+    for (t = 0; t < threads; t++)
+        failed |= jobs[t].failed;
+
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief Decode the blocks of a data chunk in memory
+ * @param adpcm The parameters of the data chunk
+ * @param data The blocks
+ * @param size Size of the blocks in bytes
+ * @param frames Destination, room for count interleaved 16-bit frames
+ * @param count Frames to decode, at most what size bytes hold
+ * @param threads Most threads to use, 0 for one per processor
+ * @return 0 on success, -1 for a corrupt block or a count too large
+ */
+int
+waveAdpcmDecode(const WAVE_ADPCM* adpcm, const void* data, uint64_t size,
+                int16_t* frames, uint64_t count, int threads)
+{
+    if (count > waveAdpcmFrames(adpcm, size))
+        return -1;
+
+    uint64_t start  = waveStageStart();
+    int      status = waveAdpcmRun(adpcm, (unsigned char*) data, size, frames,
+                                   count, 0, threads);
+
+    waveStageEnd(&waveStatsCounters.convertTime, start);
+
+    return status;
+}
+
+/**
+ * @brief Encode frames into blocks
+ * @param adpcm The parameters from waveAdpcmInit
+ * @param frames Interleaved 16-bit frames
+ * @param count Number of frames
+ * @param data Destination, room for count / samplesPerBlock rounded up
+ * blocks of nBlockAlign bytes
+ * @param threads Most threads to use, 0 for one per processor
+ * @return The size of the blocks in bytes
+ */
+uint64_t
+waveAdpcmEncode(const WAVE_ADPCM* adpcm, const int16_t* frames, uint64_t count,
+                void* data, int threads)
+{
+    uint64_t blocks = (count + adpcm->samplesPerBlock - 1) /
+                      adpcm->samplesPerBlock;
+    uint64_t start  = waveStageStart();
+
+    waveAdpcmRun(adpcm, (unsigned char*) data, blocks * adpcm->nBlockAlign,
+                 (int16_t*) frames, count, 1, threads);
+
+    waveStageEnd(&waveStatsCounters.convertTime, start);
+
+    return blocks * adpcm->nBlockAlign;
+}
+
+/*
+ * Parse the headers of an ADPCM file and read its whole fmt chunk. Returns
+ * the descriptor, or -1 once the error is reported.
+ */
+static int
+waveAdpcmOpenHead(
+        const char*    fileName,
+        unsigned char* head,
+        size_t         headMax,
+        WAVE_SOURCE*   source,
+        WAVE_ADPCM*    adpcm,
+        uint64_t*      dataOffset,
+        uint64_t*      dataSize,
+        uint64_t*      frames)
+{
+    WAVE_CHUNK_INDEX index;
+    FMT_CHUNK        fmt;
+    uint64_t         start = waveStageStart();
+    int              fd    = waveOpenFd(fileName);
+
+    waveStageEnd(&waveStatsCounters.openTime, start);
+
+    if (fd < 0) {
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return -1;
+    }
+
+    start = waveStageStart();
+
+    int64_t    headSize = waveReadFd(fd, head, headMax);
+    int64_t    fileSize = waveFdSize(fd);
+    WAVE_ERROR error    = WAVE_ERROR_READ;
+
+    source->fd       = fd;
+    source->head     = head;
+    source->headSize = headSize > 0 ? (size_t) headSize : 0;
+    source->fileSize = fileSize > 0 ? (uint64_t) fileSize : 0;
+
+    if (headSize >= 0 && fileSize >= 0)
+        error = waveParseSource(source, &index, &fmt, dataOffset, dataSize);
+
+    // the loaders of wave.h turn ADPCM down, PCM is theirs
+    if (error == WAVE_OK)
+        error = WAVE_ERROR_UNSUPPORTED;
+
+    if (error == WAVE_ERROR_UNSUPPORTED && !index.bigEndian) {
+
+        const WAVE_CHUNK* fmtChunk = waveFindChunk(&index, "fmt ");
+        const WAVE_CHUNK* fact     = waveFindChunk(&index, "fact");
+        unsigned char     body[22 + 4 * WAVE_ADPCM_MAX_COEF];
+        size_t            size     = fmtChunk->cksize < sizeof(body) ?
+                                     (size_t) fmtChunk->cksize : sizeof(body);
+
+        error = WAVE_ERROR_READ;
+        if (waveSourceRead(source, body, size, fmtChunk->offset) == 0)
+            error = waveAdpcmParseFmt(body, size, adpcm);
+
+        // without a fact chunk every block counts in full
+        if (error == WAVE_OK)
+            *frames = waveAdpcmFrames(adpcm, *dataSize);
+
+        if (error == WAVE_OK && fact && fact->cksize >= 4 &&
+            waveSourceRead(source, body, 4, fact->offset) == 0 &&
+            waveGet32(body) < *frames)
+            *frames = waveGet32(body);
+    }
+
+    waveStageEnd(&waveStatsCounters.parseTime, start);
+
+    if (error != WAVE_OK) {
+        waveError(error, fileName);
+        waveCloseFd(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * The decoded frames, as 16-bit PCM
+ */
+static void
+waveAdpcmFillInfo(const WAVE_ADPCM* adpcm, uint64_t frames, WAVE_INFO* info)
+{
+    memset(info, 0, sizeof(WAVE_INFO));
+
+    info->wFormatTag      = WAVE_FORMAT_PCM;
+    info->nChannels       = adpcm->nChannels;
+    info->nSamplesPerSec  = adpcm->nSamplesPerSec;
+    info->nBlockAlign     = (uint16_t) (2 * adpcm->nChannels);
+    info->nAvgBytesPerSec = adpcm->nSamplesPerSec * info->nBlockAlign;
+    info->wBitsPerSample  = 16;
+    info->dataSize        = frames * info->nBlockAlign;
+}
+
+/**
+ * @brief Load and decode an ADPCM wave file
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable, filled for the decoded 16-bit
+ * PCM frames
+ * @param adpcm Pointer to a WAVE_ADPCM variable for the parameters of the
+ * file, or NULL
+ * @param threads Most threads decoding the blocks, 0 for one per processor
+ * @return The frames, to release with waveFree, or NULL
+ */
+int16_t*
+waveLoadAdpcm(char* fileName, WAVE_INFO* info, WAVE_ADPCM* adpcm, int threads)
+{
+    unsigned char head[WAVE_HEAD_SIZE];
+    WAVE_SOURCE   source;
+    WAVE_ADPCM    params;
+    uint64_t      dataOffset, dataSize, frames;
+
+    int fd = waveAdpcmOpenHead(fileName, head, sizeof(head), &source, &params,
+                               &dataOffset, &dataSize, &frames);
+    if (fd < 0)
+        return NULL;
+
+    uint64_t       pcmSize = frames * 2 * params.nChannels;
+    unsigned char* blocks  = dataSize > (size_t) -1 ? NULL :
+                             (unsigned char*) malloc((size_t) dataSize + 1);
+    int16_t*       out     = pcmSize > (size_t) -1 ? NULL :
+                             (int16_t*) waveAlloc((size_t) pcmSize + 1);
+
+    if (!blocks || !out) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveCloseFd(fd);
+        free(blocks);
+        waveFree(out);
+        return NULL;
+    }
+
+    WAVE_ERROR error = WAVE_OK;
+
+    if (waveReadSpan(&source, blocks, (size_t) dataSize, dataOffset, 0) != 0)
+        error = WAVE_ERROR_READ;
+    else if (waveAdpcmDecode(&params, blocks, dataSize, out, frames,
+                             threads) != 0)
+        error = WAVE_ERROR_FORMAT;
+
+    waveCloseFd(fd);
+    free(blocks);
+
+    if (error != WAVE_OK) {
+        waveError(error, fileName);
+        waveFree(out);
+        return NULL;
+    }
+
+    waveAdpcmFillInfo(&params, frames, info);
+    if (adpcm)
+        *adpcm = params;
+
+    return out;
+}
+
+/**
+ * @brief Encode frames to an ADPCM wave file
+ * @param fileName The wave file name, truncated if it exists
+ * @param adpcm The parameters from waveAdpcmInit
+ * @param frames Interleaved 16-bit frames
+ * @param count Number of frames
+ * @param threads Most threads encoding the blocks, 0 for one per processor
+ * @return 0 on success, -1 on error
+ */
+int
+waveSaveAdpcm(char* fileName, const WAVE_ADPCM* adpcm, const int16_t* frames,
+              uint64_t count, int threads)
+{
+    int      ms      = adpcm->formatTag == WAVE_FORMAT_ADPCM;
+    uint32_t fmtSize = 20 + (ms ? 4 + 4 * adpcm->numCoef : 0);
+    uint64_t blocks  = (count + adpcm->samplesPerBlock - 1) /
+                       adpcm->samplesPerBlock;
+    uint64_t size    = blocks * adpcm->nBlockAlign;
+
+    // RIFF, fmt with its extension, fact, then the data header
+    unsigned char head[12 + 8 + 24 + 4 * WAVE_ADPCM_MAX_COEF + 12 + 8];
+    size_t        pos = 12 + 8 + fmtSize + 12 + 8;
+    uint32_t      i;
+
+    if (count == 0 || count > 0xFFFFFFFF || pos + size + 1 - 8 > 0xFFFFFFFF ||
+        size > (size_t) -2) {
+        waveError(WAVE_ERROR_FORMAT, fileName);
+        return -1;
+    }
+
+    unsigned char* data = (unsigned char*) malloc((size_t) size + 1);
+    if (!data) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        return -1;
+    }
+
+    waveAdpcmEncode(adpcm, frames, count, data, threads);
+
+    // the data chunk is word aligned
+    data[size] = 0;
+
+    memcpy(head, "RIFF", 4);
+    wavePut32(head + 4, (uint32_t) (pos + size + (size & 1) - 8));
+    memcpy(head + 8, "WAVE", 4);
+
+    memcpy(head + 12, "fmt ", 4);
+    wavePut32(head + 16, fmtSize);
+    wavePut16(head + 20, adpcm->formatTag);
+    wavePut16(head + 22, adpcm->nChannels);
+    wavePut32(head + 24, adpcm->nSamplesPerSec);
+    wavePut32(head + 28, (uint32_t) ((uint64_t) adpcm->nSamplesPerSec *
+                                     adpcm->nBlockAlign /
+                                     adpcm->samplesPerBlock));
+    wavePut16(head + 32, adpcm->nBlockAlign);
+    wavePut16(head + 34, 4);
+    wavePut16(head + 36, (uint16_t) (fmtSize - 18));
+    wavePut16(head + 38, adpcm->samplesPerBlock);
+
+    if (ms) {
+        wavePut16(head + 40, adpcm->numCoef);
+        for (i = 0; i < adpcm->numCoef; i++) {
+            wavePut16(head + 42 + 4 * i, (uint16_t) adpcm->coef[i][0]);
+            wavePut16(head + 44 + 4 * i, (uint16_t) adpcm->coef[i][1]);
+        }
+    }
+
+    unsigned char* p = head + 20 + fmtSize;
+    memcpy(p, "fact", 4);
+    wavePut32(p + 4, 4);
+    wavePut32(p + 8, (uint32_t) count);
+    memcpy(p + 12, "data", 4);
+    wavePut32(p + 16, (uint32_t) size);
+
+#ifdef _WIN32
+    int fd = _open(fileName, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                   _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+
+    int status = fd < 0 ? -1 : waveWriteAt(fd, head, pos, data,
+                                           (size_t) (size + (size & 1)), 0);
+
+    free(data);
+
+    if (fd >= 0)
+        waveCloseFd(fd);
+
+    if (status != 0) {
+        waveError(fd < 0 ? WAVE_ERROR_OPEN : WAVE_ERROR_WRITE, fileName);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Close an ADPCM stream
+ * @param stream A stream from waveAdpcmOpen, or NULL
+ */
+void
+waveAdpcmClose(WAVE_ADPCM_STREAM* stream)
+{
+    if (!stream)
+        return;
+
+    if (stream->fd >= 0)
+        waveCloseFd(stream->fd);
+
+    free(stream->raw);
+    free(stream->pcm);
+    free(stream);
+}
+
+/**
+ * @brief Open an ADPCM wave file for decoding frames in sequence
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable, filled for the decoded 16-bit
+ * PCM frames
+ * @param adpcm Pointer to a WAVE_ADPCM variable for the parameters of the
+ * file, or NULL
+ * @return The stream, to close with waveAdpcmClose, or NULL
+ */
+WAVE_ADPCM_STREAM*
+waveAdpcmOpen(char* fileName, WAVE_INFO* info, WAVE_ADPCM* adpcm)
+{
+    unsigned char head[WAVE_HEAD_SIZE];
+    WAVE_SOURCE   source;
+
+    WAVE_ADPCM_STREAM* stream =
+        (WAVE_ADPCM_STREAM*) calloc(1, sizeof(WAVE_ADPCM_STREAM));
+    if (!stream) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        return NULL;
+    }
+
+    stream->fd = waveAdpcmOpenHead(fileName, head, sizeof(head), &source,
+                                   &stream->adpcm, &stream->dataOffset,
+                                   &stream->dataSize, &stream->frames);
+    if (stream->fd < 0) {
+        free(stream);
+        return NULL;
+    }
+
+    // reads of about WAVE_STREAM_READ_SIZE, whole blocks
+    size_t align = stream->adpcm.nBlockAlign;
+
+    stream->rawBlocks = WAVE_STREAM_READ_SIZE / align ?
+                        WAVE_STREAM_READ_SIZE / align : 1;
+    stream->raw       = (unsigned char*) malloc(stream->rawBlocks * align);
+    stream->pcm       = (int16_t*) malloc((size_t) stream->adpcm.samplesPerBlock *
+                                          stream->adpcm.nChannels * 2);
+    stream->pcmBlock  = UINT64_MAX;
+
+    if (!stream->raw || !stream->pcm) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveAdpcmClose(stream);
+        return NULL;
+    }
+
+    waveAdpcmFillInfo(&stream->adpcm, stream->frames, info);
+    if (adpcm)
+        *adpcm = stream->adpcm;
+
+    return stream;
+}
+
+/*
+ * Decode a block of the stream, reading ahead when it is not in raw.
+ * Returns the frames decoded.
+ */
+static size_t
+waveAdpcmStreamBlock(WAVE_ADPCM_STREAM* stream, uint64_t block,
+                     int16_t* frames, size_t count)
+{
+    size_t   align  = stream->adpcm.nBlockAlign;
+    uint64_t offset = block * align;
+
+    if (block < stream->rawFirst || block >= stream->rawFirst + stream->rawCount) {
+
+        uint64_t left = stream->dataSize - offset;
+        size_t   size = stream->rawBlocks * align;
+        if (size > left)
+            size = (size_t) left;
+
+        stream->rawFirst = block;
+        stream->rawCount = 0;
+
+        if (waveReadFdAt(stream->fd, stream->raw, size,
+                         stream->dataOffset + offset) != 0) {
+            waveError(WAVE_ERROR_READ, NULL);
+            return 0;
+        }
+
+        stream->rawCount = (size + align - 1) / align;
+    }
+
+    size_t size = stream->dataSize - offset < align ?
+                  (size_t) (stream->dataSize - offset) : align;
+
+    size_t got = waveAdpcmDecodeBlock(&stream->adpcm,
+                                      stream->raw + (block - stream->rawFirst) * align,
+                                      size, frames, count);
+    if (got != count)
+        waveError(WAVE_ERROR_FORMAT, NULL);
+
+    return got;
+}
+
+/**
+ * @brief Decode the next frames of an ADPCM stream
+ * @param stream A stream from waveAdpcmOpen
+ * @param frames Destination, room for count interleaved 16-bit frames
+ * @param count Number of frames wanted
+ * @return The number of frames decoded, 0 at the end of the data
+ */
+size_t
+waveAdpcmRead(WAVE_ADPCM_STREAM* stream, int16_t* frames, size_t count)
+{
+    size_t   ch    = stream->adpcm.nChannels;
+    size_t   spb   = stream->adpcm.samplesPerBlock;
+    size_t   done  = 0;
+    uint64_t start = waveStageStart();
+
+    while (done < count && stream->position < stream->frames) {
+
+        uint64_t block = stream->position / spb;
+        size_t   skip  = (size_t) (stream->position % spb);
+        size_t   whole = stream->frames - block * spb < spb ?
+                         (size_t) (stream->frames - block * spb) : spb;
+        size_t   n     = whole - skip;
+
+        if (n > count - done)
+            n = count - done;
+
+        if (block != stream->pcmBlock) {
+
+            // whole blocks go straight to the caller buffer
+            if (skip == 0 && n == whole) {
+                if (waveAdpcmStreamBlock(stream, block, frames + done * ch,
+                                         n) != n)
+                    break;
+                stream->position += n;
+                done             += n;
+                continue;
+            }
+
+            stream->pcmBlock = UINT64_MAX;
+            if (waveAdpcmStreamBlock(stream, block, stream->pcm, whole) != whole)
+                break;
+            stream->pcmBlock = block;
+        }
+
+        memcpy(frames + done * ch, stream->pcm + skip * ch, n * ch * 2);
+        stream->position += n;
+        done             += n;
+    }
+
+    waveStageEnd(&waveStatsCounters.convertTime, start);
+
+    return done;
+}
+
+/**
+ * @brief Move an ADPCM stream to a frame
+ *
+ * Only the block holding the frame is decoded, by the next read.
+ *
+ * @param stream A stream from waveAdpcmOpen
+ * @param frame Index of the frame, clamped to the end of the data
+ * @return 0
+ */
+int
+waveAdpcmSeek(WAVE_ADPCM_STREAM* stream, uint64_t frame)
+{
+    stream->position = frame < stream->frames ? frame : stream->frames;
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,755 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave_batch.h
+ *
+ * Load many wave files at once. The headers of every file are read first,
+ * then all the data chunks, concurrently, so the load time of a large set of
+ * short files depends on the disk bandwidth rather than on the latency of
+ * each file.
+ *
+ * Two backends: a pool of threads doing blocking reads, and on Linux an
+ * io_uring instance keeping up to WAVE_BATCH_DEPTH reads in flight from a
+ * single thread.
+ */
+
+#ifndef WAVE_BATCH_H
+#define WAVE_BATCH_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define WAVE_HAVE_URING
+#endif
+#endif
+
+#ifdef WAVE_HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup            425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter            426
+#endif
+#endif
+
+/*
+ * waveBatchLoad backends
+ */
+#define WAVE_BATCH_AUTO                0    // io_uring if available, else threads
+#define WAVE_BATCH_THREADS             1
+#define WAVE_BATCH_URING               2
+
+/*
+ * Reads kept in flight by the io_uring backend
+ */
+#define WAVE_BATCH_DEPTH               64
+
+/*
+ * Alignment of the data of each file in the batch pool
+ */
+#define WAVE_BATCH_ALIGN               64
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * @brief A file of a batch
+ */
+typedef struct wave_batch_item_t {
+
+    char*     fileName;     // set by the caller
+    void*     buffer;       // optional destination, set by the caller
+    size_t    bufferSize;
+
+    WAVE_INFO info;         // filled by waveBatchLoad
+    void*     data;         // the frames, in buffer or in the batch pool
+    int       status;       // 0 when loaded, -1 otherwise
+
+} WAVE_BATCH_ITEM;
+
+/*
+ * Progress of one file during a load. A file is only open while a read of
+ * it is running: from its open to its parsed headers, then again for its
+ * data, so a batch holds at most one descriptor per worker or read in
+ * flight whatever its number of files.
+ */
+typedef struct wave_batch_job_t {
+
+    int            fd;          // -1 when no read is running
+    int            pending;     // headers parsed, data still to read
+    size_t         headSize;
+    uint64_t       dataOffset;
+    uint64_t       done;        // data bytes in place
+    unsigned char* dest;
+    int            swap;        // bytes per sample to reverse, see waveSwapBytes
+
+} WAVE_BATCH_JOB;
+
+/**
+ * @brief A set of files loaded together
+ */
+typedef struct wave_batch_t {
+
+    WAVE_BATCH_ITEM* items;
+    size_t           count;
+    int              threads;   // thread backend workers, 0 for a default
+    int              backend;   // backend used by the last waveBatchLoad
+
+    unsigned char*   pool;      // data of the items without a buffer
+
+    // load state
+    WAVE_BATCH_JOB*  jobs;
+    unsigned char*   heads;     // WAVE_HEAD_SIZE bytes per item
+    volatile size_t  next;
+    int              phase;
+
+} WAVE_BATCH;
+
+static void
+waveBatchFinish(WAVE_BATCH* batch, size_t i, WAVE_ERROR error)
+{
+    WAVE_BATCH_JOB* job = &batch->jobs[i];
+
+    if (job->fd >= 0)
+        waveCloseFd(job->fd);
+    job->fd      = -1;
+    job->pending = 0;
+
+    if (error != WAVE_OK) {
+        waveError(error, batch->items[i].fileName);
+    } else {
+        if (job->swap)
+            waveSwapBytes(job->dest, (size_t) batch->items[i].info.dataSize,
+                          job->swap);
+
+        batch->items[i].data   = job->dest;
+        batch->items[i].status = 0;
+    }
+}
+
+static int
+waveBatchOpen(WAVE_BATCH* batch, size_t i)
+{
+    batch->jobs[i].fd = waveOpenFd(batch->items[i].fileName);
+
+    if (batch->jobs[i].fd < 0) {
+        waveBatchFinish(batch, i, WAVE_ERROR_OPEN);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Parse the headers of a file from its first headSize bytes
+ */
+static void
+waveBatchParse(WAVE_BATCH* batch, size_t i, int64_t headSize)
+{
+    WAVE_BATCH_JOB*  job      = &batch->jobs[i];
+    int64_t          fileSize = waveFdSize(job->fd);
+
+    WAVE_SOURCE      source;
+    WAVE_CHUNK_INDEX index;
+    FMT_CHUNK        fmt;
+    uint64_t         dataSize;
+
+    source.fd       = job->fd;
+    source.head     = batch->heads + i * WAVE_HEAD_SIZE;
+    source.headSize = headSize > 0 ? (size_t) headSize : 0;
+    source.fileSize = fileSize > 0 ? (uint64_t) fileSize : 0;
+
+    WAVE_ERROR error = WAVE_ERROR_READ;
+
+    if (headSize >= 0 && fileSize >= 0)
+        error = waveParseSource(&source, &index, &fmt, &job->dataOffset,
+                                &dataSize);
+
+    if (error != WAVE_OK) {
+        waveBatchFinish(batch, i, error);
+        return;
+    }
+
+    job->headSize = source.headSize;
+    job->swap     = waveSwapSize(&index, &fmt);
+
+    waveFillInfo(&fmt, &batch->items[i].info);
+    batch->items[i].info.dataSize = dataSize;
+
+    // opened again for the data
+    waveCloseFd(job->fd);
+    job->fd      = -1;
+    job->pending = 1;
+}
+
+/*
+ * Give every parsed file its destination, in the caller buffer or in the
+ * pool, and take the part of the data that came with the headers.
+ */
+static void
+waveBatchPlace(WAVE_BATCH* batch)
+{
+    size_t total = 0;
+    size_t i;
+
+    for (i = 0; i < batch->count; i++) {
+
+        WAVE_BATCH_ITEM* item = &batch->items[i];
+        uint64_t         size = item->info.dataSize;
+
+        if (!batch->jobs[i].pending)
+            continue;
+
+        if (size > (size_t) -1 - total - WAVE_BATCH_ALIGN ||
+            (item->buffer && item->bufferSize < size))
+        {
+            waveBatchFinish(batch, i, WAVE_ERROR_MEMORY);
+            continue;
+        }
+
+        if (!item->buffer)
+            total += ((size_t) size + WAVE_BATCH_ALIGN - 1) &
+                     ~(size_t) (WAVE_BATCH_ALIGN - 1);
+    }
+
+    if (total > 0)
+        batch->pool = (unsigned char*) waveAlignedAlloc(total, 4096);
+
+    size_t offset = 0;
+
+    for (i = 0; i < batch->count; i++) {
+
+        WAVE_BATCH_ITEM* item = &batch->items[i];
+        WAVE_BATCH_JOB*  job  = &batch->jobs[i];
+        size_t           size = (size_t) item->info.dataSize;
+
+        if (!job->pending)
+            continue;
+
+        if (item->buffer) {
+            job->dest = (unsigned char*) item->buffer;
+        } else if (batch->pool) {
+            job->dest = batch->pool + offset;
+            offset += (size + WAVE_BATCH_ALIGN - 1) &
+                      ~(size_t) (WAVE_BATCH_ALIGN - 1);
+        } else {
+            waveBatchFinish(batch, i, WAVE_ERROR_MEMORY);
+            continue;
+        }
+
+        // short files are all in the head
+        job->done = 0;
+        if (job->dataOffset < job->headSize) {
+            job->done = job->headSize - (size_t) job->dataOffset;
+            if (job->done > size)
+                job->done = size;
+            memcpy(job->dest,
+                   batch->heads + i * WAVE_HEAD_SIZE + job->dataOffset,
+                   (size_t) job->done);
+        }
+
+        if (job->done == size)
+            waveBatchFinish(batch, i, WAVE_OK);
+    }
+}
+
+/*
+ * Thread backend, the workers take the files in turn
+ */
+static void
+waveBatchWorker(void* arg)
+{
+    WAVE_BATCH* batch = (WAVE_BATCH*) arg;
+    size_t      i;
+
+    while ((i = waveAtomicFetchAdd(&batch->next, 1)) < batch->count) {
+
+        WAVE_BATCH_JOB* job = &batch->jobs[i];
+
+        if (batch->phase == 0) {
+
+            if (waveBatchOpen(batch, i) != 0)
+                continue;
+
+            waveBatchParse(batch, i, waveReadFd(job->fd,
+                           batch->heads + i * WAVE_HEAD_SIZE, WAVE_HEAD_SIZE));
+
+        } else if (job->pending && waveBatchOpen(batch, i) == 0) {
+
+            size_t size = (size_t) batch->items[i].info.dataSize;
+
+            waveBatchFinish(batch, i,
+                waveReadFdAt(job->fd, job->dest + job->done,
+                             size - (size_t) job->done,
+                             job->dataOffset + job->done) == 0 ?
+                WAVE_OK : WAVE_ERROR_READ);
+        }
+    }
+}
+
+static void
+waveBatchThreads(WAVE_BATCH* batch, int phase)
+{
+    WAVE_THREAD threads[64];
+    int         count = batch->threads;
+    int         started = 0;
+
+    if (count <= 0)
+        count = 4 * waveCpuCount();
+    if (count > 64)
+        count = 64;
+    if ((size_t) count > batch->count)
+        count = (int) batch->count;
+
+    batch->phase = phase;
+    batch->next  = 0;
+
+    // the calling thread is one of the workers
+    while (started < count - 1 &&
+           waveThreadCreate(&threads[started], waveBatchWorker, batch) == 0)
+        started++;
+
+    waveBatchWorker(batch);
+
+    while (started > 0)
+        waveThreadJoin(threads[--started]);
+}
+
+#ifdef WAVE_HAVE_URING
+
+typedef struct wave_uring_t {
+
+    int                  fd;
+    unsigned             entries;
+
+    unsigned*            sqHead;
+    unsigned*            sqTail;
+    unsigned*            sqMask;
+    unsigned*            sqArray;
+    struct io_uring_sqe* sqes;
+
+    unsigned*            cqHead;
+    unsigned*            cqTail;
+    unsigned*            cqMask;
+    struct io_uring_cqe* cqes;
+
+    void*                sqRing;
+    size_t               sqRingSize;
+    void*                cqRing;
+    size_t               cqRingSize;
+    size_t               sqesSize;
+
+} WAVE_URING;
+
+static void
+waveUringExit(WAVE_URING* ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing)
+        munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing)
+        munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+/*
+ * Set up an io_uring with raw system calls. Returns -1 when the kernel does
+ * not have it or does not allow it.
+ */
+static int
+waveUringInit(WAVE_URING* ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(WAVE_URING));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->entries    = p.sq_entries;
+    ring->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize   = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes   = (struct io_uring_sqe*)
+                   mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqRing == MAP_FAILED) ring->sqRing = NULL;
+    if (ring->cqRing == MAP_FAILED) ring->cqRing = NULL;
+    if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+
+    if (!ring->sqRing || !ring->cqRing || !ring->sqes) {
+        waveUringExit(ring);
+        return -1;
+    }
+
+    unsigned char* sq = (unsigned char*) ring->sqRing;
+    unsigned char* cq = (unsigned char*) ring->cqRing;
+
+    ring->sqHead  = (unsigned*) (sq + p.sq_off.head);
+    ring->sqTail  = (unsigned*) (sq + p.sq_off.tail);
+    ring->sqMask  = (unsigned*) (sq + p.sq_off.ring_mask);
+    ring->sqArray = (unsigned*) (sq + p.sq_off.array);
+    ring->cqHead  = (unsigned*) (cq + p.cq_off.head);
+    ring->cqTail  = (unsigned*) (cq + p.cq_off.tail);
+    ring->cqMask  = (unsigned*) (cq + p.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    return 0;
+}
+
+/*
+ * Queue a read, the caller keeps at most entries operations in flight
+ */
+static void
+waveUringRead(WAVE_URING* ring, int fd, void* buffer, size_t size,
+              uint64_t offset, uint64_t userData)
+{
+    unsigned             tail = *ring->sqTail;
+    unsigned             slot = tail & *ring->sqMask;
+    struct io_uring_sqe* sqe  = &ring->sqes[slot];
+
+    if (size > (1u << 30))
+        size = 1u << 30;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t) (uintptr_t) buffer;
+    sqe->len       = (uint32_t) size;
+    sqe->off       = offset;
+    sqe->user_data = userData;
+
+    ring->sqArray[slot] = slot;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Submit the queued reads and wait for at least one completion
+ */
+static int
+waveUringSubmit(WAVE_URING* ring, unsigned submit)
+{
+    while (syscall(__NR_io_uring_enter, ring->fd, submit, 1,
+                   IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+    {
+        if (errno != EINTR)
+            return -1;
+        submit = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * Queue the next read of a file. Kernels before 5.6 lack IORING_OP_READ and
+ * complete with -EINVAL, those files are read synchronously.
+ */
+static void
+waveBatchQueue(WAVE_BATCH* batch, WAVE_URING* ring, size_t i)
+{
+    WAVE_BATCH_JOB* job = &batch->jobs[i];
+
+    if (batch->phase == 0)
+        waveUringRead(ring, job->fd, batch->heads + i * WAVE_HEAD_SIZE,
+                      WAVE_HEAD_SIZE, 0, i);
+    else
+        waveUringRead(ring, job->fd, job->dest + job->done,
+                      (size_t) (batch->items[i].info.dataSize - job->done),
+                      job->dataOffset + job->done, i);
+}
+
+/*
+ * Handle a completion, returns 1 if another read of the file was queued
+ */
+static int
+waveBatchComplete(WAVE_BATCH* batch, WAVE_URING* ring, size_t i, int res)
+{
+    WAVE_BATCH_JOB* job  = &batch->jobs[i];
+    size_t          size = (size_t) batch->items[i].info.dataSize;
+
+    if (batch->phase == 0) {
+
+        // nothing was read yet, the file position is still 0
+        if (res == -EINVAL)
+            waveBatchParse(batch, i, waveReadFd(job->fd,
+                           batch->heads + i * WAVE_HEAD_SIZE, WAVE_HEAD_SIZE));
+        else
+            waveBatchParse(batch, i, res);
+
+        return 0;
+    }
+
+    if (res == -EINVAL) {
+        waveBatchFinish(batch, i,
+            waveReadFdAt(job->fd, job->dest + job->done,
+                         size - (size_t) job->done,
+                         job->dataOffset + job->done) == 0 ?
+                WAVE_OK : WAVE_ERROR_READ);
+        return 0;
+    }
+
+    if (res <= 0) {
+        waveBatchFinish(batch, i, WAVE_ERROR_READ);
+        return 0;
+    }
+
+    job->done += (unsigned) res;
+
+    if (job->done < size) {
+        waveBatchQueue(batch, ring, i);
+        return 1;
+    }
+
+    waveBatchFinish(batch, i, WAVE_OK);
+    return 0;
+}
+
+static void
+waveBatchUring(WAVE_BATCH* batch, WAVE_URING* ring, int phase)
+{
+    size_t   next     = 0;
+    unsigned queued   = 0;
+    unsigned inflight = 0;
+
+    batch->phase = phase;
+
+    for (;;) {
+
+        while (inflight + queued < ring->entries && next < batch->count) {
+
+            size_t i = next++;
+
+            if (phase == 1 && !batch->jobs[i].pending)
+                continue;
+            if (waveBatchOpen(batch, i) != 0)
+                continue;
+
+            waveBatchQueue(batch, ring, i);
+            queued++;
+        }
+
+        if (inflight + queued == 0)
+            break;
+
+        if (waveUringSubmit(ring, queued) != 0) {
+
+            // take back the reads the kernel did not consume, a later
+            // submit would run them on closed files, and do them here
+            unsigned head    = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+            unsigned tail    = *ring->sqTail;
+            unsigned pending = tail - head;
+
+            __atomic_store_n(ring->sqTail, head, __ATOMIC_RELEASE);
+            inflight += queued - pending;
+            queued    = 0;
+
+            for (; head != tail; head++) {
+                struct io_uring_sqe* sqe = &ring->sqes[head & *ring->sqMask];
+                waveBatchComplete(batch, ring, (size_t) sqe->user_data,
+                                  -EINVAL);
+            }
+
+            if (pending > 0)
+                continue;
+
+            // waiting failed, give up on the files in flight
+            size_t i;
+            for (i = 0; i < next; i++)
+                if (batch->jobs[i].fd >= 0)
+                    waveBatchFinish(batch, i, WAVE_ERROR_READ);
+            inflight = 0;
+            continue;
+        }
+
+        inflight += queued;
+        queued    = 0;
+
+        unsigned head = *ring->cqHead;
+
+        while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+            size_t               i   = (size_t) cqe->user_data;
+            int                  res = cqe->res;
+
+            head++;
+            inflight--;
+
+            queued += waveBatchComplete(batch, ring, i, res);
+        }
+
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+#endif // WAVE_HAVE_URING
+
+/**
+ * @brief Release a batch, and the pool holding the data of its items
+ * @param batch The batch, or NULL
+ */
+void
+waveBatchFree(WAVE_BATCH* batch)
+{
+    if (!batch)
+        return;
+
+    waveAlignedFree(batch->pool);
+    free(batch->items);
+    free(batch);
+}
+
+/**
+ * @brief Create a batch of files
+ *
+ * Set the fileName of each item, and optionally a buffer to receive its
+ * frames, then call waveBatchLoad.
+ *
+ * @param count Number of files
+ * @return The batch, to release with waveBatchFree, or NULL
+ */
+WAVE_BATCH*
+waveBatchCreate(size_t count)
+{
+    WAVE_BATCH* batch = (WAVE_BATCH*) calloc(1, sizeof(WAVE_BATCH));
+    if (!batch)
+        return NULL;
+
+    batch->items = (WAVE_BATCH_ITEM*) calloc(count ? count : 1,
+                                             sizeof(WAVE_BATCH_ITEM));
+    if (!batch->items) {
+        free(batch);
+        return NULL;
+    }
+
+    batch->count = count;
+
+    return batch;
+}
+
+/**
+ * @brief Load every file of a batch
+ *
+ * The data of the items without a buffer goes to a pool owned by the batch,
+ * valid until the next waveBatchLoad or waveBatchFree. Each item gets its
+ * own status.
+ *
+ * @param batch A batch from waveBatchCreate
+ * @param backend WAVE_BATCH_AUTO, WAVE_BATCH_THREADS or WAVE_BATCH_URING
+ * @return The number of files loaded, or -1 if the backend is not available
+ */
+int64_t
+waveBatchLoad(WAVE_BATCH* batch, int backend)
+{
+    size_t i;
+    int    used = WAVE_BATCH_THREADS;
+
+#ifdef WAVE_HAVE_URING
+    WAVE_URING ring;
+    if (backend != WAVE_BATCH_THREADS &&
+        waveUringInit(&ring, WAVE_BATCH_DEPTH) == 0)
+        used = WAVE_BATCH_URING;
+#endif
+
+    if (backend == WAVE_BATCH_URING && used != WAVE_BATCH_URING)
+        return -1;
+
+    waveAlignedFree(batch->pool);
+    batch->pool = NULL;
+
+    batch->jobs  = (WAVE_BATCH_JOB*) malloc(
+            (batch->count ? batch->count : 1) * sizeof(WAVE_BATCH_JOB));
+    batch->heads = (unsigned char*) malloc(
+            (batch->count ? batch->count : 1) * WAVE_HEAD_SIZE);
+
+    for (i = 0; i < batch->count; i++) {
+        batch->items[i].data   = NULL;
+        batch->items[i].status = -1;
+        if (batch->jobs) {
+            batch->jobs[i].fd      = -1;
+            batch->jobs[i].pending = 0;
+        }
+    }
+
+    if (batch->jobs && batch->heads) {
+
+#ifdef WAVE_HAVE_URING
+        if (used == WAVE_BATCH_URING) {
+            waveBatchUring(batch, &ring, 0);
+            waveBatchPlace(batch);
+            waveBatchUring(batch, &ring, 1);
+        }
+#endif
+        if (used == WAVE_BATCH_THREADS) {
+            waveBatchThreads(batch, 0);
+            waveBatchPlace(batch);
+            waveBatchThreads(batch, 1);
+        }
+    }
+
+#ifdef WAVE_HAVE_URING
+    if (used == WAVE_BATCH_URING)
+        waveUringExit(&ring);
+#endif
+
+    free(batch->jobs);
+    free(batch->heads);
+    batch->jobs    = NULL;
+    batch->heads   = NULL;
+    batch->backend = used;
+
+    int64_t loaded = 0;
+    for (i = 0; i < batch->count; i++)
+        if (batch->items[i].status == 0)
+            loaded++;
+
+    return loaded;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,568 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Throughput of the loaders on a synthetic corpus.
+ *
+ * wave_bench [--dir DIR] [--max-size SIZE] [--rounds N] [--cold] [--quick]
+ *            [--csv FILE] [--json FILE] [--clean]
+ *
+ * The corpus covers 8/16/24/32-bit PCM, 32/64-bit float and extensible
+ * files, 1 to 8 channels, from 64 KB to --max-size (16M by default, K, M
+ * and G suffixes). Files already there with the right size are reused.
+ * Each measure keeps the best of --rounds runs, with the page cache warm,
+ * and with --cold also after dropping the pages of the file (Linux only).
+ * The 16-bit files are also encoded to IMA and Microsoft ADPCM, and decoded
+ * on one thread (MB/s per core) and on all of them, counting the bytes of
+ * the decoded PCM to compare with their load.
+ * Results go to stdout and to wave_bench.csv / wave_bench.json.
+ */
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_float.h"
+#include "wave_write.h"
+#include "wave_adpcm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+typedef struct bench_format_t {
+    const char* name;
+    uint16_t    formatTag;
+    uint16_t    bits;
+    uint16_t    channels;
+    uint32_t    mask;
+} BENCH_FORMAT;
+
+static const BENCH_FORMAT formats[] = {
+    {"u8",     0x0001,  8, 2, 0},
+    {"s16",    0x0001, 16, 1, 0},
+    {"s16",    0x0001, 16, 2, 0},
+    {"s24",    0x0001, 24, 2, 0},
+    {"s32",    0x0001, 32, 2, 0},
+    {"f32",    0x0003, 32, 2, 0},
+    {"f64",    0x0003, 64, 2, 0},
+    {"s16ext", 0x0001, 16, 2, 0x3},
+    {"s24",    0x0001, 24, 6, 0x3f},
+    {"s16",    0x0001, 16, 8, 0x63f},
+};
+
+#define FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+static const uint64_t sizes[] = {
+    64 << 10, 1 << 20, 16 << 20, 256 << 20, (uint64_t) 1 << 30,
+    (uint64_t) 4 << 30
+};
+
+#define SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+typedef struct bench_result_t {
+    char     file[64];
+    char     test[16];
+    int      cold;
+    uint64_t bytes;
+    uint64_t frames;
+    double   seconds;
+} BENCH_RESULT;
+
+static BENCH_RESULT* results;
+static size_t        resultCount;
+static size_t        resultSize;
+
+// keeps the page walk of runMap from being optimized out
+static volatile unsigned char sink;
+
+static const char* levelNames[] = {
+    "scalar", "sse2", "ssse3", "avx2", "avx512"
+};
+
+
+static uint64_t
+parseSize(const char* text)
+{
+    char*    end;
+    uint64_t size = strtoull(text, &end, 10);
+
+    if (*end == 'K' || *end == 'k') size <<= 10;
+    if (*end == 'M' || *end == 'm') size <<= 20;
+    if (*end == 'G' || *end == 'g') size <<= 30;
+
+    return size;
+}
+
+static void
+sizeName(uint64_t size, char* name, size_t length)
+{
+    if (size >= (1 << 30))
+        snprintf(name, length, "%" PRIu64 "G", size >> 30);
+    else if (size >= (1 << 20))
+        snprintf(name, length, "%" PRIu64 "M", size >> 20);
+    else
+        snprintf(name, length, "%" PRIu64 "K", size >> 10);
+}
+
+/*
+ * Write a file of about dataSize bytes of noise, unless it is already there
+ */
+static int
+generate(char* path, const BENCH_FORMAT* format, uint64_t dataSize)
+{
+    WAVE_INFO    info;
+    WAVE_STREAM* existing = waveOpen(path, &info, 0);
+
+    FMT_CHUNK fmt;
+    waveMakeFmt(&fmt, format->formatTag, format->channels, 48000,
+                format->bits, format->mask);
+
+    uint64_t frames = dataSize / fmt.nBlockAlign;
+
+    if (existing) {
+        waveClose(existing);
+        if (info.dataSize == frames * fmt.nBlockAlign)
+            return 0;
+    }
+
+    WAVE_WRITER* writer = waveCreate(path, &fmt, 0, 0);
+    if (!writer)
+        return -1;
+
+    size_t         blockFrames = 4096;
+    size_t         samples     = blockFrames * format->channels;
+    unsigned char* block       = malloc(blockFrames * fmt.nBlockAlign);
+    uint32_t       seed        = 0x9e3779b9;
+    size_t         i;
+
+    for (i = 0; i < samples; i++) {
+
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+
+        // floats stay in [-1, 1)
+        if (format->formatTag == 0x0003 && format->bits == 32)
+            ((float*) block)[i] = (float) (int32_t) seed / 2147483648.0f;
+        else if (format->formatTag == 0x0003)
+            ((double*) block)[i] = (double) (int32_t) seed / 2147483648.0;
+        else
+            memcpy(block + i * (format->bits / 8), &seed, format->bits / 8);
+    }
+
+    uint64_t done = 0;
+    while (done < frames) {
+        size_t n = frames - done < blockFrames ? (size_t) (frames - done) : blockFrames;
+        if (waveWriteFrames(writer, block, n) != 0)
+            break;
+        done += n;
+    }
+
+    free(block);
+
+    return waveFinalize(writer) == 0 && done == frames ? 0 : -1;
+}
+
+/*
+ * Drop the cached pages of a file, returns -1 where it is not possible
+ */
+static int
+dropCache(const char* path)
+{
+#if defined(__linux__)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    fdatasync(fd);
+    int status = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    return status == 0 ? 0 : -1;
+#else
+    (void) path;
+    return -1;
+#endif
+}
+
+static void
+record(const char* file, const char* test, int cold, uint64_t bytes,
+       uint64_t frames, double seconds)
+{
+    if (resultCount == resultSize) {
+        resultSize = resultSize ? resultSize * 2 : 64;
+        results    = realloc(results, resultSize * sizeof(BENCH_RESULT));
+    }
+
+    BENCH_RESULT* r = &results[resultCount++];
+
+    snprintf(r->file, sizeof(r->file), "%s", file);
+    snprintf(r->test, sizeof(r->test), "%s", test);
+    r->cold    = cold;
+    r->bytes   = bytes;
+    r->frames  = frames;
+    r->seconds = seconds;
+
+    printf("%-28s %-8s %-4s %10.1f MB/s %12.0f frames/s\n",
+           file, test, cold ? "cold" : "warm",
+           seconds > 0 ? bytes / seconds / 1e6 : 0,
+           seconds > 0 ? frames / seconds : 0);
+}
+
+/*
+ * One round of each file measure, returns 0 on success
+ */
+static int
+runLoad(char* path)
+{
+    WAVE_INFO info;
+    void*     data = waveLoad(path, &info);
+    free(data);
+    return data ? 0 : -1;
+}
+
+static int
+runMap(char* path)
+{
+    WAVE_INFO     info;
+    WAVE_MAP      map;
+    unsigned char sum = 0;
+    uint64_t      i;
+
+    unsigned char* data = waveMap(path, &info, &map, WAVE_MAP_SEQUENTIAL);
+    if (!data)
+        return -1;
+
+    // touch every page
+    for (i = 0; i < info.dataSize; i += 4096)
+        sum ^= data[i];
+
+    waveUnmap(&map);
+    sink = sum;
+    return 0;
+}
+
+static int
+runStream(char* path)
+{
+    WAVE_INFO    info;
+    WAVE_STREAM* stream = waveOpen(path, &info, 0);
+    if (!stream)
+        return -1;
+
+    size_t frames = WAVE_STREAM_READ_SIZE / info.nBlockAlign;
+    void*  block  = malloc(frames * info.nBlockAlign);
+
+    while (waveReadFrames(stream, block, frames) > 0)
+        ;
+
+    free(block);
+    waveClose(stream);
+    return 0;
+}
+
+static int
+runFloat(char* path)
+{
+    WAVE_INFO info;
+    float*    data = waveLoadFloat(path, &info);
+    free(data);
+    return data ? 0 : -1;
+}
+
+static int
+runAdpcm(char* path)
+{
+    WAVE_INFO info;
+    int16_t*  data = waveLoadAdpcm(path, &info, NULL, 1);
+    free(data);
+    return data ? 0 : -1;
+}
+
+static int
+runAdpcmThreads(char* path)
+{
+    WAVE_INFO info;
+    int16_t*  data = waveLoadAdpcm(path, &info, NULL, 0);
+    free(data);
+    return data ? 0 : -1;
+}
+
+typedef int (*BENCH_RUN)(char* path);
+
+static void
+measure(char* path, const char* file, const char* test, BENCH_RUN run,
+        int rounds, int cold, const WAVE_INFO* info)
+{
+    double best = -1;
+    int    r;
+
+    for (r = 0; r < rounds; r++) {
+
+        if (cold && dropCache(path) != 0) {
+            printf("%s: can not drop the cached pages\n", file);
+            return;
+        }
+
+        uint64_t start = waveClock();
+        if (run(path) != 0)
+            return;
+        double seconds = (waveClock() - start) / 1e9;
+
+        if (best < 0 || seconds < best)
+            best = seconds;
+    }
+
+    record(file, test, cold, info->dataSize,
+           info->dataSize / info->nBlockAlign, best);
+}
+
+/*
+ * Encode a loaded 16-bit file to IMA and MS ADPCM, unless already there,
+ * and time the decoding loads
+ */
+static int
+benchAdpcm(const char* dir, const char* size, const int16_t* data,
+           const WAVE_INFO* info, int rounds, int cold, int clean)
+{
+    uint16_t    tags[2]  = {WAVE_FORMAT_IMA_ADPCM, WAVE_FORMAT_ADPCM};
+    const char* names[2] = {"ima", "ms"};
+    uint64_t    frames   = info->dataSize / info->nBlockAlign;
+    int         t, c;
+
+    for (t = 0; t < 2; t++) {
+
+        WAVE_ADPCM adpcm;
+        WAVE_PROBE probe;
+        char       file[64];
+        char       path[1024];
+
+        snprintf(file, sizeof(file), "%s_%dch_%s.wav",
+                 names[t], info->nChannels, size);
+        snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+        if (waveAdpcmInit(&adpcm, tags[t], info->nChannels,
+                          info->nSamplesPerSec, 0) != 0)
+            return -1;
+
+        if ((waveProbe(path, &probe) != 0 || probe.frames != frames ||
+             probe.info.wFormatTag != tags[t]) &&
+            waveSaveAdpcm(path, &adpcm, data, frames, 0) != 0)
+            return -1;
+
+        for (c = 0; c <= cold; c++) {
+            measure(path, file, "adpcm",    runAdpcm,        rounds, c, info);
+            measure(path, file, "adpcm-mt", runAdpcmThreads, rounds, c, info);
+        }
+
+        if (clean)
+            remove(path);
+    }
+
+    return 0;
+}
+
+static int
+writeResults(const char* csvName, const char* jsonName, int rounds)
+{
+    FILE*  csv  = fopen(csvName, "w");
+    FILE*  json = fopen(jsonName, "w");
+    size_t i;
+
+    if (!csv || !json) {
+        if (csv) fclose(csv);
+        if (json) fclose(json);
+        return -1;
+    }
+
+    fprintf(csv, "file,test,cache,bytes,frames,seconds,mb_per_s,frames_per_s\n");
+    fprintf(json, "{\n  \"simd\": \"%s\",\n  \"rounds\": %d,\n  \"results\": [\n",
+            levelNames[waveSimdLevel()], rounds);
+
+    for (i = 0; i < resultCount; i++) {
+
+        const BENCH_RESULT* r = &results[i];
+        double mbs = r->seconds > 0 ? r->bytes / r->seconds / 1e6 : 0;
+        double fps = r->seconds > 0 ? r->frames / r->seconds : 0;
+
+        fprintf(csv, "%s,%s,%s,%" PRIu64 ",%" PRIu64 ",%.9f,%.3f,%.1f\n",
+                r->file, r->test, r->cold ? "cold" : "warm",
+                r->bytes, r->frames, r->seconds, mbs, fps);
+
+        fprintf(json,
+                "    {\"file\": \"%s\", \"test\": \"%s\", \"cache\": \"%s\", "
+                "\"bytes\": %" PRIu64 ", \"frames\": %" PRIu64 ", "
+                "\"seconds\": %.9f, \"mb_per_s\": %.3f, \"frames_per_s\": %.1f}%s\n",
+                r->file, r->test, r->cold ? "cold" : "warm",
+                r->bytes, r->frames, r->seconds, mbs, fps,
+                i + 1 < resultCount ? "," : "");
+    }
+
+    fprintf(json, "  ]\n}\n");
+
+    fclose(csv);
+    fclose(json);
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    const char* dir      = "wave_bench_corpus";
+    const char* csvName  = "wave_bench.csv";
+    const char* jsonName = "wave_bench.json";
+    uint64_t    maxSize  = 16 << 20;
+    int         rounds   = 3;
+    int         cold     = 0;
+    int         clean    = 0;
+    int         status   = 0;
+    int         i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc)
+            maxSize = parseSize(argv[++i]);
+        else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+            csvName = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            jsonName = argv[++i];
+        else if (strcmp(argv[i], "--cold") == 0)
+            cold = 1;
+        else if (strcmp(argv[i], "--clean") == 0)
+            clean = 1;
+        else if (strcmp(argv[i], "--quick") == 0) {
+            maxSize = 64 << 10;
+            rounds  = 1;
+        } else {
+            printf("usage: %s [--dir DIR] [--max-size SIZE] [--rounds N] "
+                   "[--cold] [--quick] [--csv FILE] [--json FILE] [--clean]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
+    if (rounds < 1)
+        rounds = 1;
+
+    mkdir(dir, 0755);
+
+    printf("SIMD level: %s, %d cores\n", levelNames[waveSimdLevel()],
+           waveCpuCount());
+
+    size_t f, s;
+    for (s = 0; s < SIZES && sizes[s] <= maxSize; s++) {
+        for (f = 0; f < FORMATS; f++) {
+
+            const BENCH_FORMAT* format = &formats[f];
+            char                file[64];
+            char                path[1024];
+            char                size[16];
+
+            sizeName(sizes[s], size, sizeof(size));
+            snprintf(file, sizeof(file), "%s_%dch_%s.wav",
+                     format->name, format->channels, size);
+            snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+            if (generate(path, format, sizes[s]) != 0) {
+                printf("%s: can not write the file\n", path);
+                status = 1;
+                continue;
+            }
+
+            WAVE_INFO    info;
+            WAVE_STREAM* stream = waveOpen(path, &info, 0);
+            if (!stream) {
+                status = 1;
+                continue;
+            }
+            waveClose(stream);
+
+            int c;
+            for (c = 0; c <= cold; c++) {
+                measure(path, file, "load",   runLoad,   rounds, c, &info);
+                measure(path, file, "map",    runMap,    rounds, c, &info);
+                measure(path, file, "stream", runStream, rounds, c, &info);
+                measure(path, file, "float",  runFloat,  rounds, c, &info);
+            }
+
+            // conversion alone, from memory
+            WAVE_INFO loaded;
+            void*     data   = waveLoad(path, &loaded);
+            int       sample = waveSampleFormat(&loaded);
+            size_t    count  = (size_t) loaded.dataSize / waveSampleSize(sample);
+            float*    out    = malloc(count * sizeof(float) + 1);
+
+            if (data && out) {
+
+                double best = -1;
+                int    r;
+                for (r = 0; r < rounds; r++) {
+                    uint64_t start = waveClock();
+                    waveToFloat(data, sample, out, count);
+                    double seconds = (waveClock() - start) / 1e9;
+                    if (best < 0 || seconds < best)
+                        best = seconds;
+                }
+
+                record(file, "convert", 0, loaded.dataSize,
+                       loaded.dataSize / loaded.nBlockAlign, best);
+            }
+
+            if (data && format->formatTag == 0x0001 && format->bits == 16 &&
+                !format->mask &&
+                benchAdpcm(dir, size, data, &loaded, rounds, cold, clean) != 0)
+            {
+                printf("%s: can not encode to ADPCM\n", file);
+                status = 1;
+            }
+
+            free(out);
+            free(data);
+
+            if (clean)
+                remove(path);
+        }
+    }
+
+    if (writeResults(csvName, jsonName, rounds) != 0) {
+        printf("can not write %s or %s\n", csvName, jsonName);
+        status = 1;
+    }
+
+    free(results);
+
+    return status;
+}
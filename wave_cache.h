@@ -0,0 +1,519 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave_cache.h
+ *
+ * A cache of loaded files shared by the threads of a process: one copy of
+ * each file, handed out as reference counted read-only assets, evicted least
+ * recently used first once over a byte budget.
+ */
+
+#ifndef WAVE_CACHE_H
+#define WAVE_CACHE_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_thread.h"
+#include "wave_float.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * What an asset holds
+ */
+#define WAVE_CACHE_RAW                 0    // the data chunk, see waveLoad
+#define WAVE_CACHE_FLOAT               1    // float32 frames, see waveLoadFloat
+
+/*
+ * Cache flags
+ */
+#define WAVE_CACHE_TRUST               0x1  // hits do not check the file
+
+/*
+ * Independently locked parts of the cache, and hash buckets of each
+ */
+#define WAVE_CACHE_SHARDS              16
+#define WAVE_CACHE_BUCKETS             256
+
+/**
+ * @brief A cached file, read-only, see waveCacheGet
+ */
+typedef struct wave_asset_t {
+
+    const void*  data;
+    size_t       bytes;
+    WAVE_INFO    info;
+    int          kind;          // WAVE_CACHE_RAW or WAVE_CACHE_FLOAT
+
+    // owned by the cache
+    char*                path;
+    uint64_t             hash;
+    uint64_t             fileSize;
+    int64_t              fileTime;
+    size_t               refs;
+    int                  listed;    // still in the table, else freed once
+                                    // the last reference is released
+    int                  shard;
+    struct wave_asset_t* next;      // bucket chain
+    struct wave_asset_t* newer;     // LRU list, most recent first
+    struct wave_asset_t* older;
+
+} WAVE_ASSET;
+
+/**
+ * @brief Counters of a cache, see waveCacheStats
+ */
+typedef struct wave_cache_stats_t {
+
+    uint64_t hits;
+    uint64_t misses;        // loads
+    uint64_t evictions;
+    uint64_t stale;         // entries dropped because the file changed
+    uint64_t bytes;         // held now, assets in use included
+    uint64_t assets;
+
+} WAVE_CACHE_STATS;
+
+typedef struct wave_cache_shard_t {
+
+    WAVE_MUTEX   lock;
+    WAVE_ASSET*  buckets[WAVE_CACHE_BUCKETS];
+    WAVE_ASSET*  newest;
+    WAVE_ASSET*  oldest;
+    size_t       bytes;
+    size_t       assets;
+
+    // hot counters of different shards on different lines
+    char         pad[64];
+
+} WAVE_CACHE_SHARD;
+
+/**
+ * @brief A cache, see waveCacheCreate
+ */
+typedef struct wave_cache_t {
+
+    size_t           budget;
+    int              flags;
+    volatile size_t  bytes;     // of all the shards
+
+    uint64_t         hits;
+    uint64_t         misses;
+    uint64_t         evictions;
+    uint64_t         stale;
+
+    WAVE_CACHE_SHARD shards[WAVE_CACHE_SHARDS];
+
+} WAVE_CACHE;
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * FNV-1a of the path, and the kind
+ */
+static uint64_t
+waveCacheHash(const char* path, int kind)
+{
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t) kind;
+
+    for (; *path; path++)
+        h = (h ^ (unsigned char) *path) * 1099511628211ULL;
+
+    return h;
+}
+
+static void
+waveCacheDelete(WAVE_ASSET* asset)
+{
+    waveFree((void*) asset->data);
+    free(asset->path);
+    free(asset);
+}
+
+static void
+waveCacheUnlinkLru(WAVE_CACHE_SHARD* shard, WAVE_ASSET* asset)
+{
+    if (asset->newer) asset->newer->older = asset->older;
+    else              shard->newest       = asset->older;
+    if (asset->older) asset->older->newer = asset->newer;
+    else              shard->oldest       = asset->newer;
+
+    asset->newer = asset->older = NULL;
+}
+
+static void
+waveCachePushLru(WAVE_CACHE_SHARD* shard, WAVE_ASSET* asset)
+{
+    asset->older = shard->newest;
+    asset->newer = NULL;
+    if (shard->newest) shard->newest->newer = asset;
+    else               shard->oldest        = asset;
+    shard->newest = asset;
+}
+
+/*
+ * Take an asset out of the table, the shard lock held. It is freed now if
+ * unused, else by its last release.
+ */
+static void
+waveCacheDrop(WAVE_CACHE* cache, WAVE_CACHE_SHARD* shard, WAVE_ASSET* asset)
+{
+    WAVE_ASSET** link = &shard->buckets[asset->hash % WAVE_CACHE_BUCKETS];
+
+    while (*link != asset)
+        link = &(*link)->next;
+    *link = asset->next;
+
+    waveCacheUnlinkLru(shard, asset);
+    shard->bytes -= asset->bytes;
+    shard->assets--;
+    waveAtomicFetchAdd(&cache->bytes, (size_t) 0 - asset->bytes);
+    asset->listed = 0;
+
+    if (asset->refs == 0)
+        waveCacheDelete(asset);
+}
+
+/*
+ * Evict unused assets until the cache fits its budget: the least recently
+ * used of a shard first, starting from the shard of the caller. No lock may
+ * be held.
+ */
+static void
+waveCacheTrim(WAVE_CACHE* cache, int first)
+{
+    int s;
+
+    for (s = 0; s < WAVE_CACHE_SHARDS &&
+                waveAtomicLoad(&cache->bytes) > cache->budget; s++)
+    {
+        WAVE_CACHE_SHARD* shard = &cache->shards[(first + s) % WAVE_CACHE_SHARDS];
+
+        waveMutexLock(&shard->lock);
+
+        WAVE_ASSET* asset = shard->oldest;
+
+        while (asset && waveAtomicLoad(&cache->bytes) > cache->budget) {
+
+            WAVE_ASSET* newer = asset->newer;
+
+            if (asset->refs == 0) {
+                waveCacheDrop(cache, shard, asset);
+                waveAtomicAdd64(&cache->evictions, 1);
+            }
+
+            asset = newer;
+        }
+
+        waveMutexUnlock(&shard->lock);
+    }
+}
+
+/**
+ * @brief Create a cache
+ *
+ * Assets in use are never evicted, the cache may go over budget while they
+ * are held.
+ *
+ * @param budget Bytes of samples the cache may keep
+ * @param flags 0 or WAVE_CACHE_TRUST, then a file changed on disk keeps its
+ * cached copy until evicted
+ * @return The cache, to release with waveCacheFree, or NULL
+ */
+WAVE_CACHE*
+waveCacheCreate(size_t budget, int flags)
+{
+    WAVE_CACHE* cache = (WAVE_CACHE*) calloc(1, sizeof(WAVE_CACHE));
+    int         s;
+
+    if (!cache)
+        return NULL;
+
+    cache->budget = budget;
+    cache->flags  = flags;
+
+    for (s = 0; s < WAVE_CACHE_SHARDS; s++)
+        waveMutexInit(&cache->shards[s].lock);
+
+    return cache;
+}
+
+/**
+ * @brief Release a cache and its assets, none may still be in use
+ * @param cache The cache, or NULL
+ */
+void
+waveCacheFree(WAVE_CACHE* cache)
+{
+    int s, b;
+
+    if (!cache)
+        return;
+
+    for (s = 0; s < WAVE_CACHE_SHARDS; s++) {
+
+        WAVE_CACHE_SHARD* shard = &cache->shards[s];
+
+        for (b = 0; b < WAVE_CACHE_BUCKETS; b++) {
+            while (shard->buckets[b]) {
+                WAVE_ASSET* next = shard->buckets[b]->next;
+                waveCacheDelete(shard->buckets[b]);
+                shard->buckets[b] = next;
+            }
+        }
+
+        waveMutexDestroy(&shard->lock);
+    }
+
+    free(cache);
+}
+
+/*
+ * The listed asset of a path, the shard lock held. One whose file changed
+ * is dropped.
+ */
+static WAVE_ASSET*
+waveCacheFind(WAVE_CACHE* cache, WAVE_CACHE_SHARD* shard, const char* path,
+              int kind, uint64_t hash, int checked, uint64_t size, int64_t time)
+{
+    WAVE_ASSET* asset = shard->buckets[hash % WAVE_CACHE_BUCKETS];
+
+    for (; asset; asset = asset->next) {
+
+        if (asset->hash != hash || asset->kind != kind ||
+            strcmp(asset->path, path) != 0)
+            continue;
+
+        if (checked && (asset->fileSize != size || asset->fileTime != time)) {
+            waveCacheDrop(cache, shard, asset);
+            waveAtomicAdd64(&cache->stale, 1);
+            return NULL;
+        }
+
+        return asset;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Get a file from the cache, loading it on a miss
+ *
+ * The file is looked up by path and kind. Unless the cache trusts its
+ * entries, the size and modification time of the file are checked on every
+ * call (a stat, no read) and a changed file is loaded again.
+ *
+ * @param cache The cache
+ * @param fileName The wave file name
+ * @param kind WAVE_CACHE_RAW or WAVE_CACHE_FLOAT
+ * @return The asset, to release with waveCacheRelease, or NULL
+ */
+const WAVE_ASSET*
+waveCacheGet(WAVE_CACHE* cache, const char* fileName, int kind)
+{
+    uint64_t          hash    = waveCacheHash(fileName, kind);
+    WAVE_CACHE_SHARD* shard   = &cache->shards[hash % WAVE_CACHE_SHARDS];
+    int               checked = !(cache->flags & WAVE_CACHE_TRUST);
+    uint64_t          size    = 0;
+    int64_t           time    = 0;
+    WAVE_ASSET*       asset;
+
+    if (checked && waveFileKey(fileName, &size, &time) != 0) {
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return NULL;
+    }
+
+    waveMutexLock(&shard->lock);
+
+    asset = waveCacheFind(cache, shard, fileName, kind, hash, checked, size,
+                          time);
+    if (asset) {
+        asset->refs++;
+        waveCacheUnlinkLru(shard, asset);
+        waveCachePushLru(shard, asset);
+        waveMutexUnlock(&shard->lock);
+        waveAtomicAdd64(&cache->hits, 1);
+        return asset;
+    }
+
+    waveMutexUnlock(&shard->lock);
+
+    // load without the lock, other files of the shard stay available
+    asset = (WAVE_ASSET*) calloc(1, sizeof(WAVE_ASSET));
+    if (!asset) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        return NULL;
+    }
+
+    asset->path = (char*) malloc(strlen(fileName) + 1);
+    if (asset->path) {
+        strcpy(asset->path, fileName);
+        if (kind == WAVE_CACHE_FLOAT)
+            asset->data = waveLoadFloat(asset->path, &asset->info);
+        else
+            asset->data = waveLoad(asset->path, &asset->info);
+    } else {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+    }
+
+    if (!asset->data) {
+        free(asset->path);
+        free(asset);
+        return NULL;
+    }
+
+    asset->bytes    = (size_t) asset->info.dataSize;
+    asset->kind     = kind;
+    asset->hash     = hash;
+    asset->fileSize = size;
+    asset->fileTime = time;
+    asset->refs     = 1;
+    asset->listed   = 1;
+    asset->shard    = (int) (hash % WAVE_CACHE_SHARDS);
+
+    if (kind == WAVE_CACHE_FLOAT && asset->info.nBlockAlign)
+        asset->bytes = (size_t) (asset->info.dataSize / asset->info.nBlockAlign *
+                                 asset->info.nChannels * sizeof(float));
+
+    waveAtomicAdd64(&cache->misses, 1);
+
+    waveMutexLock(&shard->lock);
+
+    // another thread may have loaded it meanwhile, keep the first copy
+    WAVE_ASSET* first = waveCacheFind(cache, shard, fileName, kind, hash,
+                                      checked, size, time);
+    if (first) {
+        first->refs++;
+        waveMutexUnlock(&shard->lock);
+        waveCacheDelete(asset);
+        return first;
+    }
+
+    WAVE_ASSET** bucket = &shard->buckets[hash % WAVE_CACHE_BUCKETS];
+
+    asset->next = *bucket;
+    *bucket     = asset;
+    waveCachePushLru(shard, asset);
+    shard->bytes += asset->bytes;
+    shard->assets++;
+    waveAtomicFetchAdd(&cache->bytes, asset->bytes);
+
+    waveMutexUnlock(&shard->lock);
+
+    waveCacheTrim(cache, asset->shard);
+
+    return asset;
+}
+
+/**
+ * @brief Give back an asset from waveCacheGet
+ * @param cache The cache
+ * @param asset The asset, not to be used anymore
+ */
+void
+waveCacheRelease(WAVE_CACHE* cache, const WAVE_ASSET* asset)
+{
+    WAVE_ASSET*       a     = (WAVE_ASSET*) asset;
+    int               s     = a->shard;
+    WAVE_CACHE_SHARD* shard = &cache->shards[s];
+
+    waveMutexLock(&shard->lock);
+
+    int unused = --a->refs == 0;
+
+    if (unused && !a->listed)
+        waveCacheDelete(a);
+
+    waveMutexUnlock(&shard->lock);
+
+    if (unused)
+        waveCacheTrim(cache, s);
+}
+
+/**
+ * @brief Evict every asset not in use
+ * @param cache The cache
+ */
+void
+waveCachePurge(WAVE_CACHE* cache)
+{
+    int s;
+
+    for (s = 0; s < WAVE_CACHE_SHARDS; s++) {
+
+        WAVE_CACHE_SHARD* shard = &cache->shards[s];
+        WAVE_ASSET*       asset;
+
+        waveMutexLock(&shard->lock);
+
+        asset = shard->oldest;
+        while (asset) {
+            WAVE_ASSET* newer = asset->newer;
+            if (asset->refs == 0) {
+                waveCacheDrop(cache, shard, asset);
+                waveAtomicAdd64(&cache->evictions, 1);
+            }
+            asset = newer;
+        }
+
+        waveMutexUnlock(&shard->lock);
+    }
+}
+
+/**
+ * @brief Read the counters of a cache
+ * @param cache The cache
+ * @param stats Pointer to a WAVE_CACHE_STATS variable
+ */
+void
+waveCacheStats(WAVE_CACHE* cache, WAVE_CACHE_STATS* stats)
+{
+    int s;
+
+    memset(stats, 0, sizeof(WAVE_CACHE_STATS));
+
+    stats->hits      = waveAtomicLoad64(&cache->hits);
+    stats->misses    = waveAtomicLoad64(&cache->misses);
+    stats->evictions = waveAtomicLoad64(&cache->evictions);
+    stats->stale     = waveAtomicLoad64(&cache->stale);
+
+    for (s = 0; s < WAVE_CACHE_SHARDS; s++) {
+        WAVE_CACHE_SHARD* shard = &cache->shards[s];
+        waveMutexLock(&shard->lock);
+        stats->bytes  += shard->bytes;
+        stats->assets += shard->assets;
+        waveMutexUnlock(&shard->lock);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
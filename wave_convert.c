@@ -0,0 +1,1015 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Convert wave files, many at once, as fast as the disks go.
+ *
+ * wave_convert --out DIR [--bits 8|16|24|32] [--float]
+ *              [--channels mono|stereo|5.1] [--rifx]
+ *              [--dither none|tpdf|shaped] [--threads N] [--files N]
+ *              [--block SIZE] [--queue N] FILE...
+ *
+ * Each FILE is written to DIR under its own name, in the requested sample
+ * format, speaker layout and byte order; what is not requested is kept.
+ * The work runs as a pipeline of three stages: --files reader threads
+ * stream the inputs in blocks of --block bytes (1M by default, K and M
+ * suffixes), --threads workers (one per CPU by default) convert the blocks,
+ * one writer thread puts them back in order in the output files. The
+ * stages pass reusable buffers through bounded queues, --queue buffers in
+ * all, so a slow stage holds the others back instead of filling memory.
+ * Readers deal the blocks to the workers in turn, an idle worker steals
+ * from the others.
+ *
+ * The dither defaults to TPDF whenever PCM is quantized from samples that
+ * are not whole output steps: float input, a channel mix, or fewer bits
+ * than the input. It is none otherwise, float output included. Blocks are
+ * quantized apart, each with its own dither seed; the noise shaping starts
+ * over on each block.
+ *
+ * At the end the bytes, busy time and stall time (waiting for the next
+ * stage to free a buffer, or for the previous one to hand a block) of
+ * each stage are printed, with the stage limiting the throughput.
+ * The exit status is 1 if a file could not be converted.
+ */
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_float.h"
+#include "wave_planar.h"
+#include "wave_mix.h"
+#include "wave_quantize.h"
+#include "wave_write.h"
+#include "wave_thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <sys/stat.h>
+#endif
+
+#define CONVERT_THREADS                64
+#define CONVERT_READ_SIZE              (64 * 1024)
+
+/*
+ * Throughput of a pipeline stage, summed over its threads
+ */
+typedef struct convert_stage_t {
+    uint64_t bytes;
+    uint64_t busy;          // ns spent working
+    uint64_t stalled;       // ns waiting for a buffer or a block
+} CONVERT_STAGE;
+
+typedef struct convert_job_t   CONVERT_JOB;
+typedef struct convert_block_t CONVERT_BLOCK;
+
+/*
+ * Frames of a file on their way through the stages
+ */
+struct convert_block_t {
+    CONVERT_JOB*   job;
+    uint64_t       index;       // position in the file, in blocks
+    size_t         frames;
+    int            last;        // the file ends with this block
+    int            failed;      // the file could not be read
+    unsigned char* in;          // as read, in host order
+    unsigned char* out;         // as written, when converted
+    unsigned char* result;      // in or out
+    uint64_t       clipped;     // samples saturated by the conversion
+    CONVERT_BLOCK* next;
+};
+
+/*
+ * A file to convert
+ */
+struct convert_job_t {
+    char*          input;
+    char*          output;
+    WAVE_INFO      info;
+    int            inFormat;
+    int            outFormat;
+    int            dither;
+    int            copy;        // same samples, no conversion
+    int            mix;         // to another speaker layout
+    uint32_t       outMask;
+    int            outChannels;
+    FMT_CHUNK      fmt;
+    size_t         frames;      // per block
+    int            failed;
+    int            created;     // the output was opened
+
+    // writer side: the output, the next block due, the blocks ahead of it
+    WAVE_WRITER*   writer;
+    uint64_t       next;
+    CONVERT_BLOCK* pending;
+    uint64_t       clipped;
+};
+
+/*
+ * A FIFO of blocks, waited on when empty
+ */
+typedef struct convert_queue_t {
+    WAVE_MUTEX     lock;
+    WAVE_COND      ready;
+    CONVERT_BLOCK* head;
+    CONVERT_BLOCK* tail;
+} CONVERT_QUEUE;
+
+/*
+ * The blocks dealt to a worker, taken from the front by the worker and
+ * from the back by thieves
+ */
+typedef struct convert_deque_t {
+    WAVE_MUTEX      lock;
+    CONVERT_BLOCK** ring;
+    size_t          size;
+    size_t          head;
+    size_t          count;
+} CONVERT_DEQUE;
+
+typedef struct convert_t CONVERT;
+
+typedef struct convert_reader_t {
+    CONVERT*       c;
+    CONVERT_STAGE  stage;
+} CONVERT_READER;
+
+typedef struct convert_worker_t {
+    CONVERT*       c;
+    int            id;
+    CONVERT_DEQUE  deque;
+    CONVERT_STAGE  stage;
+    uint64_t       steals;
+
+    float*         scratch[2];
+    WAVE_MIX       mix;
+    CONVERT_JOB*   mixJob;      // the job the mix was made for
+} CONVERT_WORKER;
+
+struct convert_t {
+
+    // options
+    const char*     outDir;
+    int             format;     // WAVE_SAMPLE_*, 0 to keep
+    uint32_t        layout;     // speaker mask, 0 to keep
+    int             rifx;
+    int             dither;     // WAVE_DITHER_*, -1 for the default
+    size_t          blockSize;
+
+    CONVERT_JOB*    jobs;
+    size_t          jobCount;
+    size_t          nextJob;    // next job for a reader
+    size_t          finished;   // jobs done by the writer
+    size_t          failures;
+
+    CONVERT_BLOCK*  blocks;
+    size_t          blockCount;
+    CONVERT_QUEUE   free;       // buffers for the readers
+    CONVERT_QUEUE   done;       // converted blocks for the writer
+
+    CONVERT_WORKER* workers;
+    int             workerCount;
+    size_t          deal;       // next worker a reader deals to
+    size_t          queued;     // blocks in the deques
+
+    WAVE_MUTEX      idle;       // workers out of blocks wait on work
+    WAVE_COND       work;
+    int             closing;    // the readers are done
+
+    CONVERT_STAGE   write;
+};
+
+static uint64_t
+parseSize(const char* text)
+{
+    char*    end;
+    uint64_t size = strtoull(text, &end, 10);
+
+    if (*end == 'K' || *end == 'k') size <<= 10;
+    if (*end == 'M' || *end == 'm') size <<= 20;
+
+    return size;
+}
+
+static void
+queueInit(CONVERT_QUEUE* q)
+{
+    waveMutexInit(&q->lock);
+    waveCondInit(&q->ready);
+    q->head = q->tail = NULL;
+}
+
+static void
+queueFree(CONVERT_QUEUE* q)
+{
+    waveCondDestroy(&q->ready);
+    waveMutexDestroy(&q->lock);
+}
+
+static void
+queuePush(CONVERT_QUEUE* q, CONVERT_BLOCK* block)
+{
+    block->next = NULL;
+
+    waveMutexLock(&q->lock);
+    if (q->tail)
+        q->tail->next = block;
+    else
+        q->head = block;
+    q->tail = block;
+    waveCondSignal(&q->ready);
+    waveMutexUnlock(&q->lock);
+}
+
+/*
+ * Take the first block, waiting for one, the wait counted in stalled
+ */
+static CONVERT_BLOCK*
+queuePop(CONVERT_QUEUE* q, uint64_t* stalled)
+{
+    uint64_t start = 0;
+
+    waveMutexLock(&q->lock);
+
+    while (!q->head) {
+        if (!start)
+            start = waveClock();
+        waveCondWait(&q->ready, &q->lock);
+    }
+
+    CONVERT_BLOCK* block = q->head;
+    q->head = block->next;
+    if (!q->head)
+        q->tail = NULL;
+
+    waveMutexUnlock(&q->lock);
+
+    if (start)
+        *stalled += waveClock() - start;
+
+    return block;
+}
+
+/*
+ * Hand a block read to the workers, in turn, and wake one of them
+ */
+static void
+dealBlock(CONVERT* c, CONVERT_BLOCK* block)
+{
+    size_t         w = waveAtomicFetchAdd(&c->deal, 1) % c->workerCount;
+    CONVERT_DEQUE* d = &c->workers[w].deque;
+
+    waveMutexLock(&d->lock);
+    d->ring[(d->head + d->count) % d->size] = block;
+    d->count++;
+    waveMutexUnlock(&d->lock);
+
+    waveAtomicFetchAdd(&c->queued, 1);
+
+    waveMutexLock(&c->idle);
+    waveCondSignal(&c->work);
+    waveMutexUnlock(&c->idle);
+}
+
+/*
+ * The oldest block of the worker, else the newest of another one
+ */
+static CONVERT_BLOCK*
+takeBlock(CONVERT_WORKER* worker)
+{
+    CONVERT*       c     = worker->c;
+    CONVERT_BLOCK* block = NULL;
+    int            k;
+
+    for (k = 0; k < c->workerCount && !block; k++) {
+
+        CONVERT_DEQUE* d = &c->workers[(worker->id + k) % c->workerCount].deque;
+
+        waveMutexLock(&d->lock);
+        if (d->count > 0) {
+            if (k == 0) {
+                block   = d->ring[d->head];
+                d->head = (d->head + 1) % d->size;
+            } else {
+                block = d->ring[(d->head + d->count - 1) % d->size];
+                worker->steals++;
+            }
+            d->count--;
+        }
+        waveMutexUnlock(&d->lock);
+    }
+
+    if (block)
+        waveAtomicFetchAdd(&c->queued, (size_t) -1);
+
+    return block;
+}
+
+static const char*
+baseName(const char* path)
+{
+    const char* base = path;
+    const char* p;
+
+    for (p = path; *p; p++)
+        if (*p == '/' || *p == '\\')
+            base = p + 1;
+
+    return base;
+}
+
+/*
+ * Whether two paths name the same file, which the output must not be
+ */
+static int
+sameFile(const char* a, const char* b)
+{
+#ifdef _WIN32
+    return _stricmp(a, b) == 0;
+#else
+    struct stat sa, sb;
+
+    if (stat(a, &sa) != 0 || stat(b, &sb) != 0)
+        return strcmp(a, b) == 0;
+
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+/*
+ * Pick the output format of a file just opened. Returns 0, or -1 if the
+ * file can not be converted.
+ */
+static int
+planJob(CONVERT* c, CONVERT_JOB* job)
+{
+    WAVE_INFO* info = &job->info;
+
+    if (sameFile(job->input, job->output)) {
+        fprintf(stderr, "%s: would be written over\n", job->input);
+        job->failed = 1;
+        return -1;
+    }
+
+    job->inFormat = waveSampleFormat(info);
+    if (job->inFormat <= 0) {
+        waveError(WAVE_ERROR_UNSUPPORTED, job->input);
+        return -1;
+    }
+
+    uint32_t inMask = waveChannelMask(info);
+    int      mix    = c->layout != 0 && c->layout != inMask;
+
+    job->outFormat   = c->format ? c->format : job->inFormat;
+    job->outMask     = mix ? c->layout : info->dwChannelMask;
+    job->outChannels = info->nChannels;
+    job->copy        = !mix && job->outFormat == job->inFormat;
+    job->mix         = mix;
+
+    if (mix) {
+        uint32_t bits;
+        job->outChannels = 0;
+        for (bits = c->layout; bits; bits &= bits - 1)
+            job->outChannels++;
+    }
+
+    // converted samples are float or PCM
+    if (!job->copy && job->outFormat == WAVE_SAMPLE_F64)
+        job->outFormat = WAVE_SAMPLE_F32;
+    if (!job->copy && job->outFormat >= WAVE_SAMPLE_ALAW)
+        job->outFormat = WAVE_SAMPLE_S16;
+
+    int inSize  = waveSampleSize(job->inFormat);
+    int outSize = waveSampleSize(job->outFormat);
+
+    // the quantizer only gets whole output steps from narrower or as wide
+    // integer samples, G.711 ones decoding to 16 bits
+    int quantized  = !job->copy && job->outFormat != WAVE_SAMPLE_F32;
+    int inBits     = job->inFormat >= WAVE_SAMPLE_ALAW ? 16 : 8 * inSize;
+    int fractional = job->inFormat == WAVE_SAMPLE_F32 ||
+                     job->inFormat == WAVE_SAMPLE_F64 ||
+                     mix || 8 * outSize < inBits;
+
+    job->dither = c->dither;
+    if (job->dither < 0)
+        job->dither = quantized && fractional ?
+                      WAVE_DITHER_TPDF : WAVE_DITHER_NONE;
+    if (job->dither == WAVE_DITHER_SHAPED &&
+        job->outChannels > WAVE_QUANTIZE_CHANNELS)
+        job->dither = WAVE_DITHER_TPDF;
+
+    uint16_t tag  = WAVE_FORMAT_PCM;
+    uint16_t bits = (uint16_t) (outSize * 8);
+
+    if (job->outFormat == WAVE_SAMPLE_F32 || job->outFormat == WAVE_SAMPLE_F64)
+        tag = WAVE_FORMAT_IEEE_FLOAT;
+    if (job->outFormat == WAVE_SAMPLE_ALAW)
+        tag = WAVE_FORMAT_ALAW;
+    if (job->outFormat == WAVE_SAMPLE_MULAW)
+        tag = WAVE_FORMAT_MULAW;
+    if (job->copy && info->wValidBitsPerSample)
+        bits = info->wValidBitsPerSample;
+
+    waveMakeFmt(&job->fmt, tag, (uint16_t) job->outChannels,
+                info->nSamplesPerSec, bits, job->outMask);
+
+    // a copy keeps the input container, wider than the valid bits of a
+    // 24-bit in 32 file for example
+    if (job->copy) {
+        job->fmt.wBitsPerSample  =
+            (uint16_t) (info->nBlockAlign / info->nChannels * 8);
+        job->fmt.nBlockAlign     = info->nBlockAlign;
+        job->fmt.nAvgBytesPerSec = info->nSamplesPerSec * info->nBlockAlign;
+    }
+
+    // as many frames as the buffers hold, float copies included
+    size_t frame = info->nBlockAlign;
+    if (frame < job->fmt.nBlockAlign) frame = job->fmt.nBlockAlign;
+    if (frame < info->nChannels * sizeof(float))
+        frame = info->nChannels * sizeof(float);
+    if (frame < job->outChannels * sizeof(float))
+        frame = job->outChannels * sizeof(float);
+
+    job->frames = c->blockSize / frame;
+    if (job->frames == 0) {
+        waveError(WAVE_ERROR_MEMORY, job->input);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Reader stage: open the next file, send its frames block by block, the
+ * last block flagged, a failed file as a single empty block
+ */
+static void
+readFiles(void* arg)
+{
+    CONVERT_READER* reader = (CONVERT_READER*) arg;
+    CONVERT*        c      = reader->c;
+    size_t          j;
+
+    while ((j = waveAtomicFetchAdd(&c->nextJob, 1)) < c->jobCount) {
+
+        CONVERT_JOB* job    = &c->jobs[j];
+        uint64_t     start  = waveClock();
+        WAVE_STREAM* stream = job->failed ? NULL :
+                              waveOpen(job->input, &job->info, CONVERT_READ_SIZE);
+        int          ok     = stream && planJob(c, job) == 0;
+
+        reader->stage.busy += waveClock() - start;
+
+        if (!ok && !job->failed)
+            fprintf(stderr, "%s: %s\n", job->input,
+                    waveErrorString(waveLastError()));
+
+        uint64_t left  = ok ? job->info.dataSize / job->info.nBlockAlign : 0;
+        uint64_t index = 0;
+        int      last  = 0;
+
+        while (!last) {
+
+            CONVERT_BLOCK* block = queuePop(&c->free, &reader->stage.stalled);
+            size_t         want  = left < job->frames ? (size_t) left : job->frames;
+
+            start = waveClock();
+            block->frames = want ? waveReadFrames(stream, block->in, want) : 0;
+            reader->stage.busy  += waveClock() - start;
+            reader->stage.bytes += block->frames * job->info.nBlockAlign;
+
+            // a file shorter than its header ends early
+            left -= block->frames;
+            last  = block->frames < want || left == 0;
+
+            block->job    = job;
+            block->index  = index++;
+            block->last   = last;
+            block->failed = !ok;
+
+            dealBlock(c, block);
+        }
+
+        if (stream)
+            waveClose(stream);
+    }
+}
+
+/*
+ * Convert the frames of a block to the format of its output file
+ */
+static void
+convertBlock(CONVERT_WORKER* worker, CONVERT_BLOCK* block)
+{
+    CONVERT_JOB* job     = block->job;
+    size_t       frames  = block->frames;
+    size_t       samples = frames * job->outChannels;
+    int          outF32  = job->outFormat == WAVE_SAMPLE_F32;
+
+    block->result  = block->in;
+    block->clipped = 0;
+
+    if (!job->copy) {
+
+        float* wide = outF32 && !job->mix ? (float*) block->out :
+                                            worker->scratch[0];
+
+        waveToFloat(block->in, job->inFormat, wide,
+                    frames * job->info.nChannels);
+
+        if (job->mix) {
+
+            float* mixed = outF32 ? (float*) block->out : worker->scratch[1];
+
+            // the planar buffers of a mix belong to one thread
+            if (worker->mixJob != job) {
+                waveMixFree(&worker->mix);
+                worker->mixJob = NULL;
+                if (waveMixInit(&worker->mix, waveChannelMask(&job->info),
+                                job->info.nChannels, job->outMask,
+                                job->outChannels, 0) == 0)
+                    worker->mixJob = job;
+            }
+
+            if (worker->mixJob != job) {
+                block->failed = 1;
+                return;
+            }
+
+            waveMixInterleaved(&worker->mix, wide, mixed, frames);
+            wide = mixed;
+        }
+
+        // the dither of each block is its own, seeded by file and index
+        if (!outF32) {
+            WAVE_QUANTIZER q;
+            waveQuantizerInit(&q, job->outFormat, job->outChannels, job->dither);
+            waveQuantizerSeed(&q, ((uint64_t) (job - worker->c->jobs) << 32) ^
+                                  block->index);
+            block->clipped = waveFromFloat(&q, wide, block->out, samples);
+        }
+
+        block->result = block->out;
+    }
+
+    if (worker->c->rifx)
+        waveSwapBytes(block->result, frames * job->fmt.nBlockAlign,
+                      waveSampleSize(job->outFormat));
+}
+
+/*
+ * Convert stage: blocks from the own deque or stolen, handed to the writer
+ */
+static void
+convertBlocks(void* arg)
+{
+    CONVERT_WORKER* worker = (CONVERT_WORKER*) arg;
+    CONVERT*        c      = worker->c;
+
+    for (;;) {
+
+        CONVERT_BLOCK* block = takeBlock(worker);
+
+        if (!block) {
+
+            uint64_t start = waveClock();
+            int      stop;
+
+            waveMutexLock(&c->idle);
+            while (waveAtomicLoad(&c->queued) == 0 && !c->closing)
+                waveCondWait(&c->work, &c->idle);
+            stop = waveAtomicLoad(&c->queued) == 0 && c->closing;
+            waveMutexUnlock(&c->idle);
+
+            worker->stage.stalled += waveClock() - start;
+
+            if (stop)
+                break;
+            continue;
+        }
+
+        if (!block->failed && block->frames > 0) {
+
+            uint64_t start = waveClock();
+
+            convertBlock(worker, block);
+
+            worker->stage.busy  += waveClock() - start;
+            worker->stage.bytes += block->frames * block->job->info.nBlockAlign;
+        }
+
+        queuePush(&c->done, block);
+    }
+}
+
+/*
+ * Close the output of a file, removed if anything failed
+ */
+static void
+finishJob(CONVERT* c, CONVERT_JOB* job)
+{
+    if (job->writer && waveFinalize(job->writer) != 0 && !job->failed) {
+        fprintf(stderr, "%s: %s\n", job->output,
+                waveErrorString(waveLastError()));
+        job->failed = 1;
+    }
+
+    job->writer = NULL;
+
+    if (job->failed) {
+        if (job->created)
+            remove(job->output);
+        c->failures++;
+    } else if (job->clipped > 0) {
+        fprintf(stderr, "%s: %" PRIu64 " samples clipped\n", job->output,
+                job->clipped);
+    }
+
+    c->finished++;
+}
+
+/*
+ * Write a block due, in file order
+ */
+static void
+writeBlock(CONVERT* c, CONVERT_BLOCK* block)
+{
+    CONVERT_JOB* job = block->job;
+
+    if (block->failed)
+        job->failed = 1;
+
+    if (!job->failed && block->index == 0) {
+        job->writer  = waveCreate(job->output, &job->fmt, c->blockSize,
+                                  c->rifx ? WAVE_WRITE_RIFX : 0);
+        job->created = job->writer != NULL;
+        if (!job->writer) {
+            fprintf(stderr, "%s: %s\n", job->output,
+                    waveErrorString(waveLastError()));
+            job->failed = 1;
+        }
+    }
+
+    if (!job->failed && block->frames > 0) {
+
+        uint64_t start = waveClock();
+
+        if (waveWriteFrames(job->writer, block->result, block->frames) != 0) {
+            fprintf(stderr, "%s: %s\n", job->output,
+                    waveErrorString(waveLastError()));
+            job->failed = 1;
+        }
+
+        c->write.busy  += waveClock() - start;
+        c->write.bytes += block->frames * job->fmt.nBlockAlign;
+    }
+
+    job->clipped += block->clipped;
+    job->next++;
+
+    if (block->last)
+        finishJob(c, job);
+}
+
+/*
+ * Write stage: blocks come in any order, each file gets them in its own
+ */
+static void
+writeFiles(void* arg)
+{
+    CONVERT* c = (CONVERT*) arg;
+
+    while (c->finished < c->jobCount) {
+
+        CONVERT_BLOCK*  block = queuePop(&c->done, &c->write.stalled);
+        CONVERT_JOB*    job   = block->job;
+        CONVERT_BLOCK** at    = &job->pending;
+
+        // blocks ahead of the next one wait, sorted
+        while (*at && (*at)->index < block->index)
+            at = &(*at)->next;
+        block->next = *at;
+        *at         = block;
+
+        while (job->pending && job->pending->index == job->next) {
+            block        = job->pending;
+            job->pending = block->next;
+            writeBlock(c, block);
+            queuePush(&c->free, block);
+        }
+    }
+}
+
+static int
+compareOutputs(const void* a, const void* b)
+{
+    const CONVERT_JOB* x = *(const CONVERT_JOB* const*) a;
+    const CONVERT_JOB* y = *(const CONVERT_JOB* const*) b;
+    int                order = strcmp(x->output, y->output);
+
+    return order ? order : (x < y ? -1 : 1);
+}
+
+static void
+printStage(const char* name, const CONVERT_STAGE* stage, int threads)
+{
+    double mb     = stage->bytes / 1e6;
+    double busy   = stage->busy / 1e9;
+    double perCpu = busy > 0 ? mb / busy : 0;
+
+    printf("%-8s %7d %10.1f %9.2f %9.2f %10.0f\n", name, threads, mb, busy,
+           stage->stalled / 1e9, perCpu);
+}
+
+static void
+usage(const char* name)
+{
+    printf("usage: %s --out DIR [--bits 8|16|24|32] [--float] "
+           "[--channels mono|stereo|5.1] [--rifx] "
+           "[--dither none|tpdf|shaped] [--threads N] [--files N] "
+           "[--block SIZE] [--queue N] FILE...\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+    CONVERT c;
+    int     threads = 0;
+    int     files   = 4;
+    int     depth   = 0;
+    int     i;
+
+    memset(&c, 0, sizeof(c));
+    c.dither    = -1;
+    c.blockSize = 1 << 20;
+
+    for (i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            c.outDir = argv[++i];
+        else if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc) {
+            int bits = atoi(argv[++i]);
+            c.format = bits == 8  ? WAVE_SAMPLE_U8  :
+                       bits == 16 ? WAVE_SAMPLE_S16 :
+                       bits == 24 ? WAVE_SAMPLE_S24 :
+                       bits == 32 ? WAVE_SAMPLE_S32 : -1;
+        } else if (strcmp(argv[i], "--float") == 0)
+            c.format = WAVE_SAMPLE_F32;
+        else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc) {
+            const char* layout = argv[++i];
+            c.layout = strcmp(layout, "mono") == 0   ? WAVE_MIX_MONO :
+                       strcmp(layout, "stereo") == 0 ? WAVE_MIX_STEREO :
+                       strcmp(layout, "5.1") == 0    ? WAVE_MIX_5POINT1 :
+                                                       (uint32_t) -1;
+        } else if (strcmp(argv[i], "--rifx") == 0)
+            c.rifx = 1;
+        else if (strcmp(argv[i], "--dither") == 0 && i + 1 < argc) {
+            const char* dither = argv[++i];
+            c.dither = strcmp(dither, "none") == 0   ? WAVE_DITHER_NONE :
+                       strcmp(dither, "tpdf") == 0   ? WAVE_DITHER_TPDF :
+                       strcmp(dither, "shaped") == 0 ? WAVE_DITHER_SHAPED : -2;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--files") == 0 && i + 1 < argc)
+            files = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc)
+            c.blockSize = (size_t) parseSize(argv[++i]);
+        else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc)
+            depth = atoi(argv[++i]);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!c.outDir || i == argc || c.format < 0 || c.layout == (uint32_t) -1 ||
+        c.dither < -1 || c.blockSize < 4096)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (threads <= 0)
+        threads = waveCpuCount();
+    if (threads > CONVERT_THREADS)
+        threads = CONVERT_THREADS;
+    if (files <= 0)
+        files = 1;
+    if (files > CONVERT_THREADS)
+        files = CONVERT_THREADS;
+
+    // enough buffers for every thread to hold one and have one waiting
+    if (depth < 2 * (threads + files) + 2)
+        depth = 2 * (threads + files) + 2;
+
+    mkdir(c.outDir, 0755);
+
+    c.jobCount = (size_t) (argc - i);
+    c.jobs     = (CONVERT_JOB*) calloc(c.jobCount, sizeof(CONVERT_JOB));
+    c.blocks   = (CONVERT_BLOCK*) calloc(depth, sizeof(CONVERT_BLOCK));
+    c.workers  = (CONVERT_WORKER*) calloc(threads, sizeof(CONVERT_WORKER));
+
+    CONVERT_READER* readers = (CONVERT_READER*) calloc(files,
+                                                       sizeof(CONVERT_READER));
+    WAVE_THREAD*    ids     = (WAVE_THREAD*) malloc((threads + files + 1) *
+                                                    sizeof(WAVE_THREAD));
+    int             ok      = c.jobs && c.blocks && c.workers && readers && ids;
+    size_t          j;
+
+    for (j = 0; ok && j < c.jobCount; j++) {
+
+        CONVERT_JOB* job  = &c.jobs[j];
+        const char*  base = baseName(argv[i + j]);
+
+        job->input  = argv[i + j];
+        job->output = (char*) malloc(strlen(c.outDir) + strlen(base) + 2);
+        ok = job->output != NULL;
+        if (ok)
+            sprintf(job->output, "%s/%s", c.outDir, base);
+    }
+
+    // inputs of the same name in two directories would share an output
+    CONVERT_JOB** sorted = ok ? (CONVERT_JOB**) malloc(c.jobCount *
+                                                       sizeof(CONVERT_JOB*)) : NULL;
+    ok = sorted != NULL;
+
+    for (j = 0; ok && j < c.jobCount; j++)
+        sorted[j] = &c.jobs[j];
+    if (ok)
+        qsort(sorted, c.jobCount, sizeof(CONVERT_JOB*), compareOutputs);
+
+    for (j = 1; ok && j < c.jobCount; j++) {
+        if (strcmp(sorted[j]->output, sorted[j - 1]->output) == 0) {
+            fprintf(stderr, "%s: %s is written from %s already\n",
+                    sorted[j]->input, sorted[j]->output, sorted[j - 1]->input);
+            sorted[j]->failed = 1;
+        }
+    }
+
+    free(sorted);
+
+    queueInit(&c.free);
+    queueInit(&c.done);
+    waveMutexInit(&c.idle);
+    waveCondInit(&c.work);
+
+    c.blockCount = ok ? (size_t) depth : 0;
+    for (j = 0; j < c.blockCount; j++) {
+        c.blocks[j].in  = (unsigned char*) waveAlignedAlloc(c.blockSize, 64);
+        c.blocks[j].out = (unsigned char*) waveAlignedAlloc(c.blockSize, 64);
+        ok = ok && c.blocks[j].in && c.blocks[j].out;
+        queuePush(&c.free, &c.blocks[j]);
+    }
+
+    c.workerCount = threads;
+    for (j = 0; ok && j < (size_t) threads; j++) {
+
+        CONVERT_WORKER* worker = &c.workers[j];
+        CONVERT_DEQUE*  d      = &worker->deque;
+
+        worker->c          = &c;
+        worker->id         = (int) j;
+        worker->scratch[0] = (float*) waveAlignedAlloc(c.blockSize, 64);
+        worker->scratch[1] = (float*) waveAlignedAlloc(c.blockSize, 64);
+        d->ring            = (CONVERT_BLOCK**) malloc(depth * sizeof(CONVERT_BLOCK*));
+        d->size            = (size_t) depth;
+        waveMutexInit(&d->lock);
+
+        ok = worker->scratch[0] && worker->scratch[1] && d->ring;
+    }
+
+    if (!ok) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    // the writer, the workers, then the readers start the flow
+    int      started = 0;
+    uint64_t start   = waveClock();
+
+    ok = waveThreadCreate(&ids[started], writeFiles, &c) == 0;
+    started += ok;
+
+    for (j = 0; ok && j < (size_t) threads; j++) {
+        ok = waveThreadCreate(&ids[started], convertBlocks, &c.workers[j]) == 0;
+        started += ok;
+    }
+
+    for (j = 0; ok && j < (size_t) files; j++) {
+        readers[j].c = &c;
+        ok = waveThreadCreate(&ids[started], readFiles, &readers[j]) == 0;
+        started += ok;
+    }
+
+    if (!ok) {
+        printf("can not start the threads\n");
+        return 1;
+    }
+
+    // readers, then workers once the deques are empty, then the writer
+    for (j = 0; j < (size_t) files; j++)
+        waveThreadJoin(ids[1 + threads + j]);
+
+    waveMutexLock(&c.idle);
+    c.closing = 1;
+    waveCondBroadcast(&c.work);
+    waveMutexUnlock(&c.idle);
+
+    for (j = 0; j < (size_t) threads; j++)
+        waveThreadJoin(ids[1 + j]);
+
+    waveThreadJoin(ids[0]);
+
+    double seconds = (waveClock() - start) / 1e9;
+
+    CONVERT_STAGE read, convert;
+    uint64_t      steals = 0;
+
+    memset(&read, 0, sizeof(read));
+    memset(&convert, 0, sizeof(convert));
+
+    for (j = 0; j < (size_t) files; j++) {
+        read.bytes   += readers[j].stage.bytes;
+        read.busy    += readers[j].stage.busy;
+        read.stalled += readers[j].stage.stalled;
+    }
+
+    for (j = 0; j < (size_t) threads; j++) {
+        convert.bytes   += c.workers[j].stage.bytes;
+        convert.busy    += c.workers[j].stage.busy;
+        convert.stalled += c.workers[j].stage.stalled;
+        steals          += c.workers[j].steals;
+    }
+
+    printf("stage    threads         MB    busy s stalled s MB/s/thread\n");
+    printStage("read",    &read,    files);
+    printStage("convert", &convert, threads);
+    printStage("write",   &c.write, 1);
+
+    // the stage with the most work per thread sets the pace
+    double      readLoad    = read.busy / 1e9 / files;
+    double      convertLoad = convert.busy / 1e9 / threads;
+    double      writeLoad   = c.write.busy / 1e9;
+    const char* bound       = "read";
+
+    if (convertLoad > readLoad && convertLoad > writeLoad)
+        bound = "convert";
+    else if (writeLoad > readLoad)
+        bound = "write";
+
+    printf("%zu files, %zu failed, %" PRIu64 " blocks stolen, %.1f MB in "
+           "%.2f s, %.0f MB/s, %s bound\n",
+           c.jobCount, c.failures, steals, read.bytes / 1e6, seconds,
+           seconds > 0 ? read.bytes / 1e6 / seconds : 0, bound);
+
+    for (j = 0; j < (size_t) threads; j++) {
+        waveMixFree(&c.workers[j].mix);
+        waveAlignedFree(c.workers[j].scratch[0]);
+        waveAlignedFree(c.workers[j].scratch[1]);
+        free(c.workers[j].deque.ring);
+        waveMutexDestroy(&c.workers[j].deque.lock);
+    }
+    for (j = 0; j < c.blockCount; j++) {
+        waveAlignedFree(c.blocks[j].in);
+        waveAlignedFree(c.blocks[j].out);
+    }
+    for (j = 0; j < c.jobCount; j++)
+        free(c.jobs[j].output);
+
+    queueFree(&c.free);
+    queueFree(&c.done);
+    waveCondDestroy(&c.work);
+    waveMutexDestroy(&c.idle);
+    free(c.blocks);
+    free(c.workers);
+    free(c.jobs);
+    free(readers);
+    free(ids);
+
+    return c.failures > 0;
+}
@@ -0,0 +1,719 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file wave_float.h
+ *
+ * Conversion of the wave sample formats to normalized float32 samples, in
+ * the [-1, 1[ range. The kernels are picked at run time from the instruction
+ * sets the CPU supports (SSE2, SSSE3, AVX2, AVX-512) with a scalar fallback.
+ */
+
+#ifndef WAVE_FLOAT_H
+#define WAVE_FLOAT_H
+
+#include "wave.h"
+#include "wave_sys.h"
+
+/*
+ * Sample encodings, see waveSampleFormat
+ */
+#define WAVE_SAMPLE_U8                 1   // 8-bit offset binary PCM
+#define WAVE_SAMPLE_S16                2   // 16-bit PCM
+#define WAVE_SAMPLE_S24                3   // 24-bit packed PCM
+#define WAVE_SAMPLE_S32                4   // 32-bit PCM
+#define WAVE_SAMPLE_F32                5   // 32-bit IEEE float
+#define WAVE_SAMPLE_F64                6   // 64-bit IEEE float
+#define WAVE_SAMPLE_ALAW               7   // 8-bit ITU-T G.711 A-law
+#define WAVE_SAMPLE_MULAW              8   // 8-bit ITU-T G.711 µ-law
+
+#define WAVE_SAMPLE_FORMATS            9
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef void (*WAVE_TO_FLOAT)(const void* src, float* dst, size_t samples);
+
+/**
+ * @brief The sample encoding of a loaded file
+ * @param info The WAVE_INFO filled by a loader
+ * @return One of the WAVE_SAMPLE_* encodings, or -1
+ */
+int
+waveSampleFormat(const WAVE_INFO* info)
+{
+    if (info->nChannels == 0)
+        return -1;
+
+    // the container size, see "PCM Format" in wave.h
+    int container = info->nBlockAlign / info->nChannels;
+
+    uint16_t code = info->wFormatTag;
+
+    if (code == WAVE_FORMAT_PCM) {
+        switch (container) {
+        case 1: return WAVE_SAMPLE_U8;
+        case 2: return WAVE_SAMPLE_S16;
+        case 3: return WAVE_SAMPLE_S24;
+        case 4: return WAVE_SAMPLE_S32;
+        }
+    } else if (code == WAVE_FORMAT_IEEE_FLOAT) {
+        switch (container) {
+        case 4: return WAVE_SAMPLE_F32;
+        case 8: return WAVE_SAMPLE_F64;
+        }
+    } else if (code == WAVE_FORMAT_ALAW && container == 1) {
+        return WAVE_SAMPLE_ALAW;
+    } else if (code == WAVE_FORMAT_MULAW && container == 1) {
+        return WAVE_SAMPLE_MULAW;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Size in bytes of one sample
+ * @param sampleFormat One of the WAVE_SAMPLE_* encodings
+ * @return The size, 0 for an unknown encoding
+ */
+size_t
+waveSampleSize(int sampleFormat)
+{
+    switch (sampleFormat) {
+    case WAVE_SAMPLE_U8:
+    case WAVE_SAMPLE_ALAW:
+    case WAVE_SAMPLE_MULAW: return 1;
+    case WAVE_SAMPLE_S16:   return 2;
+    case WAVE_SAMPLE_S24:   return 3;
+    case WAVE_SAMPLE_S32:
+    case WAVE_SAMPLE_F32:   return 4;
+    case WAVE_SAMPLE_F64:   return 8;
+    default:                return 0;
+    }
+}
+
+/*
+ * Scalar kernels. The data of a wave file has no alignment guarantee, loads
+ * go through memcpy.
+ */
+static void
+waveU8ToFloatC(const void* src, float* dst, size_t n)
+{
+    const uint8_t* in = (const uint8_t*) src;
+    size_t i;
+    for (i = 0; i < n; i++)
+        dst[i] = (float) ((int) in[i] - 128) * (1.0f / 128);
+}
+
+static void
+waveS16ToFloatC(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        int16_t v;
+        memcpy(&v, in + 2 * i, 2);
+        dst[i] = (float) v * (1.0f / 32768);
+    }
+}
+
+static void
+waveS24ToFloatC(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        const unsigned char* p = in + 3 * i;
+        int32_t v = (int32_t) (((uint32_t) p[0] << 8) |
+                               ((uint32_t) p[1] << 16) |
+                               ((uint32_t) p[2] << 24)) >> 8;
+        dst[i] = (float) v * (1.0f / 8388608);
+    }
+}
+
+static void
+waveS32ToFloatC(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        int32_t v;
+        memcpy(&v, in + 4 * i, 4);
+        dst[i] = (float) v * (1.0f / 2147483648.0f);
+    }
+}
+
+static void
+waveF32ToFloatC(const void* src, float* dst, size_t n)
+{
+    memcpy(dst, src, n * sizeof(float));
+}
+
+static void
+waveF64ToFloatC(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        double v;
+        memcpy(&v, in + 8 * i, 8);
+        dst[i] = (float) v;
+    }
+}
+
+/*
+ * G.711 expansion, to 16-bit linear then float. Both laws go through a 256
+ * entries table.
+ */
+static float           waveAlawTable[256];
+static float           waveMulawTable[256];
+static volatile size_t waveLawTablesOnce = WAVE_ONCE_INIT;
+
+static void
+waveBuildLawTables(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+
+        int a   = i ^ 0x55;
+        int t   = (a & 0x0f) << 4;
+        int seg = (a & 0x70) >> 4;
+
+        if (seg == 0)
+            t += 8;
+        else if (seg == 1)
+            t += 0x108;
+        else
+            t = (t + 0x108) << (seg - 1);
+
+        waveAlawTable[i] = (float) ((a & 0x80) ? t : -t) * (1.0f / 32768);
+
+        int u = ~i & 0xff;
+        t = (((u & 0x0f) << 3) + 0x84) << ((u & 0x70) >> 4);
+
+        waveMulawTable[i] =
+            (float) ((u & 0x80) ? (0x84 - t) : (t - 0x84)) * (1.0f / 32768);
+    }
+}
+
+/*
+ * Build the tables on first use, safe from any number of threads
+ */
+static void
+waveInitLawTables(void)
+{
+    waveOnce(&waveLawTablesOnce, waveBuildLawTables);
+}
+
+static void
+waveAlawToFloatC(const void* src, float* dst, size_t n)
+{
+    const uint8_t* in = (const uint8_t*) src;
+    size_t i;
+    for (i = 0; i < n; i++)
+        dst[i] = waveAlawTable[in[i]];
+}
+
+static void
+waveMulawToFloatC(const void* src, float* dst, size_t n)
+{
+    const uint8_t* in = (const uint8_t*) src;
+    size_t i;
+    for (i = 0; i < n; i++)
+        dst[i] = waveMulawTable[in[i]];
+}
+
+#ifdef WAVE_X86
+
+/*
+ * SSE2 kernels
+ */
+WAVE_TARGET("sse2") static void
+waveU8ToFloatSSE2(const void* src, float* dst, size_t n)
+{
+    const uint8_t* in   = (const uint8_t*) src;
+    const __m128i  zero = _mm_setzero_si128();
+    const __m128   bias = _mm_set1_ps(128.0f);
+    const __m128   k    = _mm_set1_ps(1.0f / 128);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i x  = _mm_loadu_si128((const __m128i*) (in + i));
+        __m128i lo = _mm_unpacklo_epi8(x, zero);
+        __m128i hi = _mm_unpackhi_epi8(x, zero);
+
+        __m128 a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+        __m128 b = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+        __m128 c = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+        __m128 d = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+
+        _mm_storeu_ps(dst + i,      _mm_mul_ps(_mm_sub_ps(a, bias), k));
+        _mm_storeu_ps(dst + i + 4,  _mm_mul_ps(_mm_sub_ps(b, bias), k));
+        _mm_storeu_ps(dst + i + 8,  _mm_mul_ps(_mm_sub_ps(c, bias), k));
+        _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_sub_ps(d, bias), k));
+    }
+
+    waveU8ToFloatC(in + i, dst + i, n - i);
+}
+
+WAVE_TARGET("sse2") static void
+waveS16ToFloatSSE2(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    const __m128         k  = _mm_set1_ps(1.0f / 32768);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i x  = _mm_loadu_si128((const __m128i*) (in + 2 * i));
+
+        // sign extend by shifting the sample down from the high half
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+        _mm_storeu_ps(dst + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), k));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), k));
+    }
+
+    waveS16ToFloatC(in + 2 * i, dst + i, n - i);
+}
+
+WAVE_TARGET("sse2") static void
+waveS32ToFloatSSE2(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    const __m128         k  = _mm_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (in + 4 * i));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), k));
+    }
+
+    waveS32ToFloatC(in + 4 * i, dst + i, n - i);
+}
+
+WAVE_TARGET("sse2") static void
+waveF64ToFloatSSE2(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_cvtpd_ps(_mm_loadu_pd((const double*) (in + 8 * i)));
+        __m128 b = _mm_cvtpd_ps(_mm_loadu_pd((const double*) (in + 8 * i + 16)));
+        _mm_storeu_ps(dst + i, _mm_movelh_ps(a, b));
+    }
+
+    waveF64ToFloatC(in + 8 * i, dst + i, n - i);
+}
+
+/*
+ * SSSE3 kernel: pshufb moves each 3 bytes sample to the top of a 32-bit lane,
+ * an arithmetic shift brings it back with its sign.
+ */
+WAVE_TARGET("ssse3") static void
+waveS24ToFloatSSSE3(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in   = (const unsigned char*) src;
+    const __m128i        mask = _mm_setr_epi8(
+            -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    const __m128         k    = _mm_set1_ps(1.0f / 8388608);
+    size_t i = 0;
+
+    // each load reads 16 bytes for 12 used
+    for (; i + 6 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (in + 3 * i));
+        x = _mm_srai_epi32(_mm_shuffle_epi8(x, mask), 8);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), k));
+    }
+
+    waveS24ToFloatC(in + 3 * i, dst + i, n - i);
+}
+
+/*
+ * AVX2 kernels
+ */
+WAVE_TARGET("avx2") static void
+waveU8ToFloatAVX2(const void* src, float* dst, size_t n)
+{
+    const uint8_t* in   = (const uint8_t*) src;
+    const __m256   bias = _mm256_set1_ps(128.0f);
+    const __m256   k    = _mm256_set1_ps(1.0f / 128);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (in + i));
+        __m256  a = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(x));
+        __m256  b = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(x, 8)));
+
+        _mm256_storeu_ps(dst + i,     _mm256_mul_ps(_mm256_sub_ps(a, bias), k));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_sub_ps(b, bias), k));
+    }
+
+    waveU8ToFloatC(in + i, dst + i, n - i);
+}
+
+WAVE_TARGET("avx2") static void
+waveS16ToFloatAVX2(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    const __m256         k  = _mm256_set1_ps(1.0f / 32768);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (in + 2 * i));
+        __m128i y = _mm_loadu_si128((const __m128i*) (in + 2 * i + 16));
+        __m256  a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x));
+        __m256  b = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(y));
+
+        _mm256_storeu_ps(dst + i,     _mm256_mul_ps(a, k));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(b, k));
+    }
+
+    waveS16ToFloatC(in + 2 * i, dst + i, n - i);
+}
+
+WAVE_TARGET("avx2") static void
+waveS24ToFloatAVX2(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in   = (const unsigned char*) src;
+    const __m256i        mask = _mm256_setr_epi8(
+            -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+            -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    const __m256         k    = _mm256_set1_ps(1.0f / 8388608);
+    size_t i = 0;
+
+    // 8 samples from two 16 bytes loads, 12 bytes apart
+    for (; i + 10 <= n; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i*) (in + 3 * i));
+        __m128i hi = _mm_loadu_si128((const __m128i*) (in + 3 * i + 12));
+        __m256i x  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        x = _mm256_srai_epi32(_mm256_shuffle_epi8(x, mask), 8);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), k));
+    }
+
+    waveS24ToFloatC(in + 3 * i, dst + i, n - i);
+}
+
+WAVE_TARGET("avx2") static void
+waveS32ToFloatAVX2(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    const __m256         k  = _mm256_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (in + 4 * i));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), k));
+    }
+
+    waveS32ToFloatC(in + 4 * i, dst + i, n - i);
+}
+
+WAVE_TARGET("avx2") static void
+waveF64ToFloatAVX2(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm256_cvtpd_ps(_mm256_loadu_pd((const double*) (in + 8 * i)));
+        __m128 b = _mm256_cvtpd_ps(_mm256_loadu_pd((const double*) (in + 8 * i + 32)));
+        _mm_storeu_ps(dst + i,     a);
+        _mm_storeu_ps(dst + i + 4, b);
+    }
+
+    waveF64ToFloatC(in + 8 * i, dst + i, n - i);
+}
+
+#ifdef WAVE_HAVE_AVX512
+
+/*
+ * AVX-512 kernels (AVX512F and AVX512BW)
+ */
+WAVE_TARGET("avx512f,avx512bw") static void
+waveU8ToFloatAVX512(const void* src, float* dst, size_t n)
+{
+    const uint8_t* in   = (const uint8_t*) src;
+    const __m512   bias = _mm512_set1_ps(128.0f);
+    const __m512   k    = _mm512_set1_ps(1.0f / 128);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (in + i));
+        __m512  a = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(x));
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_sub_ps(a, bias), k));
+    }
+
+    waveU8ToFloatC(in + i, dst + i, n - i);
+}
+
+WAVE_TARGET("avx512f,avx512bw") static void
+waveS16ToFloatAVX512(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    const __m512         k  = _mm512_set1_ps(1.0f / 32768);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (in + 2 * i));
+        __m512  a = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(x));
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(a, k));
+    }
+
+    waveS16ToFloatC(in + 2 * i, dst + i, n - i);
+}
+
+WAVE_TARGET("avx512f,avx512bw") static void
+waveS24ToFloatAVX512(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in   = (const unsigned char*) src;
+    const __m512i        mask = _mm512_broadcast_i32x4(_mm_setr_epi8(
+            -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11));
+    const __m512         k    = _mm512_set1_ps(1.0f / 8388608);
+    size_t i = 0;
+
+    // 16 samples from four 16 bytes loads, 12 bytes apart
+    for (; i + 18 <= n; i += 16) {
+        const unsigned char* p = in + 3 * i;
+
+        __m512i x = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i*) p));
+        x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*) (p + 12)), 1);
+        x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*) (p + 24)), 2);
+        x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*) (p + 36)), 3);
+
+        x = _mm512_srai_epi32(_mm512_shuffle_epi8(x, mask), 8);
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_cvtepi32_ps(x), k));
+    }
+
+    waveS24ToFloatC(in + 3 * i, dst + i, n - i);
+}
+
+WAVE_TARGET("avx512f,avx512bw") static void
+waveS32ToFloatAVX512(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    const __m512         k  = _mm512_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m512i x = _mm512_loadu_si512((const void*) (in + 4 * i));
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_cvtepi32_ps(x), k));
+    }
+
+    waveS32ToFloatC(in + 4 * i, dst + i, n - i);
+}
+
+WAVE_TARGET("avx512f,avx512bw") static void
+waveF64ToFloatAVX512(const void* src, float* dst, size_t n)
+{
+    const unsigned char* in = (const unsigned char*) src;
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256 a = _mm512_cvtpd_ps(_mm512_loadu_pd((const void*) (in + 8 * i)));
+        __m256 b = _mm512_cvtpd_ps(_mm512_loadu_pd((const void*) (in + 8 * i + 64)));
+        _mm256_storeu_ps(dst + i,     a);
+        _mm256_storeu_ps(dst + i + 8, b);
+    }
+
+    waveF64ToFloatC(in + 8 * i, dst + i, n - i);
+}
+
+#endif // WAVE_HAVE_AVX512
+#endif // WAVE_X86
+
+/*
+ * Kernels of each SIMD level, indexed by WAVE_SAMPLE_*. All the levels are
+ * filled once, so changing the level never rewrites a table that another
+ * thread is reading.
+ */
+static WAVE_TO_FLOAT
+waveToFloatKernels[WAVE_SIMD_AVX512 + 1][WAVE_SAMPLE_FORMATS];
+static volatile size_t waveToFloatOnce = WAVE_ONCE_INIT;
+
+static void
+waveSelectToFloat(WAVE_TO_FLOAT* k, int level)
+{
+    k[WAVE_SAMPLE_U8]    = waveU8ToFloatC;
+    k[WAVE_SAMPLE_S16]   = waveS16ToFloatC;
+    k[WAVE_SAMPLE_S24]   = waveS24ToFloatC;
+    k[WAVE_SAMPLE_S32]   = waveS32ToFloatC;
+    k[WAVE_SAMPLE_F32]   = waveF32ToFloatC;
+    k[WAVE_SAMPLE_F64]   = waveF64ToFloatC;
+    k[WAVE_SAMPLE_ALAW]  = waveAlawToFloatC;
+    k[WAVE_SAMPLE_MULAW] = waveMulawToFloatC;
+
+#ifdef WAVE_X86
+    if (level >= WAVE_SIMD_SSE2) {
+        k[WAVE_SAMPLE_U8]  = waveU8ToFloatSSE2;
+        k[WAVE_SAMPLE_S16] = waveS16ToFloatSSE2;
+        k[WAVE_SAMPLE_S32] = waveS32ToFloatSSE2;
+        k[WAVE_SAMPLE_F64] = waveF64ToFloatSSE2;
+    }
+    if (level >= WAVE_SIMD_SSSE3) {
+        k[WAVE_SAMPLE_S24] = waveS24ToFloatSSSE3;
+    }
+    if (level >= WAVE_SIMD_AVX2) {
+        k[WAVE_SAMPLE_U8]  = waveU8ToFloatAVX2;
+        k[WAVE_SAMPLE_S16] = waveS16ToFloatAVX2;
+        k[WAVE_SAMPLE_S24] = waveS24ToFloatAVX2;
+        k[WAVE_SAMPLE_S32] = waveS32ToFloatAVX2;
+        k[WAVE_SAMPLE_F64] = waveF64ToFloatAVX2;
+    }
+#ifdef WAVE_HAVE_AVX512
+    if (level >= WAVE_SIMD_AVX512) {
+        k[WAVE_SAMPLE_U8]  = waveU8ToFloatAVX512;
+        k[WAVE_SAMPLE_S16] = waveS16ToFloatAVX512;
+        k[WAVE_SAMPLE_S24] = waveS24ToFloatAVX512;
+        k[WAVE_SAMPLE_S32] = waveS32ToFloatAVX512;
+        k[WAVE_SAMPLE_F64] = waveF64ToFloatAVX512;
+    }
+#endif
+#endif // WAVE_X86
+
+    (void) level;
+}
+
+static void
+waveBuildToFloat(void)
+{
+    int level;
+
+    waveInitLawTables();
+
+    for (level = WAVE_SIMD_NONE; level <= WAVE_SIMD_AVX512; level++)
+        waveSelectToFloat(waveToFloatKernels[level], level);
+}
+
+/**
+ * @brief Convert samples to normalized float32
+ * @param src The samples, as stored in the data chunk
+ * @param sampleFormat One of the WAVE_SAMPLE_* encodings
+ * @param dst Destination, room for samples floats
+ * @param samples Number of samples (frames * channels)
+ * @return 0 on success, -1 for an unknown encoding
+ */
+int
+waveToFloat(const void* src, int sampleFormat, float* dst, size_t samples)
+{
+    if (sampleFormat <= 0 || sampleFormat >= WAVE_SAMPLE_FORMATS)
+        return -1;
+
+    waveOnce(&waveToFloatOnce, waveBuildToFloat);
+    waveToFloatKernels[waveSimdLevel()][sampleFormat](src, dst, samples);
+
+    return 0;
+}
+
+/**
+ * @brief Load a wave file as normalized float32 samples
+ *
+ * The file is mapped and converted in one pass.
+ *
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable
+ * @return The interleaved samples, to release with waveFree, or NULL
+ */
+float*
+waveLoadFloat(char* fileName, WAVE_INFO* info)
+{
+    WAVE_MAP map;
+    void*    data = waveMap(fileName, info, &map, WAVE_MAP_SEQUENTIAL);
+
+    if (!data)
+        return NULL;
+
+    int    format  = waveSampleFormat(info);
+    size_t samples = format > 0 ? map.dataSize / waveSampleSize(format) : 0;
+    float* out     = format > 0 ?
+        (float*) waveAlloc(samples * sizeof(float)) : NULL;
+
+    if (out) {
+        uint64_t start = waveStageStart();
+        waveToFloat(data, format, out, samples);
+        waveStageEnd(&waveStatsCounters.convertTime, start);
+    } else {
+        waveError(format > 0 ? WAVE_ERROR_MEMORY : WAVE_ERROR_UNSUPPORTED,
+                  fileName);
+    }
+
+    waveUnmap(&map);
+
+    return out;
+}
+
+/**
+ * @brief Read the next frames of a stream as normalized float32 samples
+ * @param stream A stream from waveOpen
+ * @param buffer Destination, at least frames * nChannels floats
+ * @param frames Number of frames wanted
+ * @return The number of frames read, 0 at the end of the data
+ */
+size_t
+waveReadFloat(WAVE_STREAM* stream, float* buffer, size_t frames)
+{
+    int format = waveSampleFormat(&stream->info);
+    if (format < 0)
+        return 0;
+
+    // raw frames go through a scratch buffer small enough to stay in cache
+    unsigned char scratch[16 * 1024];
+    size_t        blockAlign = stream->info.nBlockAlign;
+    size_t        perPass    = sizeof(scratch) / blockAlign;
+    size_t        channels   = stream->info.nChannels;
+    size_t        done       = 0;
+
+    if (perPass == 0)
+        return 0;
+
+    while (done < frames) {
+
+        size_t want = frames - done;
+        if (want > perPass) want = perPass;
+
+        size_t got = waveReadFrames(stream, scratch, want);
+        if (got == 0)
+            break;
+
+        uint64_t start = waveStageStart();
+        waveToFloat(scratch, format, buffer + done * channels, got * channels);
+        waveStageEnd(&waveStatsCounters.convertTime, start);
+        done += got;
+
+        if (got < want)
+            break;
+    }
+
+    return done;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
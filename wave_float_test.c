@@ -0,0 +1,997 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "wave_float.h"
+#include "wave_planar.h"
+#include "wave_resample.h"
+#include "wave_peaks.h"
+#include "wave_mix.h"
+#include "wave_quantize.h"
+#include "wave_loudness.h"
+
+#include <math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Check every SIMD level against the scalar kernels, on random samples, and
+ * print the throughput of each.
+ */
+
+#define SAMPLES (1 << 20)
+#define ROUNDS  8
+
+static const char* formatNames[WAVE_SAMPLE_FORMATS] = {
+    "", "u8", "s16", "s24", "s32", "f32", "f64", "alaw", "mulaw"
+};
+
+static const char* levelNames[] = {
+    "scalar", "sse2", "ssse3", "avx2", "avx512"
+};
+
+/*
+ * Resample a stereo 1 kHz sine and cosine, fed and drained in odd sized
+ * blocks, into out. Returns the number of frames.
+ */
+static size_t
+resampleSine(uint32_t inRate, uint32_t outRate, int quality, float* out,
+             size_t outMax)
+{
+    const double    pi     = 3.14159265358979323846;
+    size_t          frames = inRate / 2;
+    float*          in     = malloc(frames * 2 * sizeof(float));
+    WAVE_RESAMPLER* r      = waveResamplerCreate(2, inRate, outRate, quality);
+    size_t          taken  = 0;
+    size_t          done   = 0;
+    size_t          i;
+
+    for (i = 0; i < frames; i++) {
+        in[i * 2]     = (float) sin(2 * pi * 1000 * i / inRate);
+        in[i * 2 + 1] = (float) cos(2 * pi * 1000 * i / inRate);
+    }
+
+    while (taken < frames) {
+        size_t n = frames - taken;
+        if (n > 777) n = 777;
+        size_t room = outMax - done;
+        if (room > 333) room = 333;
+        done  += waveResample(r, in + taken * 2, &n, out + done * 2, room);
+        taken += n;
+    }
+
+    size_t got;
+    while ((got = waveResampleFlush(r, out + done * 2, outMax - done)) > 0)
+        done += got;
+
+    waveResamplerFree(r);
+    free(in);
+
+    return done;
+}
+
+
+int main(int argc, char* argv[])
+{
+    size_t         rawSize = SAMPLES * 8;
+    unsigned char* raw     = malloc(rawSize);
+    float*         ref     = malloc(SAMPLES * sizeof(float));
+    float*         out     = malloc(SAMPLES * sizeof(float));
+    int            status  = 0;
+    size_t         i;
+
+    srand(42);
+    for (i = 0; i < rawSize; i++)
+        raw[i] = (unsigned char) rand();
+
+    // keep the float inputs finite, full scale
+    float*  f32 = (float*) raw;
+    double* f64 = (double*) raw;
+    int     detected = waveSetSimdLevel(WAVE_SIMD_AVX512);
+
+    printf("detected SIMD level: %s\n", levelNames[detected]);
+
+    int format;
+    for (format = 1; format < WAVE_SAMPLE_FORMATS; format++) {
+
+        if (format == WAVE_SAMPLE_F32)
+            for (i = 0; i < SAMPLES; i++)
+                f32[i] = (float) rand() / RAND_MAX * 2 - 1;
+        if (format == WAVE_SAMPLE_F64)
+            for (i = 0; i < SAMPLES; i++)
+                f64[i] = (double) rand() / RAND_MAX * 2 - 1;
+
+        // odd lengths exercise the scalar tails
+        waveSetSimdLevel(WAVE_SIMD_NONE);
+        waveToFloat(raw, format, ref, SAMPLES);
+
+        int level;
+        for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+
+            waveSetSimdLevel(level);
+
+            size_t n;
+            for (n = SAMPLES - 37; n <= SAMPLES; n += 37) {
+                memset(out, 0, SAMPLES * sizeof(float));
+                waveToFloat(raw, format, out, n);
+                if (memcmp(out, ref, n * sizeof(float)) != 0) {
+                    printf("%s %s: mismatch with the scalar kernel (n=%zu)\n",
+                           formatNames[format], levelNames[level], n);
+                    status = 1;
+                }
+            }
+
+            clock_t start = clock();
+            int r;
+            for (r = 0; r < ROUNDS; r++)
+                waveToFloat(raw, format, out, SAMPLES);
+            double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+            if (seconds > 0)
+                printf("%-6s %-7s %8.0f MB/s in %8.0f MB/s out\n",
+                       formatNames[format], levelNames[level],
+                       (double) SAMPLES * ROUNDS * waveSampleSize(format) / seconds / 1e6,
+                       (double) SAMPLES * ROUNDS * sizeof(float) / seconds / 1e6);
+        }
+    }
+
+    // full scale values
+    unsigned char s24[6] = {0x00, 0x00, 0x80, 0xff, 0xff, 0x7f};
+    float         v[2];
+    waveToFloat(s24, WAVE_SAMPLE_S24, v, 2);
+    if (v[0] != -1.0f || v[1] != 8388607.0f / 8388608) {
+        printf("s24 full scale: %f %f\n", v[0], v[1]);
+        status = 1;
+    }
+
+    unsigned char laws[2] = {0xd5, 0xff};
+    waveToFloat(laws, WAVE_SAMPLE_ALAW, v, 1);
+    waveToFloat(laws + 1, WAVE_SAMPLE_MULAW, v + 1, 1);
+    if (v[0] != 8.0f / 32768 || v[1] != 0.0f) {
+        printf("G.711 silence: %f %f\n", v[0], v[1]);
+        status = 1;
+    }
+
+    // planar round trip, for every channel count up to 8
+    int channels;
+    for (channels = 1; channels <= 8; channels++) {
+
+        WAVE_INFO   layout;
+        WAVE_PLANAR planar;
+        size_t      frames = 1000 + channels;
+
+        memset(&layout, 0, sizeof(layout));
+        layout.nChannels = (uint16_t) channels;
+
+        float* back = malloc(frames * channels * sizeof(float));
+        wavePlanarInit(&planar, &layout, frames);
+
+        int level;
+        for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+
+            waveSetSimdLevel(level);
+            memset(back, 0, frames * channels * sizeof(float));
+
+            waveDeinterleave(ref, &planar, 0, frames);
+            waveInterleave(&planar, 0, frames, back);
+
+            if (planar.channel[channels - 1][frames - 1] !=
+                    ref[frames * channels - 1] ||
+                memcmp(back, ref, frames * channels * sizeof(float)) != 0)
+            {
+                printf("planar %d channels %s: round trip mismatch\n",
+                       channels, levelNames[level]);
+                status = 1;
+            }
+        }
+
+        wavePlanarFree(&planar);
+        free(back);
+    }
+
+    // resampled sines, against the ideal ones, at every SIMD level
+    const uint32_t rates[][2] = {{44100, 48000}, {96000, 48000},
+                                 {48000, 44100}, {48000, 48000},
+                                 {44100, 48001}};
+    const double   pi         = 3.14159265358979323846;
+    float*         first      = malloc(SAMPLES * sizeof(float));
+    size_t         t;
+
+    for (t = 0; t < sizeof(rates) / sizeof(rates[0]); t++) {
+
+        uint32_t inRate  = rates[t][0];
+        uint32_t outRate = rates[t][1];
+        size_t   expect  = ((size_t) inRate / 2 * outRate + inRate - 1) / inRate;
+        int      quality;
+
+        for (quality = WAVE_RESAMPLE_FAST; quality <= WAVE_RESAMPLE_BEST;
+             quality++)
+        {
+            int level;
+            for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+
+                waveSetSimdLevel(level);
+
+                size_t n     = resampleSine(inRate, outRate, quality, out,
+                                            SAMPLES / 2);
+                double worst = 0;
+
+                for (i = 200; i + 200 < n; i++) {
+                    double x = 2 * pi * 1000 * i / outRate;
+                    double e = fabs(out[i * 2] - sin(x)) +
+                               fabs(out[i * 2 + 1] - cos(x));
+                    if (e > worst) worst = e;
+                }
+
+                if (level == WAVE_SIMD_NONE)
+                    memcpy(first, out, n * 2 * sizeof(float));
+
+                double drift = 0;
+                for (i = 0; i < n * 2; i++)
+                    if (fabs(out[i] - first[i]) > drift)
+                        drift = fabs(out[i] - first[i]);
+
+                if (n != expect || worst > 2e-3 || drift > 1e-5) {
+                    printf("resample %u -> %u q%d %s: %zu frames of %zu, "
+                           "error %g, %g from scalar\n", inRate, outRate,
+                           quality, levelNames[level], n, expect, worst, drift);
+                    status = 1;
+                }
+            }
+        }
+    }
+
+    free(first);
+    waveSetSimdLevel(detected);
+
+    // standard mixes, then every SIMD level against the scalar one
+    const float h = WAVE_MIX_HALF_POWER;
+    const struct {
+        uint32_t in, out;
+        float    matrix[48];
+    } mixes[] = {
+        {WAVE_MIX_5POINT1, WAVE_MIX_STEREO, {1, 0, h, 0, h, 0,
+                                             0, 1, h, 0, 0, h}},
+        {WAVE_MIX_MONO,    WAVE_MIX_STEREO, {h, h}},
+        {WAVE_MIX_STEREO,  WAVE_MIX_MONO,   {h, h}},
+        {WAVE_MIX_STEREO,  WAVE_MIX_5POINT1, {1, 0, 0, 1}},
+        {WAVE_MIX_5POINT1 | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT,
+         WAVE_MIX_5POINT1, {1, 0, 0, 0, 0, 0, 0, 0,
+                            0, 1, 0, 0, 0, 0, 0, 0,
+                            0, 0, 1, 0, 0, 0, 0, 0,
+                            0, 0, 0, 1, 0, 0, 0, 0,
+                            0, 0, 0, 0, 1, 0, 1, 0,
+                            0, 0, 0, 0, 0, 1, 0, 1}},
+    };
+    WAVE_MIX mix;
+
+    for (t = 0; t < sizeof(mixes) / sizeof(mixes[0]); t++) {
+
+        int in   = waveChannelCount(mixes[t].in);
+        int outs = waveChannelCount(mixes[t].out);
+        int n    = in * outs;
+
+        waveMixInit(&mix, mixes[t].in, in, mixes[t].out, outs, 0);
+        if (memcmp(mix.matrix, mixes[t].matrix, n * sizeof(float)) != 0) {
+            printf("mix %x -> %x: unexpected matrix\n", mixes[t].in,
+                   mixes[t].out);
+            status = 1;
+        }
+        waveMixFree(&mix);
+    }
+
+    {
+        size_t       frames = 1000 + 3;
+        const float* in[6];
+        float*       mixed[2];
+        float*       first  = malloc(frames * 2 * sizeof(float));
+        float*       inter  = malloc(frames * 2 * sizeof(float));
+        int          level, c;
+
+        for (c = 0; c < 6; c++)
+            in[c] = ref + c * frames;
+        mixed[0] = out;
+        mixed[1] = out + frames;
+
+        waveMixInit(&mix, WAVE_MIX_5POINT1, 6, WAVE_MIX_STEREO, 2,
+                    WAVE_MIX_NORMALIZE | WAVE_MIX_LFE);
+
+        for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+
+            waveSetSimdLevel(level);
+            waveMixPlanar(&mix, in, mixed, frames);
+
+            if (level == WAVE_SIMD_NONE)
+                memcpy(first, out, frames * 2 * sizeof(float));
+
+            // interleaved input: ref read as 6 channel frames
+            waveMixInterleaved(&mix, ref, inter, frames);
+
+            for (i = 0; i < frames * 2; i++) {
+                // the LFE reaches the sides through the center
+                size_t       f = i / 2;
+                const float* x = ref + f * 6;
+                float        e = x[i % 2] + h * x[2] + h * h * x[3] +
+                                 h * x[4 + i % 2];
+
+                if (fabsf(out[i] - first[i]) > 1e-6f ||
+                    fabsf(inter[i] - e / (1 + 2 * h + h * h)) > 1e-5f)
+                {
+                    printf("mix %s: frame %zu differs\n", levelNames[level], f);
+                    status = 1;
+                    break;
+                }
+            }
+        }
+
+        waveMixFree(&mix);
+        free(first);
+        free(inter);
+        waveSetSimdLevel(detected);
+    }
+
+    // byte swaps in place, every level against the scalar one, and back
+    {
+        static const int sizes[] = {2, 3, 4, 8};
+        unsigned char*   swapped = malloc(rawSize);
+        unsigned char*   first   = malloc(rawSize);
+
+        for (t = 0; t < 4; t++) {
+
+            int    size  = sizes[t];
+            size_t bytes = (SAMPLES - 5) * (size_t) size;
+            int    level;
+
+            for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+
+                waveSetSimdLevel(level);
+                memcpy(swapped, raw, bytes);
+                waveSwapBytes(swapped, bytes, size);
+
+                if (level == WAVE_SIMD_NONE)
+                    memcpy(first, swapped, bytes);
+
+                int same = memcmp(swapped, first, bytes) == 0 &&
+                           swapped[bytes - size] == raw[bytes - 1] &&
+                           swapped[bytes - 1] == raw[bytes - size];
+
+                waveSwapBytes(swapped, bytes, size);
+
+                if (!same || memcmp(swapped, raw, bytes) != 0) {
+                    printf("swap %d bytes %s: mismatch\n", size,
+                           levelNames[level]);
+                    status = 1;
+                }
+            }
+        }
+
+        free(swapped);
+        free(first);
+        waveSetSimdLevel(detected);
+    }
+
+    // quantized back to PCM, every level against the scalar one, in calls
+    // of odd lengths that leave the dither lanes anywhere
+    {
+        float*         wide  = malloc(SAMPLES * sizeof(float));
+        unsigned char* first = malloc(SAMPLES * 4);
+        unsigned char* pcm   = malloc(SAMPLES * 4);
+        WAVE_QUANTIZER q;
+        int            dither, level;
+
+        for (i = 0; i < SAMPLES; i++)
+            wide[i] = (float) rand() / RAND_MAX * 2.5f - 1.25f;
+
+        for (format = WAVE_SAMPLE_U8; format <= WAVE_SAMPLE_S32; format++) {
+
+            size_t size = waveSampleSize(format);
+            size_t expect = 0;
+
+            for (dither = WAVE_DITHER_NONE; dither <= WAVE_DITHER_TPDF;
+                 dither++)
+            {
+                for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+
+                    size_t clipped = 0, done = 0, n = 1;
+
+                    waveSetSimdLevel(level);
+                    waveQuantizerInit(&q, format, 2, dither);
+                    memset(pcm, 0, SAMPLES * size);
+
+                    while (done < SAMPLES) {
+                        n = 1 + n * 31 % 4093;
+                        if (n > SAMPLES - done) n = SAMPLES - done;
+                        clipped += waveFromFloat(&q, wide + done,
+                                                 pcm + done * size, n);
+                        done += n;
+                    }
+
+                    if (level == WAVE_SIMD_NONE) {
+                        memcpy(first, pcm, SAMPLES * size);
+                        expect = clipped;
+                    }
+
+                    // a fifth of the samples are beyond full scale
+                    if (memcmp(pcm, first, SAMPLES * size) != 0 ||
+                        clipped != expect || q.clipped != clipped ||
+                        clipped < SAMPLES / 6 || clipped > SAMPLES / 4)
+                    {
+                        printf("quantize %s dither %d %s: mismatch with the "
+                               "scalar kernel, %zu clipped\n",
+                               formatNames[format], dither, levelNames[level],
+                               clipped);
+                        status = 1;
+                    }
+
+                    clock_t start = clock();
+                    int r;
+                    for (r = 0; r < ROUNDS; r++)
+                        waveFromFloat(&q, wide, pcm, SAMPLES);
+                    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+                    if (seconds > 0 && dither == WAVE_DITHER_TPDF)
+                        printf("%-6s %-7s %8.0f MB/s in %8.0f MB/s out, "
+                               "dithered\n",
+                               formatNames[format], levelNames[level],
+                               (double) SAMPLES * ROUNDS * sizeof(float) / seconds / 1e6,
+                               (double) SAMPLES * ROUNDS * size / seconds / 1e6);
+                }
+            }
+
+            // PCM converted to float and back is unchanged, but for 32-bit
+            // samples that float can not hold
+            if (format == WAVE_SAMPLE_S32)
+                continue;
+
+            for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+                waveSetSimdLevel(level);
+                waveQuantizerInit(&q, format, 2, WAVE_DITHER_NONE);
+                waveToFloat(raw, format, wide, SAMPLES);
+                if (waveFromFloat(&q, wide, pcm, SAMPLES) != 0 ||
+                    memcmp(pcm, raw, SAMPLES * size) != 0)
+                {
+                    printf("quantize %s %s: round trip mismatch\n",
+                           formatNames[format], levelNames[level]);
+                    status = 1;
+                }
+            }
+
+            for (i = 0; i < SAMPLES; i++)
+                wide[i] = (float) rand() / RAND_MAX * 2.5f - 1.25f;
+        }
+
+        // the shaped error sums to nothing over a few samples: its running
+        // sum stays within a few LSB, where plain TPDF drifts like a random
+        // walk
+        const size_t frames = 65536;
+        double       drift[2];
+
+        for (i = 0; i < frames * 2; i++)
+            wide[i] = (float) (0.5 * sin(2 * pi * 1000 * (i / 2) / 48000.0 +
+                                         i % 2));
+
+        for (dither = WAVE_DITHER_TPDF; dither <= WAVE_DITHER_SHAPED;
+             dither++)
+        {
+            double sum[2] = {0, 0};
+
+            waveQuantizerInit(&q, WAVE_SAMPLE_S16, 2, dither);
+            waveFromFloat(&q, wide, pcm, frames);
+            waveFromFloat(&q, wide + frames, pcm + frames * 2, frames);
+
+            drift[dither - WAVE_DITHER_TPDF] = 0;
+            for (i = 0; i < frames * 2; i++) {
+                int16_t x;
+                memcpy(&x, pcm + 2 * i, 2);
+                sum[i % 2] += x - wide[i] * 32768.0;
+                if (fabs(sum[i % 2]) > drift[dither - WAVE_DITHER_TPDF])
+                    drift[dither - WAVE_DITHER_TPDF] = fabs(sum[i % 2]);
+            }
+        }
+
+        if (drift[1] > 4 || drift[0] < 16) {
+            printf("quantize: shaped error drifts by %g LSB, TPDF by %g\n",
+                   drift[1], drift[0]);
+            status = 1;
+        }
+
+        // clipped samples do not upset the noise shaping
+        for (i = 0; i < frames * 2; i++)
+            wide[i] *= 2.5f;
+
+        waveQuantizerInit(&q, WAVE_SAMPLE_S16, 2, WAVE_DITHER_SHAPED);
+        size_t clipped = waveFromFloat(&q, wide, pcm, frames * 2);
+
+        for (i = 0; i < frames * 2; i++) {
+            int16_t x;
+            memcpy(&x, pcm + 2 * i, 2);
+            double e = wide[i] * 32768.0;
+            if (e > 32767) e = 32767;
+            if (e < -32768) e = -32768;
+            if (fabs(x - e) > 8) break;
+        }
+
+        if (clipped == 0 || clipped != q.clipped || i != frames * 2) {
+            printf("quantize: shaped and clipped, %zu clipped, sample %zu "
+                   "off\n", clipped, i);
+            status = 1;
+        }
+
+        free(wide);
+        free(first);
+        free(pcm);
+        waveSetSimdLevel(detected);
+    }
+
+    // loudness of sines whose levels are known, in odd sized pieces
+    {
+        const size_t  frames = 48000 * 10;
+        float*        wide   = malloc(frames * 8 * sizeof(float));
+        WAVE_INFO     layout;
+        WAVE_LOUDNESS l;
+        WAVE_ANALYSIS ref, a;
+
+        memset(&layout, 0, sizeof(layout));
+        layout.nChannels      = 2;
+        layout.nSamplesPerSec = 48000;
+
+        // -23 dBFS at 1 kHz on both channels is -23 LUFS, the second
+        // channel also has a 0.25 offset; the 48 kHz / 4 sine at 45
+        // degrees peaks between its samples
+        double amplitude = pow(10, -23 / 20.0);
+        for (i = 0; i < frames; i++)
+            wide[i * 2] = (float) (amplitude * sin(2 * pi * 1000 * i / 48000));
+
+        int level;
+        for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+
+            waveSetSimdLevel(level);
+            waveLoudnessInit(&l, &layout);
+
+            for (i = 0; i < frames * 2; i += 2)
+                wide[i + 1] = wide[i];
+            waveLoudnessAdd(&l, wide, frames);
+            waveLoudnessResult(&l, &a);
+
+            if (fabs(a.integrated + 23) > 0.1 ||
+                fabs(a.momentaryMax + 23) > 0.1 ||
+                fabs(a.shortTermMax + 23) > 0.1 ||
+                fabs(waveLoudnessShortTerm(&l) + 23) > 0.1)
+            {
+                printf("loudness %s: %f LUFS, %f momentary, %f short-term\n",
+                       levelNames[level], a.integrated, a.momentaryMax,
+                       a.shortTermMax);
+                status = 1;
+            }
+
+            waveLoudnessFree(&l);
+            waveLoudnessInit(&l, &layout);
+
+            for (i = 0; i < frames; i++)
+                wide[i * 2 + 1] = (float) (0.25 + 0.5 * sin(pi * i / 2 + pi / 4));
+
+            size_t done, n;
+            for (done = 0; done < frames; done += n) {
+                n = frames - done < 777 ? frames - done : 777;
+                waveLoudnessAdd(&l, wide + done * 2, n);
+            }
+            waveLoudnessResult(&l, &a);
+
+            WAVE_LEVEL* x = &a.channel[1];
+            if (fabs(x->dc - 0.25) > 1e-4 || fabs(x->rms - sqrt(0.1875)) > 1e-4 ||
+                fabs(x->peak - (0.25 + 0.5 * sqrt(0.5))) > 1e-6 ||
+                fabs(x->truePeak - 0.75) > 0.01 ||
+                fabs(a.channel[0].truePeak - amplitude) > amplitude * 0.01)
+            {
+                printf("levels %s: dc %f rms %f peak %f true peak %f\n",
+                       levelNames[level], x->dc, x->rms, x->peak,
+                       x->truePeak);
+                status = 1;
+            }
+
+            waveLoudnessFree(&l);
+        }
+
+        // every channel count, each lane of the filters against the scalar
+        // ones; the low frequency channel of 5.1 does not count
+        for (channels = 1; channels <= 8; channels++) {
+
+            layout.nChannels     = (uint16_t) channels;
+            layout.dwChannelMask = channels == 6 ? 0x3F : 0;
+
+            for (i = 0; i < (size_t) (48000 * channels); i++)
+                wide[i] = (float) rand() / RAND_MAX * (i % channels + 1) / 8;
+
+            for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+
+                waveSetSimdLevel(level);
+                waveLoudnessInit(&l, &layout);
+                waveLoudnessAdd(&l, wide, 48000);
+                waveLoudnessResult(&l, level == WAVE_SIMD_NONE ? &ref : &a);
+                waveLoudnessFree(&l);
+
+                if (level == WAVE_SIMD_NONE)
+                    continue;
+
+                int c, same = fabs(a.integrated - ref.integrated) < 1e-9;
+                for (c = 0; c < channels; c++) {
+                    same = same &&
+                        a.channel[c].peak == ref.channel[c].peak &&
+                        fabs(a.channel[c].truePeak - ref.channel[c].truePeak) < 1e-6 &&
+                        fabs(a.channel[c].rms - ref.channel[c].rms) < 1e-5 &&
+                        fabs(a.channel[c].dc - ref.channel[c].dc) < 1e-5;
+                }
+
+                if (!same) {
+                    printf("loudness %s, %d channels: mismatch with the "
+                           "scalar kernels\n", levelNames[level], channels);
+                    status = 1;
+                }
+            }
+
+            if (channels == 6) {
+                for (i = 0; i < 48000 * 6; i++)
+                    if (i % 6 != 3)
+                        wide[i] = 0;
+
+                waveLoudnessInit(&l, &layout);
+                waveLoudnessAdd(&l, wide, 48000);
+                if (waveLoudnessIntegrated(&l) != -HUGE_VAL) {
+                    printf("loudness: the LFE is weighted\n");
+                    status = 1;
+                }
+                waveLoudnessFree(&l);
+            }
+        }
+
+        clock_t start = clock();
+        waveLoudnessInit(&l, &layout);
+        waveLoudnessAdd(&l, wide, frames);
+        waveLoudnessFree(&l);
+        double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+        if (seconds > 0)
+            printf("loudness %d channels %8.0f MB/s\n", layout.nChannels,
+                   (double) frames * 8 * sizeof(float) / seconds / 1e6);
+
+        free(wide);
+        waveSetSimdLevel(detected);
+    }
+
+    // a real file, loaded and streamed
+    if (argc > 1) {
+
+        WAVE_PLANAR planar;
+        WAVE_INFO   planarInfo;
+
+        if (waveLoadPlanar(argv[1], &planarInfo, &planar) != 0)
+            return 1;
+
+        // 5.1: the low frequency channel is the fourth one
+        if (planarInfo.nChannels == 6 &&
+            wavePlanarFind(&planar, SPEAKER_LOW_FREQUENCY) != 3)
+        {
+            printf("planar: no LFE on the 4th channel\n");
+            status = 1;
+        }
+
+        WAVE_INFO info;
+        float*    all = waveLoadFloat(argv[1], &info);
+
+        if (!all)
+            return 1;
+
+        WAVE_STREAM* stream = waveOpen(argv[1], &info, 0);
+        size_t       frames = (size_t) info.dataSize / info.nBlockAlign;
+        size_t       done   = 0;
+        size_t       got;
+        float*       block  = malloc(4096 * info.nChannels * sizeof(float));
+
+        while ((got = waveReadFloat(stream, block, 4096)) > 0) {
+            if (memcmp(block, all + done * info.nChannels,
+                       got * info.nChannels * sizeof(float)) != 0)
+                break;
+            if (planar.channel[info.nChannels - 1][done + got - 1] !=
+                    block[got * info.nChannels - 1])
+                break;
+            done += got;
+        }
+
+        if (done != frames) {
+            printf("streamed %zu frames out of %zu\n", done, frames);
+            status = 1;
+        }
+
+        free(block);
+        waveClose(stream);
+
+        // peaks of every block, at every SIMD level, against the samples
+        WAVE_PEAKS peaks;
+        int        level;
+
+        for (level = WAVE_SIMD_NONE; level <= detected; level++) {
+
+            waveSetSimdLevel(level);
+
+            if (wavePeaksCompute(argv[1], &peaks, 0) != 0)
+                return 1;
+
+            size_t entry, c;
+            for (entry = 0; entry < peaks.count[0]; entry++) {
+                for (c = 0; c < info.nChannels; c++) {
+
+                    size_t first = entry * peaks.blockFrames;
+                    size_t last  = first + peaks.blockFrames;
+                    float  lo    = 1, hi = -1;
+                    double sum   = 0;
+
+                    if (last > frames) last = frames;
+                    for (i = first; i < last; i++) {
+                        float x = all[i * info.nChannels + c];
+                        if (x < lo) lo = x;
+                        if (x > hi) hi = x;
+                        sum += (double) x * x;
+                    }
+
+                    WAVE_PEAK p = peaks.level[0][entry * info.nChannels + c];
+                    if (p.min != wavePeakQuantize(lo) ||
+                        p.max != wavePeakQuantize(hi) ||
+                        abs(p.rms - wavePeakQuantize(
+                                (float) sqrt(sum / (last - first)))) > 1)
+                    {
+                        printf("peaks %s: block %zu channel %zu is %d %d %d\n",
+                               levelNames[level], entry, c, p.min, p.max, p.rms);
+                        status = 1;
+                        break;
+                    }
+                }
+            }
+
+            wavePeaksFree(&peaks);
+        }
+
+        waveSetSimdLevel(detected);
+
+        // analyzed in one pass, or fed in odd pieces
+        WAVE_ANALYSIS analysis, fed;
+        WAVE_LOUDNESS loudness;
+
+        if (waveAnalyze(argv[1], &analysis) != 0 ||
+            waveLoudnessInit(&loudness, &info) != 0)
+            return 1;
+
+        for (done = 0; done < frames; done += got) {
+            got = frames - done < 1234 ? frames - done : 1234;
+            waveLoudnessAdd(&loudness, all + done * info.nChannels, got);
+        }
+        waveLoudnessResult(&loudness, &fed);
+        waveLoudnessFree(&loudness);
+
+        for (i = 0; i < info.nChannels; i++) {
+            if (analysis.frames != frames ||
+                analysis.channel[i].peak != fed.channel[i].peak ||
+                fabs(analysis.channel[i].truePeak - fed.channel[i].truePeak) > 1e-6 ||
+                fabs(analysis.channel[i].rms - fed.channel[i].rms) > 1e-5 ||
+                (analysis.integrated != fed.integrated &&
+                 fabs(analysis.integrated - fed.integrated) > 1e-9))
+            {
+                printf("analysis: channel %zu mismatch, %f LUFS\n", i,
+                       analysis.integrated);
+                status = 1;
+                break;
+            }
+        }
+
+        // the sidecar is used while valid, rewritten once stale
+        WAVE_PEAKS cached;
+        const char sidecar[] = "wave_float_test.peaks";
+
+        remove(sidecar);
+        wavePeaksCompute(argv[1], &peaks, 0);
+
+        if (wavePeaksOpen(argv[1], &cached, sidecar) == 0)
+            wavePeaksFree(&cached);
+
+        if (wavePeaksLoad(sidecar, &cached) != 0 ||
+            cached.levels != peaks.levels ||
+            cached.count[cached.levels - 1] != 1 ||
+            memcmp(cached.block, peaks.block,
+                   (cached.level[cached.levels - 1] + info.nChannels -
+                    cached.block) * sizeof(WAVE_PEAK)) != 0)
+        {
+            printf("peaks: sidecar mismatch\n");
+            status = 1;
+        }
+        wavePeaksFree(&cached);
+
+        peaks.fileTime--;
+        peaks.level[0][0].max = 12345;
+        wavePeaksSave(&peaks, sidecar);
+        wavePeaksFree(&peaks);
+
+        if (wavePeaksOpen(argv[1], &cached, sidecar) != 0 ||
+            cached.level[0][0].max == 12345 ||
+            wavePeaksLoad(sidecar, &peaks) != 0 ||
+            peaks.fileTime != cached.fileTime)
+        {
+            printf("peaks: stale sidecar kept\n");
+            status = 1;
+        }
+
+        if (wavePeaksPick(&cached, 1) != 0 ||
+            wavePeaksPick(&cached, 1e12) != cached.levels - 1 ||
+            wavePeaksPick(&cached, cached.blockFrames * 4.5) != 2)
+        {
+            printf("peaks: wrong zoom levels\n");
+            status = 1;
+        }
+
+        wavePeaksFree(&cached);
+        wavePeaksFree(&peaks);
+
+        // corrupt headers are rejected before anything is sized from them:
+        // levels that would wrap the allocation, too many levels
+        int corrupt;
+        for (corrupt = 0; corrupt < 2; corrupt++) {
+
+            WAVE_PEAKS_HEADER header;
+            FILE*             side = fopen(sidecar, "r+b");
+
+            if (!side || fread(&header, sizeof(header), 1, side) != 1) {
+                printf("peaks: sidecar not read back\n");
+                status = 1;
+                if (side)
+                    fclose(side);
+                break;
+            }
+
+            if (corrupt == 0) {
+                header.frames      = (uint64_t) 1 << 62;
+                header.blockFrames = 1;
+                header.nChannels   = 64;
+            } else {
+                header.levels = WAVE_PEAKS_LEVELS + 1;
+            }
+
+            fseek(side, 0, SEEK_SET);
+            fwrite(&header, sizeof(header), 1, side);
+            fclose(side);
+
+            if (wavePeaksLoad(sidecar, &cached) == 0 || cached.block) {
+                printf("peaks: corrupt sidecar %d loaded\n", corrupt);
+                wavePeaksFree(&cached);
+                status = 1;
+            }
+        }
+
+        remove(sidecar);
+
+        // folded to stereo in the library
+        size_t mixedFrames;
+        float* stereo = waveLoadMixed(argv[1], &info, WAVE_MIX_STEREO, 0,
+                                      &mixedFrames);
+        if (!stereo || mixedFrames != frames)
+            return 1;
+
+        waveMixInit(&mix, waveChannelMask(&info), info.nChannels,
+                    WAVE_MIX_STEREO, 2, 0);
+
+        for (i = 0; i < frames * 2; i++) {
+            const float* x = all + i / 2 * info.nChannels;
+            const float* g = mix.matrix + i % 2 * info.nChannels;
+            float        e = 0;
+            int          c;
+
+            for (c = 0; c < info.nChannels; c++)
+                e += g[c] * x[c];
+
+            if (fabsf(stereo[i] - e) > 1e-5f) {
+                printf("mixed to stereo: frame %zu differs\n", i / 2);
+                status = 1;
+                break;
+            }
+        }
+
+        waveMixFree(&mix);
+        waveFree(stereo);
+
+        // written back from float, without dither the file is unchanged
+        const char     copy[] = "wave_float_test.wav";
+        int            sampleFormat = waveSampleFormat(&info);
+        FMT_CHUNK      fmt;
+        WAVE_QUANTIZER q;
+        WAVE_INFO      copyInfo;
+
+        waveMakeFmt(&fmt, WAVE_FORMAT_PCM, info.nChannels, info.nSamplesPerSec,
+                    info.wBitsPerSample, waveChannelMask(&info));
+        waveQuantizerInit(&q, sampleFormat, info.nChannels, WAVE_DITHER_NONE);
+
+        WAVE_WRITER* writer = waveCreate((char*) copy, &fmt, 0, 0);
+        if (!writer)
+            return 1;
+
+        for (done = 0; done < frames; done += 1000) {
+            size_t n = frames - done < 1000 ? frames - done : 1000;
+            if (waveWriteFloat(writer, &q, all + done * info.nChannels, n) != 0)
+                break;
+        }
+
+        float* back = waveFinalize(writer) == 0 ?
+                      waveLoadFloat((char*) copy, &copyInfo) : NULL;
+
+        if (!back || q.clipped != 0 || copyInfo.dataSize != info.dataSize ||
+            memcmp(back, all, frames * info.nChannels * sizeof(float)) != 0)
+        {
+            printf("written from float: mismatch\n");
+            status = 1;
+        }
+
+        waveFree(back);
+        remove(copy);
+        free(all);
+
+        // resampled in one pass, or streamed
+        size_t resampled;
+        float* fast = waveLoadResampled(argv[1], &info, 22050,
+                                        WAVE_RESAMPLE_FAST, &resampled);
+        if (!fast)
+            return 1;
+
+        stream = waveOpen(argv[1], &info, 0);
+        WAVE_RESAMPLER* r = waveResamplerCreate(info.nChannels,
+                                info.nSamplesPerSec, 22050, WAVE_RESAMPLE_FAST);
+        block = malloc(1000 * info.nChannels * sizeof(float));
+        done  = 0;
+
+        while ((got = waveReadResampled(stream, r, block, 1000)) > 0) {
+            if (done + got > resampled ||
+                memcmp(block, fast + done * info.nChannels,
+                       got * info.nChannels * sizeof(float)) != 0)
+                break;
+            done += got;
+        }
+
+        if (done != resampled ||
+            resampled != waveResampleLength(r, frames))
+        {
+            printf("resampled %zu frames, streamed %zu\n", resampled, done);
+            status = 1;
+        }
+
+        free(block);
+        waveResamplerFree(r);
+        waveClose(stream);
+        waveFree(fast);
+        wavePlanarFree(&planar);
+    }
+
+    free(raw);
+    free(ref);
+    free(out);
+
+    return status;
+}
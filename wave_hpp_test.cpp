@@ -0,0 +1,188 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "wave.hpp"
+#include "wave_write.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+ * The typed views of a file against waveLoadFloat: usage is
+ * wave_hpp_test <wave file> <not a wave file>
+ */
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+        return 1;
+
+    WAVE_INFO info;
+    float*    ref = waveLoadFloat(argv[1], &info);
+
+    if (!ref)
+        return 1;
+
+    int status = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+
+        wave::File file = pass ? wave::File::map(argv[1])
+                               : wave::File::load(argv[1]);
+        wave::File owner(std::move(file));
+
+        if (file || !owner || owner.error() != WAVE_OK) {
+            std::printf("%s: not loaded\n", pass ? "map" : "load");
+            return 1;
+        }
+
+        std::size_t frames   = owner.frames();
+        std::size_t channels = owner.channels();
+
+        // one instantiation per encoding and layout, picked once
+        std::vector<float> out(frames * channels);
+        std::size_t extent = wave::dispatch(owner, [&](auto view) {
+            if (view.frames() == frames)
+                wave::toFloat(view, out.data());
+            return decltype(view)::extent;
+        });
+
+        std::size_t expected = channels == 2 || channels == 6 ?
+                               channels : wave::dynamic;
+
+        if (extent != expected ||
+            std::memcmp(out.data(), ref, out.size() * sizeof(float)) != 0)
+        {
+            std::printf("%s: dispatched view differs\n",
+                        pass ? "map" : "load");
+            status = 1;
+        }
+
+        // frames and channels of a 16-bit view agree
+        auto view = owner.view<std::int16_t>();
+        std::size_t c = channels - 1;
+        std::size_t f = 0;
+
+        for (std::int16_t s : view.channel(c)) {
+            if (s != view[f][c] || s != view.at(f, c))
+                break;
+            f++;
+        }
+
+        auto tail = view.sub(frames - 10, 100);
+
+        // the channel iterators work with the random access algorithms
+        auto channel = view.channel(c);
+        auto first   = channel.begin();
+        auto last    = std::prev(channel.end());
+        auto loudest = std::max_element(first, channel.end());
+        auto offset  = static_cast<std::size_t>(loudest - first);
+
+        decltype(first) none;
+
+        if (std::distance(first, channel.end()) !=
+                static_cast<std::ptrdiff_t>(frames) ||
+            *loudest != channel[offset] || *last != view[frames - 1][c] ||
+            first[5] != view[5][c] || !(first < last) ||
+            last - 3 + 3 != last || none != decltype(none)())
+        {
+            std::printf("%s: channel iterator mismatch\n",
+                        pass ? "map" : "load");
+            status = 1;
+        }
+
+        if (f != frames || view[0].size() != channels ||
+            tail.frames() != 10 || tail.data() != &view.at(frames - 10, 0) ||
+            !owner.view<float>().empty() ||
+            !owner.view<std::int16_t, 3>().empty())
+        {
+            std::printf("%s: view mismatch\n", pass ? "map" : "load");
+            status = 1;
+        }
+    }
+
+    // float data after a fact chunk starts on an even offset only (94 for
+    // a mono file), the float view of a mapped file must still be aligned
+    std::string input = argv[1];
+    std::string name  = "wave_hpp_test_float_" +
+                        input.substr(input.find_last_of("/\\") + 1);
+    std::size_t count = info.dataSize / info.nBlockAlign * info.nChannels;
+    FMT_CHUNK   fmt;
+
+    waveMakeFmt(&fmt, WAVE_FORMAT_IEEE_FLOAT, 1, info.nSamplesPerSec, 32, 0);
+
+    WAVE_WRITER* writer = waveCreate(&name[0], &fmt, 0, 0);
+
+    if (!writer || waveWriteFrames(writer, ref, count) != 0 ||
+        waveFinalize(writer) != 0)
+    {
+        std::printf("float copy: not written\n");
+        return 1;
+    }
+
+    WAVE_INFO   floatInfo;
+    WAVE_MAP    floatMap;
+    const void* mapped = waveMap(&name[0], &floatInfo, &floatMap,
+                                 WAVE_MAP_NORMAL);
+    bool        odd    = mapped &&
+                         reinterpret_cast<std::uintptr_t>(mapped) %
+                         alignof(float) != 0;
+
+    if (mapped)
+        waveUnmap(&floatMap);
+
+    wave::File floats = wave::File::map(name.c_str());
+    auto       view   = floats.view<float>();
+
+    if (!odd || view.empty() || view.frames() != count ||
+        reinterpret_cast<std::uintptr_t>(view.data()) % alignof(float) != 0 ||
+        std::memcmp(view.data(), ref, count * sizeof(float)) != 0)
+    {
+        std::printf("float copy: misaligned or different view\n");
+        status = 1;
+    }
+
+    floats = wave::File();
+    std::remove(name.c_str());
+
+    // failures are no exceptions
+    wave::File bad = wave::File::load(argv[2]);
+
+    if (bad || bad.error() != WAVE_ERROR_FORMAT || bad.frames() != 0 ||
+        wave::dispatch(bad, [](auto view) { return view.frames(); }) != 0)
+    {
+        std::printf("not a wave file: loaded\n");
+        status = 1;
+    }
+
+    waveFree(ref);
+
+    return status;
+}
@@ -0,0 +1,1050 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file wave_loudness.h
+ *
+ * Loudness and level analysis in one pass: the K-weighted loudness of
+ * ITU-R BS.1770 / EBU R128 (momentary, short-term and gated integrated),
+ * the true peak from 4x oversampling, and the sample peak, RMS and DC
+ * offset of every channel. Channels are weighted by their speaker position.
+ *
+ * The K-weighting filters recur over time, they run on the interleaved
+ * frames with a SIMD lane per channel. The other measures run on planar
+ * copies of the channels, several frames per instruction.
+ */
+
+#ifndef WAVE_LOUDNESS_H
+#define WAVE_LOUDNESS_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_float.h"
+#include "wave_planar.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Most channels of an analysis
+ */
+#define WAVE_LOUDNESS_CHANNELS         32
+
+/*
+ * Frames analyzed per pass
+ */
+#define WAVE_LOUDNESS_BLOCK            4096
+
+/*
+ * Samples of the previous pass kept before each planar channel, for the
+ * oversampling filter
+ */
+#define WAVE_LOUDNESS_HISTORY          32
+
+/*
+ * Taps of the oversampling filter, and the room of one of its phases
+ */
+#define WAVE_LOUDNESS_TAPS             49
+#define WAVE_LOUDNESS_PHASE            32
+
+/*
+ * 100 ms segments in the short-term window, 4 make the momentary one and a
+ * gating block
+ */
+#define WAVE_LOUDNESS_SEGMENTS         30
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * @brief Levels of a channel, full scale is 1
+ */
+typedef struct wave_level_t {
+
+    double peak;            // largest sample magnitude
+    double truePeak;        // largest magnitude between the samples too
+    double rms;
+    double dc;              // mean of the samples
+
+} WAVE_LEVEL;
+
+/**
+ * @brief Result of an analysis, loudness in LUFS, -HUGE_VAL for silence
+ */
+typedef struct wave_analysis_t {
+
+    uint16_t   nChannels;
+    uint64_t   frames;
+
+    double     integrated;      // gated, over the whole file
+    double     momentaryMax;    // loudest 400 ms
+    double     shortTermMax;    // loudest 3 s
+
+    WAVE_LEVEL channel[WAVE_LOUDNESS_CHANNELS];
+
+} WAVE_ANALYSIS;
+
+/**
+ * @brief A running analysis, see waveLoudnessInit
+ */
+typedef struct wave_loudness_t {
+
+    uint16_t    nChannels;
+    uint32_t    nSamplesPerSec;
+    uint64_t    frames;
+    int         failed;
+
+    double      weight[WAVE_LOUDNESS_CHANNELS];
+
+    // two biquads, b0 b1 b2 a1 a2 each, and their state by channel, with
+    // room for the unused lanes of the last SIMD group
+    double      coef[10];
+    double      state[4][WAVE_LOUDNESS_CHANNELS + 8];
+    double      energy[WAVE_LOUDNESS_CHANNELS + 8];
+
+    // weighted mean squares of the last 100 ms segments
+    size_t      segmentFrames;
+    size_t      segmentFill;
+    uint64_t    segments;
+    double      ring[WAVE_LOUDNESS_SEGMENTS];
+    double      momentary, shortTerm;
+    double      momentaryMax, shortTermMax;
+
+    // mean squares of the gating blocks above the absolute gate
+    double*     blocks;
+    size_t      blockCount;
+    size_t      blockSize;
+
+    double      sum[WAVE_LOUDNESS_CHANNELS];
+    double      squares[WAVE_LOUDNESS_CHANNELS];
+    float       low[WAVE_LOUDNESS_CHANNELS];
+    float       high[WAVE_LOUDNESS_CHANNELS];
+    float       truePeak[WAVE_LOUDNESS_CHANNELS];
+
+    // polyphase oversampling filter, 1 when the rate is high enough
+    int         factor;
+    int         taps;
+    float       fir[4][WAVE_LOUDNESS_PHASE];
+
+    WAVE_PLANAR planar;
+
+} WAVE_LOUDNESS;
+
+/*
+ * Loudness of a mean square, in LUFS
+ */
+static double
+waveLufs(double energy)
+{
+    return energy > 0 ? -0.691 + 10 * log10(energy) : -HUGE_VAL;
+}
+
+/*
+ * K-weighting of one 100 ms piece of interleaved frames, the squares of the
+ * output summed into energy
+ */
+static void
+waveKWeightC(WAVE_LOUDNESS* l, const float* x, size_t frames)
+{
+    const double* k  = l->coef;
+    size_t        ch = l->nChannels;
+    size_t        c, f;
+
+    for (c = 0; c < ch; c++) {
+
+        double s0 = l->state[0][c], s1 = l->state[1][c];
+        double s2 = l->state[2][c], s3 = l->state[3][c];
+        double e  = 0;
+
+        for (f = 0; f < frames; f++) {
+            double v = x[f * ch + c];
+            double y = k[0] * v + s0;
+            s0 = k[1] * v - k[3] * y + s1;
+            s1 = k[2] * v - k[4] * y;
+            double z = k[5] * y + s2;
+            s2 = k[6] * y - k[8] * z + s3;
+            s3 = k[7] * y - k[9] * z;
+            e += z * z;
+        }
+
+        l->state[0][c] = s0;
+        l->state[1][c] = s1;
+        l->state[2][c] = s2;
+        l->state[3][c] = s3;
+        l->energy[c]  += e;
+    }
+}
+
+/*
+ * Min, max, sum and sum of squares of n samples
+ */
+static void
+waveLevelScanC(const float* x, size_t n, float* min, float* max, float* sum,
+               float* squares)
+{
+    float  lo = x[0], hi = x[0], s = 0, q = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (x[i] < lo) lo = x[i];
+        if (x[i] > hi) hi = x[i];
+        s += x[i];
+        q += x[i] * x[i];
+    }
+
+    *min     = lo;
+    *max     = hi;
+    *sum     = s;
+    *squares = q;
+}
+
+/*
+ * Largest magnitude of the oversampled signal, from sample first on. The
+ * samples before x are the history.
+ */
+static float
+waveTruePeakC(const WAVE_LOUDNESS* l, const float* x, size_t first, size_t n,
+              float peak)
+{
+    size_t i;
+    int    p, k;
+
+    for (i = first; i < n; i++) {
+        for (p = 0; p < l->factor; p++) {
+
+            const float* h   = l->fir[p];
+            float        acc = 0;
+
+            for (k = 0; k < l->taps; k++)
+                acc += h[k] * x[(ptrdiff_t) i - k];
+
+            acc = fabsf(acc);
+            if (acc > peak) peak = acc;
+        }
+    }
+
+    return peak;
+}
+
+#ifdef WAVE_X86
+WAVE_TARGET("sse2") static void
+waveKWeightSSE2(WAVE_LOUDNESS* l, const float* x, size_t frames)
+{
+    const double* k  = l->coef;
+    size_t        ch = l->nChannels;
+    size_t        c, f;
+
+    __m128d b0 = _mm_set1_pd(k[0]), b1 = _mm_set1_pd(k[1]);
+    __m128d b2 = _mm_set1_pd(k[2]), a1 = _mm_set1_pd(k[3]);
+    __m128d a2 = _mm_set1_pd(k[4]), d0 = _mm_set1_pd(k[5]);
+    __m128d d1 = _mm_set1_pd(k[6]), d2 = _mm_set1_pd(k[7]);
+    __m128d c1 = _mm_set1_pd(k[8]), c2 = _mm_set1_pd(k[9]);
+
+    // two channels a group, a lone last one loads a single sample
+    for (c = 0; c < ch; c += 2) {
+
+        __m128d s0 = _mm_loadu_pd(l->state[0] + c);
+        __m128d s1 = _mm_loadu_pd(l->state[1] + c);
+        __m128d s2 = _mm_loadu_pd(l->state[2] + c);
+        __m128d s3 = _mm_loadu_pd(l->state[3] + c);
+        __m128d e  = _mm_setzero_pd();
+        int     pair = c + 1 < ch;
+
+        const float* p = x + c;
+
+        for (f = 0; f < frames; f++, p += ch) {
+
+            __m128  in = pair ?
+                _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*) p)) :
+                _mm_load_ss(p);
+            __m128d v  = _mm_cvtps_pd(in);
+
+            __m128d y = _mm_add_pd(_mm_mul_pd(b0, v), s0);
+            s0 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1, v), _mm_mul_pd(a1, y)), s1);
+            s1 = _mm_sub_pd(_mm_mul_pd(b2, v), _mm_mul_pd(a2, y));
+            __m128d z = _mm_add_pd(_mm_mul_pd(d0, y), s2);
+            s2 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(d1, y), _mm_mul_pd(c1, z)), s3);
+            s3 = _mm_sub_pd(_mm_mul_pd(d2, y), _mm_mul_pd(c2, z));
+            e  = _mm_add_pd(e, _mm_mul_pd(z, z));
+        }
+
+        _mm_storeu_pd(l->state[0] + c, s0);
+        _mm_storeu_pd(l->state[1] + c, s1);
+        _mm_storeu_pd(l->state[2] + c, s2);
+        _mm_storeu_pd(l->state[3] + c, s3);
+        _mm_storeu_pd(l->energy + c,
+                      _mm_add_pd(_mm_loadu_pd(l->energy + c), e));
+    }
+}
+
+WAVE_TARGET("sse2") static void
+waveLevelScanSSE2(const float* x, size_t n, float* min, float* max,
+                  float* sum, float* squares)
+{
+    size_t i  = n & ~(size_t) 3;
+    __m128 lo = _mm_set1_ps(x[0]);
+    __m128 hi = lo;
+    __m128 s  = _mm_setzero_ps();
+    __m128 q  = _mm_setzero_ps();
+    size_t k;
+
+    for (k = 0; k < i; k += 4) {
+        __m128 v = _mm_loadu_ps(x + k);
+        lo = _mm_min_ps(lo, v);
+        hi = _mm_max_ps(hi, v);
+        s  = _mm_add_ps(s, v);
+        q  = _mm_add_ps(q, _mm_mul_ps(v, v));
+    }
+
+    float l[4], h[4], t[4], u[4];
+    _mm_storeu_ps(l, lo);
+    _mm_storeu_ps(h, hi);
+    _mm_storeu_ps(t, s);
+    _mm_storeu_ps(u, q);
+
+    float rl = l[0], rh = h[0];
+    for (k = 1; k < 4; k++) {
+        if (l[k] < rl) rl = l[k];
+        if (h[k] > rh) rh = h[k];
+    }
+    float rs = (t[0] + t[1]) + (t[2] + t[3]);
+    float rq = (u[0] + u[1]) + (u[2] + u[3]);
+
+    for (; i < n; i++) {
+        if (x[i] < rl) rl = x[i];
+        if (x[i] > rh) rh = x[i];
+        rs += x[i];
+        rq += x[i] * x[i];
+    }
+
+    *min     = rl;
+    *max     = rh;
+    *sum     = rs;
+    *squares = rq;
+}
+
+WAVE_TARGET("sse2") static float
+waveTruePeakSSE2(const WAVE_LOUDNESS* l, const float* x, size_t n)
+{
+    size_t i    = n & ~(size_t) 3;
+    __m128 abs  = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 peak = _mm_setzero_ps();
+    size_t f;
+    int    p, k;
+
+    for (f = 0; f < i; f += 4) {
+        for (p = 0; p < l->factor; p++) {
+
+            const float* h   = l->fir[p];
+            __m128       acc = _mm_setzero_ps();
+
+            for (k = 0; k < l->taps; k++)
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(h[k]),
+                                                 _mm_loadu_ps(x + f - k)));
+
+            peak = _mm_max_ps(peak, _mm_and_ps(acc, abs));
+        }
+    }
+
+    float v[4];
+    _mm_storeu_ps(v, peak);
+
+    float r = v[0];
+    for (k = 1; k < 4; k++)
+        if (v[k] > r) r = v[k];
+
+    return waveTruePeakC(l, x, i, n, r);
+}
+
+WAVE_TARGET("avx2") static void
+waveKWeightAVX2(WAVE_LOUDNESS* l, const float* x, size_t frames)
+{
+    const double* k  = l->coef;
+    size_t        ch = l->nChannels;
+    size_t        c, f;
+
+    __m256d b0 = _mm256_set1_pd(k[0]), b1 = _mm256_set1_pd(k[1]);
+    __m256d b2 = _mm256_set1_pd(k[2]), a1 = _mm256_set1_pd(k[3]);
+    __m256d a2 = _mm256_set1_pd(k[4]), d0 = _mm256_set1_pd(k[5]);
+    __m256d d1 = _mm256_set1_pd(k[6]), d2 = _mm256_set1_pd(k[7]);
+    __m256d c1 = _mm256_set1_pd(k[8]), c2 = _mm256_set1_pd(k[9]);
+
+    // four channels a group, the lanes past the last channel masked off
+    for (c = 0; c < ch; c += 4) {
+
+        __m256d s0 = _mm256_loadu_pd(l->state[0] + c);
+        __m256d s1 = _mm256_loadu_pd(l->state[1] + c);
+        __m256d s2 = _mm256_loadu_pd(l->state[2] + c);
+        __m256d s3 = _mm256_loadu_pd(l->state[3] + c);
+        __m256d e  = _mm256_setzero_pd();
+        __m128i m  = _mm_cmpgt_epi32(_mm_set1_epi32((int) (ch - c)),
+                                     _mm_setr_epi32(0, 1, 2, 3));
+
+        const float* p = x + c;
+
+        for (f = 0; f < frames; f++, p += ch) {
+
+            __m256d v = _mm256_cvtps_pd(_mm_maskload_ps(p, m));
+
+            __m256d y = _mm256_add_pd(_mm256_mul_pd(b0, v), s0);
+            s0 = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(b1, v),
+                                             _mm256_mul_pd(a1, y)), s1);
+            s1 = _mm256_sub_pd(_mm256_mul_pd(b2, v), _mm256_mul_pd(a2, y));
+            __m256d z = _mm256_add_pd(_mm256_mul_pd(d0, y), s2);
+            s2 = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(d1, y),
+                                             _mm256_mul_pd(c1, z)), s3);
+            s3 = _mm256_sub_pd(_mm256_mul_pd(d2, y), _mm256_mul_pd(c2, z));
+            e  = _mm256_add_pd(e, _mm256_mul_pd(z, z));
+        }
+
+        _mm256_storeu_pd(l->state[0] + c, s0);
+        _mm256_storeu_pd(l->state[1] + c, s1);
+        _mm256_storeu_pd(l->state[2] + c, s2);
+        _mm256_storeu_pd(l->state[3] + c, s3);
+        _mm256_storeu_pd(l->energy + c,
+                         _mm256_add_pd(_mm256_loadu_pd(l->energy + c), e));
+    }
+}
+
+WAVE_TARGET("avx2") static void
+waveLevelScanAVX2(const float* x, size_t n, float* min, float* max,
+                  float* sum, float* squares)
+{
+    size_t i  = n & ~(size_t) 7;
+    __m256 lo = _mm256_set1_ps(x[0]);
+    __m256 hi = lo;
+    __m256 s  = _mm256_setzero_ps();
+    __m256 q  = _mm256_setzero_ps();
+    size_t k;
+
+    for (k = 0; k < i; k += 8) {
+        __m256 v = _mm256_loadu_ps(x + k);
+        lo = _mm256_min_ps(lo, v);
+        hi = _mm256_max_ps(hi, v);
+        s  = _mm256_add_ps(s, v);
+        q  = _mm256_add_ps(q, _mm256_mul_ps(v, v));
+    }
+
+    float l[8], h[8], t[8], u[8];
+    _mm256_storeu_ps(l, lo);
+    _mm256_storeu_ps(h, hi);
+    _mm256_storeu_ps(t, s);
+    _mm256_storeu_ps(u, q);
+
+    float rl = l[0], rh = h[0];
+    for (k = 1; k < 8; k++) {
+        if (l[k] < rl) rl = l[k];
+        if (h[k] > rh) rh = h[k];
+    }
+    float rs = ((t[0] + t[1]) + (t[2] + t[3])) + ((t[4] + t[5]) + (t[6] + t[7]));
+    float rq = ((u[0] + u[1]) + (u[2] + u[3])) + ((u[4] + u[5]) + (u[6] + u[7]));
+
+    for (; i < n; i++) {
+        if (x[i] < rl) rl = x[i];
+        if (x[i] > rh) rh = x[i];
+        rs += x[i];
+        rq += x[i] * x[i];
+    }
+
+    *min     = rl;
+    *max     = rh;
+    *sum     = rs;
+    *squares = rq;
+}
+
+WAVE_TARGET("avx2") static float
+waveTruePeakAVX2(const WAVE_LOUDNESS* l, const float* x, size_t n)
+{
+    size_t i    = n & ~(size_t) 7;
+    __m256 abs  = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 peak = _mm256_setzero_ps();
+    size_t f;
+    int    p, k;
+
+    for (f = 0; f < i; f += 8) {
+        for (p = 0; p < l->factor; p++) {
+
+            const float* h   = l->fir[p];
+            __m256       acc = _mm256_setzero_ps();
+
+            for (k = 0; k < l->taps; k++)
+                acc = _mm256_add_ps(acc,
+                                    _mm256_mul_ps(_mm256_set1_ps(h[k]),
+                                                  _mm256_loadu_ps(x + f - k)));
+
+            peak = _mm256_max_ps(peak, _mm256_and_ps(acc, abs));
+        }
+    }
+
+    float v[8];
+    _mm256_storeu_ps(v, peak);
+
+    float r = v[0];
+    for (k = 1; k < 8; k++)
+        if (v[k] > r) r = v[k];
+
+    return waveTruePeakC(l, x, i, n, r);
+}
+
+#ifdef WAVE_HAVE_AVX512
+WAVE_TARGET("avx512f") static void
+waveKWeightAVX512(WAVE_LOUDNESS* l, const float* x, size_t frames)
+{
+    const double* k  = l->coef;
+    size_t        ch = l->nChannels;
+    size_t        c, f;
+
+    __m512d b0 = _mm512_set1_pd(k[0]), b1 = _mm512_set1_pd(k[1]);
+    __m512d b2 = _mm512_set1_pd(k[2]), a1 = _mm512_set1_pd(k[3]);
+    __m512d a2 = _mm512_set1_pd(k[4]), d0 = _mm512_set1_pd(k[5]);
+    __m512d d1 = _mm512_set1_pd(k[6]), d2 = _mm512_set1_pd(k[7]);
+    __m512d c1 = _mm512_set1_pd(k[8]), c2 = _mm512_set1_pd(k[9]);
+
+    // eight channels a group
+    for (c = 0; c < ch; c += 8) {
+
+        __m512d   s0 = _mm512_loadu_pd(l->state[0] + c);
+        __m512d   s1 = _mm512_loadu_pd(l->state[1] + c);
+        __m512d   s2 = _mm512_loadu_pd(l->state[2] + c);
+        __m512d   s3 = _mm512_loadu_pd(l->state[3] + c);
+        __m512d   e  = _mm512_setzero_pd();
+        __mmask16 m  = (__mmask16) ((1u << (ch - c < 8 ? ch - c : 8)) - 1);
+
+        const float* p = x + c;
+
+        for (f = 0; f < frames; f++, p += ch) {
+
+            __m512d v = _mm512_cvtps_pd(
+                    _mm512_castps512_ps256(_mm512_maskz_loadu_ps(m, p)));
+
+            __m512d y = _mm512_add_pd(_mm512_mul_pd(b0, v), s0);
+            s0 = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(b1, v),
+                                             _mm512_mul_pd(a1, y)), s1);
+            s1 = _mm512_sub_pd(_mm512_mul_pd(b2, v), _mm512_mul_pd(a2, y));
+            __m512d z = _mm512_add_pd(_mm512_mul_pd(d0, y), s2);
+            s2 = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(d1, y),
+                                             _mm512_mul_pd(c1, z)), s3);
+            s3 = _mm512_sub_pd(_mm512_mul_pd(d2, y), _mm512_mul_pd(c2, z));
+            e  = _mm512_add_pd(e, _mm512_mul_pd(z, z));
+        }
+
+        _mm512_storeu_pd(l->state[0] + c, s0);
+        _mm512_storeu_pd(l->state[1] + c, s1);
+        _mm512_storeu_pd(l->state[2] + c, s2);
+        _mm512_storeu_pd(l->state[3] + c, s3);
+        _mm512_storeu_pd(l->energy + c,
+                         _mm512_add_pd(_mm512_loadu_pd(l->energy + c), e));
+    }
+}
+
+WAVE_TARGET("avx512f") static void
+waveLevelScanAVX512(const float* x, size_t n, float* min, float* max,
+                    float* sum, float* squares)
+{
+    size_t i  = n & ~(size_t) 15;
+    __m512 lo = _mm512_set1_ps(x[0]);
+    __m512 hi = lo;
+    __m512 s  = _mm512_setzero_ps();
+    __m512 q  = _mm512_setzero_ps();
+    size_t k;
+
+    for (k = 0; k < i; k += 16) {
+        __m512 v = _mm512_loadu_ps(x + k);
+        lo = _mm512_min_ps(lo, v);
+        hi = _mm512_max_ps(hi, v);
+        s  = _mm512_add_ps(s, v);
+        q  = _mm512_add_ps(q, _mm512_mul_ps(v, v));
+    }
+
+    float rl = _mm512_reduce_min_ps(lo);
+    float rh = _mm512_reduce_max_ps(hi);
+    float rs = _mm512_reduce_add_ps(s);
+    float rq = _mm512_reduce_add_ps(q);
+
+    for (; i < n; i++) {
+        if (x[i] < rl) rl = x[i];
+        if (x[i] > rh) rh = x[i];
+        rs += x[i];
+        rq += x[i] * x[i];
+    }
+
+    *min     = rl;
+    *max     = rh;
+    *sum     = rs;
+    *squares = rq;
+}
+
+WAVE_TARGET("avx512f") static float
+waveTruePeakAVX512(const WAVE_LOUDNESS* l, const float* x, size_t n)
+{
+    size_t i    = n & ~(size_t) 15;
+    __m512 peak = _mm512_setzero_ps();
+    size_t f;
+    int    p, k;
+
+    for (f = 0; f < i; f += 16) {
+        for (p = 0; p < l->factor; p++) {
+
+            const float* h   = l->fir[p];
+            __m512       acc = _mm512_setzero_ps();
+
+            for (k = 0; k < l->taps; k++)
+                acc = _mm512_add_ps(acc,
+                                    _mm512_mul_ps(_mm512_set1_ps(h[k]),
+                                                  _mm512_loadu_ps(x + f - k)));
+
+            peak = _mm512_max_ps(peak, _mm512_abs_ps(acc));
+        }
+    }
+
+    return waveTruePeakC(l, x, i, n, _mm512_reduce_max_ps(peak));
+}
+#endif
+#endif // WAVE_X86
+
+/**
+ * @brief Release the memory of an analysis
+ * @param l The analysis
+ */
+void
+waveLoudnessFree(WAVE_LOUDNESS* l)
+{
+    wavePlanarFree(&l->planar);
+    free(l->blocks);
+    l->blocks     = NULL;
+    l->blockCount = 0;
+    l->blockSize  = 0;
+}
+
+/**
+ * @brief Start an analysis of float frames
+ *
+ * The channels are weighted by their speaker: 1 for the front ones, 1.41
+ * for the side and back left and right ones, 0 for the LFE.
+ *
+ * @param l Pointer to a WAVE_LOUDNESS variable, to release with
+ * waveLoudnessFree
+ * @param info The format of the frames, for the rate, the channels and the
+ * speaker mask
+ * @return 0 on success, -1 for more than WAVE_LOUDNESS_CHANNELS channels or
+ * an allocation failure
+ */
+int
+waveLoudnessInit(WAVE_LOUDNESS* l, const WAVE_INFO* info)
+{
+    memset(l, 0, sizeof(WAVE_LOUDNESS));
+
+    if (info->nChannels == 0 || info->nChannels > WAVE_LOUDNESS_CHANNELS ||
+        info->nSamplesPerSec == 0)
+        return -1;
+
+    if (wavePlanarInit(&l->planar, info,
+                       WAVE_LOUDNESS_HISTORY + WAVE_LOUDNESS_BLOCK) != 0)
+        return -1;
+
+    l->nChannels      = info->nChannels;
+    l->nSamplesPerSec = info->nSamplesPerSec;
+    l->segmentFrames  = (info->nSamplesPerSec + 5) / 10;
+
+    // the BS.1770 filters, from their analog prototypes for any rate
+    double rate = info->nSamplesPerSec;
+    double pi   = 3.14159265358979323846;
+    double f0   = 1681.974450955533;
+    double q    = 0.7071752369554196;
+    double k    = tan(pi * f0 / rate);
+    double vh   = pow(10, 3.999843853973347 / 20);
+    double vb   = pow(vh, 0.4996667741545416);
+    double a0   = 1 + k / q + k * k;
+
+    l->coef[0] = (vh + vb * k / q + k * k) / a0;
+    l->coef[1] = 2 * (k * k - vh) / a0;
+    l->coef[2] = (vh - vb * k / q + k * k) / a0;
+    l->coef[3] = 2 * (k * k - 1) / a0;
+    l->coef[4] = (1 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q  = 0.5003270373238773;
+    k  = tan(pi * f0 / rate);
+    a0 = 1 + k / q + k * k;
+
+    l->coef[5] = 1;
+    l->coef[6] = -2;
+    l->coef[7] = 1;
+    l->coef[8] = 2 * (k * k - 1) / a0;
+    l->coef[9] = (1 - k / q + k * k) / a0;
+
+    // Hann windowed sinc, split in phases, the first one is the samples
+    l->factor = info->nSamplesPerSec < 96000 ? 4 :
+                info->nSamplesPerSec < 192000 ? 2 : 1;
+    l->taps   = (WAVE_LOUDNESS_TAPS + l->factor - 1) / l->factor;
+
+    int j, c;
+    for (j = 0; j < WAVE_LOUDNESS_TAPS && l->factor > 1; j++) {
+
+        double m = j - (WAVE_LOUDNESS_TAPS - 1) / 2.0;
+        double h = fabs(m) > 1e-6 ?
+                   sin(m * pi / l->factor) / (m * pi / l->factor) : 1;
+
+        h *= 0.5 * (1 - cos(2 * pi * j / (WAVE_LOUDNESS_TAPS - 1)));
+        l->fir[j % l->factor][j / l->factor] = (float) h;
+    }
+
+    for (c = 0; c < l->nChannels; c++) {
+
+        uint32_t speaker = l->planar.speaker[c];
+
+        l->weight[c] = speaker == SPEAKER_LOW_FREQUENCY ? 0 :
+                       speaker == SPEAKER_BACK_LEFT ||
+                       speaker == SPEAKER_BACK_RIGHT ||
+                       speaker == SPEAKER_SIDE_LEFT ||
+                       speaker == SPEAKER_SIDE_RIGHT ? 1.41 : 1;
+
+        memset(l->planar.channel[c], 0, WAVE_LOUDNESS_HISTORY * sizeof(float));
+        l->low[c]  = 1;
+        l->high[c] = -1;
+    }
+
+    return 0;
+}
+
+/*
+ * End of a 100 ms segment: update the windows and keep the gating block
+ */
+static void
+waveLoudnessSegment(WAVE_LOUDNESS* l)
+{
+    double z = 0;
+    int    c, s;
+
+    for (c = 0; c < l->nChannels; c++) {
+
+        z += l->weight[c] * l->energy[c];
+        l->energy[c] = 0;
+
+        // denormals after a long silence would slow the filters down
+        for (s = 0; s < 4; s++)
+            if (fabs(l->state[s][c]) < 1e-30)
+                l->state[s][c] = 0;
+    }
+
+    l->ring[l->segments++ % WAVE_LOUDNESS_SEGMENTS] = z / l->segmentFrames;
+    l->segmentFill = 0;
+
+    // the windows are zero before the first frame
+    double   m = 0, t = 0;
+    uint64_t i;
+
+    for (i = 0; i < WAVE_LOUDNESS_SEGMENTS && i < l->segments; i++) {
+        double e = l->ring[(l->segments - 1 - i) % WAVE_LOUDNESS_SEGMENTS];
+        if (i < 4)
+            m += e;
+        t += e;
+    }
+
+    l->momentary = m / 4;
+    l->shortTerm = t / WAVE_LOUDNESS_SEGMENTS;
+
+    if (l->momentary > l->momentaryMax)
+        l->momentaryMax = l->momentary;
+    if (l->shortTerm > l->shortTermMax)
+        l->shortTermMax = l->shortTerm;
+
+    // 400 ms blocks overlapping by 75 %, above -70 LUFS
+    if (l->segments < 4 || l->momentary <= pow(10, (-70 + 0.691) / 10))
+        return;
+
+    if (l->blockCount == l->blockSize) {
+
+        size_t  size   = l->blockSize ? 2 * l->blockSize : 1024;
+        double* blocks = (double*) realloc(l->blocks, size * sizeof(double));
+
+        if (!blocks) {
+            l->failed = 1;
+            return;
+        }
+
+        l->blocks    = blocks;
+        l->blockSize = size;
+    }
+
+    l->blocks[l->blockCount++] = l->momentary;
+}
+
+/**
+ * @brief Analyze the next frames
+ * @param l An analysis from waveLoudnessInit
+ * @param frames Interleaved float frames, full scale is 1
+ * @param count Number of frames
+ * @return 0 on success, -1 if the gating blocks could not be kept
+ */
+int
+waveLoudnessAdd(WAVE_LOUDNESS* l, const float* frames, size_t count)
+{
+    size_t ch    = l->nChannels;
+    int    level = waveSimdLevel();
+
+    while (count > 0) {
+
+        size_t n = count < WAVE_LOUDNESS_BLOCK ? count : WAVE_LOUDNESS_BLOCK;
+        size_t f, c;
+
+        // K-weighting, cut at the end of the segments
+        for (f = 0; f < n; ) {
+
+            size_t m = l->segmentFrames - l->segmentFill;
+            if (m > n - f) m = n - f;
+
+            const float* x = frames + f * ch;
+
+#ifdef WAVE_X86
+#ifdef WAVE_HAVE_AVX512
+            if (level >= WAVE_SIMD_AVX512)
+                waveKWeightAVX512(l, x, m);
+            else
+#endif
+            if (level >= WAVE_SIMD_AVX2)
+                waveKWeightAVX2(l, x, m);
+            else if (level >= WAVE_SIMD_SSE2)
+                waveKWeightSSE2(l, x, m);
+            else
+#endif
+                waveKWeightC(l, x, m);
+
+            f              += m;
+            l->segmentFill += m;
+
+            if (l->segmentFill == l->segmentFrames)
+                waveLoudnessSegment(l);
+        }
+
+        // levels and true peak on the planar channels, after their history
+        waveDeinterleave(frames, &l->planar, WAVE_LOUDNESS_HISTORY, n);
+
+        for (c = 0; c < ch; c++) {
+
+            float* x = l->planar.channel[c] + WAVE_LOUDNESS_HISTORY;
+            float  lo, hi, sum, squares, peak = l->truePeak[c];
+
+#ifdef WAVE_X86
+#ifdef WAVE_HAVE_AVX512
+            if (level >= WAVE_SIMD_AVX512) {
+                waveLevelScanAVX512(x, n, &lo, &hi, &sum, &squares);
+                if (l->factor > 1)
+                    peak = waveTruePeakAVX512(l, x, n);
+            } else
+#endif
+            if (level >= WAVE_SIMD_AVX2) {
+                waveLevelScanAVX2(x, n, &lo, &hi, &sum, &squares);
+                if (l->factor > 1)
+                    peak = waveTruePeakAVX2(l, x, n);
+            } else if (level >= WAVE_SIMD_SSE2) {
+                waveLevelScanSSE2(x, n, &lo, &hi, &sum, &squares);
+                if (l->factor > 1)
+                    peak = waveTruePeakSSE2(l, x, n);
+            } else
+#endif
+            {
+                waveLevelScanC(x, n, &lo, &hi, &sum, &squares);
+                if (l->factor > 1)
+                    peak = waveTruePeakC(l, x, 0, n, 0);
+            }
+
+            if (lo < l->low[c])  l->low[c]  = lo;
+            if (hi > l->high[c]) l->high[c] = hi;
+            if (peak > l->truePeak[c]) l->truePeak[c] = peak;
+
+            l->sum[c]     += sum;
+            l->squares[c] += squares;
+
+            // the last samples are the history of the next pass
+            memmove(x - WAVE_LOUDNESS_HISTORY, x + n - WAVE_LOUDNESS_HISTORY,
+                    WAVE_LOUDNESS_HISTORY * sizeof(float));
+        }
+
+        l->frames += n;
+        frames    += n * ch;
+        count     -= n;
+    }
+
+    (void) level;
+
+    return l->failed ? -1 : 0;
+}
+
+/**
+ * @brief Loudness of the last 400 ms
+ * @param l An analysis
+ * @return LUFS, -HUGE_VAL for silence
+ */
+double
+waveLoudnessMomentary(const WAVE_LOUDNESS* l)
+{
+    return waveLufs(l->momentary);
+}
+
+/**
+ * @brief Loudness of the last 3 s
+ * @param l An analysis
+ * @return LUFS, -HUGE_VAL for silence
+ */
+double
+waveLoudnessShortTerm(const WAVE_LOUDNESS* l)
+{
+    return waveLufs(l->shortTerm);
+}
+
+/**
+ * @brief Gated loudness of the frames so far
+ *
+ * The blocks above -70 LUFS are averaged, then again only those less than
+ * 10 LU below that average.
+ *
+ * @param l An analysis
+ * @return LUFS, -HUGE_VAL before 400 ms of sound
+ */
+double
+waveLoudnessIntegrated(const WAVE_LOUDNESS* l)
+{
+    double sum = 0, gated = 0;
+    size_t i, count = 0;
+
+    for (i = 0; i < l->blockCount; i++)
+        sum += l->blocks[i];
+
+    if (l->blockCount == 0)
+        return -HUGE_VAL;
+
+    double gate = sum / l->blockCount / 10;
+
+    for (i = 0; i < l->blockCount; i++) {
+        if (l->blocks[i] > gate) {
+            gated += l->blocks[i];
+            count++;
+        }
+    }
+
+    return count ? waveLufs(gated / count) : -HUGE_VAL;
+}
+
+/**
+ * @brief The measures of the frames so far
+ * @param l An analysis
+ * @param analysis Pointer to the WAVE_ANALYSIS to fill
+ */
+void
+waveLoudnessResult(const WAVE_LOUDNESS* l, WAVE_ANALYSIS* analysis)
+{
+    int c;
+
+    memset(analysis, 0, sizeof(WAVE_ANALYSIS));
+
+    analysis->nChannels    = l->nChannels;
+    analysis->frames       = l->frames;
+    analysis->integrated   = waveLoudnessIntegrated(l);
+    analysis->momentaryMax = waveLufs(l->momentaryMax);
+    analysis->shortTermMax = waveLufs(l->shortTermMax);
+
+    for (c = 0; c < l->nChannels && l->frames > 0; c++) {
+
+        WAVE_LEVEL* level = &analysis->channel[c];
+
+        level->peak     = -l->low[c] > l->high[c] ? -l->low[c] : l->high[c];
+        level->truePeak = l->truePeak[c] > level->peak ? l->truePeak[c] :
+                                                         level->peak;
+        level->rms      = sqrt(l->squares[c] / l->frames);
+        level->dc       = l->sum[c] / l->frames;
+    }
+}
+
+/**
+ * @brief Analyze a wave file in one pass
+ * @param fileName The wave file name
+ * @param analysis Pointer to the WAVE_ANALYSIS to fill
+ * @return 0 on success, -1 on error
+ */
+int
+waveAnalyze(char* fileName, WAVE_ANALYSIS* analysis)
+{
+    WAVE_INFO     info;
+    WAVE_MAP      map;
+    WAVE_LOUDNESS l;
+
+    void* data = waveMap(fileName, &info, &map, WAVE_MAP_SEQUENTIAL);
+    if (!data)
+        return -1;
+
+    int format = waveSampleFormat(&info);
+    if (format <= 0 || info.nChannels > WAVE_LOUDNESS_CHANNELS) {
+        waveError(WAVE_ERROR_UNSUPPORTED, fileName);
+        waveUnmap(&map);
+        return -1;
+    }
+
+    float* scratch = (float*) waveAlignedAlloc(
+            WAVE_LOUDNESS_BLOCK * info.nChannels * sizeof(float),
+            WAVE_PLANAR_ALIGN);
+
+    if (!scratch || waveLoudnessInit(&l, &info) != 0) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveAlignedFree(scratch);
+        waveUnmap(&map);
+        return -1;
+    }
+
+    uint64_t frames = map.dataSize / info.nBlockAlign;
+    uint64_t start  = waveStageStart();
+    uint64_t f;
+    int      status = 0;
+
+    for (f = 0; f < frames && status == 0; f += WAVE_LOUDNESS_BLOCK) {
+
+        size_t n = (size_t) (frames - f);
+        if (n > WAVE_LOUDNESS_BLOCK) n = WAVE_LOUDNESS_BLOCK;
+
+        waveToFloat((char*) data + f * info.nBlockAlign, format, scratch,
+                    n * info.nChannels);
+        status = waveLoudnessAdd(&l, scratch, n);
+    }
+
+    waveStageEnd(&waveStatsCounters.convertTime, start);
+
+    if (status == 0)
+        waveLoudnessResult(&l, analysis);
+    else
+        waveError(WAVE_ERROR_MEMORY, fileName);
+
+    waveLoudnessFree(&l);
+    waveAlignedFree(scratch);
+    waveUnmap(&map);
+
+    return status;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,532 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave_mix.h
+ *
+ * Channel mixing: a matrix of gains from every input channel to every output
+ * channel, derived from the speaker masks of the two layouts (ITU-R BS.775
+ * downmix coefficients) or given by the caller, applied to planar or
+ * interleaved float32 frames a block at a time.
+ */
+
+#ifndef WAVE_MIX_H
+#define WAVE_MIX_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_float.h"
+#include "wave_planar.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Mix flags
+ */
+#define WAVE_MIX_NORMALIZE             0x1  // scale rows summing above 1
+#define WAVE_MIX_LFE                   0x2  // keep the LFE in a downmix
+
+/*
+ * Usual output layouts
+ */
+#define WAVE_MIX_MONO                  SPEAKER_FRONT_CENTER
+#define WAVE_MIX_STEREO                (SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT)
+#define WAVE_MIX_5POINT1               (WAVE_MIX_STEREO | SPEAKER_FRONT_CENTER | \
+                                        SPEAKER_LOW_FREQUENCY | \
+                                        SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT)
+
+/*
+ * -3 dB, the gain of a speaker shared by two others
+ */
+#define WAVE_MIX_HALF_POWER            0.70710678f
+
+/**
+ * @brief A mixing matrix, see waveMixInit
+ */
+typedef struct wave_mix_t {
+
+    int         inChannels;
+    int         outChannels;
+    float*      matrix;     // outChannels rows of inChannels gains
+
+    // block buffers of waveMixInterleaved
+    WAVE_PLANAR in;
+    WAVE_PLANAR out;
+
+} WAVE_MIX;
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Where a speaker goes when the output has no such speaker: the first rule
+ * whose targets are all in the output applies, else the last one, again.
+ */
+typedef struct wave_mix_rule_t {
+
+    uint32_t speaker;
+    uint32_t target[2];
+    float    gain;
+
+} WAVE_MIX_RULE;
+
+static const WAVE_MIX_RULE waveMixRules[] = {
+    {SPEAKER_FRONT_CENTER,  {SPEAKER_FRONT_LEFT, SPEAKER_FRONT_RIGHT}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_FRONT_LEFT,    {SPEAKER_FRONT_CENTER, 0}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_FRONT_RIGHT,   {SPEAKER_FRONT_CENTER, 0}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_BACK_LEFT,     {SPEAKER_SIDE_LEFT, 0},  1.0f},
+    {SPEAKER_BACK_LEFT,     {SPEAKER_FRONT_LEFT, 0}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_BACK_RIGHT,    {SPEAKER_SIDE_RIGHT, 0}, 1.0f},
+    {SPEAKER_BACK_RIGHT,    {SPEAKER_FRONT_RIGHT, 0}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_SIDE_LEFT,     {SPEAKER_BACK_LEFT, 0},  1.0f},
+    {SPEAKER_SIDE_LEFT,     {SPEAKER_FRONT_LEFT, 0}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_SIDE_RIGHT,    {SPEAKER_BACK_RIGHT, 0}, 1.0f},
+    {SPEAKER_SIDE_RIGHT,    {SPEAKER_FRONT_RIGHT, 0}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_BACK_CENTER,   {SPEAKER_BACK_LEFT, SPEAKER_BACK_RIGHT}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_BACK_CENTER,   {SPEAKER_SIDE_LEFT, SPEAKER_SIDE_RIGHT}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_BACK_CENTER,   {SPEAKER_FRONT_LEFT, SPEAKER_FRONT_RIGHT}, 0.5f},
+    {SPEAKER_FRONT_LEFT_OF_CENTER,  {SPEAKER_FRONT_LEFT, 0},  1.0f},
+    {SPEAKER_FRONT_RIGHT_OF_CENTER, {SPEAKER_FRONT_RIGHT, 0}, 1.0f},
+    {SPEAKER_TOP_CENTER,       {SPEAKER_FRONT_CENTER, 0}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_TOP_FRONT_LEFT,   {SPEAKER_FRONT_LEFT, 0},   WAVE_MIX_HALF_POWER},
+    {SPEAKER_TOP_FRONT_CENTER, {SPEAKER_FRONT_CENTER, 0}, WAVE_MIX_HALF_POWER},
+    {SPEAKER_TOP_FRONT_RIGHT,  {SPEAKER_FRONT_RIGHT, 0},  WAVE_MIX_HALF_POWER},
+    {SPEAKER_TOP_BACK_LEFT,    {SPEAKER_BACK_LEFT, 0},    WAVE_MIX_HALF_POWER},
+    {SPEAKER_TOP_BACK_CENTER,  {SPEAKER_BACK_CENTER, 0},  WAVE_MIX_HALF_POWER},
+    {SPEAKER_TOP_BACK_RIGHT,   {SPEAKER_BACK_RIGHT, 0},   WAVE_MIX_HALF_POWER},
+};
+
+/*
+ * Add the gains of a speaker to the row of each output speaker it reaches
+ */
+static void
+waveMixRoute(float* gains, uint32_t speaker, float gain, uint32_t outMask,
+             int depth)
+{
+    const WAVE_MIX_RULE* last = NULL;
+    size_t               r;
+    int                  t;
+
+    if (outMask & speaker) {
+        gains[waveChannelIndex(outMask, speaker)] += gain;
+        return;
+    }
+
+    if (depth == 0)
+        return;
+
+    for (r = 0; r < sizeof(waveMixRules) / sizeof(waveMixRules[0]); r++) {
+
+        const WAVE_MIX_RULE* rule = &waveMixRules[r];
+
+        if (rule->speaker != speaker)
+            continue;
+
+        last = rule;
+
+        uint32_t targets = rule->target[0] | rule->target[1];
+        if ((outMask & targets) == targets)
+            break;
+    }
+
+    if (last)
+        for (t = 0; t < 2; t++)
+            if (last->target[t])
+                waveMixRoute(gains, last->target[t], gain * last->gain,
+                             outMask, depth - 1);
+}
+
+static void
+waveMixReset(WAVE_MIX* mix)
+{
+    waveAlignedFree(mix->matrix);
+    wavePlanarFree(&mix->in);
+    wavePlanarFree(&mix->out);
+    memset(mix, 0, sizeof(WAVE_MIX));
+}
+
+/**
+ * @brief Release a mixing matrix
+ * @param mix The matrix
+ */
+void
+waveMixFree(WAVE_MIX* mix)
+{
+    waveMixReset(mix);
+}
+
+/**
+ * @brief Set up a mix from a matrix of gains
+ * @param mix Pointer to a WAVE_MIX variable, to release with waveMixFree
+ * @param inChannels Input channels
+ * @param outChannels Output channels
+ * @param matrix outChannels rows of inChannels gains, copied
+ * @return 0 on success, -1 on error
+ */
+int
+waveMixInitMatrix(WAVE_MIX* mix, int inChannels, int outChannels,
+                  const float* matrix)
+{
+    WAVE_INFO layout;
+
+    memset(mix, 0, sizeof(WAVE_MIX));
+
+    if (inChannels <= 0 || outChannels <= 0 ||
+        inChannels > 0xffff || outChannels > 0xffff)
+        return -1;
+
+    size_t size = (size_t) inChannels * outChannels * sizeof(float);
+
+    mix->inChannels  = inChannels;
+    mix->outChannels = outChannels;
+    mix->matrix      = (float*) waveAlignedAlloc(size, WAVE_PLANAR_ALIGN);
+
+    memset(&layout, 0, sizeof(layout));
+    layout.nChannels = (uint16_t) inChannels;
+    int failed = wavePlanarInit(&mix->in, &layout, WAVE_PLANAR_BLOCK);
+    layout.nChannels = (uint16_t) outChannels;
+    failed |= wavePlanarInit(&mix->out, &layout, WAVE_PLANAR_BLOCK);
+
+    if (failed || !mix->matrix) {
+        waveMixReset(mix);
+        return -1;
+    }
+
+    if (matrix)
+        memcpy(mix->matrix, matrix, size);
+    else
+        memset(mix->matrix, 0, size);
+
+    return 0;
+}
+
+/**
+ * @brief Set up the standard mix between two speaker layouts
+ *
+ * Every input speaker goes to the same output speaker, else folds to its
+ * neighbours: center to left and right at -3 dB, back to side or front at
+ * -3 dB, and so on, as ITU-R BS.775 does for 5.1 to stereo. The LFE is
+ * dropped from a downmix unless WAVE_MIX_LFE is set. Input channels past the
+ * bits of the mask go to the output channel of the same index.
+ *
+ * @param mix Pointer to a WAVE_MIX variable, to release with waveMixFree
+ * @param inMask Speaker mask of the input, see waveChannelMask
+ * @param inChannels Input channels
+ * @param outMask Speaker mask of the output
+ * @param outChannels Output channels
+ * @param flags WAVE_MIX_NORMALIZE, WAVE_MIX_LFE
+ * @return 0 on success, -1 on error
+ */
+int
+waveMixInit(WAVE_MIX* mix, uint32_t inMask, int inChannels, uint32_t outMask,
+            int outChannels, int flags)
+{
+    if (waveMixInitMatrix(mix, inChannels, outChannels, NULL) != 0)
+        return -1;
+
+    float* gains = (float*) calloc(outChannels + 32, sizeof(float));
+    int    i, o;
+
+    if (!gains) {
+        waveMixReset(mix);
+        return -1;
+    }
+
+    for (i = 0; i < inChannels; i++) {
+
+        uint32_t speaker = waveChannelSpeaker(inMask, i);
+
+        memset(gains, 0, (outChannels + 32) * sizeof(float));
+
+        if (speaker == 0) {
+            if (i < outChannels && waveChannelSpeaker(outMask, i) == 0)
+                gains[i] = 1.0f;
+        } else if (speaker == SPEAKER_LOW_FREQUENCY &&
+                   !(outMask & SPEAKER_LOW_FREQUENCY))
+        {
+            if (flags & WAVE_MIX_LFE)
+                waveMixRoute(gains, SPEAKER_FRONT_CENTER, WAVE_MIX_HALF_POWER,
+                             outMask, 3);
+        } else {
+            waveMixRoute(gains, speaker, 1.0f, outMask, 3);
+        }
+
+        for (o = 0; o < outChannels; o++)
+            mix->matrix[o * inChannels + i] = gains[o];
+    }
+
+    free(gains);
+
+    if (flags & WAVE_MIX_NORMALIZE) {
+        for (o = 0; o < outChannels; o++) {
+
+            float* row = mix->matrix + o * inChannels;
+            float  sum = 0;
+
+            for (i = 0; i < inChannels; i++)
+                sum += row[i] < 0 ? -row[i] : row[i];
+
+            if (sum > 1.0f)
+                for (i = 0; i < inChannels; i++)
+                    row[i] /= sum;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * out = sum of gain[i] * in[i], over n frames, the gains are not all zero
+ */
+static void
+waveMixRowC(const float* const* in, const float* gain, int channels,
+            float* out, size_t n, size_t f)
+{
+    int i;
+
+    for (; f < n; f++) {
+        float s = 0;
+        for (i = 0; i < channels; i++)
+            s += gain[i] * in[i][f];
+        out[f] = s;
+    }
+}
+
+#ifdef WAVE_X86
+WAVE_TARGET("sse2") static void
+waveMixRowSSE2(const float* const* in, const float* gain, int channels,
+               float* out, size_t n)
+{
+    size_t f;
+    int    i;
+
+    for (f = 0; f + 8 <= n; f += 8) {
+        __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+        for (i = 0; i < channels; i++) {
+            if (gain[i] == 0)
+                continue;
+            __m128 g = _mm_set1_ps(gain[i]);
+            s0 = _mm_add_ps(s0, _mm_mul_ps(g, _mm_loadu_ps(in[i] + f)));
+            s1 = _mm_add_ps(s1, _mm_mul_ps(g, _mm_loadu_ps(in[i] + f + 4)));
+        }
+        _mm_storeu_ps(out + f, s0);
+        _mm_storeu_ps(out + f + 4, s1);
+    }
+
+    waveMixRowC(in, gain, channels, out, n, f);
+}
+
+WAVE_TARGET("avx2") static void
+waveMixRowAVX2(const float* const* in, const float* gain, int channels,
+               float* out, size_t n)
+{
+    size_t f;
+    int    i;
+
+    for (f = 0; f + 16 <= n; f += 16) {
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        for (i = 0; i < channels; i++) {
+            if (gain[i] == 0)
+                continue;
+            __m256 g = _mm256_set1_ps(gain[i]);
+            s0 = _mm256_add_ps(s0, _mm256_mul_ps(g, _mm256_loadu_ps(in[i] + f)));
+            s1 = _mm256_add_ps(s1, _mm256_mul_ps(g, _mm256_loadu_ps(in[i] + f + 8)));
+        }
+        _mm256_storeu_ps(out + f, s0);
+        _mm256_storeu_ps(out + f + 8, s1);
+    }
+
+    waveMixRowC(in, gain, channels, out, n, f);
+}
+
+#ifdef WAVE_HAVE_AVX512
+WAVE_TARGET("avx512f") static void
+waveMixRowAVX512(const float* const* in, const float* gain, int channels,
+                 float* out, size_t n)
+{
+    size_t f;
+    int    i;
+
+    for (f = 0; f + 16 <= n; f += 16) {
+        __m512 s = _mm512_setzero_ps();
+        for (i = 0; i < channels; i++) {
+            if (gain[i] == 0)
+                continue;
+            s = _mm512_add_ps(s, _mm512_mul_ps(_mm512_set1_ps(gain[i]),
+                                               _mm512_loadu_ps(in[i] + f)));
+        }
+        _mm512_storeu_ps(out + f, s);
+    }
+
+    waveMixRowC(in, gain, channels, out, n, f);
+}
+#endif
+#endif // WAVE_X86
+
+/**
+ * @brief Mix planar frames
+ * @param mix The matrix
+ * @param in mix->inChannels arrays of frames
+ * @param out mix->outChannels arrays of frames, apart from the inputs
+ * @param frames Number of frames
+ */
+void
+waveMixPlanar(const WAVE_MIX* mix, const float* const* in, float* const* out,
+              size_t frames)
+{
+    int level = waveSimdLevel();
+    int o;
+
+    (void) level;
+
+    for (o = 0; o < mix->outChannels; o++) {
+
+        const float* gain = mix->matrix + o * mix->inChannels;
+
+#ifdef WAVE_X86
+#ifdef WAVE_HAVE_AVX512
+        if (level >= WAVE_SIMD_AVX512)
+            waveMixRowAVX512(in, gain, mix->inChannels, out[o], frames);
+        else
+#endif
+        if (level >= WAVE_SIMD_AVX2)
+            waveMixRowAVX2(in, gain, mix->inChannels, out[o], frames);
+        else if (level >= WAVE_SIMD_SSE2)
+            waveMixRowSSE2(in, gain, mix->inChannels, out[o], frames);
+        else
+#endif
+            waveMixRowC(in, gain, mix->inChannels, out[o], frames, 0);
+    }
+}
+
+/**
+ * @brief Mix interleaved frames
+ *
+ * The frames are transposed to planar blocks held by the mix, one mix must
+ * not be used by two threads at once.
+ *
+ * @param mix The matrix
+ * @param in Interleaved frames of mix->inChannels samples
+ * @param out Interleaved frames of mix->outChannels samples, apart from in
+ * @param frames Number of frames
+ */
+void
+waveMixInterleaved(WAVE_MIX* mix, const float* in, float* out, size_t frames)
+{
+    size_t f;
+
+    for (f = 0; f < frames; f += WAVE_PLANAR_BLOCK) {
+
+        size_t n = frames - f;
+        if (n > WAVE_PLANAR_BLOCK) n = WAVE_PLANAR_BLOCK;
+
+        waveDeinterleave(in + f * mix->inChannels, &mix->in, 0, n);
+        waveMixPlanar(mix, (const float* const*) mix->in.channel,
+                      mix->out.channel, n);
+        waveInterleave(&mix->out, 0, n, out + f * mix->outChannels);
+    }
+}
+
+/**
+ * @brief Load a wave file as float32, mixed to a speaker layout
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable, describing the file
+ * @param outMask Speaker mask of the output, WAVE_MIX_STEREO for example
+ * @param flags WAVE_MIX_NORMALIZE, WAVE_MIX_LFE
+ * @param frames Pointer to a variable set to the number of frames
+ * @return Interleaved frames of one sample per bit of outMask, to release
+ * with waveFree, or NULL
+ */
+float*
+waveLoadMixed(char* fileName, WAVE_INFO* info, uint32_t outMask, int flags,
+              size_t* frames)
+{
+    WAVE_MAP map;
+    WAVE_MIX mix;
+    void*    data = waveMap(fileName, info, &map, WAVE_MAP_SEQUENTIAL);
+
+    if (!data)
+        return NULL;
+
+    int    format      = waveSampleFormat(info);
+    int    outChannels = waveChannelCount(outMask);
+    size_t total       = map.dataSize / info->nBlockAlign;
+    float* out         = NULL;
+    float* block       = NULL;
+
+    if (format > 0 && outChannels > 0 &&
+        waveMixInit(&mix, waveChannelMask(info), info->nChannels, outMask,
+                    outChannels, flags) == 0)
+    {
+        out   = (float*) waveAlloc((total ? total : 1) * outChannels *
+                                   sizeof(float));
+        block = (float*) malloc(WAVE_PLANAR_BLOCK * info->nChannels *
+                                sizeof(float));
+        if (!out || !block) {
+            waveFree(out);
+            out = NULL;
+            waveMixFree(&mix);
+        }
+    }
+
+    if (!out) {
+        waveError(format > 0 ? WAVE_ERROR_MEMORY : WAVE_ERROR_UNSUPPORTED,
+                  fileName);
+        free(block);
+        waveUnmap(&map);
+        return NULL;
+    }
+
+    uint64_t start = waveStageStart();
+    size_t   f;
+
+    for (f = 0; f < total; f += WAVE_PLANAR_BLOCK) {
+
+        size_t n = total - f;
+        if (n > WAVE_PLANAR_BLOCK) n = WAVE_PLANAR_BLOCK;
+
+        waveToFloat((char*) data + f * info->nBlockAlign, format, block,
+                    n * info->nChannels);
+        waveMixInterleaved(&mix, block, out + f * outChannels, n);
+    }
+
+    waveStageEnd(&waveStatsCounters.convertTime, start);
+
+    free(block);
+    waveMixFree(&mix);
+    waveUnmap(&map);
+
+    *frames = total;
+
+    return out;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,674 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave_peaks.h
+ *
+ * Waveform overviews: the min, max and RMS of every channel over blocks of
+ * frames, then over blocks twice as long, up to the whole file. The pyramid
+ * is computed in one pass over the data and kept in a sidecar file, so a
+ * file opened again is drawn without reading its samples.
+ */
+
+#ifndef WAVE_PEAKS_H
+#define WAVE_PEAKS_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_float.h"
+#include "wave_planar.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Frames summarized by an entry of the finest level
+ */
+#define WAVE_PEAKS_BLOCK               256
+
+/*
+ * Most levels of a pyramid, enough for 2^47 blocks
+ */
+#define WAVE_PEAKS_LEVELS              48
+
+/*
+ * Base blocks converted per pass
+ */
+#define WAVE_PEAKS_PASS                16
+
+/*
+ * Sidecar file format
+ */
+#define WAVE_PEAKS_MAGIC               "WPKS"
+#define WAVE_PEAKS_VERSION             1
+#define WAVE_PEAKS_SUFFIX              ".peaks"
+
+/**
+ * @brief Summary of a block of one channel, full scale is 32767
+ */
+typedef struct wave_peak_t {
+
+    int16_t  min;
+    int16_t  max;
+    int16_t  rms;
+
+} WAVE_PEAK;
+
+/**
+ * @brief A min/max/RMS pyramid, see wavePeaksOpen
+ */
+typedef struct wave_peaks_t {
+
+    uint16_t   nChannels;
+    uint32_t   blockFrames;     // frames of an entry of level 0
+    uint64_t   frames;          // frames of the file
+
+    // the file the pyramid was computed from
+    uint64_t   fileSize;
+    int64_t    fileTime;        // modification time, in seconds
+
+    // level l holds count[l] entries of blockFrames << l frames, each
+    // nChannels WAVE_PEAK, the last level has a single entry
+    int        levels;
+    size_t     count[WAVE_PEAKS_LEVELS];
+    WAVE_PEAK* level[WAVE_PEAKS_LEVELS];
+
+    WAVE_PEAK* block;           // the single allocation holding the levels
+
+} WAVE_PEAKS;
+
+/*
+ * Sidecar header, followed by the levels one after the other
+ */
+typedef struct wave_peaks_header_t {
+
+    char     magic[4];
+    uint32_t version;
+    uint64_t fileSize;
+    int64_t  fileTime;
+    uint64_t frames;
+    uint32_t blockFrames;
+    uint16_t nChannels;
+    uint16_t levels;
+
+} WAVE_PEAKS_HEADER;
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Min, max and sum of squares of n samples
+ */
+static void
+wavePeakScanC(const float* x, size_t n, float* min, float* max, float* sum)
+{
+    float  lo = x[0], hi = x[0], s = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (x[i] < lo) lo = x[i];
+        if (x[i] > hi) hi = x[i];
+        s += x[i] * x[i];
+    }
+
+    *min = lo;
+    *max = hi;
+    *sum = s;
+}
+
+#ifdef WAVE_X86
+WAVE_TARGET("sse2") static void
+wavePeakScanSSE2(const float* x, size_t n, float* min, float* max, float* sum)
+{
+    size_t i  = n & ~(size_t) 3;
+    __m128 lo = _mm_set1_ps(x[0]);
+    __m128 hi = lo;
+    __m128 s  = _mm_setzero_ps();
+    size_t k;
+
+    for (k = 0; k < i; k += 4) {
+        __m128 v = _mm_loadu_ps(x + k);
+        lo = _mm_min_ps(lo, v);
+        hi = _mm_max_ps(hi, v);
+        s  = _mm_add_ps(s, _mm_mul_ps(v, v));
+    }
+
+    float l[4], h[4], t[4];
+    _mm_storeu_ps(l, lo);
+    _mm_storeu_ps(h, hi);
+    _mm_storeu_ps(t, s);
+
+    float rl = l[0], rh = h[0], rs;
+    for (k = 1; k < 4; k++) {
+        if (l[k] < rl) rl = l[k];
+        if (h[k] > rh) rh = h[k];
+    }
+    rs = (t[0] + t[1]) + (t[2] + t[3]);
+
+    for (; i < n; i++) {
+        if (x[i] < rl) rl = x[i];
+        if (x[i] > rh) rh = x[i];
+        rs += x[i] * x[i];
+    }
+
+    *min = rl;
+    *max = rh;
+    *sum = rs;
+}
+
+WAVE_TARGET("avx2") static void
+wavePeakScanAVX2(const float* x, size_t n, float* min, float* max, float* sum)
+{
+    size_t i  = n & ~(size_t) 7;
+    __m256 lo = _mm256_set1_ps(x[0]);
+    __m256 hi = lo;
+    __m256 s  = _mm256_setzero_ps();
+    size_t k;
+
+    for (k = 0; k < i; k += 8) {
+        __m256 v = _mm256_loadu_ps(x + k);
+        lo = _mm256_min_ps(lo, v);
+        hi = _mm256_max_ps(hi, v);
+        s  = _mm256_add_ps(s, _mm256_mul_ps(v, v));
+    }
+
+    float l[8], h[8], t[8];
+    _mm256_storeu_ps(l, lo);
+    _mm256_storeu_ps(h, hi);
+    _mm256_storeu_ps(t, s);
+
+    float rl = l[0], rh = h[0], rs;
+    for (k = 1; k < 8; k++) {
+        if (l[k] < rl) rl = l[k];
+        if (h[k] > rh) rh = h[k];
+    }
+    rs = ((t[0] + t[1]) + (t[2] + t[3])) + ((t[4] + t[5]) + (t[6] + t[7]));
+
+    for (; i < n; i++) {
+        if (x[i] < rl) rl = x[i];
+        if (x[i] > rh) rh = x[i];
+        rs += x[i] * x[i];
+    }
+
+    *min = rl;
+    *max = rh;
+    *sum = rs;
+}
+
+#ifdef WAVE_HAVE_AVX512
+WAVE_TARGET("avx512f") static void
+wavePeakScanAVX512(const float* x, size_t n, float* min, float* max, float* sum)
+{
+    size_t i  = n & ~(size_t) 15;
+    __m512 lo = _mm512_set1_ps(x[0]);
+    __m512 hi = lo;
+    __m512 s  = _mm512_setzero_ps();
+    size_t k;
+
+    for (k = 0; k < i; k += 16) {
+        __m512 v = _mm512_loadu_ps(x + k);
+        lo = _mm512_min_ps(lo, v);
+        hi = _mm512_max_ps(hi, v);
+        s  = _mm512_add_ps(s, _mm512_mul_ps(v, v));
+    }
+
+    float rl = _mm512_reduce_min_ps(lo);
+    float rh = _mm512_reduce_max_ps(hi);
+    float rs = _mm512_reduce_add_ps(s);
+
+    for (; i < n; i++) {
+        if (x[i] < rl) rl = x[i];
+        if (x[i] > rh) rh = x[i];
+        rs += x[i] * x[i];
+    }
+
+    *min = rl;
+    *max = rh;
+    *sum = rs;
+}
+#endif
+#endif // WAVE_X86
+
+static int16_t
+wavePeakQuantize(float v)
+{
+    float q = v * 32767.0f;
+
+    if (q >  32767.0f) return  32767;
+    if (q < -32767.0f) return -32767;
+
+    return (int16_t) lrintf(q);
+}
+
+/*
+ * Count the entries of every level and the bytes they take. Returns -1 when
+ * they can not be addressed, for a corrupt sidecar for example.
+ */
+static int
+wavePeaksCount(WAVE_PEAKS* peaks, size_t* bytes)
+{
+    uint64_t blocks = peaks->frames / peaks->blockFrames +
+                      (peaks->frames % peaks->blockFrames != 0);
+    size_t   entry  = peaks->nChannels * sizeof(WAVE_PEAK);
+    size_t   total  = 0;
+    size_t   count  = (size_t) blocks;
+
+    peaks->levels = 0;
+
+    if (blocks > (size_t) -1)
+        return -1;
+
+    while (count > 0 && peaks->levels < WAVE_PEAKS_LEVELS) {
+
+        if (count > (size_t) -1 - total)
+            return -1;
+
+        peaks->count[peaks->levels++] = count;
+        total += count;
+
+        if (count == 1)
+            break;
+        count = count / 2 + (count & 1);
+    }
+
+    if (total > (size_t) -1 / entry)
+        return -1;
+
+    *bytes = total * entry;
+
+    return 0;
+}
+
+/*
+ * Count the entries of every level and allocate them
+ */
+static int
+wavePeaksAlloc(WAVE_PEAKS* peaks)
+{
+    size_t bytes;
+
+    if (wavePeaksCount(peaks, &bytes) != 0)
+        return -1;
+
+    peaks->block = (WAVE_PEAK*) malloc(bytes ? bytes : 1);
+    if (!peaks->block)
+        return -1;
+
+    size_t total = 0;
+    int    l;
+
+    for (l = 0; l < peaks->levels; l++) {
+        peaks->level[l] = peaks->block + total * peaks->nChannels;
+        total += peaks->count[l];
+    }
+
+    return 0;
+}
+
+/*
+ * Fill the coarser levels from level 0
+ */
+static void
+wavePeaksReduce(WAVE_PEAKS* peaks)
+{
+    size_t channels = peaks->nChannels;
+    int    l;
+
+    for (l = 1; l < peaks->levels; l++) {
+
+        const WAVE_PEAK* src = peaks->level[l - 1];
+        WAVE_PEAK*       dst = peaks->level[l];
+        size_t           n   = peaks->count[l - 1];
+        size_t           i, c;
+
+        for (i = 0; i < peaks->count[l]; i++) {
+            for (c = 0; c < channels; c++) {
+
+                WAVE_PEAK a = src[2 * i * channels + c];
+
+                if (2 * i + 1 < n) {
+                    WAVE_PEAK b  = src[(2 * i + 1) * channels + c];
+                    double    sq = ((double) a.rms * a.rms +
+                                    (double) b.rms * b.rms) / 2;
+
+                    if (b.min < a.min) a.min = b.min;
+                    if (b.max > a.max) a.max = b.max;
+                    a.rms = (int16_t) lrint(sqrt(sq));
+                }
+
+                dst[i * channels + c] = a;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Release a pyramid
+ * @param peaks The pyramid
+ */
+void
+wavePeaksFree(WAVE_PEAKS* peaks)
+{
+    free(peaks->block);
+    memset(peaks, 0, sizeof(WAVE_PEAKS));
+}
+
+/**
+ * @brief Compute the pyramid of a wave file
+ * @param fileName The wave file name
+ * @param peaks Pointer to a WAVE_PEAKS variable, to release with wavePeaksFree
+ * @param blockFrames Frames of an entry of level 0, WAVE_PEAKS_BLOCK if 0
+ * @return 0 on success, -1 on error
+ */
+int
+wavePeaksCompute(char* fileName, WAVE_PEAKS* peaks, uint32_t blockFrames)
+{
+    WAVE_INFO info;
+    WAVE_MAP  map;
+
+    memset(peaks, 0, sizeof(WAVE_PEAKS));
+
+    if (waveFileKey(fileName, &peaks->fileSize, &peaks->fileTime) != 0) {
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return -1;
+    }
+
+    void* data = waveMap(fileName, &info, &map, WAVE_MAP_SEQUENTIAL);
+    if (!data)
+        return -1;
+
+    int format = waveSampleFormat(&info);
+    if (format <= 0) {
+        waveError(WAVE_ERROR_UNSUPPORTED, fileName);
+        waveUnmap(&map);
+        return -1;
+    }
+
+    peaks->nChannels   = info.nChannels;
+    peaks->blockFrames = blockFrames ? blockFrames : WAVE_PEAKS_BLOCK;
+    peaks->frames      = map.dataSize / info.nBlockAlign;
+
+    size_t      perPass  = (size_t) peaks->blockFrames * WAVE_PEAKS_PASS;
+    size_t      channels = info.nChannels;
+    float*      scratch  = (float*) waveAlignedAlloc(
+            perPass * channels * sizeof(float), WAVE_PLANAR_ALIGN);
+    WAVE_PLANAR planar;
+
+    if (wavePeaksAlloc(peaks) != 0 || !scratch ||
+        wavePlanarInit(&planar, &info, perPass) != 0)
+    {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveAlignedFree(scratch);
+        wavePeaksFree(peaks);
+        waveUnmap(&map);
+        return -1;
+    }
+
+    int      level = waveSimdLevel();
+    uint64_t start = waveStageStart();
+    size_t   entry = 0;
+    uint64_t f;
+
+    (void) level;
+
+    // convert and transpose a pass, then scan each block of each channel
+    for (f = 0; f < peaks->frames; f += perPass) {
+
+        size_t n = (size_t) (peaks->frames - f);
+        if (n > perPass) n = perPass;
+
+        waveToFloat((char*) data + f * info.nBlockAlign, format, scratch,
+                    n * channels);
+        waveDeinterleave(scratch, &planar, 0, n);
+
+        size_t b, c;
+        for (b = 0; b < n; b += peaks->blockFrames, entry++) {
+
+            size_t len = n - b;
+            if (len > peaks->blockFrames) len = peaks->blockFrames;
+
+            for (c = 0; c < channels; c++) {
+
+                const float* x = planar.channel[c] + b;
+                float        lo, hi, sum;
+
+#ifdef WAVE_X86
+#ifdef WAVE_HAVE_AVX512
+                if (level >= WAVE_SIMD_AVX512)
+                    wavePeakScanAVX512(x, len, &lo, &hi, &sum);
+                else
+#endif
+                if (level >= WAVE_SIMD_AVX2)
+                    wavePeakScanAVX2(x, len, &lo, &hi, &sum);
+                else if (level >= WAVE_SIMD_SSE2)
+                    wavePeakScanSSE2(x, len, &lo, &hi, &sum);
+                else
+#endif
+                    wavePeakScanC(x, len, &lo, &hi, &sum);
+
+                WAVE_PEAK* p = peaks->level[0] + entry * channels + c;
+                p->min = wavePeakQuantize(lo);
+                p->max = wavePeakQuantize(hi);
+                p->rms = wavePeakQuantize(sqrtf(sum / len));
+            }
+        }
+    }
+
+    wavePeaksReduce(peaks);
+
+    waveStageEnd(&waveStatsCounters.convertTime, start);
+
+    wavePlanarFree(&planar);
+    waveAlignedFree(scratch);
+    waveUnmap(&map);
+
+    return 0;
+}
+
+/**
+ * @brief Write a pyramid to a sidecar file
+ * @param peaks The pyramid
+ * @param path The sidecar file name
+ * @return 0 on success, -1 on error
+ */
+int
+wavePeaksSave(const WAVE_PEAKS* peaks, const char* path)
+{
+    WAVE_PEAKS_HEADER header;
+    size_t            total = 0;
+    int               l;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAVE_PEAKS_MAGIC, 4);
+    header.version     = WAVE_PEAKS_VERSION;
+    header.fileSize    = peaks->fileSize;
+    header.fileTime    = peaks->fileTime;
+    header.frames      = peaks->frames;
+    header.blockFrames = peaks->blockFrames;
+    header.nChannels   = peaks->nChannels;
+    header.levels      = (uint16_t) peaks->levels;
+
+    for (l = 0; l < peaks->levels; l++)
+        total += peaks->count[l];
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        waveError(WAVE_ERROR_OPEN, path);
+        return -1;
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(peaks->block, sizeof(WAVE_PEAK) * peaks->nChannels,
+                    total, file) == total;
+
+    if (fclose(file) != 0 || !ok) {
+        waveError(WAVE_ERROR_WRITE, path);
+        remove(path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read a pyramid from a sidecar file
+ * @param path The sidecar file name
+ * @param peaks Pointer to a WAVE_PEAKS variable, to release with wavePeaksFree
+ * @return 0 on success, -1 if the file is missing, truncated or of another
+ * version
+ */
+int
+wavePeaksLoad(const char* path, WAVE_PEAKS* peaks)
+{
+    WAVE_PEAKS_HEADER header;
+
+    memset(peaks, 0, sizeof(WAVE_PEAKS));
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return -1;
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, WAVE_PEAKS_MAGIC, 4) != 0 ||
+        header.version != WAVE_PEAKS_VERSION ||
+        header.nChannels == 0 || header.blockFrames == 0 ||
+        header.levels > WAVE_PEAKS_LEVELS)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    peaks->nChannels   = header.nChannels;
+    peaks->blockFrames = header.blockFrames;
+    peaks->frames      = header.frames;
+    peaks->fileSize    = header.fileSize;
+    peaks->fileTime    = header.fileTime;
+
+    // the header must describe exactly the levels that follow it, before
+    // anything is sized from it
+    uint64_t size;
+    int64_t  time;
+    size_t   bytes;
+
+    if (wavePeaksCount(peaks, &bytes) != 0 ||
+        peaks->levels != header.levels ||
+        waveFileKey(path, &size, &time) != 0 ||
+        size != sizeof(header) + (uint64_t) bytes ||
+        wavePeaksAlloc(peaks) != 0)
+    {
+        fclose(file);
+        memset(peaks, 0, sizeof(WAVE_PEAKS));
+        return -1;
+    }
+
+    if (fread(peaks->block, 1, bytes, file) != bytes || fgetc(file) != EOF) {
+        fclose(file);
+        wavePeaksFree(peaks);
+        return -1;
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+/**
+ * @brief Get the pyramid of a wave file, from its sidecar if still valid
+ *
+ * The sidecar is valid while the size and modification time of the file are
+ * the ones it was computed from. Otherwise the pyramid is computed again and
+ * the sidecar rewritten. A sidecar that cannot be written is reported to the
+ * error callback but the pyramid is still returned.
+ *
+ * @param fileName The wave file name
+ * @param peaks Pointer to a WAVE_PEAKS variable, to release with wavePeaksFree
+ * @param sidecar The sidecar file name, fileName with WAVE_PEAKS_SUFFIX if NULL
+ * @return 0 on success, -1 on error
+ */
+int
+wavePeaksOpen(char* fileName, WAVE_PEAKS* peaks, const char* sidecar)
+{
+    char     path[4096];
+    uint64_t size;
+    int64_t  time;
+
+    if (!sidecar) {
+        if (strlen(fileName) + sizeof(WAVE_PEAKS_SUFFIX) > sizeof(path))
+            return wavePeaksCompute(fileName, peaks, 0);
+        strcpy(path, fileName);
+        strcat(path, WAVE_PEAKS_SUFFIX);
+        sidecar = path;
+    }
+
+    if (waveFileKey(fileName, &size, &time) != 0) {
+        waveError(WAVE_ERROR_OPEN, fileName);
+        return -1;
+    }
+
+    if (wavePeaksLoad(sidecar, peaks) == 0) {
+        if (peaks->fileSize == size && peaks->fileTime == time)
+            return 0;
+        wavePeaksFree(peaks);
+    }
+
+    if (wavePeaksCompute(fileName, peaks, 0) != 0)
+        return -1;
+
+    // best effort, the pyramid is good without it
+    wavePeaksSave(peaks, sidecar);
+
+    return 0;
+}
+
+/**
+ * @brief Pick the level to draw at a zoom
+ * @param peaks The pyramid
+ * @param framesPerPixel Frames each pixel covers
+ * @return The coarsest level with entries no longer than a pixel, -1 if the
+ * pyramid is empty
+ */
+int
+wavePeaksPick(const WAVE_PEAKS* peaks, double framesPerPixel)
+{
+    int l = 0;
+
+    if (peaks->levels == 0)
+        return -1;
+
+    while (l + 1 < peaks->levels &&
+           (double) peaks->blockFrames * ((uint64_t) 2 << l) <= framesPerPixel)
+        l++;
+
+    return l;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,546 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file wave_planar.h
+ *
+ * Planar (one array per channel) float32 buffers, with each channel labeled
+ * by its speaker position, and the transposes from and to interleaved frames.
+ */
+
+#ifndef WAVE_PLANAR_H
+#define WAVE_PLANAR_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_float.h"
+
+/*
+ * Channel arrays start on a cache line
+ */
+#define WAVE_PLANAR_ALIGN              64
+
+/*
+ * Frames transposed per block, small enough for the block to stay in L1
+ */
+#define WAVE_PLANAR_BLOCK              256
+
+/**
+ * @brief Float32 samples stored one contiguous array per channel
+ */
+typedef struct wave_planar_t {
+
+    uint16_t  nChannels;
+    size_t    frames;       // frames each channel can hold
+    size_t    stride;       // floats from a channel array to the next one
+
+    float**   channel;      // channel[c] is the array of channel c
+    uint32_t* speaker;      // SPEAKER_* position of channel c, 0 if unknown
+
+    float*    block;        // the single allocation holding the arrays
+
+} WAVE_PLANAR;
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * @brief The speaker mask of a file
+ *
+ * Files without the extensible format carry no mask, mono and stereo then get
+ * their usual positions.
+ *
+ * @param info The WAVE_INFO filled by a loader
+ * @return The dwChannelMask of the file, or the usual one for its channels
+ */
+uint32_t
+waveChannelMask(const WAVE_INFO* info)
+{
+    if (info->dwChannelMask != 0)
+        return info->dwChannelMask;
+
+    if (info->nChannels == 1)
+        return SPEAKER_FRONT_CENTER;
+    if (info->nChannels == 2)
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+
+    return 0;
+}
+
+/**
+ * @brief The speaker position of a channel
+ *
+ * Channels are stored in the order of the mask bits, lowest bit first.
+ *
+ * @param channelMask A speaker mask
+ * @param channel The channel index
+ * @return The SPEAKER_* bit of the channel, 0 past the bits of the mask
+ */
+uint32_t
+waveChannelSpeaker(uint32_t channelMask, int channel)
+{
+    uint32_t bit;
+
+    for (bit = 1; bit != 0 && bit <= SPEAKER_TOP_BACK_RIGHT; bit <<= 1) {
+        if (channelMask & bit) {
+            if (channel == 0)
+                return bit;
+            channel--;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Number of channels of a speaker mask
+ * @param channelMask A speaker mask
+ * @return The number of SPEAKER_* bits set
+ */
+int
+waveChannelCount(uint32_t channelMask)
+{
+    int count = 0;
+
+    for (channelMask &= 2 * SPEAKER_TOP_BACK_RIGHT - 1; channelMask;
+         channelMask &= channelMask - 1)
+        count++;
+
+    return count;
+}
+
+/**
+ * @brief The channel playing on a speaker
+ * @param channelMask A speaker mask
+ * @param speaker A SPEAKER_* bit of the mask
+ * @return The channel index, -1 if the mask has no such speaker
+ */
+int
+waveChannelIndex(uint32_t channelMask, uint32_t speaker)
+{
+    if (!(channelMask & speaker))
+        return -1;
+
+    return waveChannelCount(channelMask & (speaker - 1));
+}
+
+/**
+ * @brief Release the memory of a planar buffer
+ * @param planar The buffer
+ */
+void
+wavePlanarFree(WAVE_PLANAR* planar)
+{
+    waveAlignedFree(planar->block);
+    free(planar->channel);
+    memset(planar, 0, sizeof(WAVE_PLANAR));
+}
+
+/**
+ * @brief Allocate a planar buffer for the channels of a file
+ * @param planar Pointer to a WAVE_PLANAR variable
+ * @param info The WAVE_INFO filled by a loader
+ * @param frames Frames each channel must hold
+ * @return 0 on success, -1 on allocation failure
+ */
+int
+wavePlanarInit(WAVE_PLANAR* planar, const WAVE_INFO* info, size_t frames)
+{
+    memset(planar, 0, sizeof(WAVE_PLANAR));
+
+    size_t channels = info->nChannels;
+    size_t perLine  = WAVE_PLANAR_ALIGN / sizeof(float);
+
+    if (channels == 0)
+        return -1;
+
+    planar->nChannels = info->nChannels;
+    planar->frames    = frames;
+    planar->stride    = (frames + perLine - 1) / perLine * perLine;
+
+    planar->channel = (float**) malloc(channels * (sizeof(float*) + sizeof(uint32_t)));
+    planar->block   = (float*) waveAlignedAlloc(
+            channels * planar->stride * sizeof(float), WAVE_PLANAR_ALIGN);
+
+    if (!planar->channel || !planar->block) {
+        wavePlanarFree(planar);
+        return -1;
+    }
+
+    planar->speaker = (uint32_t*) (planar->channel + channels);
+
+    uint32_t mask = waveChannelMask(info);
+    size_t   c;
+
+    for (c = 0; c < channels; c++) {
+        planar->channel[c] = planar->block + c * planar->stride;
+        planar->speaker[c] = waveChannelSpeaker(mask, (int) c);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Find the channel playing on a speaker
+ * @param planar The buffer
+ * @param speaker A SPEAKER_* position
+ * @return The channel index, or -1
+ */
+int
+wavePlanarFind(const WAVE_PLANAR* planar, uint32_t speaker)
+{
+    int c;
+    for (c = 0; c < planar->nChannels; c++)
+        if (planar->speaker[c] == speaker)
+            return c;
+
+    return -1;
+}
+
+/*
+ * Scalar transposes, also used for the channels and frames left over by the
+ * SIMD ones.
+ */
+static void
+waveDeinterleaveC(const float* src, float** dst, size_t channels,
+                  size_t c0, size_t f0, size_t frames)
+{
+    size_t c, f;
+    for (c = c0; c < channels; c++)
+        for (f = f0; f < frames; f++)
+            dst[c][f] = src[f * channels + c];
+}
+
+static void
+waveInterleaveC(float* const* src, float* dst, size_t channels,
+                size_t c0, size_t f0, size_t frames)
+{
+    size_t c, f;
+    for (f = f0; f < frames; f++)
+        for (c = c0; c < channels; c++)
+            dst[f * channels + c] = src[c][f];
+}
+
+#ifdef WAVE_X86
+
+/*
+ * SSE kernels: stereo is split with shuffles, other layouts are transposed by
+ * tiles of 4 frames by 4 channels.
+ */
+WAVE_TARGET("sse2") static void
+waveDeinterleaveSSE2(const float* src, float** dst, size_t channels,
+                     size_t frames)
+{
+    size_t f = 0, c;
+
+    if (channels == 2) {
+
+        float* l = dst[0];
+        float* r = dst[1];
+
+        for (; f + 4 <= frames; f += 4) {
+            __m128 a = _mm_loadu_ps(src + 2 * f);
+            __m128 b = _mm_loadu_ps(src + 2 * f + 4);
+            _mm_storeu_ps(l + f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(r + f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+
+        waveDeinterleaveC(src, dst, 2, 0, f, frames);
+        return;
+    }
+
+    for (; f + 4 <= frames; f += 4) {
+
+        const float* in = src + f * channels;
+
+        for (c = 0; c + 4 <= channels; c += 4) {
+            __m128 r0 = _mm_loadu_ps(in + c);
+            __m128 r1 = _mm_loadu_ps(in + channels + c);
+            __m128 r2 = _mm_loadu_ps(in + 2 * channels + c);
+            __m128 r3 = _mm_loadu_ps(in + 3 * channels + c);
+
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+            _mm_storeu_ps(dst[c] + f,     r0);
+            _mm_storeu_ps(dst[c + 1] + f, r1);
+            _mm_storeu_ps(dst[c + 2] + f, r2);
+            _mm_storeu_ps(dst[c + 3] + f, r3);
+        }
+    }
+
+    // channels past the last full tile, then frames past the last tile
+    waveDeinterleaveC(src, dst, channels, channels / 4 * 4, 0, f);
+    waveDeinterleaveC(src, dst, channels, 0, f, frames);
+}
+
+WAVE_TARGET("sse2") static void
+waveInterleaveSSE2(float* const* src, float* dst, size_t channels,
+                   size_t frames)
+{
+    size_t f = 0, c;
+
+    if (channels == 2) {
+
+        const float* l = src[0];
+        const float* r = src[1];
+
+        for (; f + 4 <= frames; f += 4) {
+            __m128 a = _mm_loadu_ps(l + f);
+            __m128 b = _mm_loadu_ps(r + f);
+            _mm_storeu_ps(dst + 2 * f,     _mm_unpacklo_ps(a, b));
+            _mm_storeu_ps(dst + 2 * f + 4, _mm_unpackhi_ps(a, b));
+        }
+
+        waveInterleaveC(src, dst, 2, 0, f, frames);
+        return;
+    }
+
+    for (; f + 4 <= frames; f += 4) {
+
+        float* out = dst + f * channels;
+
+        for (c = 0; c + 4 <= channels; c += 4) {
+            __m128 r0 = _mm_loadu_ps(src[c] + f);
+            __m128 r1 = _mm_loadu_ps(src[c + 1] + f);
+            __m128 r2 = _mm_loadu_ps(src[c + 2] + f);
+            __m128 r3 = _mm_loadu_ps(src[c + 3] + f);
+
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+            _mm_storeu_ps(out + c,                r0);
+            _mm_storeu_ps(out + channels + c,     r1);
+            _mm_storeu_ps(out + 2 * channels + c, r2);
+            _mm_storeu_ps(out + 3 * channels + c, r3);
+        }
+    }
+
+    waveInterleaveC(src, dst, channels, channels / 4 * 4, 0, f);
+    waveInterleaveC(src, dst, channels, 0, f, frames);
+}
+
+/*
+ * AVX2 stereo split: 8 frames per iteration, the lane crossing is fixed with
+ * a 64-bit permute.
+ */
+WAVE_TARGET("avx2") static void
+waveDeinterleaveStereoAVX2(const float* src, float** dst, size_t frames)
+{
+    float* l = dst[0];
+    float* r = dst[1];
+    size_t f = 0;
+
+    for (; f + 8 <= frames; f += 8) {
+        __m256 a  = _mm256_loadu_ps(src + 2 * f);
+        __m256 b  = _mm256_loadu_ps(src + 2 * f + 8);
+        __m256 lo = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 hi = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+        lo = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(lo), 0xD8));
+        hi = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(hi), 0xD8));
+
+        _mm256_storeu_ps(l + f, lo);
+        _mm256_storeu_ps(r + f, hi);
+    }
+
+    waveDeinterleaveC(src, dst, 2, 0, f, frames);
+}
+
+WAVE_TARGET("avx2") static void
+waveInterleaveStereoAVX2(float* const* src, float* dst, size_t frames)
+{
+    const float* l = src[0];
+    const float* r = src[1];
+    size_t f = 0;
+
+    for (; f + 8 <= frames; f += 8) {
+        __m256 a  = _mm256_loadu_ps(l + f);
+        __m256 b  = _mm256_loadu_ps(r + f);
+        __m256 lo = _mm256_unpacklo_ps(a, b);
+        __m256 hi = _mm256_unpackhi_ps(a, b);
+
+        _mm256_storeu_ps(dst + 2 * f,     _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(dst + 2 * f + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+
+    waveInterleaveC(src, dst, 2, 0, f, frames);
+}
+
+#endif // WAVE_X86
+
+/**
+ * @brief Split interleaved float frames into a planar buffer
+ * @param src Interleaved frames, planar->nChannels samples each
+ * @param planar The destination
+ * @param offset First frame written in each channel
+ * @param frames Number of frames, offset + frames must fit in planar->frames
+ */
+void
+waveDeinterleave(const float* src, WAVE_PLANAR* planar, size_t offset,
+                 size_t frames)
+{
+    size_t channels = planar->nChannels;
+    int    level    = waveSimdLevel();
+    float* dst[256];
+    float** out = dst;
+
+    if (channels > 256) {
+        out = (float**) malloc(channels * sizeof(float*));
+        if (!out) return;
+    }
+
+    size_t f, c;
+    for (f = 0; f < frames; f += WAVE_PLANAR_BLOCK) {
+
+        size_t n = frames - f;
+        if (n > WAVE_PLANAR_BLOCK) n = WAVE_PLANAR_BLOCK;
+
+        for (c = 0; c < channels; c++)
+            out[c] = planar->channel[c] + offset + f;
+
+        const float* in = src + f * channels;
+
+#ifdef WAVE_X86
+        if (channels == 2 && level >= WAVE_SIMD_AVX2)
+            waveDeinterleaveStereoAVX2(in, out, n);
+        else if (level >= WAVE_SIMD_SSE2)
+            waveDeinterleaveSSE2(in, out, channels, n);
+        else
+#endif
+            waveDeinterleaveC(in, out, channels, 0, 0, n);
+    }
+
+    if (out != dst)
+        free(out);
+
+    (void) level;
+}
+
+/**
+ * @brief Interleave the frames of a planar buffer
+ * @param planar The source
+ * @param offset First frame read in each channel
+ * @param frames Number of frames
+ * @param dst Destination, frames * planar->nChannels floats
+ */
+void
+waveInterleave(const WAVE_PLANAR* planar, size_t offset, size_t frames,
+               float* dst)
+{
+    size_t channels = planar->nChannels;
+    int    level    = waveSimdLevel();
+    float* src[256];
+    float** in = src;
+
+    if (channels > 256) {
+        in = (float**) malloc(channels * sizeof(float*));
+        if (!in) return;
+    }
+
+    size_t f, c;
+    for (f = 0; f < frames; f += WAVE_PLANAR_BLOCK) {
+
+        size_t n = frames - f;
+        if (n > WAVE_PLANAR_BLOCK) n = WAVE_PLANAR_BLOCK;
+
+        for (c = 0; c < channels; c++)
+            in[c] = planar->channel[c] + offset + f;
+
+        float* out = dst + f * channels;
+
+#ifdef WAVE_X86
+        if (channels == 2 && level >= WAVE_SIMD_AVX2)
+            waveInterleaveStereoAVX2(in, out, n);
+        else if (level >= WAVE_SIMD_SSE2)
+            waveInterleaveSSE2(in, out, channels, n);
+        else
+#endif
+            waveInterleaveC(in, out, channels, 0, 0, n);
+    }
+
+    if (in != src)
+        free(in);
+
+    (void) level;
+}
+
+/**
+ * @brief Load a wave file as planar float32 channels
+ *
+ * The file is mapped, then converted and transposed block by block.
+ *
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable
+ * @param planar Pointer to a WAVE_PLANAR variable, to release with
+ * wavePlanarFree
+ * @return 0 on success, -1 on failure
+ */
+int
+waveLoadPlanar(char* fileName, WAVE_INFO* info, WAVE_PLANAR* planar)
+{
+    WAVE_MAP map;
+    void*    data = waveMap(fileName, info, &map, WAVE_MAP_SEQUENTIAL);
+
+    if (!data)
+        return -1;
+
+    int    format = waveSampleFormat(info);
+    size_t frames = map.dataSize / info->nBlockAlign;
+    float* block  = (float*) malloc(
+            (size_t) WAVE_PLANAR_BLOCK * info->nChannels * sizeof(float));
+
+    if (format < 0 || !block || wavePlanarInit(planar, info, frames) != 0) {
+        waveError(format < 0 ? WAVE_ERROR_UNSUPPORTED : WAVE_ERROR_MEMORY,
+                  fileName);
+        free(block);
+        waveUnmap(&map);
+        return -1;
+    }
+
+    uint64_t start = waveStageStart();
+
+    size_t f;
+    for (f = 0; f < frames; f += WAVE_PLANAR_BLOCK) {
+
+        size_t n = frames - f;
+        if (n > WAVE_PLANAR_BLOCK) n = WAVE_PLANAR_BLOCK;
+
+        waveToFloat((char*) data + f * info->nBlockAlign, format, block,
+                    n * info->nChannels);
+        waveDeinterleave(block, planar, f, n);
+    }
+
+    waveStageEnd(&waveStatsCounters.convertTime, start);
+
+    free(block);
+    waveUnmap(&map);
+
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,687 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave_quantize.h
+ *
+ * Conversion of normalized float32 samples back to the PCM encodings of
+ * wave_float.h, with saturation, optional TPDF dither and noise shaping.
+ * Every call reports the number of samples clipped. The kernels are picked
+ * at run time like those of waveToFloat, and waveWriteFloat feeds a
+ * WAVE_WRITER through them.
+ */
+
+#ifndef WAVE_QUANTIZE_H
+#define WAVE_QUANTIZE_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_float.h"
+#include "wave_write.h"
+
+#include <math.h>
+
+/*
+ * waveQuantizerInit dither modes
+ */
+#define WAVE_DITHER_NONE               0    // round to nearest
+#define WAVE_DITHER_TPDF               1    // triangular dither, +/- 1 LSB
+#define WAVE_DITHER_SHAPED             2    // TPDF, noise pushed to the top
+
+/*
+ * Channels with a noise shaping state, the most a WAVE_DITHER_SHAPED
+ * quantizer accepts
+ */
+#define WAVE_QUANTIZE_CHANNELS         32
+
+/*
+ * Dither generator lanes, samples take them in turn
+ */
+#define WAVE_QUANTIZE_LANES            16
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * @brief Float to PCM conversion state, see waveQuantizerInit
+ */
+typedef struct wave_quantizer_t {
+
+    int      sampleFormat;  // WAVE_SAMPLE_U8, S16, S24 or S32
+    int      dither;        // WAVE_DITHER_*
+    int      channels;
+
+    uint64_t clipped;       // samples saturated since waveQuantizerInit
+
+    // xorshift32 generators, sample n draws from lane (lane + n) % 16
+    uint32_t seed[WAVE_QUANTIZE_LANES];
+    unsigned lane;
+
+    // noise shaping: last two errors of each channel, next channel
+    float    error[WAVE_QUANTIZE_CHANNELS][2];
+    int      channel;
+
+} WAVE_QUANTIZER;
+
+/*
+ * Scale to the integer range, and its bounds. A float can not hold
+ * 2^31 - 1, 32-bit samples stop at the float right below 2^31.
+ */
+typedef struct wave_quantize_range_t {
+
+    float scale;
+    float offset;
+    float lo;
+    float hi;
+
+} WAVE_QUANTIZE_RANGE;
+
+static const WAVE_QUANTIZE_RANGE waveQuantizeRanges[WAVE_SAMPLE_S32 + 1] = {
+    {0, 0, 0, 0},
+    {128.0f,         128.0f, 0.0f,            255.0f},
+    {32768.0f,       0.0f,   -32768.0f,       32767.0f},
+    {8388608.0f,     0.0f,   -8388608.0f,     8388607.0f},
+    {2147483648.0f,  0.0f,   -2147483648.0f,  2147483520.0f}
+};
+
+/**
+ * @brief Restart the dither from another seed
+ *
+ * Blocks of a stream quantized apart, each with its own quantizer, get
+ * unrelated dither when seeded with their index. The noise shaping state
+ * starts over.
+ *
+ * @param q A quantizer from waveQuantizerInit
+ * @param seed Any number, the same seed gives the same dither
+ */
+void
+waveQuantizerSeed(WAVE_QUANTIZER* q, uint64_t seed)
+{
+    // splitmix32 spreads the lanes apart, none may be 0
+    uint32_t x = 0x9E3779B9u ^ (uint32_t) (seed ^ (seed >> 32) * 0x85EBCA6Bu);
+    int      i;
+
+    for (i = 0; i < WAVE_QUANTIZE_LANES; i++) {
+        uint32_t z = (x += 0x9E3779B9u);
+        z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+        z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+        z ^= z >> 16;
+        q->seed[i] = z ? z : 1;
+    }
+
+    q->lane    = 0;
+    q->channel = 0;
+    memset(q->error, 0, sizeof(q->error));
+}
+
+/**
+ * @brief Prepare a quantizer
+ *
+ * The dither generators start from a fixed seed, the same samples always
+ * give the same output.
+ *
+ * @param q Pointer to the WAVE_QUANTIZER to fill
+ * @param sampleFormat WAVE_SAMPLE_U8, WAVE_SAMPLE_S16, WAVE_SAMPLE_S24 or
+ * WAVE_SAMPLE_S32
+ * @param channels Number of interleaved channels
+ * @param dither One of the WAVE_DITHER_* modes
+ * @return 0 on success, -1 for an unsupported format or mode
+ */
+int
+waveQuantizerInit(WAVE_QUANTIZER* q, int sampleFormat, int channels,
+                  int dither)
+{
+    memset(q, 0, sizeof(WAVE_QUANTIZER));
+
+    if (sampleFormat < WAVE_SAMPLE_U8 || sampleFormat > WAVE_SAMPLE_S32 ||
+        dither < WAVE_DITHER_NONE || dither > WAVE_DITHER_SHAPED ||
+        channels <= 0 ||
+        (dither == WAVE_DITHER_SHAPED && channels > WAVE_QUANTIZE_CHANNELS))
+        return -1;
+
+    q->sampleFormat = sampleFormat;
+    q->dither       = dither;
+    q->channels     = channels;
+
+    waveQuantizerSeed(q, 0);
+
+    return 0;
+}
+
+/*
+ * Triangular noise in ]-1, 1[ LSB: the difference of the two 16-bit halves
+ * of the next number of a lane
+ */
+static float
+waveDitherNext(WAVE_QUANTIZER* q)
+{
+    uint32_t* seed = &q->seed[q->lane++ % WAVE_QUANTIZE_LANES];
+    uint32_t  x    = *seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+
+    return (float) ((int32_t) (x & 0xFFFF) - (int32_t) (x >> 16)) *
+           (1.0f / 65536);
+}
+
+static void
+waveQuantizeStore(unsigned char* p, int sampleFormat, int32_t v)
+{
+    switch (sampleFormat) {
+    case WAVE_SAMPLE_U8:
+        p[0] = (unsigned char) v;
+        break;
+    case WAVE_SAMPLE_S16: {
+        int16_t s = (int16_t) v;
+        memcpy(p, &s, 2);
+        break;
+    }
+    case WAVE_SAMPLE_S24:
+        p[0] = (unsigned char) v;
+        p[1] = (unsigned char) (v >> 8);
+        p[2] = (unsigned char) (v >> 16);
+        break;
+    default:
+        memcpy(p, &v, 4);
+    }
+}
+
+/*
+ * Scalar kernel. The clamps are written like the SIMD min and max so that
+ * every level gives the same bytes, NaN included.
+ */
+static size_t
+waveQuantizeC(WAVE_QUANTIZER* q, const float* src, unsigned char* dst,
+              size_t n)
+{
+    const WAVE_QUANTIZE_RANGE* r    = &waveQuantizeRanges[q->sampleFormat];
+    size_t                     size = waveSampleSize(q->sampleFormat);
+    size_t                     clipped = 0;
+    size_t                     i;
+
+    for (i = 0; i < n; i++) {
+
+        float v = src[i] * r->scale;
+        if (q->dither != WAVE_DITHER_NONE)
+            v += waveDitherNext(q);
+        v += r->offset;
+
+        clipped += v > r->hi || v < r->lo;
+        v = v > r->lo ? v : r->lo;
+        v = v < r->hi ? v : r->hi;
+
+        waveQuantizeStore(dst + i * size, q->sampleFormat, (int32_t) lrintf(v));
+    }
+
+    return clipped;
+}
+
+/*
+ * Noise shaping by error feedback. The error of each sample, dither
+ * included, is fed back through 2 z^-1 - z^-2: the output error is the
+ * error filtered by (1 - z^-1)^2, nothing at DC and four times the white
+ * level at the Nyquist frequency. The error of a clipped sample is not fed
+ * back, it would make the loop unstable.
+ */
+static size_t
+waveQuantizeShapedC(WAVE_QUANTIZER* q, const float* src, unsigned char* dst,
+                    size_t n)
+{
+    const WAVE_QUANTIZE_RANGE* r    = &waveQuantizeRanges[q->sampleFormat];
+    size_t                     size = waveSampleSize(q->sampleFormat);
+    size_t                     clipped = 0;
+    size_t                     i;
+
+    for (i = 0; i < n; i++) {
+
+        float*  e = q->error[q->channel];
+        float   v = src[i] * r->scale - 2 * e[0] + e[1];
+        float   w = v + waveDitherNext(q) + r->offset;
+        int32_t out;
+
+        e[1] = e[0];
+
+        if (w > r->hi || w < r->lo || w != w) {
+            out  = w > r->hi ? (int32_t) r->hi : (int32_t) r->lo;
+            e[0] = 0;
+            clipped++;
+        } else {
+            out  = (int32_t) lrintf(w);
+            e[0] = (float) out - r->offset - v;
+        }
+
+        waveQuantizeStore(dst + i * size, q->sampleFormat, out);
+
+        if (++q->channel == q->channels)
+            q->channel = 0;
+    }
+
+    return clipped;
+}
+
+#ifdef WAVE_X86
+
+/*
+ * Store the low 12 bytes of x
+ */
+WAVE_TARGET("sse2") static void
+waveStore12(unsigned char* p, __m128i x)
+{
+    int32_t top = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+    _mm_storel_epi64((__m128i*) p, x);
+    memcpy(p + 8, &top, 4);
+}
+
+/*
+ * SSE2 kernel, 16 samples per pass, four generator lanes per vector. The
+ * conversion rounds to nearest even like lrintf.
+ */
+WAVE_TARGET("sse2") static size_t
+waveQuantizeSSE2(WAVE_QUANTIZER* q, const float* src, unsigned char* dst,
+                 size_t n)
+{
+    const WAVE_QUANTIZE_RANGE* r      = &waveQuantizeRanges[q->sampleFormat];
+    const __m128               scale  = _mm_set1_ps(r->scale);
+    const __m128               offset = _mm_set1_ps(r->offset);
+    const __m128               lo     = _mm_set1_ps(r->lo);
+    const __m128               hi     = _mm_set1_ps(r->hi);
+    const __m128               k      = _mm_set1_ps(1.0f / 65536);
+    const __m128i              low16  = _mm_set1_epi32(0xFFFF);
+    int                        dither = q->dither != WAVE_DITHER_NONE;
+    __m128i                    count  = _mm_setzero_si128();
+    __m128i                    seed[4];
+    size_t                     i = 0;
+    int                        j;
+
+    for (j = 0; j < 4; j++)
+        seed[j] = _mm_loadu_si128((const __m128i*) (q->seed + 4 * j));
+
+    for (; i + 16 <= n; i += 16) {
+
+        __m128i x[4];
+
+        for (j = 0; j < 4; j++) {
+
+            __m128 v = _mm_mul_ps(_mm_loadu_ps(src + i + 4 * j), scale);
+
+            if (dither) {
+                __m128i s = seed[j];
+                s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+                s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+                s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+                seed[j] = s;
+
+                __m128i t = _mm_sub_epi32(_mm_and_si128(s, low16),
+                                          _mm_srli_epi32(s, 16));
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_cvtepi32_ps(t), k));
+            }
+            v = _mm_add_ps(v, offset);
+
+            __m128 out = _mm_or_ps(_mm_cmpgt_ps(v, hi), _mm_cmplt_ps(v, lo));
+            count = _mm_sub_epi32(count, _mm_castps_si128(out));
+
+            v    = _mm_min_ps(_mm_max_ps(v, lo), hi);
+            x[j] = _mm_cvtps_epi32(v);
+        }
+
+        switch (q->sampleFormat) {
+        case WAVE_SAMPLE_U8:
+            _mm_storeu_si128((__m128i*) (dst + i),
+                             _mm_packus_epi16(_mm_packs_epi32(x[0], x[1]),
+                                              _mm_packs_epi32(x[2], x[3])));
+            break;
+        case WAVE_SAMPLE_S16:
+            _mm_storeu_si128((__m128i*) (dst + 2 * i),
+                             _mm_packs_epi32(x[0], x[1]));
+            _mm_storeu_si128((__m128i*) (dst + 2 * i + 16),
+                             _mm_packs_epi32(x[2], x[3]));
+            break;
+        case WAVE_SAMPLE_S24: {
+            int32_t t[16];
+            for (j = 0; j < 4; j++)
+                _mm_storeu_si128((__m128i*) (t + 4 * j), x[j]);
+            for (j = 0; j < 16; j++)
+                waveQuantizeStore(dst + 3 * (i + j), WAVE_SAMPLE_S24, t[j]);
+            break;
+        }
+        default:
+            for (j = 0; j < 4; j++)
+                _mm_storeu_si128((__m128i*) (dst + 4 * (i + 4 * j)), x[j]);
+        }
+    }
+
+    for (j = 0; j < 4; j++)
+        _mm_storeu_si128((__m128i*) (q->seed + 4 * j), seed[j]);
+
+    int32_t c[4];
+    _mm_storeu_si128((__m128i*) c, count);
+
+    return (size_t) c[0] + c[1] + c[2] + c[3] +
+           waveQuantizeC(q, src + i, dst + i * waveSampleSize(q->sampleFormat),
+                         n - i);
+}
+
+/*
+ * AVX2 kernel, 16 samples per pass as two vectors
+ */
+WAVE_TARGET("avx2") static size_t
+waveQuantizeAVX2(WAVE_QUANTIZER* q, const float* src, unsigned char* dst,
+                 size_t n)
+{
+    const WAVE_QUANTIZE_RANGE* r      = &waveQuantizeRanges[q->sampleFormat];
+    const __m256               scale  = _mm256_set1_ps(r->scale);
+    const __m256               offset = _mm256_set1_ps(r->offset);
+    const __m256               lo     = _mm256_set1_ps(r->lo);
+    const __m256               hi     = _mm256_set1_ps(r->hi);
+    const __m256               k      = _mm256_set1_ps(1.0f / 65536);
+    const __m256i              low16  = _mm256_set1_epi32(0xFFFF);
+    const __m128i              pack24 = _mm_setr_epi8(
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int                        dither = q->dither != WAVE_DITHER_NONE;
+    __m256i                    count  = _mm256_setzero_si256();
+    __m256i                    seed[2];
+    size_t                     i = 0;
+    int                        j;
+
+    for (j = 0; j < 2; j++)
+        seed[j] = _mm256_loadu_si256((const __m256i*) (q->seed + 8 * j));
+
+    for (; i + 16 <= n; i += 16) {
+
+        __m256i x[2];
+
+        for (j = 0; j < 2; j++) {
+
+            __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8 * j), scale);
+
+            if (dither) {
+                __m256i s = seed[j];
+                s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+                s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+                s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+                seed[j] = s;
+
+                __m256i t = _mm256_sub_epi32(_mm256_and_si256(s, low16),
+                                             _mm256_srli_epi32(s, 16));
+                v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_cvtepi32_ps(t), k));
+            }
+            v = _mm256_add_ps(v, offset);
+
+            __m256 out = _mm256_or_ps(_mm256_cmp_ps(v, hi, _CMP_GT_OQ),
+                                      _mm256_cmp_ps(v, lo, _CMP_LT_OQ));
+            count = _mm256_sub_epi32(count, _mm256_castps_si256(out));
+
+            v    = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+            x[j] = _mm256_cvtps_epi32(v);
+        }
+
+        switch (q->sampleFormat) {
+        case WAVE_SAMPLE_U8: {
+            // packs works within 128-bit lanes, put the halves back in order
+            __m256i s = _mm256_permute4x64_epi64(
+                    _mm256_packs_epi32(x[0], x[1]), 0xD8);
+            _mm_storeu_si128((__m128i*) (dst + i),
+                             _mm_packus_epi16(_mm256_castsi256_si128(s),
+                                              _mm256_extracti128_si256(s, 1)));
+            break;
+        }
+        case WAVE_SAMPLE_S16:
+            _mm256_storeu_si256((__m256i*) (dst + 2 * i),
+                                _mm256_permute4x64_epi64(
+                                        _mm256_packs_epi32(x[0], x[1]), 0xD8));
+            break;
+        case WAVE_SAMPLE_S24:
+            for (j = 0; j < 2; j++) {
+                unsigned char* p = dst + 3 * (i + 8 * j);
+                waveStore12(p, _mm_shuffle_epi8(
+                        _mm256_castsi256_si128(x[j]), pack24));
+                waveStore12(p + 12, _mm_shuffle_epi8(
+                        _mm256_extracti128_si256(x[j], 1), pack24));
+            }
+            break;
+        default:
+            _mm256_storeu_si256((__m256i*) (dst + 4 * i), x[0]);
+            _mm256_storeu_si256((__m256i*) (dst + 4 * i + 32), x[1]);
+        }
+    }
+
+    for (j = 0; j < 2; j++)
+        _mm256_storeu_si256((__m256i*) (q->seed + 8 * j), seed[j]);
+
+    int32_t c[8];
+    _mm256_storeu_si256((__m256i*) c, count);
+
+    return (size_t) c[0] + c[1] + c[2] + c[3] + c[4] + c[5] + c[6] + c[7] +
+           waveQuantizeC(q, src + i, dst + i * waveSampleSize(q->sampleFormat),
+                         n - i);
+}
+
+#ifdef WAVE_HAVE_AVX512
+
+/*
+ * AVX-512 kernel, one vector of 16 samples per pass
+ */
+WAVE_TARGET("avx512f,avx512bw") static size_t
+waveQuantizeAVX512(WAVE_QUANTIZER* q, const float* src, unsigned char* dst,
+                   size_t n)
+{
+    const WAVE_QUANTIZE_RANGE* r      = &waveQuantizeRanges[q->sampleFormat];
+    const __m512               scale  = _mm512_set1_ps(r->scale);
+    const __m512               offset = _mm512_set1_ps(r->offset);
+    const __m512               lo     = _mm512_set1_ps(r->lo);
+    const __m512               hi     = _mm512_set1_ps(r->hi);
+    const __m512               k      = _mm512_set1_ps(1.0f / 65536);
+    const __m512i              low16  = _mm512_set1_epi32(0xFFFF);
+    const __m512i              pack24 = _mm512_broadcast_i32x4(_mm_setr_epi8(
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+    int                        dither = q->dither != WAVE_DITHER_NONE;
+    const __m512i              one    = _mm512_set1_epi32(1);
+    __m512i                    s      = _mm512_loadu_si512((const void*) q->seed);
+    __m512i                    count  = _mm512_setzero_si512();
+    size_t                     i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+
+        __m512 v = _mm512_mul_ps(_mm512_loadu_ps(src + i), scale);
+
+        if (dither) {
+            s = _mm512_xor_si512(s, _mm512_slli_epi32(s, 13));
+            s = _mm512_xor_si512(s, _mm512_srli_epi32(s, 17));
+            s = _mm512_xor_si512(s, _mm512_slli_epi32(s, 5));
+
+            __m512i t = _mm512_sub_epi32(_mm512_and_si512(s, low16),
+                                         _mm512_srli_epi32(s, 16));
+            v = _mm512_add_ps(v, _mm512_mul_ps(_mm512_cvtepi32_ps(t), k));
+        }
+        v = _mm512_add_ps(v, offset);
+
+        __mmask16 out = _mm512_cmp_ps_mask(v, hi, _CMP_GT_OQ) |
+                        _mm512_cmp_ps_mask(v, lo, _CMP_LT_OQ);
+        count = _mm512_mask_add_epi32(count, out, count, one);
+
+        v = _mm512_min_ps(_mm512_max_ps(v, lo), hi);
+        __m512i x = _mm512_cvtps_epi32(v);
+
+        switch (q->sampleFormat) {
+        case WAVE_SAMPLE_U8:
+            _mm_storeu_si128((__m128i*) (dst + i), _mm512_cvtusepi32_epi8(x));
+            break;
+        case WAVE_SAMPLE_S16:
+            _mm256_storeu_si256((__m256i*) (dst + 2 * i),
+                                _mm512_cvtsepi32_epi16(x));
+            break;
+        case WAVE_SAMPLE_S24: {
+            unsigned char* p = dst + 3 * i;
+            x = _mm512_shuffle_epi8(x, pack24);
+            waveStore12(p,      _mm512_castsi512_si128(x));
+            waveStore12(p + 12, _mm512_extracti32x4_epi32(x, 1));
+            waveStore12(p + 24, _mm512_extracti32x4_epi32(x, 2));
+            waveStore12(p + 36, _mm512_extracti32x4_epi32(x, 3));
+            break;
+        }
+        default:
+            _mm512_storeu_si512((void*) (dst + 4 * i), x);
+        }
+    }
+
+    _mm512_storeu_si512((void*) q->seed, s);
+
+    int32_t c[16];
+    size_t  clipped = 0;
+    int     j;
+
+    _mm512_storeu_si512((void*) c, count);
+    for (j = 0; j < 16; j++)
+        clipped += (size_t) c[j];
+
+    return clipped +
+           waveQuantizeC(q, src + i, dst + i * waveSampleSize(q->sampleFormat),
+                         n - i);
+}
+
+#endif // WAVE_HAVE_AVX512
+#endif // WAVE_X86
+
+/**
+ * @brief Convert normalized float32 samples to PCM
+ *
+ * Samples beyond [-1, 1[ saturate. Without noise shaping the conversion is
+ * vectorized, the dither included; with it the error feedback of each
+ * channel runs sample by sample.
+ *
+ * @param q A quantizer from waveQuantizerInit, its dither and shaping state
+ * carries over from one call to the next
+ * @param src The samples, interleaved when shaping
+ * @param dst Destination, as stored in the data chunk
+ * @param samples Number of samples (frames * channels)
+ * @return The number of samples clipped by this call
+ */
+size_t
+waveFromFloat(WAVE_QUANTIZER* q, const float* src, void* dst, size_t samples)
+{
+    unsigned char* out     = (unsigned char*) dst;
+    size_t         size    = waveSampleSize(q->sampleFormat);
+    size_t         clipped = 0;
+
+    if (q->dither == WAVE_DITHER_SHAPED) {
+        clipped = waveQuantizeShapedC(q, src, out, samples);
+        q->clipped += clipped;
+        return clipped;
+    }
+
+    // the vector lanes start on the first generator
+    if (q->dither != WAVE_DITHER_NONE && q->lane % WAVE_QUANTIZE_LANES) {
+        size_t head = WAVE_QUANTIZE_LANES - q->lane % WAVE_QUANTIZE_LANES;
+        if (head > samples) head = samples;
+        clipped = waveQuantizeC(q, src, out, head);
+        src     += head;
+        out     += head * size;
+        samples -= head;
+    }
+
+    int level = waveSimdLevel();
+
+#ifdef WAVE_X86
+#ifdef WAVE_HAVE_AVX512
+    if (level >= WAVE_SIMD_AVX512)
+        clipped += waveQuantizeAVX512(q, src, out, samples);
+    else
+#endif
+    if (level >= WAVE_SIMD_AVX2)
+        clipped += waveQuantizeAVX2(q, src, out, samples);
+    else if (level >= WAVE_SIMD_SSE2)
+        clipped += waveQuantizeSSE2(q, src, out, samples);
+    else
+#endif // WAVE_X86
+        clipped += waveQuantizeC(q, src, out, samples);
+
+    (void) level;
+    q->clipped += clipped;
+
+    return clipped;
+}
+
+/**
+ * @brief Append float32 frames to a PCM wave file
+ *
+ * The frames are quantized through a scratch buffer small enough to stay in
+ * cache, then go through waveWriteFrames.
+ *
+ * @param writer A writer from waveCreate, for PCM samples of the quantizer
+ * format
+ * @param q A quantizer from waveQuantizerInit, clipped counts the samples
+ * saturated
+ * @param frames Interleaved normalized samples
+ * @param count Number of frames
+ * @return 0 on success, -1 on error
+ */
+int
+waveWriteFloat(WAVE_WRITER* writer, WAVE_QUANTIZER* q, const float* frames,
+               size_t count)
+{
+    size_t channels   = writer->fmt.nChannels;
+    size_t blockAlign = writer->fmt.nBlockAlign;
+
+    if (q->channels != (int) channels ||
+        blockAlign != channels * waveSampleSize(q->sampleFormat))
+    {
+        waveError(WAVE_ERROR_FORMAT, NULL);
+        return -1;
+    }
+
+    unsigned char scratch[16 * 1024];
+    size_t        perPass = sizeof(scratch) / blockAlign;
+    size_t        done    = 0;
+
+    if (perPass == 0)
+        return -1;
+
+    while (done < count) {
+
+        size_t n = count - done;
+        if (n > perPass) n = perPass;
+
+        uint64_t start = waveStageStart();
+        waveFromFloat(q, frames + done * channels, scratch, n * channels);
+        waveStageEnd(&waveStatsCounters.convertTime, start);
+
+        if (waveWriteFrames(writer, scratch, n) != 0)
+            return -1;
+
+        done += n;
+    }
+
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
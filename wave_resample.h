@@ -0,0 +1,654 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave_resample.h
+ *
+ * Streaming sample rate conversion of float32 frames with a polyphase
+ * windowed-sinc filter. The coefficients of every phase are computed once
+ * (Kaiser window), each output sample is then one dot product, run with
+ * SSE, AVX2 or AVX-512 kernels picked at run time.
+ */
+
+#ifndef WAVE_RESAMPLE_H
+#define WAVE_RESAMPLE_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_float.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Quality presets
+ */
+#define WAVE_RESAMPLE_FAST             0    // 16 taps, ~60 dB stop band
+#define WAVE_RESAMPLE_MEDIUM           1    // 32 taps, ~85 dB stop band
+#define WAVE_RESAMPLE_BEST             2    // 64 taps, ~120 dB stop band
+
+/*
+ * Most phases in the coefficient table. Ratios needing more, like
+ * 44100 to 48001, round the position to the nearest of these phases.
+ */
+#define WAVE_RESAMPLE_MAX_PHASES       1024
+
+/*
+ * Input frames buffered per channel, beyond the filter length
+ */
+#define WAVE_RESAMPLE_BLOCK            1024
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef float (*WAVE_DOT)(const float* x, const float* h, int taps);
+
+/**
+ * @brief A sample rate converter, see waveResamplerCreate
+ */
+typedef struct wave_resampler_t {
+
+    int       channels;
+    uint32_t  inRate;
+    uint32_t  outRate;
+
+    int       taps;         // per phase, a multiple of 16
+    uint32_t  phases;
+    float*    coeffs;       // phases * taps, one phase after the other
+
+    // position of the next output: buffer frame pos, plus frac / den
+    int       exact;        // den is the number of phases, else 2^32
+    uint64_t  stepInt;
+    uint64_t  stepFrac;
+    uint64_t  den;
+    size_t    pos;
+    uint64_t  frac;
+
+    float*    buffer;       // planar input, capacity frames per channel
+    size_t    capacity;
+    size_t    fill;
+
+    uint64_t  inTotal;
+    uint64_t  outTotal;
+    int       flushing;     // set by waveResampleFlush
+    size_t    padding;      // zero frames still to append
+
+} WAVE_RESAMPLER;
+
+static float
+waveDotC(const float* x, const float* h, int taps)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int   k;
+
+    for (k = 0; k < taps; k += 4) {
+        s0 += x[k]     * h[k];
+        s1 += x[k + 1] * h[k + 1];
+        s2 += x[k + 2] * h[k + 2];
+        s3 += x[k + 3] * h[k + 3];
+    }
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef WAVE_X86
+WAVE_TARGET("sse2") static float
+waveDotSSE2(const float* x, const float* h, int taps)
+{
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    __m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+    int    k;
+
+    for (k = 0; k < taps; k += 16) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(x + k),      _mm_load_ps(h + k)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(x + k + 4),  _mm_load_ps(h + k + 4)));
+        s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(x + k + 8),  _mm_load_ps(h + k + 8)));
+        s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(x + k + 12), _mm_load_ps(h + k + 12)));
+    }
+
+    __m128 s = _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+
+    return _mm_cvtss_f32(s);
+}
+
+WAVE_TARGET("avx2") static float
+waveDotAVX2(const float* x, const float* h, int taps)
+{
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    int    k;
+
+    for (k = 0; k < taps; k += 16) {
+        s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(x + k),
+                                             _mm256_load_ps(h + k)));
+        s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(x + k + 8),
+                                             _mm256_load_ps(h + k + 8)));
+    }
+
+    __m256 s  = _mm256_add_ps(s0, s1);
+    __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    s4 = _mm_add_ps(s4, _mm_movehl_ps(s4, s4));
+    s4 = _mm_add_ss(s4, _mm_shuffle_ps(s4, s4, 1));
+
+    return _mm_cvtss_f32(s4);
+}
+
+#ifdef WAVE_HAVE_AVX512
+WAVE_TARGET("avx512f") static float
+waveDotAVX512(const float* x, const float* h, int taps)
+{
+    __m512 s = _mm512_setzero_ps();
+    int    k;
+
+    for (k = 0; k < taps; k += 16)
+        s = _mm512_add_ps(s, _mm512_mul_ps(_mm512_loadu_ps(x + k),
+                                           _mm512_load_ps(h + k)));
+
+    return _mm512_reduce_add_ps(s);
+}
+#endif
+#endif // WAVE_X86
+
+static WAVE_DOT
+waveSelectDot(void)
+{
+    int level = waveSimdLevel();
+    (void) level;
+
+#ifdef WAVE_X86
+#ifdef WAVE_HAVE_AVX512
+    if (level >= WAVE_SIMD_AVX512)
+        return waveDotAVX512;
+#endif
+    if (level >= WAVE_SIMD_AVX2)
+        return waveDotAVX2;
+    if (level >= WAVE_SIMD_SSE2)
+        return waveDotSSE2;
+#endif
+
+    return waveDotC;
+}
+
+static uint64_t
+waveGcd(uint64_t a, uint64_t b)
+{
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * Modified Bessel function of the first kind, order 0, for the Kaiser window
+ */
+static double
+waveBesselI0(double x)
+{
+    double sum  = 1;
+    double term = 1;
+    int    k;
+
+    for (k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum  += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+
+    return sum;
+}
+
+/*
+ * Fill the table of each phase: the lowpass at the lower of the two Nyquist
+ * frequencies, windowed, sampled at the phase offset, with a unity DC gain.
+ */
+static void
+waveResamplerDesign(WAVE_RESAMPLER* r, double beta, double rolloff)
+{
+    const double pi    = 3.14159265358979323846;
+    double       scale = r->outRate < r->inRate ?
+                         (double) r->outRate / r->inRate : 1.0;
+    double       fc    = 0.5 * rolloff * scale;   // cycles per input sample
+    double       half  = r->taps / 2;
+    double       i0    = waveBesselI0(beta);
+    uint32_t     p;
+    int          k;
+
+    for (p = 0; p < r->phases; p++) {
+
+        double d   = (double) p / r->phases;
+        double sum = 0;
+        float* h   = r->coeffs + (size_t) p * r->taps;
+
+        for (k = 0; k < r->taps; k++) {
+
+            double t = k - half + 1 - d;
+            double x = 2 * fc * t;
+            double s = t == 0 ? 1.0 : sin(pi * x) / (pi * x);
+            double w = t / half;
+
+            w = w * w < 1 ? waveBesselI0(beta * sqrt(1 - w * w)) / i0 : 0;
+
+            h[k] = (float) (2 * fc * s * w);
+            sum += h[k];
+        }
+
+        for (k = 0; k < r->taps; k++)
+            h[k] = (float) (h[k] / sum);
+    }
+}
+
+/**
+ * @brief Release a resampler
+ * @param r The resampler, or NULL
+ */
+void
+waveResamplerFree(WAVE_RESAMPLER* r)
+{
+    if (!r)
+        return;
+
+    waveAlignedFree(r->coeffs);
+    waveAlignedFree(r->buffer);
+    free(r);
+}
+
+/**
+ * @brief Create a sample rate converter
+ * @param channels Number of interleaved channels
+ * @param inRate Input rate, in Hz
+ * @param outRate Output rate, in Hz
+ * @param quality WAVE_RESAMPLE_FAST, WAVE_RESAMPLE_MEDIUM or WAVE_RESAMPLE_BEST
+ * @return The resampler, to release with waveResamplerFree, or NULL
+ */
+WAVE_RESAMPLER*
+waveResamplerCreate(int channels, uint32_t inRate, uint32_t outRate,
+                    int quality)
+{
+    static const int    presetTaps[3]    = {16, 32, 64};
+    static const double presetBeta[3]    = {6.0, 8.6, 12.0};
+    static const double presetRolloff[3] = {0.85, 0.90, 0.94};
+
+    if (channels <= 0 || inRate == 0 || outRate == 0)
+        return NULL;
+
+    if (quality < WAVE_RESAMPLE_FAST || quality > WAVE_RESAMPLE_BEST)
+        quality = WAVE_RESAMPLE_MEDIUM;
+
+    WAVE_RESAMPLER* r = (WAVE_RESAMPLER*) calloc(1, sizeof(WAVE_RESAMPLER));
+    if (!r)
+        return NULL;
+
+    r->channels = channels;
+    r->inRate   = inRate;
+    r->outRate  = outRate;
+
+    // downsampling narrows the passband, more taps keep the transition sharp
+    double rolloff = inRate == outRate ? 1.0 : presetRolloff[quality];
+    int    taps    = presetTaps[quality];
+    if (outRate < inRate)
+        taps = (int) ceil((double) taps * inRate / outRate);
+    if (taps > 512)
+        taps = 512;
+    r->taps = (taps + 15) & ~15;
+
+    uint64_t g    = waveGcd(inRate, outRate);
+    uint64_t up   = outRate / g;
+    uint64_t down = inRate / g;
+
+    if (up <= WAVE_RESAMPLE_MAX_PHASES) {
+        r->exact    = 1;
+        r->phases   = (uint32_t) up;
+        r->den      = up;
+        r->stepInt  = down / up;
+        r->stepFrac = down % up;
+    } else {
+        r->phases   = WAVE_RESAMPLE_MAX_PHASES;
+        r->den      = (uint64_t) 1 << 32;
+        r->stepInt  = inRate / outRate;
+        r->stepFrac = ((uint64_t) (inRate % outRate) << 32) / outRate;
+    }
+
+    r->capacity = r->taps + WAVE_RESAMPLE_BLOCK;
+    r->coeffs   = (float*) waveAlignedAlloc(
+            (size_t) r->phases * r->taps * sizeof(float), 64);
+    r->buffer   = (float*) waveAlignedAlloc(
+            r->capacity * channels * sizeof(float), 64);
+
+    if (!r->coeffs || !r->buffer) {
+        waveResamplerFree(r);
+        return NULL;
+    }
+
+    waveResamplerDesign(r, presetBeta[quality], rolloff);
+
+    // the first output is centered on the first input frame
+    r->fill = r->taps / 2 - 1;
+    memset(r->buffer, 0, r->capacity * channels * sizeof(float));
+
+    return r;
+}
+
+/**
+ * @brief Number of output frames for a number of input frames
+ * @param r A resampler
+ * @param inFrames Input frames
+ * @return The frames the whole input becomes once flushed
+ */
+uint64_t
+waveResampleLength(const WAVE_RESAMPLER* r, uint64_t inFrames)
+{
+    return (inFrames * r->outRate + r->inRate - 1) / r->inRate;
+}
+
+/*
+ * Produce the outputs the buffered input allows
+ */
+static size_t
+waveResampleRun(WAVE_RESAMPLER* r, float* out, size_t outFrames)
+{
+    WAVE_DOT dot      = waveSelectDot();
+    int      channels = r->channels;
+    size_t   done     = 0;
+
+    // past the end, the zero padding would give a few extra frames
+    uint64_t limit = r->flushing ? waveResampleLength(r, r->inTotal) :
+                                  (uint64_t) -1;
+
+    while (done < outFrames && r->outTotal < limit &&
+           r->pos + r->taps <= r->fill)
+    {
+        uint64_t phase = r->exact ? r->frac :
+                         (r->frac * r->phases + (r->den >> 1)) >> 32;
+        size_t   pos   = r->pos;
+
+        // rounding up to the last phase is the next frame, phase 0
+        if (phase == r->phases) {
+            phase = 0;
+            pos++;
+            if (pos + r->taps > r->fill)
+                break;
+        }
+
+        const float* h = r->coeffs + (size_t) phase * r->taps;
+        int          c;
+
+        for (c = 0; c < channels; c++)
+            out[done * channels + c] =
+                dot(r->buffer + (size_t) c * r->capacity + pos, h, r->taps);
+
+        done++;
+        r->outTotal++;
+
+        r->pos  += (size_t) r->stepInt;
+        r->frac += r->stepFrac;
+        if (r->frac >= r->den) {
+            r->frac -= r->den;
+            r->pos++;
+        }
+    }
+
+    return done;
+}
+
+/*
+ * Append interleaved frames, zeros if in is NULL, after dropping the frames
+ * behind the filter. Returns the number taken.
+ */
+static size_t
+waveResampleFeed(WAVE_RESAMPLER* r, const float* in, size_t frames)
+{
+    int    channels = r->channels;
+    size_t drop     = r->pos < r->fill ? r->pos : r->fill;
+    int    c;
+
+    if (drop > 0 && r->fill + frames > r->capacity) {
+        for (c = 0; c < channels; c++) {
+            float* b = r->buffer + (size_t) c * r->capacity;
+            memmove(b, b + drop, (r->fill - drop) * sizeof(float));
+        }
+        r->fill -= drop;
+        r->pos  -= drop;
+    }
+
+    if (frames > r->capacity - r->fill)
+        frames = r->capacity - r->fill;
+
+    size_t f;
+    for (c = 0; c < channels; c++) {
+        float* b = r->buffer + (size_t) c * r->capacity + r->fill;
+        if (in)
+            for (f = 0; f < frames; f++)
+                b[f] = in[f * channels + c];
+        else
+            memset(b, 0, frames * sizeof(float));
+    }
+
+    r->fill += frames;
+
+    return frames;
+}
+
+/**
+ * @brief Convert interleaved frames
+ *
+ * Takes input until the output is full. The filter keeps a few frames back,
+ * waveResampleFlush returns them at the end of the stream.
+ *
+ * @param r A resampler
+ * @param in Interleaved input frames
+ * @param inFrames Pointer to the number of input frames, set to the number
+ * taken
+ * @param out Interleaved output frames
+ * @param outFrames Room in out, in frames
+ * @return The number of output frames
+ */
+size_t
+waveResample(WAVE_RESAMPLER* r, const float* in, size_t* inFrames,
+             float* out, size_t outFrames)
+{
+    size_t taken = 0;
+    size_t done  = 0;
+
+    for (;;) {
+
+        done += waveResampleRun(r, out + done * r->channels, outFrames - done);
+
+        if (done == outFrames || taken == *inFrames)
+            break;
+
+        taken += waveResampleFeed(r, in + taken * r->channels,
+                                  *inFrames - taken);
+    }
+
+    r->inTotal += taken;
+    *inFrames   = taken;
+
+    return done;
+}
+
+/**
+ * @brief Return the last frames at the end of the stream
+ * @param r A resampler
+ * @param out Interleaved output frames
+ * @param outFrames Room in out, in frames
+ * @return The number of output frames, 0 once everything was returned
+ */
+size_t
+waveResampleFlush(WAVE_RESAMPLER* r, float* out, size_t outFrames)
+{
+    uint64_t limit = waveResampleLength(r, r->inTotal);
+    size_t   done  = 0;
+
+    // zeros past the end complete the last windows
+    if (!r->flushing) {
+        r->flushing = 1;
+        r->padding  = r->taps;
+    }
+
+    for (;;) {
+
+        done += waveResampleRun(r, out + done * r->channels, outFrames - done);
+
+        if (done == outFrames || r->outTotal >= limit || r->padding == 0)
+            break;
+
+        r->padding -= waveResampleFeed(r, NULL, r->padding);
+    }
+
+    return done;
+}
+
+/**
+ * @brief Read the next frames of a stream, as float32 at another rate
+ * @param stream A stream from waveOpen
+ * @param r A resampler from the stream rate and channels
+ * @param buffer Interleaved output frames
+ * @param frames Number of frames wanted
+ * @return The number of frames read, 0 at the end
+ */
+size_t
+waveReadResampled(WAVE_STREAM* stream, WAVE_RESAMPLER* r, float* buffer,
+                  size_t frames)
+{
+    float  scratch[4096];
+    size_t perPass = sizeof(scratch) / sizeof(float) / r->channels;
+    size_t done    = 0;
+
+    while (done < frames) {
+
+        size_t got = waveResampleRun(r, buffer + done * r->channels,
+                                     frames - done);
+        done += got;
+
+        if (done == frames)
+            break;
+
+        // only what the resampler can take, nothing is left over
+        size_t drop = r->pos < r->fill ? r->pos : r->fill;
+        size_t room = r->capacity - r->fill + drop;
+        if (room > perPass)
+            room = perPass;
+
+        size_t n = waveReadFloat(stream, scratch, room);
+
+        if (n == 0) {
+            done += waveResampleFlush(r, buffer + done * r->channels,
+                                      frames - done);
+            break;
+        }
+
+        size_t taken = n;
+        done += waveResample(r, scratch, &taken, buffer + done * r->channels,
+                             frames - done);
+    }
+
+    return done;
+}
+
+/**
+ * @brief Load a wave file as float32 at another rate
+ *
+ * The samples are converted and resampled block by block, while still in
+ * cache.
+ *
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable, describing the file
+ * @param rate Output rate, in Hz
+ * @param quality WAVE_RESAMPLE_FAST, WAVE_RESAMPLE_MEDIUM or WAVE_RESAMPLE_BEST
+ * @param frames Pointer to a variable set to the number of output frames
+ * @return The interleaved frames, to release with waveFree, or NULL
+ */
+float*
+waveLoadResampled(char* fileName, WAVE_INFO* info, uint32_t rate,
+                  int quality, size_t* frames)
+{
+    WAVE_MAP map;
+    void*    data = waveMap(fileName, info, &map, WAVE_MAP_SEQUENTIAL);
+
+    if (!data)
+        return NULL;
+
+    int             format   = waveSampleFormat(info);
+    size_t          inFrames = map.dataSize / info->nBlockAlign;
+    size_t          channels = info->nChannels;
+    WAVE_RESAMPLER* r        = format > 0 ?
+        waveResamplerCreate((int) channels, info->nSamplesPerSec, rate, quality) :
+        NULL;
+
+    float  block[4096];
+    size_t perPass = sizeof(block) / sizeof(float) / channels;
+    size_t total   = r ? (size_t) waveResampleLength(r, inFrames) : 0;
+    float* out     = r ? (float*) waveAlloc((total + 1) * channels *
+                                            sizeof(float)) : NULL;
+
+    if (!out) {
+        waveError(format > 0 ? WAVE_ERROR_MEMORY : WAVE_ERROR_UNSUPPORTED,
+                  fileName);
+        waveResamplerFree(r);
+        waveUnmap(&map);
+        return NULL;
+    }
+
+    uint64_t start = waveStageStart();
+    size_t   done  = 0;
+    size_t   f;
+
+    for (f = 0; f < inFrames && perPass > 0; f += perPass) {
+
+        size_t n = inFrames - f;
+        if (n > perPass) n = perPass;
+
+        waveToFloat((char*) data + f * info->nBlockAlign, format, block,
+                    n * channels);
+
+        // the output is sized for everything, all the input is taken
+        size_t taken = n;
+        done += waveResample(r, block, &taken, out + done * channels,
+                             total - done);
+    }
+
+    done += waveResampleFlush(r, out + done * channels, total - done);
+
+    waveStageEnd(&waveStatsCounters.convertTime, start);
+
+    waveResamplerFree(r);
+    waveUnmap(&map);
+
+    *frames = done;
+
+    return out;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
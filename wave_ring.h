@@ -0,0 +1,365 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave_ring.h
+ *
+ * Real-time playback of wave files of any size. A prefetch thread reads the
+ * frames of a WAVE_STREAM ahead into a single producer, single consumer ring,
+ * the audio callback takes them out with waveRingPull, which never allocates,
+ * locks or blocks.
+ */
+
+#ifndef WAVE_RING_H
+#define WAVE_RING_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Default ring capacity, in frames
+ */
+#define WAVE_RING_FRAMES               (1 << 16)
+
+/*
+ * waveRingOpen flags
+ */
+#define WAVE_RING_LOOP                 1    // restart at the end of the file
+
+/*
+ * Keeps the producer and consumer positions on their own cache lines
+ */
+#define WAVE_RING_CACHE_LINE           64
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * @brief Playback counters, see waveRingStats
+ */
+typedef struct wave_ring_stats_t {
+
+    uint64_t underruns;     // pulls not fully served before the end of file
+    uint64_t silentFrames;  // frames of silence inserted by the underruns
+    uint64_t pulledFrames;  // frames of the file handed to the callback
+    size_t   fill;          // frames ready in the ring
+    size_t   minFill;       // lowest fill seen by a pull
+    size_t   capacity;      // ring capacity, in frames
+
+} WAVE_RING_STATS;
+
+/**
+ * @brief A wave file being prefetched for playback
+ */
+typedef struct wave_ring_t {
+
+    WAVE_STREAM*      stream;
+    WAVE_THREAD       thread;
+    int               flags;
+
+    unsigned char*    buffer;
+    size_t            frameSize;
+    size_t            capacity;     // frames, a power of two
+    size_t            prefetch;     // frames read at once by the producer
+    unsigned int      idle;         // producer sleep when the ring is full, ms
+    unsigned char     silence;      // byte value of a silent sample
+
+    unsigned char     pad0[WAVE_RING_CACHE_LINE];
+
+    // written by the prefetch thread only
+    volatile size_t   head;         // frames written since the start
+    volatile size_t   eof;
+
+    unsigned char     pad1[WAVE_RING_CACHE_LINE];
+
+    // written by waveRingPull only
+    volatile size_t   tail;         // frames read since the start
+    volatile size_t   minFill;
+    volatile uint64_t underruns;
+    volatile uint64_t silentFrames;
+    volatile uint64_t pulledFrames;
+
+    unsigned char     pad2[WAVE_RING_CACHE_LINE];
+
+    volatile size_t   stop;
+
+} WAVE_RING;
+
+/*
+ * Read the next frames of the file into the free part of the ring. Called by
+ * the producer only. Returns the number of frames added, 0 when the ring is
+ * full or the file done.
+ */
+static size_t
+waveRingProduce(WAVE_RING* ring)
+{
+    size_t head = ring->head;
+    size_t room = ring->capacity - (head - waveAtomicLoad(&ring->tail));
+
+    // wait for room for a whole prefetch, reads stay large
+    if (room < ring->prefetch || ring->eof)
+        return 0;
+
+    size_t index = head & (ring->capacity - 1);
+    size_t n     = ring->prefetch;
+    if (n > ring->capacity - index)
+        n = ring->capacity - index;
+
+    size_t got = waveReadFrames(ring->stream,
+                                ring->buffer + index * ring->frameSize, n);
+
+    if (got == 0 && (ring->flags & WAVE_RING_LOOP) &&
+        ring->stream->info.dataSize >= ring->frameSize &&
+        waveRewind(ring->stream) == 0)
+    {
+        got = waveReadFrames(ring->stream,
+                             ring->buffer + index * ring->frameSize, n);
+    }
+
+    if (got == 0) {
+        waveAtomicStore(&ring->eof, 1);
+        return 0;
+    }
+
+    waveAtomicStore(&ring->head, head + got);
+
+    return got;
+}
+
+static void
+waveRingPrefetch(void* arg)
+{
+    WAVE_RING* ring = (WAVE_RING*) arg;
+
+    while (!waveAtomicLoad(&ring->stop)) {
+        if (waveRingProduce(ring) == 0)
+            waveSleep(ring->idle);
+    }
+}
+
+/**
+ * @brief Close a ring from waveRingOpen, stopping its prefetch thread
+ * @param ring The ring, or NULL
+ */
+void
+waveRingClose(WAVE_RING* ring)
+{
+    if (!ring)
+        return;
+
+    waveAtomicStore(&ring->stop, 1);
+    waveThreadJoin(ring->thread);
+
+    waveClose(ring->stream);
+    waveAlignedFree(ring->buffer);
+    waveAlignedFree(ring);
+}
+
+/**
+ * @brief Open a wave file for playback
+ *
+ * The ring is filled before returning, then a thread keeps it filled while
+ * waveRingPull takes the frames out.
+ *
+ * @param fileName The wave file name
+ * @param info Pointer to a WAVE_INFO variable
+ * @param frames Ring capacity in frames, rounded up to a power of two, 0 for
+ * WAVE_RING_FRAMES
+ * @param flags 0 or WAVE_RING_LOOP
+ * @return The ring, to close with waveRingClose, or NULL
+ */
+WAVE_RING*
+waveRingOpen(char* fileName, WAVE_INFO* info, size_t frames, int flags)
+{
+    if (frames == 0)
+        frames = WAVE_RING_FRAMES;
+
+    size_t capacity = 16;
+    while (capacity < frames)
+        capacity <<= 1;
+
+    WAVE_RING* ring = (WAVE_RING*) waveAlignedAlloc(sizeof(WAVE_RING),
+                                                    WAVE_RING_CACHE_LINE);
+    if (!ring) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        return NULL;
+    }
+
+    memset(ring, 0, sizeof(WAVE_RING));
+
+    ring->stream = waveOpen(fileName, info, 0);
+    if (!ring->stream) {
+        waveAlignedFree(ring);
+        return NULL;
+    }
+
+    ring->flags     = flags;
+    ring->frameSize = info->nBlockAlign;
+    ring->capacity  = capacity;
+    ring->prefetch  = capacity / 4;
+    ring->minFill   = capacity;
+
+    // sleep a fraction of the time the callback needs to drain a prefetch
+    uint64_t ms = (uint64_t) ring->prefetch * 1000 /
+                  (info->nSamplesPerSec ? info->nSamplesPerSec : 1) / 4;
+    ring->idle = ms < 1 ? 1 : ms > 100 ? 100 : (unsigned int) ms;
+
+    if (info->wFormatTag == WAVE_FORMAT_PCM && info->wBitsPerSample == 8)
+        ring->silence = 0x80;
+    else if (info->wFormatTag == WAVE_FORMAT_ALAW)
+        ring->silence = 0xd5;
+    else if (info->wFormatTag == WAVE_FORMAT_MULAW)
+        ring->silence = 0xff;
+
+    ring->buffer = (unsigned char*) waveAlignedAlloc(
+            capacity * ring->frameSize, WAVE_RING_CACHE_LINE);
+    if (!ring->buffer) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveClose(ring->stream);
+        waveAlignedFree(ring);
+        return NULL;
+    }
+
+    // start full
+    while (waveRingProduce(ring) > 0)
+        ;
+
+    if (waveThreadCreate(&ring->thread, waveRingPrefetch, ring) != 0) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        waveClose(ring->stream);
+        waveAlignedFree(ring->buffer);
+        waveAlignedFree(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/**
+ * @brief Number of frames ready to be pulled
+ * @param ring A ring from waveRingOpen
+ * @return The frames waveRingPull can return without an underrun
+ */
+size_t
+waveRingAvailable(WAVE_RING* ring)
+{
+    return waveAtomicLoad(&ring->head) - waveAtomicLoad(&ring->tail);
+}
+
+/**
+ * @brief Whether every frame of the file was pulled
+ * @param ring A ring from waveRingOpen
+ * @return 1 when done, 0 otherwise. A looping ring is never done.
+ */
+int
+waveRingFinished(WAVE_RING* ring)
+{
+    return waveAtomicLoad(&ring->eof) && waveRingAvailable(ring) == 0;
+}
+
+/**
+ * @brief Take the next frames out of the ring, for the audio callback
+ *
+ * Never allocates, locks or blocks. When the prefetch thread is late, or
+ * at the end of the file, the missing frames are filled with silence.
+ *
+ * @param ring A ring from waveRingOpen
+ * @param buffer Destination, frames * nBlockAlign bytes
+ * @param frames Number of frames wanted
+ * @return The number of frames of the file copied, the rest is silence
+ */
+size_t
+waveRingPull(WAVE_RING* ring, void* buffer, size_t frames)
+{
+    unsigned char* out = (unsigned char*) buffer;
+
+    // eof before head: if set, head is final
+    size_t eof  = waveAtomicLoad(&ring->eof);
+    size_t tail = ring->tail;
+    size_t fill = waveAtomicLoad(&ring->head) - tail;
+
+    if (fill < ring->minFill)
+        waveAtomicStore(&ring->minFill, fill);
+
+    size_t n = frames < fill ? frames : fill;
+
+    size_t index = tail & (ring->capacity - 1);
+    size_t first = ring->capacity - index;
+    if (first > n)
+        first = n;
+
+    memcpy(out, ring->buffer + index * ring->frameSize,
+           first * ring->frameSize);
+    memcpy(out + first * ring->frameSize, ring->buffer,
+           (n - first) * ring->frameSize);
+
+    waveAtomicStore(&ring->tail, tail + n);
+
+    if (n < frames) {
+
+        memset(out + n * ring->frameSize, ring->silence,
+               (frames - n) * ring->frameSize);
+
+        if (!eof) {
+            waveAtomicAdd64(&ring->underruns, 1);
+            waveAtomicAdd64(&ring->silentFrames, frames - n);
+        }
+    }
+
+    waveAtomicAdd64(&ring->pulledFrames, n);
+
+    return n;
+}
+
+/**
+ * @brief Read the playback counters
+ *
+ * Safe to call from any thread while playing.
+ *
+ * @param ring A ring from waveRingOpen
+ * @param stats Pointer to a WAVE_RING_STATS variable
+ */
+void
+waveRingStats(WAVE_RING* ring, WAVE_RING_STATS* stats)
+{
+    stats->underruns    = waveAtomicLoad64(&ring->underruns);
+    stats->silentFrames = waveAtomicLoad64(&ring->silentFrames);
+    stats->pulledFrames = waveAtomicLoad64(&ring->pulledFrames);
+    stats->fill         = waveRingAvailable(ring);
+    stats->minFill      = waveAtomicLoad(&ring->minFill);
+    stats->capacity     = ring->capacity;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
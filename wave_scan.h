@@ -0,0 +1,638 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave_scan.h
+ *
+ * Catalog the wave files of a directory tree: every file is only probed
+ * (see waveProbe), by a pool of threads, and described by one record of a
+ * CSV or binary index.
+ */
+
+#ifndef WAVE_SCAN_H
+#define WAVE_SCAN_H
+
+#include "wave.h"
+#include "wave_sys.h"
+#include "wave_thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * Scan flags
+ */
+#define WAVE_SCAN_CSV                  0x0  // the default index format
+#define WAVE_SCAN_BINARY               0x1  // WAVE_SCAN_RECORD, then strings
+#define WAVE_SCAN_ALL                  0x2  // probe every file, not only
+                                            // .wav .wave .bwf .rf64 .bw64
+
+/*
+ * Binary index header: magic, then a 32-bit version
+ */
+#define WAVE_SCAN_MAGIC                "WIDX"
+#define WAVE_SCAN_VERSION              1
+
+/*
+ * Most threads of a scan
+ */
+#define WAVE_SCAN_THREADS              64
+
+/**
+ * @brief A file of the binary index, followed by its path, title and artist,
+ * without terminating nul
+ */
+typedef struct wave_scan_record_t {
+
+    uint64_t fileSize;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    uint64_t frames;
+    uint32_t nSamplesPerSec;
+    uint32_t dwChannelMask;
+    uint16_t wFormatTag;
+    uint16_t nChannels;
+    uint16_t nBlockAlign;
+    uint16_t wBitsPerSample;
+    uint16_t status;            // WAVE_ERROR of waveProbe
+    uint16_t pathLength;
+    uint16_t titleLength;       // "INAM" of LIST/INFO
+    uint16_t artistLength;      // "IART" of LIST/INFO
+
+} WAVE_SCAN_RECORD;
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct wave_scan_item_t {
+
+    WAVE_SCAN_RECORD record;
+    char*            text;      // path, title and artist, nul separated
+
+} WAVE_SCAN_ITEM;
+
+typedef struct wave_scan_worker_t {
+
+    struct wave_scan_t* scan;
+
+    // found in the directories of the current level
+    char**          dirs;
+    size_t          dirCount;
+    size_t          dirRoom;
+    WAVE_SCAN_ITEM* items;
+    size_t          itemCount;
+    size_t          itemRoom;
+
+} WAVE_SCAN_WORKER;
+
+typedef struct wave_scan_t {
+
+    int              flags;
+
+    // the directories of a level, shared by the workers
+    char**           dirs;
+    size_t           count;
+    volatile size_t  next;
+
+    WAVE_SCAN_WORKER workers[WAVE_SCAN_THREADS];
+    int              threads;
+
+} WAVE_SCAN;
+
+/*
+ * Make room for one more element of size bytes
+ */
+static void*
+waveScanGrow(void** array, size_t* count, size_t* room, size_t size)
+{
+    if (*count == *room) {
+        size_t grown = *room ? *room * 2 : 64;
+        void*  moved = realloc(*array, grown * size);
+        if (!moved)
+            return NULL;
+        *array = moved;
+        *room  = grown;
+    }
+
+    return (char*) *array + (*count)++ * size;
+}
+
+static int
+waveScanIsWave(const char* name, int flags)
+{
+    static const char* extensions[] = {"wav", "wave", "bwf", "rf64", "bw64"};
+    const char*        dot = strrchr(name, '.');
+    size_t             e, i;
+
+    if (flags & WAVE_SCAN_ALL)
+        return 1;
+    if (!dot)
+        return 0;
+
+    for (e = 0; e < sizeof(extensions) / sizeof(extensions[0]); e++) {
+        const char* x = extensions[e];
+        for (i = 0; x[i] && (dot[1 + i] | 0x20) == x[i]; i++)
+            ;
+        if (!x[i] && !dot[1 + i])
+            return 1;
+    }
+
+    return 0;
+}
+
+static char*
+waveScanJoin(const char* dir, const char* name)
+{
+    size_t length = strlen(dir);
+    int    slash  = length > 0 && dir[length - 1] != '/' &&
+                    dir[length - 1] != '\\';
+    char*  path   = (char*) malloc(length + slash + strlen(name) + 1);
+
+    if (path) {
+        memcpy(path, dir, length);
+        if (slash)
+            path[length++] = '/';
+        strcpy(path + length, name);
+    }
+
+    return path;
+}
+
+/*
+ * Probe a file and record it, unless it is not a wave file and was only
+ * looked at because of WAVE_SCAN_ALL
+ */
+static void
+waveScanFile(WAVE_SCAN_WORKER* worker, char* path)
+{
+    WAVE_PROBE probe;
+
+    if (waveProbe(path, &probe) != 0 && probe.status == WAVE_ERROR_FORMAT &&
+        (worker->scan->flags & WAVE_SCAN_ALL))
+    {
+        free(path);
+        return;
+    }
+
+    WAVE_SCAN_ITEM* item = (WAVE_SCAN_ITEM*) waveScanGrow(
+            (void**) &worker->items, &worker->itemCount, &worker->itemRoom,
+            sizeof(WAVE_SCAN_ITEM));
+    if (!item) {
+        free(path);
+        return;
+    }
+
+    const char* title  = waveProbeTag(&probe, "INAM");
+    const char* artist = waveProbeTag(&probe, "IART");
+    size_t      p      = strlen(path);
+    size_t      t      = title ? strlen(title) : 0;
+    size_t      a      = artist ? strlen(artist) : 0;
+
+    if (p > 0xffff) p = 0xffff;
+
+    WAVE_SCAN_RECORD* r = &item->record;
+
+    memset(r, 0, sizeof(WAVE_SCAN_RECORD));
+    r->fileSize       = probe.fileSize;
+    r->dataOffset     = probe.dataOffset;
+    r->dataSize       = probe.info.dataSize;
+    r->frames         = probe.frames;
+    r->nSamplesPerSec = probe.info.nSamplesPerSec;
+    r->dwChannelMask  = probe.info.dwChannelMask;
+    r->wFormatTag     = probe.info.wFormatTag;
+    r->nChannels      = probe.info.nChannels;
+    r->nBlockAlign    = probe.info.nBlockAlign;
+    r->wBitsPerSample = probe.info.wBitsPerSample;
+    r->status         = (uint16_t) probe.status;
+    r->pathLength     = (uint16_t) p;
+    r->titleLength    = (uint16_t) t;
+    r->artistLength   = (uint16_t) a;
+
+    item->text = (char*) malloc(p + t + a + 3);
+    if (!item->text) {
+        free(path);
+        worker->itemCount--;
+        return;
+    }
+
+    memcpy(item->text, path, p);
+    item->text[p] = '\0';
+    free(path);
+    memcpy(item->text + p + 1, title ? title : "", t + 1);
+    memcpy(item->text + p + t + 2, artist ? artist : "", a + 1);
+}
+
+static void
+waveScanDir(WAVE_SCAN_WORKER* worker, const char* dir)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    char*            pattern = waveScanJoin(dir, "*");
+    HANDLE           find    = pattern ? FindFirstFileA(pattern, &entry) :
+                                         INVALID_HANDLE_VALUE;
+
+    free(pattern);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+
+    do {
+        const char* name = entry.cFileName;
+        DWORD       attr = entry.dwFileAttributes;
+
+        // links to directories could loop
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            (attr & FILE_ATTRIBUTE_REPARSE_POINT))
+            continue;
+
+        int type = (attr & FILE_ATTRIBUTE_DIRECTORY) ? 2 : 1;
+#else
+    DIR*           d = opendir(dir);
+    struct dirent* entry;
+
+    if (!d)
+        return;
+
+    waveCount(&waveStatsCounters.syscalls, 1);
+
+    while ((entry = readdir(d)) != NULL) {
+
+        const char* name = entry->d_name;
+        int         type = 0;   // 1 file, 2 directory
+
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+
+#ifdef DT_DIR
+        if (entry->d_type == DT_DIR)
+            type = 2;
+        else if (entry->d_type == DT_REG)
+            type = 1;
+#endif
+#endif // _WIN32
+
+        if (type == 1 && !waveScanIsWave(name, worker->scan->flags))
+            continue;
+
+        char* path = waveScanJoin(dir, name);
+        if (!path)
+            continue;
+
+#ifndef _WIN32
+        // no type from readdir, or a link: links to files are followed,
+        // links to directories could loop
+        if (type == 0) {
+            struct stat st;
+            waveCount(&waveStatsCounters.syscalls, 1);
+            if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+                type = 2;
+            else if (stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+                     waveScanIsWave(name, worker->scan->flags))
+                type = 1;
+        }
+#endif
+
+        if (type == 1) {
+            waveScanFile(worker, path);
+        } else if (type == 2) {
+            char** slot = (char**) waveScanGrow((void**) &worker->dirs,
+                    &worker->dirCount, &worker->dirRoom, sizeof(char*));
+            if (slot)
+                *slot = path;
+            else
+                free(path);
+        } else {
+            free(path);
+        }
+    }
+#ifdef _WIN32
+    while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    closedir(d);
+#endif
+}
+
+static void
+waveScanWorker(void* arg)
+{
+    WAVE_SCAN_WORKER* worker = (WAVE_SCAN_WORKER*) arg;
+    WAVE_SCAN*        scan   = worker->scan;
+    size_t            i;
+
+    while ((i = waveAtomicFetchAdd(&scan->next, 1)) < scan->count)
+        waveScanDir(worker, scan->dirs[i]);
+}
+
+static int
+waveScanComparePaths(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static int
+waveScanCompareItems(const void* a, const void* b)
+{
+    return strcmp(((const WAVE_SCAN_ITEM*) a)->text,
+                  ((const WAVE_SCAN_ITEM*) b)->text);
+}
+
+/*
+ * CSV field between quotes, quotes doubled
+ */
+static void
+waveScanQuote(FILE* out, const char* text)
+{
+    fputc('"', out);
+    for (; *text; text++) {
+        if (*text == '"')
+            fputc('"', out);
+        fputc(*text, out);
+    }
+    fputc('"', out);
+}
+
+static void
+waveScanWrite(FILE* out, const WAVE_SCAN_ITEM* item, int flags)
+{
+    const WAVE_SCAN_RECORD* r = &item->record;
+    const char*             title  = item->text + r->pathLength + 1;
+    const char*             artist = title + r->titleLength + 1;
+
+    if (flags & WAVE_SCAN_BINARY) {
+        fwrite(r, sizeof(WAVE_SCAN_RECORD), 1, out);
+        fwrite(item->text, 1, r->pathLength, out);
+        fwrite(title, 1, r->titleLength, out);
+        fwrite(artist, 1, r->artistLength, out);
+        return;
+    }
+
+    double seconds = r->nSamplesPerSec ?
+                     (double) r->frames / r->nSamplesPerSec : 0;
+
+    waveScanQuote(out, item->text);
+    fprintf(out, ",%u,%llu,%u,%u,%u,%u,%u,%u,%llu,%.3f,%llu,",
+            r->status, (unsigned long long) r->fileSize, r->wFormatTag,
+            r->nChannels, r->nSamplesPerSec, r->wBitsPerSample,
+            r->nBlockAlign, r->dwChannelMask, (unsigned long long) r->frames,
+            seconds, (unsigned long long) r->dataOffset);
+    waveScanQuote(out, title);
+    fputc(',', out);
+    waveScanQuote(out, artist);
+    fputc('\n', out);
+}
+
+/**
+ * @brief Index the wave files of a directory tree
+ *
+ * The tree is walked a level at a time, the directories of a level listed
+ * and their files probed by a pool of threads. Records are written sorted
+ * by path within a level. Links to directories are not followed.
+ *
+ * The CSV columns are path, status (WAVE_ERROR), file size, format tag,
+ * channels, rate, bits, block align, channel mask, frames, seconds, data
+ * offset, title and artist. The binary index starts with WAVE_SCAN_MAGIC
+ * and WAVE_SCAN_VERSION, see waveScanNext.
+ *
+ * @param root The top directory
+ * @param indexFile The index file name, overwritten
+ * @param flags WAVE_SCAN_CSV or WAVE_SCAN_BINARY, optionally or'ed with
+ * WAVE_SCAN_ALL
+ * @param threads Number of threads, 0 for four per CPU
+ * @return The number of records, or -1 if the index could not be written
+ */
+int64_t
+waveScan(const char* root, const char* indexFile, int flags, int threads)
+{
+    FILE* out = fopen(indexFile, "wb");
+    if (!out) {
+        waveError(WAVE_ERROR_OPEN, indexFile);
+        return -1;
+    }
+
+    if (flags & WAVE_SCAN_BINARY) {
+        uint32_t version = WAVE_SCAN_VERSION;
+        fwrite(WAVE_SCAN_MAGIC, 1, 4, out);
+        fwrite(&version, sizeof(version), 1, out);
+    } else {
+        fputs("path,status,size,format,channels,rate,bits,block_align,"
+              "channel_mask,frames,seconds,data_offset,title,artist\n", out);
+    }
+
+    WAVE_SCAN* scan = (WAVE_SCAN*) calloc(1, sizeof(WAVE_SCAN));
+    char*      top  = (char*) malloc(strlen(root) + 1);
+    int64_t    total = 0;
+
+    if (!scan || !top) {
+        free(scan);
+        free(top);
+        fclose(out);
+        waveError(WAVE_ERROR_MEMORY, indexFile);
+        return -1;
+    }
+
+    if (threads <= 0)
+        threads = 4 * waveCpuCount();
+    if (threads > WAVE_SCAN_THREADS)
+        threads = WAVE_SCAN_THREADS;
+
+    strcpy(top, root);
+    scan->flags   = flags;
+    scan->threads = threads;
+    scan->dirs    = (char**) malloc(sizeof(char*));
+    scan->count   = scan->dirs ? 1 : 0;
+    if (scan->dirs)
+        scan->dirs[0] = top;
+    else
+        free(top);
+
+    while (scan->count > 0) {
+
+        WAVE_THREAD pool[WAVE_SCAN_THREADS];
+        int         count   = scan->threads;
+        int         started = 0;
+        int         w;
+
+        if ((size_t) count > scan->count)
+            count = (int) scan->count;
+
+        scan->next = 0;
+        for (w = 0; w < count; w++)
+            scan->workers[w].scan = scan;
+
+        // the calling thread is one of the workers
+        while (started < count - 1 &&
+               waveThreadCreate(&pool[started], waveScanWorker,
+                                &scan->workers[started + 1]) == 0)
+            started++;
+
+        waveScanWorker(&scan->workers[0]);
+
+        while (started > 0)
+            waveThreadJoin(pool[--started]);
+
+        // gather the level, write its files, go down to its directories
+        WAVE_SCAN_ITEM* items     = NULL;
+        size_t          itemCount = 0, itemRoom = 0;
+        char**          dirs      = NULL;
+        size_t          dirCount  = 0, dirRoom = 0;
+        size_t          i;
+
+        for (w = 0; w < count; w++) {
+
+            WAVE_SCAN_WORKER* worker = &scan->workers[w];
+
+            for (i = 0; i < worker->itemCount; i++) {
+                WAVE_SCAN_ITEM* item = (WAVE_SCAN_ITEM*) waveScanGrow(
+                        (void**) &items, &itemCount, &itemRoom,
+                        sizeof(WAVE_SCAN_ITEM));
+                if (item)
+                    *item = worker->items[i];
+                else
+                    free(worker->items[i].text);
+            }
+            for (i = 0; i < worker->dirCount; i++) {
+                char** slot = (char**) waveScanGrow((void**) &dirs,
+                        &dirCount, &dirRoom, sizeof(char*));
+                if (slot)
+                    *slot = worker->dirs[i];
+                else
+                    free(worker->dirs[i]);
+            }
+
+            free(worker->items);
+            free(worker->dirs);
+            memset(worker, 0, sizeof(WAVE_SCAN_WORKER));
+        }
+
+        if (itemCount > 0)
+            qsort(items, itemCount, sizeof(WAVE_SCAN_ITEM),
+                  waveScanCompareItems);
+        if (dirCount > 0)
+            qsort(dirs, dirCount, sizeof(char*), waveScanComparePaths);
+
+        for (i = 0; i < itemCount; i++) {
+            waveScanWrite(out, &items[i], flags);
+            free(items[i].text);
+        }
+        total += (int64_t) itemCount;
+        free(items);
+
+        for (i = 0; i < scan->count; i++)
+            free(scan->dirs[i]);
+        free(scan->dirs);
+
+        scan->dirs  = dirs;
+        scan->count = dirCount;
+    }
+
+    free(scan->dirs);
+    free(scan);
+
+    if (fclose(out) != 0) {
+        waveError(WAVE_ERROR_WRITE, indexFile);
+        return -1;
+    }
+
+    return total;
+}
+
+/**
+ * @brief Open a binary index written by waveScan
+ * @param indexFile The index file name
+ * @return The index, positioned on the first record, to close with fclose,
+ * or NULL
+ */
+FILE*
+waveScanOpen(const char* indexFile)
+{
+    char     magic[4];
+    uint32_t version;
+    FILE*    index = fopen(indexFile, "rb");
+
+    if (!index) {
+        waveError(WAVE_ERROR_OPEN, indexFile);
+        return NULL;
+    }
+
+    if (fread(magic, 1, 4, index) != 4 ||
+        fread(&version, sizeof(version), 1, index) != 1 ||
+        memcmp(magic, WAVE_SCAN_MAGIC, 4) != 0 ||
+        version != WAVE_SCAN_VERSION)
+    {
+        fclose(index);
+        waveError(WAVE_ERROR_FORMAT, indexFile);
+        return NULL;
+    }
+
+    return index;
+}
+
+/**
+ * @brief Read the next record of a binary index
+ * @param index An index from waveScanOpen
+ * @param record Pointer to a WAVE_SCAN_RECORD variable
+ * @param text Set to the path, the title and the artist, each nul
+ * terminated, one after the other
+ * @param textSize Size of text, 3 * 65536 always fits
+ * @return 1 for a record, 0 at the end, -1 if truncated or too long
+ */
+int
+waveScanNext(FILE* index, WAVE_SCAN_RECORD* record, char* text,
+             size_t textSize)
+{
+    if (fread(record, sizeof(WAVE_SCAN_RECORD), 1, index) != 1)
+        return 0;
+
+    size_t p = record->pathLength;
+    size_t t = record->titleLength;
+    size_t a = record->artistLength;
+
+    if (p + t + a + 3 > textSize ||
+        fread(text, 1, p, index) != p ||
+        fread(text + p + 1, 1, t, index) != t ||
+        fread(text + p + t + 2, 1, a, index) != a)
+        return -1;
+
+    text[p] = '\0';
+    text[p + t + 1] = '\0';
+    text[p + t + a + 2] = '\0';
+
+    return 1;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
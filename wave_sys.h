@@ -0,0 +1,359 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file wave_sys.h
+ *
+ * Portability helpers shared by the processing modules: CPU feature
+ * detection for the SIMD kernels, aligned allocations, atomics and a clock.
+ */
+
+#ifndef WAVE_SYS_H
+#define WAVE_SYS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define WAVE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+/*
+ * GCC and Clang only allow the intrinsics of an instruction set in functions
+ * compiled for it. MSVC allows them anywhere.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define WAVE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define WAVE_TARGET(isa)
+#endif
+
+/*
+ * AVX-512 intrinsics are missing from older compilers
+ */
+#if defined(WAVE_X86) && \
+    ((defined(__GNUC__) && __GNUC__ >= 6) || defined(__clang__) || \
+     (defined(_MSC_VER) && _MSC_VER >= 1911))
+#define WAVE_HAVE_AVX512
+#endif
+
+/*
+ * Instruction set levels, each one implies the previous ones
+ */
+#define WAVE_SIMD_NONE                 0
+#define WAVE_SIMD_SSE2                 1
+#define WAVE_SIMD_SSSE3                2
+#define WAVE_SIMD_AVX2                 3
+#define WAVE_SIMD_AVX512               4
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Atomics. Loads acquire and stores release, enough for the single producer
+ * single consumer hand-offs of the library. Inline, each header only uses
+ * some of them.
+ */
+static inline size_t
+waveAtomicLoad(const volatile size_t* p)
+{
+#ifdef _MSC_VER
+    size_t v = *p;
+    _ReadWriteBarrier();
+    return v;
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void
+waveAtomicStore(volatile size_t* p, size_t v)
+{
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+    *p = v;
+#else
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline size_t
+waveAtomicFetchAdd(volatile size_t* p, size_t v)
+{
+#ifdef _MSC_VER
+#ifdef _WIN64
+    return (size_t) _InterlockedExchangeAdd64((volatile __int64*) p,
+                                              (__int64) v);
+#else
+    return (size_t) _InterlockedExchangeAdd((volatile long*) p, (long) v);
+#endif
+#else
+    return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline uint64_t
+waveAtomicLoad64(const volatile uint64_t* p)
+{
+#ifdef _MSC_VER
+    return (uint64_t) _InterlockedCompareExchange64(
+            (volatile __int64*) p, 0, 0);
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline uint64_t
+waveAtomicAdd64(volatile uint64_t* p, uint64_t v)
+{
+#ifdef _MSC_VER
+    return (uint64_t) _InterlockedExchangeAdd64((volatile __int64*) p,
+                                                (__int64) v) + v;
+#else
+    return __atomic_add_fetch(p, v, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline int
+waveAtomicCompareSwap(volatile size_t* p, size_t expected, size_t desired)
+{
+#ifdef _MSC_VER
+#ifdef _WIN64
+    return (size_t) _InterlockedCompareExchange64((volatile __int64*) p,
+            (__int64) desired, (__int64) expected) == expected;
+#else
+    return (size_t) _InterlockedCompareExchange((volatile long*) p,
+            (long) desired, (long) expected) == expected;
+#endif
+#else
+    return __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+ * Run init once for the process, whatever the number of threads getting
+ * there at the same time. The others wait for its end, which is short: the
+ * library only builds small tables this way, no thread library needed.
+ */
+#define WAVE_ONCE_INIT                 0
+#define WAVE_ONCE_RUNNING              1
+#define WAVE_ONCE_DONE                 2
+
+static inline void
+waveOnce(volatile size_t* once, void (*init)(void))
+{
+    if (waveAtomicLoad(once) == WAVE_ONCE_DONE)
+        return;
+
+    if (waveAtomicCompareSwap(once, WAVE_ONCE_INIT, WAVE_ONCE_RUNNING)) {
+        init();
+        waveAtomicStore(once, WAVE_ONCE_DONE);
+        return;
+    }
+
+    while (waveAtomicLoad(once) != WAVE_ONCE_DONE)
+        ;
+}
+
+
+static int             waveSimdDetected = WAVE_SIMD_NONE;
+static int             waveSimdLimit    = WAVE_SIMD_AVX512;
+static volatile size_t waveSimdOnce     = WAVE_ONCE_INIT;
+
+#ifdef WAVE_X86
+static void
+waveCpuid(unsigned int leaf, unsigned int r[4])
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuidex(regs, (int) leaf, 0);
+    r[0] = regs[0]; r[1] = regs[1]; r[2] = regs[2]; r[3] = regs[3];
+#else
+    __cpuid_count(leaf, 0, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+static uint64_t
+waveXgetbv(void)
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+    return ((uint64_t) hi << 32) | lo;
+#endif
+}
+#endif // WAVE_X86
+
+static int
+waveSimdDetect(void)
+{
+    int level = WAVE_SIMD_NONE;
+
+#ifdef WAVE_X86
+    unsigned int r[4];
+
+    waveCpuid(0, r);
+    unsigned int maxLeaf = r[0];
+
+    waveCpuid(1, r);
+    if (r[3] & (1u << 26)) level = WAVE_SIMD_SSE2;
+    if (level == WAVE_SIMD_SSE2 && (r[2] & (1u << 9))) level = WAVE_SIMD_SSSE3;
+
+    // AVX needs the OS to save the ymm (and zmm) registers
+    int osxsave = (r[2] & (1u << 27)) && (r[2] & (1u << 28));
+    if (!osxsave || maxLeaf < 7 || level < WAVE_SIMD_SSSE3)
+        return level;
+
+    uint64_t xcr0 = waveXgetbv();
+
+    waveCpuid(7, r);
+    if ((xcr0 & 0x6) == 0x6 && (r[1] & (1u << 5)))
+        level = WAVE_SIMD_AVX2;
+
+#ifdef WAVE_HAVE_AVX512
+    // AVX512F and AVX512BW
+    if (level == WAVE_SIMD_AVX2 && (xcr0 & 0xE6) == 0xE6 &&
+        (r[1] & (1u << 16)) && (r[1] & (1u << 30)))
+    {
+        level = WAVE_SIMD_AVX512;
+    }
+#endif
+#endif // WAVE_X86
+
+    return level;
+}
+
+/*
+ * Detect the instruction set once, through waveOnce
+ */
+static void
+waveSimdInit(void)
+{
+    waveSimdDetected = waveSimdDetect();
+}
+
+/**
+ * @brief The instruction set level used by the SIMD kernels
+ * @return One of the WAVE_SIMD_* levels
+ */
+int
+waveSimdLevel(void)
+{
+    waveOnce(&waveSimdOnce, waveSimdInit);
+
+    return waveSimdDetected < waveSimdLimit ? waveSimdDetected : waveSimdLimit;
+}
+
+/**
+ * @brief Limit the instruction set used by the SIMD kernels
+ *
+ * Mostly useful to compare the kernels with the scalar code. Set it before
+ * starting threads that convert samples.
+ *
+ * @param level One of the WAVE_SIMD_* levels
+ * @return The level really in use, bounded by what the CPU supports
+ */
+int
+waveSetSimdLevel(int level)
+{
+    waveSimdLimit = level;
+    return waveSimdLevel();
+}
+
+/**
+ * @brief Allocate memory aligned on a power of two
+ * @param size Bytes wanted
+ * @param alignment Power of two, at least sizeof(void*)
+ * @return The memory, to release with waveAlignedFree, or NULL
+ */
+void*
+waveAlignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, alignment);
+#else
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, alignment, size ? size : 1) != 0)
+        return NULL;
+    return ptr;
+#endif
+}
+
+/**
+ * @brief Release memory from waveAlignedAlloc
+ * @param ptr The memory, or NULL
+ */
+void
+waveAlignedFree(void* ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+/**
+ * @brief Read a monotonic clock
+ * @return Nanoseconds since an arbitrary origin
+ */
+uint64_t
+waveClock(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t) ((double) count.QuadPart * 1e9 / (double) frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
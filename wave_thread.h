@@ -0,0 +1,267 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file wave_thread.h
+ *
+ * Minimal threads, locks and condition variables on top of pthreads or Win32,
+ * for the background workers of the library. The functions are static
+ * inline: a file calling only some of them gets no unused warnings.
+ */
+
+#ifndef WAVE_THREAD_H
+#define WAVE_THREAD_H
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifdef _WIN32
+typedef HANDLE    WAVE_THREAD;
+#else
+typedef pthread_t WAVE_THREAD;
+#endif
+
+typedef void (*WAVE_THREAD_FUNC)(void* arg);
+
+#ifdef _WIN32
+typedef SRWLOCK            WAVE_MUTEX;
+typedef CONDITION_VARIABLE WAVE_COND;
+#else
+typedef pthread_mutex_t    WAVE_MUTEX;
+typedef pthread_cond_t     WAVE_COND;
+#endif
+
+typedef struct wave_thread_start_t {
+    WAVE_THREAD_FUNC func;
+    void*            arg;
+} WAVE_THREAD_START;
+
+#ifdef _WIN32
+static inline DWORD WINAPI
+waveThreadMain(LPVOID param)
+#else
+static inline void*
+waveThreadMain(void* param)
+#endif
+{
+    WAVE_THREAD_START start = *(WAVE_THREAD_START*) param;
+    free(param);
+
+    start.func(start.arg);
+
+    return 0;
+}
+
+/*
+ * Start func(arg) on a new thread. Returns 0 on success, -1 on failure.
+ */
+static inline int
+waveThreadCreate(WAVE_THREAD* thread, WAVE_THREAD_FUNC func, void* arg)
+{
+    WAVE_THREAD_START* start =
+        (WAVE_THREAD_START*) malloc(sizeof(WAVE_THREAD_START));
+    if (!start)
+        return -1;
+
+    start->func = func;
+    start->arg  = arg;
+
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, waveThreadMain, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return -1;
+    }
+#else
+    if (pthread_create(thread, NULL, waveThreadMain, start) != 0) {
+        free(start);
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Wait for the end of a thread from waveThreadCreate
+ */
+static inline void
+waveThreadJoin(WAVE_THREAD thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+/*
+ * Mutual exclusion between the threads of a process
+ */
+static inline void
+waveMutexInit(WAVE_MUTEX* mutex)
+{
+#ifdef _WIN32
+    InitializeSRWLock(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static inline void
+waveMutexDestroy(WAVE_MUTEX* mutex)
+{
+#ifdef _WIN32
+    (void) mutex;
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+static inline void
+waveMutexLock(WAVE_MUTEX* mutex)
+{
+#ifdef _WIN32
+    AcquireSRWLockExclusive(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+static inline void
+waveMutexUnlock(WAVE_MUTEX* mutex)
+{
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+/*
+ * Condition variables, waited on with their mutex held
+ */
+static inline void
+waveCondInit(WAVE_COND* cond)
+{
+#ifdef _WIN32
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+static inline void
+waveCondDestroy(WAVE_COND* cond)
+{
+#ifdef _WIN32
+    (void) cond;
+#else
+    pthread_cond_destroy(cond);
+#endif
+}
+
+static inline void
+waveCondWait(WAVE_COND* cond, WAVE_MUTEX* mutex)
+{
+#ifdef _WIN32
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+static inline void
+waveCondSignal(WAVE_COND* cond)
+{
+#ifdef _WIN32
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+static inline void
+waveCondBroadcast(WAVE_COND* cond)
+{
+#ifdef _WIN32
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+/*
+ * Suspend the calling thread
+ */
+static inline void
+waveSleep(unsigned int milliseconds)
+{
+#ifdef _WIN32
+    Sleep(milliseconds);
+#else
+    struct timespec ts;
+    ts.tv_sec  = milliseconds / 1000;
+    ts.tv_nsec = (long) (milliseconds % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/*
+ * Number of processors online, at least 1
+ */
+static inline int
+waveCpuCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
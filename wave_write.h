@@ -0,0 +1,603 @@
+/*
+ * MIT License
+ *
+ * LIBWAVE Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file wave_write.h
+ *
+ * Wave file writer. The frames are gathered in large blocks written at
+ * positioned offsets, the sizes in the headers are patched when the file is
+ * flushed or finalized so that a capture of unknown length can stream to
+ * disk.
+ *
+ * A JUNK chunk the size of a ds64 chunk is reserved after the RIFF header.
+ * Files growing past 4 GB are turned into RF64 (EBU Tech 3306) in place.
+ */
+
+#ifndef WAVE_WRITE_H
+#define WAVE_WRITE_H
+
+#include "wave.h"
+#include "wave_sys.h"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+/*
+ * Default size of the writer blocks
+ */
+#define WAVE_WRITE_BUFFER_SIZE         (1024 * 1024)
+
+/*
+ * waveCreate flags
+ */
+#define WAVE_WRITE_RF64                0x1  // RF64 even below 4 GB
+#define WAVE_WRITE_BW64                0x2  // BW64 (ITU-R BS.2088) ID for RF64
+#define WAVE_WRITE_NO_JUNK             0x4  // no room for ds64, stop at 4 GB
+#define WAVE_WRITE_RIFX                0x8  // big-endian RIFX, stops at 4 GB
+
+/**
+ * @brief A wave file being written
+ */
+typedef struct wave_writer_t {
+
+    int            fd;
+    FMT_CHUNK      fmt;
+    int            flags;
+
+    uint64_t       ds64Offset;      // the JUNK chunk reserved for ds64, or 0
+    uint64_t       riffSizeOffset;
+    uint64_t       factOffset;      // sample count of the fact chunk, or 0
+    uint64_t       dataSizeOffset;
+    uint64_t       dataOffset;      // start of the data chunk body
+
+    uint64_t       written;         // data bytes sent to the file
+    unsigned char* buffer;          // data bytes not sent yet
+    size_t         bufferSize;
+    size_t         buffered;
+
+    int            error;
+
+} WAVE_WRITER;
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+static void
+wavePut16(unsigned char* p, uint16_t v)
+{
+    p[0] = (unsigned char) v;
+    p[1] = (unsigned char) (v >> 8);
+}
+
+static void
+wavePut32(unsigned char* p, uint32_t v)
+{
+    p[0] = (unsigned char) v;
+    p[1] = (unsigned char) (v >> 8);
+    p[2] = (unsigned char) (v >> 16);
+    p[3] = (unsigned char) (v >> 24);
+}
+
+static void
+wavePut64(unsigned char* p, uint64_t v)
+{
+    wavePut32(p, (uint32_t) v);
+    wavePut32(p + 4, (uint32_t) (v >> 32));
+}
+
+/*
+ * Header fields of RIFX files are big-endian
+ */
+static void
+wavePutOrder16(unsigned char* p, uint16_t v, int bigEndian)
+{
+    if (!bigEndian) {
+        wavePut16(p, v);
+        return;
+    }
+
+    p[0] = (unsigned char) (v >> 8);
+    p[1] = (unsigned char) v;
+}
+
+static void
+wavePutOrder32(unsigned char* p, uint32_t v, int bigEndian)
+{
+    if (!bigEndian) {
+        wavePut32(p, v);
+        return;
+    }
+
+    p[0] = (unsigned char) (v >> 24);
+    p[1] = (unsigned char) (v >> 16);
+    p[2] = (unsigned char) (v >> 8);
+    p[3] = (unsigned char) v;
+}
+
+/**
+ * @brief Fill a FMT_CHUNK for writing
+ *
+ * The extensible format is used when the wave specification asks for it:
+ * PCM with more than 16 bits, more than 2 channels, valid bits narrower than
+ * the container, or a speaker mask.
+ *
+ * @param fmt Pointer to the FMT_CHUNK to fill
+ * @param formatTag WAVE_FORMAT_PCM, WAVE_FORMAT_IEEE_FLOAT, WAVE_FORMAT_ALAW
+ * or WAVE_FORMAT_MULAW
+ * @param nChannels Number of channels
+ * @param nSamplesPerSec Sample rate
+ * @param wBitsPerSample Valid bits per sample, the container is rounded up
+ * to a multiple of 8
+ * @param dwChannelMask Speaker mask, 0 for none
+ */
+void
+waveMakeFmt(
+        FMT_CHUNK* fmt,
+        uint16_t   formatTag,
+        uint16_t   nChannels,
+        uint32_t   nSamplesPerSec,
+        uint16_t   wBitsPerSample,
+        uint32_t   dwChannelMask)
+{
+    uint16_t container = (uint16_t) ((wBitsPerSample + 7) / 8 * 8);
+
+    memset(fmt, 0, sizeof(FMT_CHUNK));
+
+    fmt->wFormatTag      = formatTag;
+    fmt->nChannels       = nChannels;
+    fmt->nSamplesPerSec  = nSamplesPerSec;
+    fmt->nBlockAlign     = (uint16_t) (nChannels * container / 8);
+    fmt->nAvgBytesPerSec = nSamplesPerSec * fmt->nBlockAlign;
+    fmt->wBitsPerSample  = container;
+
+    int extensible =
+        (formatTag == WAVE_FORMAT_PCM && container > 16) ||
+        nChannels > 2 || container != wBitsPerSample || dwChannelMask != 0;
+
+    if (extensible) {
+        fmt->wFormatTag           = WAVE_FORMAT_EXTENSIBLE;
+        fmt->cbSize               = 22;
+        fmt->wValidBitsPerSample  = wBitsPerSample;
+        fmt->dwChannelMask        = dwChannelMask;
+        fmt->SubFormat.formatCode = formatTag;
+        memcpy(fmt->SubFormat.fixedString,
+               "\x00\x00\x00\x00\x10\x00\x80\x00\x00\xAA\x00\x38\x9B\x71", 14);
+    } else if (formatTag != WAVE_FORMAT_PCM) {
+        // non-PCM formats carry an empty extension
+        fmt->cbSize = 0;
+    }
+}
+
+/*
+ * Write all the bytes of the vectors at offset. Return 0 on success.
+ */
+static int
+waveWriteAt(int fd, const void* a, size_t aSize, const void* b, size_t bSize,
+            uint64_t offset)
+{
+#ifdef _WIN32
+    if (_lseeki64(fd, (__int64) offset, SEEK_SET) < 0)
+        return -1;
+
+    const void* parts[2] = {a, b};
+    size_t      sizes[2] = {aSize, bSize};
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        const char* p    = (const char*) parts[i];
+        size_t      left = sizes[i];
+        while (left > 0) {
+            unsigned int n   = left > (1u << 30) ? (1u << 30) : (unsigned int) left;
+            int          put = _write(fd, p, n);
+            if (put <= 0)
+                return -1;
+            p    += put;
+            left -= (size_t) put;
+        }
+    }
+
+    return 0;
+#else
+    struct iovec iov[2];
+    int          count = 0;
+
+    if (aSize > 0) {
+        iov[count].iov_base = (void*) a;
+        iov[count].iov_len  = aSize;
+        count++;
+    }
+    if (bSize > 0) {
+        iov[count].iov_base = (void*) b;
+        iov[count].iov_len  = bSize;
+        count++;
+    }
+
+    struct iovec* v = iov;
+
+    while (count > 0) {
+
+        ssize_t put = pwritev(fd, v, count, (off_t) offset);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return -1;
+
+        offset += (uint64_t) put;
+
+        // drop what went out, resume inside a vector on short writes
+        while (count > 0 && (size_t) put >= v->iov_len) {
+            put -= (ssize_t) v->iov_len;
+            v++;
+            count--;
+        }
+        if (count > 0) {
+            v->iov_base = (char*) v->iov_base + put;
+            v->iov_len -= (size_t) put;
+        }
+    }
+
+    return 0;
+#endif
+}
+
+/*
+ * Send the buffered bytes, followed by extra bytes of the caller, in one
+ * write.
+ */
+static int
+waveWriterSend(WAVE_WRITER* writer, const void* extra, size_t extraSize)
+{
+    if (writer->error)
+        return -1;
+
+    if (writer->buffered + extraSize == 0)
+        return 0;
+
+    if (waveWriteAt(writer->fd, writer->buffer, writer->buffered,
+                    extra, extraSize, writer->dataOffset + writer->written) != 0)
+    {
+        waveError(WAVE_ERROR_WRITE, NULL);
+        writer->error = 1;
+        return -1;
+    }
+
+    writer->written += writer->buffered + extraSize;
+    writer->buffered = 0;
+
+    return 0;
+}
+
+/*
+ * Rewrite the sizes of the headers for the data written so far, switching to
+ * RF64 when they no longer fit in 32 bits. The pad byte of an odd data size,
+ * counted in the RIFF size, is written too: the next frames write over it.
+ */
+static int
+waveWriterPatch(WAVE_WRITER* writer)
+{
+    uint64_t      dataSize = writer->written;
+    uint64_t      frames   = dataSize / writer->fmt.nBlockAlign;
+    uint64_t      riffSize = writer->dataOffset + dataSize + (dataSize & 1) - 8;
+    int           rf64     = (writer->flags & WAVE_WRITE_RF64) ||
+                             riffSize > 0xFFFFFFFF;
+    int           big      = (writer->flags & WAVE_WRITE_RIFX) != 0;
+    unsigned char v[4];
+
+    if (rf64 && !writer->ds64Offset)
+        return -1;
+
+    if (dataSize & 1) {
+        unsigned char pad = 0;
+        if (waveWriteAt(writer->fd, &pad, 1, NULL, 0,
+                        writer->dataOffset + dataSize) != 0)
+            return -1;
+    }
+
+    if (rf64) {
+
+        unsigned char ds64[8 + 28];
+
+        memcpy(ds64, "ds64", 4);
+        wavePut32(ds64 + 4, 28);
+        wavePut64(ds64 + 8,  riffSize);
+        wavePut64(ds64 + 16, dataSize);
+        wavePut64(ds64 + 24, frames);
+        wavePut32(ds64 + 32, 0);
+
+        if (waveWriteAt(writer->fd, ds64, sizeof(ds64), NULL, 0,
+                        writer->ds64Offset) != 0)
+            return -1;
+
+        unsigned char head[8];
+        memcpy(head, (writer->flags & WAVE_WRITE_BW64) ? "BW64" : "RF64", 4);
+        wavePut32(head + 4, 0xFFFFFFFF);
+
+        if (waveWriteAt(writer->fd, head, 8, NULL, 0, 0) != 0)
+            return -1;
+
+        riffSize = dataSize = frames = 0xFFFFFFFF;
+
+    } else {
+
+        wavePutOrder32(v, (uint32_t) riffSize, big);
+        if (waveWriteAt(writer->fd, v, 4, NULL, 0, writer->riffSizeOffset) != 0)
+            return -1;
+    }
+
+    wavePutOrder32(v, (uint32_t) dataSize, big);
+    if (waveWriteAt(writer->fd, v, 4, NULL, 0, writer->dataSizeOffset) != 0)
+        return -1;
+
+    if (writer->factOffset) {
+        wavePutOrder32(v, frames > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t) frames,
+                       big);
+        if (waveWriteAt(writer->fd, v, 4, NULL, 0, writer->factOffset) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void
+waveWriterFree(WAVE_WRITER* writer)
+{
+    if (writer->fd >= 0)
+        waveCloseFd(writer->fd);
+
+    waveAlignedFree(writer->buffer);
+    free(writer);
+}
+
+/**
+ * @brief Create a wave file for writing
+ *
+ * With WAVE_WRITE_RIFX the headers are big-endian and the frames given to
+ * waveWriteFrames must be too, see waveSwapBytes. RIFX files have no ds64
+ * chunk, the RF64 flags are ignored.
+ *
+ * @param fileName The wave file name, truncated if it exists
+ * @param fmt The format of the frames, see waveMakeFmt
+ * @param bufferSize Size of the blocks written to the file, 0 for
+ * WAVE_WRITE_BUFFER_SIZE
+ * @param flags 0 or WAVE_WRITE_* flags
+ * @return The writer, to finish with waveFinalize, or NULL
+ */
+WAVE_WRITER*
+waveCreate(char* fileName, const FMT_CHUNK* fmt, size_t bufferSize, int flags)
+{
+    if (flags & WAVE_WRITE_RIFX)
+        flags = WAVE_WRITE_RIFX | WAVE_WRITE_NO_JUNK;
+    if (flags & WAVE_WRITE_BW64)
+        flags |= WAVE_WRITE_RF64;
+    if (flags & WAVE_WRITE_RF64)
+        flags &= ~WAVE_WRITE_NO_JUNK;
+
+    if (fmt->nBlockAlign == 0 || fmt->nChannels == 0) {
+        waveError(WAVE_ERROR_FORMAT, fileName);
+        return NULL;
+    }
+
+    if (bufferSize == 0)
+        bufferSize = WAVE_WRITE_BUFFER_SIZE;
+    if (bufferSize < 4096)
+        bufferSize = 4096;
+
+    WAVE_WRITER* writer = (WAVE_WRITER*) calloc(1, sizeof(WAVE_WRITER));
+    if (!writer) {
+        waveError(WAVE_ERROR_MEMORY, fileName);
+        return NULL;
+    }
+
+    writer->fmt        = *fmt;
+    writer->flags      = flags;
+    writer->bufferSize = bufferSize;
+    writer->buffer     = (unsigned char*) waveAlignedAlloc(bufferSize, 4096);
+
+#ifdef _WIN32
+    writer->fd = _open(fileName, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                       _S_IREAD | _S_IWRITE);
+#else
+    writer->fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+
+    if (writer->fd < 0 || !writer->buffer) {
+        waveError(writer->fd < 0 ? WAVE_ERROR_OPEN : WAVE_ERROR_MEMORY, fileName);
+        waveWriterFree(writer);
+        return NULL;
+    }
+
+    // RIFF, room for ds64, fmt, fact for non-PCM data, then the data header
+    unsigned char head[12 + 36 + 8 + 40 + 12 + 8];
+    size_t        pos     = 0;
+    uint32_t      fmtSize = fmt->wFormatTag == WAVE_FORMAT_PCM ? 16 :
+                            fmt->cbSize == 22 ? 40 : 18;
+    int           big     = (flags & WAVE_WRITE_RIFX) != 0;
+
+    memcpy(head, big ? "RIFX" : "RIFF", 4);
+    wavePutOrder32(head + 4, 0, big);
+    memcpy(head + 8, "WAVE", 4);
+    writer->riffSizeOffset = 4;
+    pos = 12;
+
+    if (!(flags & WAVE_WRITE_NO_JUNK)) {
+        memcpy(head + pos, "JUNK", 4);
+        wavePutOrder32(head + pos + 4, 28, big);
+        memset(head + pos + 8, 0, 28);
+        writer->ds64Offset = pos;
+        pos += 36;
+    }
+
+    memcpy(head + pos, "fmt ", 4);
+    wavePutOrder32(head + pos + 4, fmtSize, big);
+    pos += 8;
+
+    wavePutOrder16(head + pos,      fmt->wFormatTag, big);
+    wavePutOrder16(head + pos + 2,  fmt->nChannels, big);
+    wavePutOrder32(head + pos + 4,  fmt->nSamplesPerSec, big);
+    wavePutOrder32(head + pos + 8,  fmt->nAvgBytesPerSec, big);
+    wavePutOrder16(head + pos + 12, fmt->nBlockAlign, big);
+    wavePutOrder16(head + pos + 14, fmt->wBitsPerSample, big);
+
+    if (fmtSize >= 18)
+        wavePutOrder16(head + pos + 16, fmt->cbSize, big);
+
+    if (fmtSize == 40) {
+        wavePutOrder16(head + pos + 18, fmt->wValidBitsPerSample, big);
+        wavePutOrder32(head + pos + 20, fmt->dwChannelMask, big);
+        wavePut16(head + pos + 24, fmt->SubFormat.formatCode);
+        memcpy(head + pos + 26, fmt->SubFormat.fixedString, 14);
+
+        // the first three fields of the GUID follow the byte order
+        if (big) {
+            unsigned char* guid = head + pos + 24;
+            wavePutOrder32(guid, waveGet32(guid), 1);
+            wavePutOrder16(guid + 4, waveGet16(guid + 4), 1);
+            wavePutOrder16(guid + 6, waveGet16(guid + 6), 1);
+        }
+    }
+    pos += fmtSize;
+
+    uint16_t code = fmt->wFormatTag == WAVE_FORMAT_EXTENSIBLE ?
+                    fmt->SubFormat.formatCode : fmt->wFormatTag;
+
+    if (code != WAVE_FORMAT_PCM) {
+        memcpy(head + pos, "fact", 4);
+        wavePutOrder32(head + pos + 4, 4, big);
+        wavePutOrder32(head + pos + 8, 0, big);
+        writer->factOffset = pos + 8;
+        pos += 12;
+    }
+
+    memcpy(head + pos, "data", 4);
+    wavePutOrder32(head + pos + 4, 0, big);
+    writer->dataSizeOffset = pos + 4;
+    pos += 8;
+
+    writer->dataOffset = pos;
+
+    if (waveWriteAt(writer->fd, head, pos, NULL, 0, 0) != 0) {
+        waveError(WAVE_ERROR_WRITE, fileName);
+        waveWriterFree(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+/**
+ * @brief Append frames to a wave file
+ *
+ * Small writes are gathered in the writer buffer. Its blocks end on file
+ * offsets multiple of the buffer size. A write larger than the buffer goes
+ * out with the buffered bytes in a single vectored write, without a copy.
+ *
+ * @param writer A writer from waveCreate
+ * @param frames The frames, as they must be stored in the data chunk
+ * @param count Number of frames
+ * @return 0 on success, -1 on error
+ */
+int
+waveWriteFrames(WAVE_WRITER* writer, const void* frames, size_t count)
+{
+    const unsigned char* in   = (const unsigned char*) frames;
+    size_t               left = count * writer->fmt.nBlockAlign;
+
+    if (writer->error)
+        return -1;
+
+    while (left > 0) {
+
+        if (left >= writer->bufferSize)
+            return waveWriterSend(writer, in, left);
+
+        uint64_t pos   = writer->dataOffset + writer->written + writer->buffered;
+        size_t   room  = writer->bufferSize - (size_t) (pos % writer->bufferSize);
+
+        if (room > writer->bufferSize - writer->buffered)
+            room = writer->bufferSize - writer->buffered;
+
+        size_t n = left < room ? left : room;
+
+        memcpy(writer->buffer + writer->buffered, in, n);
+        writer->buffered += n;
+        in   += n;
+        left -= n;
+
+        if (n == room && waveWriterSend(writer, NULL, 0) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write the buffered frames and update the header sizes
+ *
+ * After a flush the file on disk is a complete wave file.
+ *
+ * @param writer A writer from waveCreate
+ * @return 0 on success, -1 on error
+ */
+int
+waveFlush(WAVE_WRITER* writer)
+{
+    if (waveWriterSend(writer, NULL, 0) != 0)
+        return -1;
+
+    if (waveWriterPatch(writer) != 0) {
+        waveError(WAVE_ERROR_WRITE, NULL);
+        writer->error = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Finish a wave file and release the writer
+ * @param writer A writer from waveCreate
+ * @return 0 if the whole file was written, -1 on error
+ */
+int
+waveFinalize(WAVE_WRITER* writer)
+{
+    int status = waveWriterSend(writer, NULL, 0);
+
+    if (status == 0 && waveWriterPatch(writer) != 0) {
+        waveError(WAVE_ERROR_WRITE, NULL);
+        status = -1;
+    }
+
+    waveWriterFree(writer);
+
+    return status;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif